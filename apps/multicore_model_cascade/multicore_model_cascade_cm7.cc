@@ -12,10 +12,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#include "libs/base/filesystem.h"
 #include "libs/base/http_server_handlers.h"
 #include "libs/base/ipc_m7.h"
 #include "libs/base/led.h"
+#include "libs/base/model_store.h"
 #include "libs/base/mutex.h"
 #include "libs/base/network.h"
 #include "libs/base/reset.h"
@@ -43,6 +43,7 @@
 #include <cstdio>
 #include <cstring>
 #include <memory>
+#include <optional>
 #include <utility>
 #include <vector>
 
@@ -55,6 +56,8 @@ constexpr int kCmdStop = 2;
 constexpr int kCmdProcess = 3;
 
 constexpr int kNetworkPort = 27000;
+// Bytes waiting for a slow client beyond which new messages are dropped.
+constexpr size_t kSendHighWater = 64 * 1024;
 
 constexpr int kMessageTypeSetup = 0;
 constexpr int kMessageTypeImageData = 1;
@@ -63,6 +66,8 @@ constexpr int kLowPowerChange = 3;
 
 constexpr int kTensorArenaSize = 1024 * 1024 * 2;
 STATIC_TENSOR_ARENA_IN_SDRAM(tensor_arena, kTensorArenaSize);
+constexpr int kModelStoreSize = 1024 * 1024 * 2;
+STATIC_MODEL_STORE_IN_SDRAM(model_window, kModelStoreSize);
 constexpr char kModelPath[] =
     "/models/"
     "posenet_mobilenet_v1_075_324_324_16_quant_decoder_edgetpu.tflite";
@@ -153,8 +158,19 @@ class NetworkTask : private Task<NetworkTask> {
       return;
     }
 
-    if (WriteMessage(client_socket_, type, bytes, size) != IOStatus::kOk)
-      ResetClientSocket();
+    // Never block the camera or PoseNet task on a slow client; drop whole
+    // messages instead.
+    const IoBuffer payload = {bytes, size};
+    switch (writer_->WriteMessageV(type, &payload, 1)) {
+      case IOStatus::kOk:
+        break;
+      case IOStatus::kWouldBlock:
+        ++dropped_messages_;
+        break;
+      default:
+        ResetClientSocket();
+        break;
+    }
   }
 
   [[nodiscard]] bool PosenetInactiveForMs(int ms) const {
@@ -190,10 +206,21 @@ class NetworkTask : private Task<NetworkTask> {
   SemaphoreHandle_t mutex_;
   TickType_t last_pose_data_ = 0;
   int client_socket_ = -1;
+  std::optional<SocketWriter> writer_;
+  int dropped_messages_ = 0;
+
+  static void OnHighWater(void* ctx, size_t pending) {
+    auto* self = static_cast<NetworkTask*>(ctx);
+    printf("INFO: Client is behind by %u bytes, %d messages dropped.\r\n",
+           pending, self->dropped_messages_);
+  }
 
   void ResetClientSocket(int sockfd = -1) {
     if (client_socket_ != -1) SocketClose(client_socket_);
     client_socket_ = sockfd;
+    writer_.reset();
+    if (sockfd != -1)
+      writer_.emplace(sockfd, kSendHighWater, OnHighWater, this);
   }
 };
 
@@ -267,6 +294,7 @@ class MainTask : private Task<MainTask> {
 
     std::vector<uint8_t> input(kModelSize);
     std::vector<unsigned char> jpeg(1024 * 70);
+    JpegEncoder encoder;
 
     TaskMessage message{};
     std::optional<std::string> our_ip_addr;
@@ -309,10 +337,12 @@ class MainTask : private Task<MainTask> {
           fmt.buffer = input.data();
           CameraTask::GetSingleton()->GetFrame({fmt});
 
-          auto jpeg_size =
-              JpegCompressRgb(input.data(), fmt.width, fmt.height,
-                              /*quality=*/75, jpeg.data(), jpeg.size());
-          network_task_->Send(kMessageTypeImageData, jpeg.data(), jpeg_size);
+          // The encoder leaves `input` untouched for the PoseNet task.
+          auto jpeg_size = encoder.Encode(
+              input.data(), fmt.width, fmt.height, JpegPixelFormat::kRgb,
+              /*quality=*/75, jpeg.data(), jpeg.size());
+          if (jpeg_size > 0)
+            network_task_->Send(kMessageTypeImageData, jpeg.data(), jpeg_size);
 
           posenet_task_->Put(input);
 
@@ -376,8 +406,10 @@ void reset_count_rpc(struct jsonrpc_request* r) {
     printf("Failed to get tpu context.\r\n");
     vTaskSuspend(nullptr);
   }
-  std::vector<uint8_t> posenet_tflite;
-  if (!LfsReadFile(kModelPath, &posenet_tflite)) {
+  auto* model_store = ModelStore::GetSingleton();
+  model_store->Init(model_window, kModelStoreSize);
+  const uint8_t* posenet_tflite = model_store->Map(kModelPath);
+  if (!posenet_tflite) {
     printf("ERROR: Failed to read model: %s\r\n", kModelPath);
     vTaskSuspend(nullptr);
   }
@@ -388,7 +420,7 @@ void reset_count_rpc(struct jsonrpc_request* r) {
   resolver.AddCustom(kCustomOp, RegisterCustomOp());
   resolver.AddCustom(kPosenetDecoderOp, RegisterPosenetDecoderOp());
   auto interpreter = std::make_shared<tflite::MicroInterpreter>(
-      tflite::GetModel(posenet_tflite.data()), resolver, tensor_arena,
+      tflite::GetModel(posenet_tflite), resolver, tensor_arena,
       kTensorArenaSize, &error_reporter);
   if (interpreter->AllocateTensors() != kTfLiteOk) {
     printf("Failed to allocate tensor\r\n");
@@ -217,6 +217,8 @@ extern "C" void app_main(void* param) {
                  coralmicro::testlib::BeginUploadResource);
   jsonrpc_export(coralmicro::testlib::kMethodUploadResourceChunk,
                  coralmicro::testlib::UploadResourceChunk);
+  jsonrpc_export(coralmicro::testlib::kMethodGetResourceInfo,
+                 coralmicro::testlib::GetResourceInfo);
   jsonrpc_export(coralmicro::testlib::kMethodDeleteResource,
                  coralmicro::testlib::DeleteResource);
   jsonrpc_export(coralmicro::testlib::kMethodFetchResource,
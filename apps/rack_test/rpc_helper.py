@@ -13,12 +13,14 @@
 # limitations under the License.
 """Establishes communication to the RPC server on Dev Board Micro device."""
 
-import base64
 import copy
 import enum
+import hashlib
+import json as jsonlib
 import math
 import os
-from typing import Any
+import struct
+from typing import Any, List
 
 from PIL import Image
 import requests
@@ -70,6 +72,49 @@ class CoralMicroRPCHelper(object):
       return requests.post(self.url, json=json, timeout=60).json()
     raise ValueError('Missing key in RPC')
 
+  def send_binary_rpc(self, json, attachments: List[bytes]):
+    """Sends a JSON-RPC request with raw binary attachments.
+
+    The request is posted to `<url>/binary`. Each attachment is sent as is,
+    not base64 encoded, and the JSON refers to it as `{'attachment': index}`.
+    Attachments in the response are replaced by their bytes.
+
+    Args:
+      json: The JSON-RPC request.
+      attachments: The raw attachments referenced by the request.
+
+    Returns:
+      The JSON-RPC response.
+    """
+    if self.print_payloads:
+      print(json)
+    body = jsonlib.dumps(json).encode()
+    frame = [struct.pack('<I', len(body)), body]
+    for attachment in attachments:
+      frame += [struct.pack('<I', len(attachment)), bytes(attachment)]
+    resp = requests.post(
+        self.url + '/binary', data=b''.join(frame), timeout=60).content
+
+    (size,) = struct.unpack_from('<I', resp, 0)
+    response = jsonlib.loads(resp[4:4 + size])
+    pos = 4 + size
+    resp_attachments = []
+    while pos < len(resp):
+      (size,) = struct.unpack_from('<I', resp, pos)
+      resp_attachments.append(resp[pos + 4:pos + 4 + size])
+      pos += 4 + size
+
+    def resolve(value):
+      if isinstance(value, dict):
+        if list(value.keys()) == ['attachment']:
+          return resp_attachments[value['attachment']]
+        return {k: resolve(v) for k, v in value.items()}
+      if isinstance(value, list):
+        return [resolve(v) for v in value]
+      return value
+
+    return resolve(response)
+
   def call_rpc_method(self, method):
     """Calls specified method in RPC server."""
     payload = self.get_new_payload()
@@ -169,9 +214,11 @@ class CoralMicroRPCHelper(object):
     return self.send_rpc(payload)
 
   def resource_max_chunk_size(self):
-    return 2 ** 13
+    # Chunks are sent as raw attachments, without base64 overhead.
+    return 2 ** 16
 
-  def begin_upload_resource(self, resource_name, resource_size):
+  def begin_upload_resource(self, resource_name, resource_size,
+                            storage='ram', sha256=None):
     """Begins the process of uploading a resource to the device.
 
     Informs the device of the name of the resource, and how large it will be.
@@ -179,16 +226,22 @@ class CoralMicroRPCHelper(object):
     Args:
       resource_name: Name of the resource to be opened.
       resource_size: Number of bytes that the resource is.
+      storage: 'ram', or 'flash' to keep the resource across reboots.
+      sha256: Optional hex SHA-256 that the device checks the data against.
 
     Returns:
       A JSON-RPC response.
     """
     payload = self.get_new_payload()
     payload['method'] = 'begin_upload_resource'
-    payload['params'].append({
+    params = {
         'name': resource_name,
         'size': resource_size,
-    })
+        'storage': storage,
+    }
+    if sha256:
+      params['sha256'] = sha256
+    payload['params'].append(params)
     print(f'Uploading: {payload}')
     return self.send_rpc(payload)
 
@@ -213,36 +266,66 @@ class CoralMicroRPCHelper(object):
     payload = self.get_new_payload()
     payload['method'] = 'upload_resource_chunk'
     payload['params'].append({
-        'name':
-            resource_name,
-        'offset':
-            offset,
-        'data':
-            base64.b64encode(resource_data[offset:offset + chunk_size]
-                             ).decode()
+        'name': resource_name,
+        'offset': offset,
+        'data': {
+            'attachment': 0
+        },
+    })
+    return self.send_binary_rpc(
+        payload, [resource_data[offset:offset + chunk_size]])
+
+  def get_resource_info(self, resource_name):
+    """Gets the size, storage, upload progress, and SHA-256 of a resource.
+
+    Args:
+      resource_name: Name of the resource.
+
+    Returns:
+      A JSON-RPC response.
+    """
+    payload = self.get_new_payload()
+    payload['method'] = 'get_resource_info'
+    payload['params'].append({
+        'name': resource_name,
     })
     return self.send_rpc(payload)
 
   def upload_resource(self, resource_name: str, resource_data: Any,
-                      resource_size: int) -> None:
+                      resource_size: int, storage: str = 'ram') -> None:
     """Uploads resource to device.
 
+    If the device already has a complete resource with the same SHA-256 in
+    the requested storage, for example a model stored on flash before a
+    reboot, the upload is skipped.
+
     Args:
       resource_name: Name of an open resource.
       resource_data: Byte array containing the resource's data.
       resource_size: The size of the resource.
+      storage: 'ram', or 'flash' to keep the resource across reboots.
 
     Returns:
       None
     """
-    self.begin_upload_resource(resource_name, resource_size)
+    sha256 = hashlib.sha256(resource_data[:resource_size]).hexdigest()
+    info = self.get_resource_info(resource_name).get('result')
+    if (info and info['complete'] and info['sha256'] == sha256 and
+        info['storage'] == storage):
+      print(f'Already on the Dev Board Micro: {resource_name}')
+      return
+
+    self.begin_upload_resource(resource_name, resource_size, storage, sha256)
     uploads = math.ceil(resource_size / self.resource_max_chunk_size())
     for x in range(0, uploads):
       if x % 50 == 0:
         print('[{} - {:.2f}% ({} of {})]'.format(resource_name,
               (x / uploads) * 100, x, uploads))
-      self.upload_resource_chunk(resource_name, resource_data,
-                                 x * self.resource_max_chunk_size())
+      response = self.upload_resource_chunk(resource_name, resource_data,
+                                            x * self.resource_max_chunk_size())
+      if 'error' in response:
+        raise RuntimeError(f'Failed to upload {resource_name}: '
+                           f'{response["error"]}')
     print(f'Finished uploading: {resource_name} to the Dev Board Micro.')
 
   def upload_test_image(self, image_file_path: str) -> None:
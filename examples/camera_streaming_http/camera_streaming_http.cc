@@ -13,8 +13,10 @@
 // limitations under the License.
 
 #include <cstdio>
+#include <utility>
 #include <vector>
 
+#include "libs/base/buffer_pool.h"
 #include "libs/base/http_server.h"
 #include "libs/base/led.h"
 #include "libs/base/strings.h"
@@ -39,29 +41,54 @@ namespace {
 
 constexpr char kIndexFileName[] = "/coral_micro_camera.html";
 constexpr char kCameraStreamUrlPrefix[] = "/camera_stream";
+constexpr char kMjpegStreamUrlPrefix[] = "/camera.mjpeg";
+// Large enough for a native resolution frame at quality 75.
+constexpr size_t kMaxJpegSize = 64 * 1024;
+// Frame rate limit for each MJPEG viewer.
+constexpr int kMaxFps = 15;
 
-HttpServer::Content UriHandler(const char* uri) {
+BufferPool::Handle CaptureJpeg() {
+  // [start-snippet:jpeg]
+  // The encoder keeps its tables and working memory between frames, and
+  // pulls YCbCr rows from the camera frame 16 at a time, so no full-size
+  // RGB frame is ever allocated. Encoded frames go into pooled buffers that
+  // return to the pool once every response that uses them is sent: one for
+  // the latest frame, one being encoded, and the rest for slow viewers that
+  // are still sending an older frame.
+  static JpegEncoder encoder;
+  static BufferPool pool(/*num_buffers=*/4, kMaxJpegSize);
+  auto jpeg = pool.Acquire(/*timeout_ms=*/100);
+  if (!jpeg) {
+    printf("No free JPEG buffer\r\n");
+    return {};
+  }
+  if (!CameraTask::GetSingleton()->GetFrameStrips(
+          {CameraStripFormat::kYCbCr}, &jpeg,
+          +[](void* ctx, CameraStripReader* reader) {
+            auto* jpeg = static_cast<BufferPool::Handle*>(ctx);
+            const size_t size = encoder.Encode(
+                reader->Width(), reader->Height(), JpegPixelFormat::kYCbCr,
+                /*quality=*/75, reader, CameraStripReader::ReadRows,
+                jpeg->Data(), jpeg->Capacity());
+            // Encode() returns 0 for a frame that didn't fit. Set the size it
+            // needed anyway, so the pool counts the frame as oversize.
+            return jpeg->SetSize(encoder.RequiredSize()) && size > 0;
+          })) {
+    printf("Unable to get frame from camera\r\n");
+    return {};
+  }
+  // [end-snippet:jpeg]
+  return jpeg;
+}
+
+HttpServer::Content UriHandler(MjpegStream* stream, const char* uri) {
   if (StrEndsWith(uri, "index.shtml")) {
     return std::string(kIndexFileName);
+  } else if (StrEndsWith(uri, kMjpegStreamUrlPrefix)) {
+    // Frames are captured once by Main() and shared by all viewers.
+    return stream->Subscribe();
   } else if (StrEndsWith(uri, kCameraStreamUrlPrefix)) {
-    // [start-snippet:jpeg]
-    std::vector<uint8_t> buf(CameraTask::kWidth * CameraTask::kHeight *
-                             CameraFormatBpp(CameraFormat::kRgb));
-    auto fmt = CameraFrameFormat{
-        CameraFormat::kRgb,       CameraFilterMethod::kBilinear,
-        CameraRotation::k0,       CameraTask::kWidth,
-        CameraTask::kHeight,
-        /*preserve_ratio=*/false, buf.data(),
-        /*while_balance=*/true};
-    if (!CameraTask::GetSingleton()->GetFrame({fmt})) {
-      printf("Unable to get frame from camera\r\n");
-      return {};
-    }
-
-    std::vector<uint8_t> jpeg;
-    JpegCompressRgb(buf.data(), fmt.width, fmt.height, /*quality=*/75, &jpeg);
-    // [end-snippet:jpeg]
-    return jpeg;
+    return CaptureJpeg();
   }
   return {};
 }
@@ -109,11 +136,24 @@ void Main() {
   }
 #endif  // defined(CAMERA_STREAMING_HTTP_ETHERNET)
 
+  MjpegStream stream(kMaxFps);
   HttpServer http_server;
-  http_server.AddUriHandler(UriHandler);
+  http_server.AddUriHandler(
+      [&stream](const char* uri) { return UriHandler(&stream, uri); });
   UseHttpServer(&http_server);
 
-  vTaskSuspend(nullptr);
+  // Capture only while somebody is watching the MJPEG stream.
+  while (true) {
+    if (stream.NumClients() == 0) {
+      vTaskDelay(pdMS_TO_TICKS(100));
+      continue;
+    }
+    if (auto jpeg = CaptureJpeg()) {
+      stream.Publish(std::move(jpeg));
+    } else {
+      vTaskDelay(pdMS_TO_TICKS(10));
+    }
+  }
 }
 }  // namespace
 }  // namespace coralmicro
@@ -121,6 +121,14 @@ void GetImageFromCamera(struct jsonrpc_request* request) {
                          nullptr);
     return;
   }
+  // Clients that post to /jsonrpc/binary get the raw image as an attachment.
+  int attachment = JsonRpcAddAttachment(request, image.data(), image.size());
+  if (attachment >= 0) {
+    jsonrpc_return_success(request, "{%Q: %d, %Q: %d, %Q: {%Q: %d}}", "width",
+                           width, "height", height, "data", "attachment",
+                           attachment);
+    return;
+  }
   jsonrpc_return_success(request, "{%Q: %d, %Q: %d, %Q: %V}", "width", width,
                          "height", height, "base64_data", image.size(),
                          image.data());
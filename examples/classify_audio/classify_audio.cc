@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include "libs/audio/audio_service.h"
+#include "libs/audio/voice_activity.h"
 #include "libs/base/filesystem.h"
 #include "libs/base/led.h"
 #include "libs/base/timer.h"
@@ -43,6 +44,8 @@ constexpr int kDmaBufferSize =
     kNumDmaBuffers * tensorflow::kYamnetSampleRateMs * kDmaBufferSizeMs;
 constexpr int kAudioServicePriority = 4;
 constexpr int kDropFirstSamplesMs = 150;
+// Polling interval for `vad.Active()` while there is no sound.
+constexpr int kVadPollMs = 50;
 
 AudioDriverBuffers<kNumDmaBuffers, kDmaBufferSize> audio_buffers;
 AudioDriver audio_driver(audio_buffers);
@@ -163,9 +166,22 @@ void run(tflite::MicroInterpreter* interpreter, FrontendState* frontend_state) {
         static_cast<LatestSamples*>(ctx)->Append(samples, num_samples);
         return true;
       });
+  // Only run the model while there is sound to classify.
+  VoiceActivityDetector vad(audio_config.sample_rate, VoiceActivityConfig{},
+                            nullptr, nullptr);
+  audio_service.AddCallback(
+      &vad, +[](void* ctx, const int32_t* samples, size_t num_samples) {
+        static_cast<VoiceActivityDetector*>(ctx)->Process(samples,
+                                                          num_samples);
+        return true;
+      });
   // Delay for the first buffers to fill.
   vTaskDelay(pdMS_TO_TICKS(tensorflow::kYamnetDurationMs));
   while (true) {
+    if (!vad.Active()) {
+      vTaskDelay(pdMS_TO_TICKS(kVadPollMs));
+      continue;
+    }
     audio_latest.AccessLatestSamples(
         [](const std::vector<int32_t>& samples, size_t start_index) {
           size_t i, j = 0;
@@ -0,0 +1,210 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "libs/audio/audio_service.h"
+#include "libs/base/check.h"
+#include "libs/base/filesystem.h"
+#include "libs/base/mutex.h"
+#include "libs/base/timer.h"
+#include "libs/tensorflow/audio_models.h"
+#include "libs/tensorflow/classification.h"
+#include "libs/tensorflow/utils.h"
+#include "libs/tpu/edgetpu_manager.h"
+#include "libs/tpu/edgetpu_op.h"
+#include "third_party/tflite-micro/tensorflow/lite/micro/micro_interpreter.h"
+#include "third_party/tflite-micro/tensorflow/lite/micro/micro_mutable_op_resolver.h"
+
+// Recognizes sounds with YamNet and spoken commands with the keyword detector,
+// both on the Edge TPU, from the same on-board mic audio.
+//
+// The two models share a `SharedAudioFrontend`, so each new slice of audio
+// goes through the window and FFT once, and each model only applies its own
+// filterbank. The spectrograms are updated as audio arrives, rather than
+// recomputed from the raw audio before every inference.
+//
+// To build and flash from coralmicro root:
+//    bash build.sh
+//    python3 scripts/flashtool.py -e classify_audio_and_speech
+
+namespace coralmicro {
+namespace {
+constexpr int kTensorArenaSize = 1 * 1024 * 1024;
+STATIC_TENSOR_ARENA_IN_SDRAM(yamnet_arena, kTensorArenaSize);
+STATIC_TENSOR_ARENA_IN_SDRAM(keyword_arena, kTensorArenaSize);
+constexpr int kNumDmaBuffers = 2;
+constexpr int kDmaBufferSizeMs = 50;
+constexpr int kDmaBufferSize =
+    kNumDmaBuffers * tensorflow::kYamnetSampleRateMs * kDmaBufferSizeMs;
+constexpr int kAudioServicePriority = 4;
+constexpr int kDropFirstSamplesMs = 150;
+// How often both models run.
+constexpr int kInferenceIntervalMs = 1000;
+// Samples converted from 32 to 16 bits at once in the audio callback.
+constexpr size_t kConvertBatchSize = 128;
+
+constexpr float kThreshold = 0.3;
+constexpr int kTopK = 5;
+constexpr char kYamnetModelName[] = "/models/yamnet_spectra_in_edgetpu.tflite";
+constexpr char kKeywordModelName[] =
+    "/models/voice_commands_v0.7_edgetpu.tflite";
+constexpr char kLabelsName[] = "/models/labels_gc2.raw.txt";
+
+AudioDriverBuffers<kNumDmaBuffers, kDmaBufferSize> audio_buffers;
+AudioDriver audio_driver(audio_buffers);
+
+// Fed by the audio service task and read by the main task.
+tensorflow::SharedAudioFrontend frontend;
+SemaphoreHandle_t frontend_mutex;
+
+std::array<int16_t, tensorflow::kYamnetFeatureElementCount> yamnet_features;
+std::array<int16_t, tensorflow::kKeywordDetectorFeatureElementCount>
+    keyword_features;
+std::vector<std::string> labels;
+
+bool ProcessAudio(void* ctx, const int32_t* samples, size_t num_samples) {
+  auto* shared_frontend = static_cast<tensorflow::SharedAudioFrontend*>(ctx);
+  std::array<int16_t, kConvertBatchSize> batch;
+  MutexLock lock(frontend_mutex);
+  while (num_samples > 0) {
+    const size_t count = std::min(num_samples, batch.size());
+    for (size_t i = 0; i < count; ++i) batch[i] = samples[i] >> 16;
+    shared_frontend->ProcessSamples(batch.data(), count);
+    samples += count;
+    num_samples -= count;
+  }
+  return true;
+}
+
+void Invoke(tflite::MicroInterpreter* interpreter, const char* name) {
+  const auto start = TimerMillis();
+  if (interpreter->Invoke() != kTfLiteOk) {
+    printf("Failed to invoke %s\r\n", name);
+    vTaskSuspend(nullptr);
+  }
+  printf("%s invoke time: %lums\r\n", name,
+         static_cast<uint32_t>(TimerMillis() - start));
+}
+
+[[noreturn]] void Main() {
+  printf("Classify Audio and Speech!\r\n");
+  std::vector<uint8_t> yamnet_tflite;
+  std::vector<uint8_t> keyword_tflite;
+  std::vector<uint8_t> labels_raw;
+  if (!LfsReadFile(kYamnetModelName, &yamnet_tflite) ||
+      !LfsReadFile(kKeywordModelName, &keyword_tflite)) {
+    printf("Failed to load models\r\n");
+    vTaskSuspend(nullptr);
+  }
+  if (!LfsReadFile(kLabelsName, &labels_raw)) {
+    printf("Failed to load labels\r\n");
+    vTaskSuspend(nullptr);
+  }
+  labels_raw.push_back('\0');
+  labels.push_back("negative");
+  char* label = strtok(reinterpret_cast<char*>(labels_raw.data()), "\n");
+  while (label != nullptr) {
+    labels.push_back(label);
+    label = strtok(nullptr, "\n");
+  }
+
+  auto edgetpu_context = EdgeTpuManager::GetSingleton()->OpenDevice();
+  if (!edgetpu_context) {
+    printf("Failed to get TPU context\r\n");
+    vTaskSuspend(nullptr);
+  }
+
+  tflite::MicroErrorReporter error_reporter;
+  auto yamnet_resolver = tensorflow::SetupYamNetResolver</*tForTpu=*/true>();
+  tflite::MicroInterpreter yamnet_interpreter(
+      tflite::GetModel(yamnet_tflite.data()), yamnet_resolver, yamnet_arena,
+      kTensorArenaSize, &error_reporter);
+  tflite::MicroMutableOpResolver<1> keyword_resolver;
+  keyword_resolver.AddCustom(kCustomOp, RegisterCustomOp());
+  tflite::MicroInterpreter keyword_interpreter(
+      tflite::GetModel(keyword_tflite.data()), keyword_resolver, keyword_arena,
+      kTensorArenaSize, &error_reporter);
+  if (yamnet_interpreter.AllocateTensors() != kTfLiteOk ||
+      keyword_interpreter.AllocateTensors() != kTfLiteOk) {
+    printf("AllocateTensors failed.\r\n");
+    vTaskSuspend(nullptr);
+  }
+
+  // Both models must be added before any audio is processed.
+  const int yamnet = frontend.AddModel(tensorflow::kYAMNet);
+  const int keyword = frontend.AddModel(tensorflow::kKeywordDetector);
+  if (yamnet < 0 || keyword < 0) {
+    printf("Failed to set up the audio frontend\r\n");
+    vTaskSuspend(nullptr);
+  }
+  frontend_mutex = xSemaphoreCreateMutex();
+  CHECK(frontend_mutex);
+
+  AudioDriverConfig audio_config{AudioSampleRate::k16000_Hz, kNumDmaBuffers,
+                                 kDmaBufferSizeMs};
+  AudioService audio_service(&audio_driver, audio_config, kAudioServicePriority,
+                             kDropFirstSamplesMs);
+  audio_service.AddCallback(&frontend, ProcessAudio);
+
+  while (true) {
+    vTaskDelay(pdMS_TO_TICKS(kInferenceIntervalMs));
+
+    bool yamnet_ready, keyword_ready;
+    {
+      MutexLock lock(frontend_mutex);
+      yamnet_ready = frontend.FeaturesReady(yamnet);
+      if (yamnet_ready) frontend.GetFeatures(yamnet, yamnet_features.data());
+      keyword_ready = frontend.FeaturesReady(keyword);
+      if (keyword_ready)
+        frontend.GetFeatures(keyword, keyword_features.data());
+    }
+
+    if (yamnet_ready) {
+      tensorflow::YamNetFeaturesToInput(yamnet_features.data(),
+                                        yamnet_interpreter.input_tensor(0));
+      Invoke(&yamnet_interpreter, "YamNet");
+      auto results = tensorflow::GetClassificationResults(
+          &yamnet_interpreter, kThreshold, kTopK);
+      printf("%s\r\n", tensorflow::FormatClassificationOutput(results).c_str());
+    }
+
+    // The keyword detector needs 2 seconds of audio, so it starts later.
+    if (keyword_ready) {
+      tensorflow::KeywordDetectorFeaturesToInput(
+          keyword_features.data(), keyword_interpreter.input_tensor(0));
+      Invoke(&keyword_interpreter, "Keyword detector");
+      auto results = tensorflow::GetClassificationResults(
+          &keyword_interpreter, kThreshold, kTopK);
+      for (const auto& c : results) {
+        if (static_cast<size_t>(c.id) < labels.size())
+          printf("%s: %f\r\n", labels[c.id].c_str(), c.score);
+      }
+      printf("\r\n");
+    }
+  }
+}
+}  // namespace
+}  // namespace coralmicro
+
+extern "C" void app_main(void* param) {
+  (void)param;
+  coralmicro::Main();
+}
@@ -13,8 +13,10 @@
 // limitations under the License.
 
 #include <cstring>
+#include <memory>
 #include <vector>
 
+#include "libs/base/boot_sequence.h"
 #include "libs/base/filesystem.h"
 #include "libs/base/gpio.h"
 #include "libs/base/led.h"
@@ -150,14 +152,28 @@ void DetectConsole(tflite::MicroInterpreter* interpreter) {
   // Turn on Status LED to show the board is on.
   LedSet(Led::kStatus, true);
 
+  // Read the model, open the Edge TPU, and start the camera at the same time.
   std::vector<uint8_t> model;
-  if (!LfsReadFile(kModelPath, &model)) {
+  std::shared_ptr<EdgeTpuContext> tpu_context;
+  BootSequence boot;
+  auto load_model = boot.AddStage(
+      "model", [&model] { return LfsReadFile(kModelPath, &model); });
+  auto open_tpu = boot.AddStage("tpu", [&tpu_context] {
+    tpu_context = EdgeTpuManager::GetSingleton()->OpenDevice();
+    return tpu_context != nullptr;
+  });
+  auto start_camera = boot.AddStage("camera", [] {
+    return CameraTask::GetSingleton()->SetPower(true) &&
+           CameraTask::GetSingleton()->Enable(CameraMode::kTrigger);
+  });
+  boot.Start();
+
+  if (!boot.Wait(load_model)) {
     printf("ERROR: Failed to load %s\r\n", kModelPath);
     vTaskSuspend(nullptr);
   }
 
-  auto tpu_context = EdgeTpuManager::GetSingleton()->OpenDevice();
-  if (!tpu_context) {
+  if (!boot.Wait(open_tpu)) {
     printf("ERROR: Failed to get EdgeTpu context\r\n");
     vTaskSuspend(nullptr);
   }
@@ -181,9 +197,11 @@ void DetectConsole(tflite::MicroInterpreter* interpreter) {
     vTaskSuspend(nullptr);
   }
 
-  // Starting Camera.
-  CameraTask::GetSingleton()->SetPower(true);
-  CameraTask::GetSingleton()->Enable(CameraMode::kTrigger);
+  if (!boot.Wait(start_camera)) {
+    printf("ERROR: Failed to start the camera\r\n");
+    vTaskSuspend(nullptr);
+  }
+  boot.PrintTimeline();
 
   printf("Initializing detection server...\r\n");
   jsonrpc_init(nullptr, &interpreter);
@@ -0,0 +1,119 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdio>
+
+#include "libs/base/check.h"
+#include "libs/base/queue_task.h"
+#include "libs/base/tasks.h"
+#include "libs/base/timer.h"
+#include "third_party/freertos_kernel/include/FreeRTOS.h"
+#include "third_party/freertos_kernel/include/task.h"
+
+// Measures the round-trip time of synchronous `QueueTask` requests, the path
+// used by the camera, PMIC, and Edge TPU tasks.
+//
+// The worker task runs at the lowest application priority. The second run
+// adds a busy task between the worker and the caller; requests still complete
+// quickly because the worker inherits the caller's priority.
+//
+// To build and flash from coralmicro root:
+//    bash build.sh
+//    python3 scripts/flashtool.py -e queue_task_benchmark
+
+namespace coralmicro {
+namespace {
+constexpr int kRequests = 10000;
+constexpr UBaseType_t kWorkerPriority = TaskPriority<1>;
+constexpr UBaseType_t kBusyPriority = TaskPriority<2>;
+
+struct Response {
+  uint32_t value;
+};
+
+struct Request {
+  uint32_t value;
+  QueueTaskCallback<Response> callback;
+};
+
+constexpr char kEchoTaskName[] = "echo_task";
+
+// Responds to each request with its own value.
+class EchoTask : public QueueTask<Request, Response, kEchoTaskName,
+                                  configMINIMAL_STACK_SIZE, kWorkerPriority,
+                                  /*QueueLength=*/4> {
+ public:
+  uint32_t Echo(uint32_t value) {
+    Request req;
+    req.value = value;
+    return SendRequest(req).value;
+  }
+
+ private:
+  void RequestHandler(Request* req) override {
+    Response resp;
+    resp.value = req->value;
+    if (req->callback) req->callback(resp);
+  }
+};
+
+volatile bool busy = false;
+
+[[noreturn]] void BusyTask(void* param) {
+  (void)param;
+  while (true) {
+    while (busy) {
+    }
+    vTaskDelay(1);
+  }
+}
+
+void RunBenchmark(EchoTask* echo, const char* name) {
+  uint64_t min_us = UINT64_MAX, max_us = 0;
+  const uint64_t start = TimerMicros();
+  for (int i = 0; i < kRequests; ++i) {
+    const uint64_t request_start = TimerMicros();
+    CHECK(echo->Echo(i) == static_cast<uint32_t>(i));
+    const uint64_t elapsed = TimerMicros() - request_start;
+    if (elapsed < min_us) min_us = elapsed;
+    if (elapsed > max_us) max_us = elapsed;
+  }
+  const uint64_t total_us = TimerMicros() - start;
+  printf("%s: %d requests in %lu us, %lu ns average, %lu-%lu us\r\n", name,
+         kRequests, static_cast<uint32_t>(total_us),
+         static_cast<uint32_t>(total_us * 1000 / kRequests),
+         static_cast<uint32_t>(min_us), static_cast<uint32_t>(max_us));
+}
+
+void Main() {
+  printf("QueueTask Benchmark!\r\n");
+
+  static EchoTask echo;
+  echo.Init();
+  CHECK(xTaskCreate(BusyTask, "busy_task", configMINIMAL_STACK_SIZE, nullptr,
+                    kBusyPriority, nullptr) == pdPASS);
+
+  RunBenchmark(&echo, "Idle");
+  busy = true;
+  RunBenchmark(&echo, "Busy");
+  busy = false;
+}
+}  // namespace
+}  // namespace coralmicro
+
+extern "C" void app_main(void* param) {
+  (void)param;
+  coralmicro::Main();
+  vTaskSuspend(nullptr);
+}
@@ -0,0 +1,79 @@
+// Copyright 2022 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstdio>
+#include <string>
+
+#include "libs/base/check.h"
+#include "libs/base/utils.h"
+#include "third_party/freertos_kernel/include/FreeRTOS.h"
+#include "third_party/freertos_kernel/include/task.h"
+#include "third_party/nxp/rt1176-sdk/middleware/lwip/src/include/lwip/apps/lwiperf.h"
+#include "third_party/nxp/rt1176-sdk/middleware/lwip/src/include/lwip/tcpip.h"
+
+// Runs an iperf server on the USB network interface, to measure the
+// throughput of the CDC-EEM link between the board and a Linux host.
+//
+// To build and flash from coralmicro root:
+//    bash build.sh
+//    python3 scripts/flashtool.py -e usb_iperf
+//
+// Then run iperf 2 on the host, for each direction:
+//    iperf -c 10.10.10.1 -t 10 -i 1
+//    iperf -c 10.10.10.1 -t 10 -i 1 -r
+//
+// The first run measures host to board (board RX); with `-r`, iperf then
+// also measures board to host (board TX). The board prints each result on
+// its console.
+//
+// To compare against the 300-byte MTU the interface used to have, lower the
+// MTU of the host's USB interface and run both directions again. TCP then
+// sends segments that fit 300-byte frames both ways:
+//    sudo ip link set <usb interface> mtu 300
+
+namespace coralmicro {
+namespace {
+void Report(void* arg, enum lwiperf_report_type report_type,
+            const ip_addr_t* local_addr, u16_t local_port,
+            const ip_addr_t* remote_addr, u16_t remote_port,
+            u64_t bytes_transferred, u32_t ms_duration,
+            u32_t bandwidth_kbitpsec) {
+  printf("iperf: %lu bytes in %lu ms, %lu kbit/s (report type %d)\r\n",
+         static_cast<uint32_t>(bytes_transferred), ms_duration,
+         bandwidth_kbitpsec, report_type);
+}
+
+void StartServer(void* ctx) {
+  if (!lwiperf_start_tcp_server_default(Report, nullptr)) {
+    printf("Failed to start iperf server\r\n");
+  }
+}
+
+void Main() {
+  printf("USB iperf Example!\r\n");
+
+  std::string usb_ip;
+  if (!GetUsbIpAddress(&usb_ip)) usb_ip = "10.10.10.1";
+  CHECK(tcpip_callback(StartServer, nullptr) == ERR_OK);
+  printf("iperf server listening on %s:%d\r\n", usb_ip.c_str(),
+         LWIPERF_TCP_PORT_DEFAULT);
+}
+}  // namespace
+}  // namespace coralmicro
+
+extern "C" void app_main(void* param) {
+  (void)param;
+  coralmicro::Main();
+  vTaskSuspend(nullptr);
+}
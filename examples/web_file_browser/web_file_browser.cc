@@ -17,6 +17,7 @@
 #include <cstring>
 #include <map>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "libs/base/filesystem.h"
@@ -56,7 +57,7 @@ std::string GetPath(const char* uri) {
   return path;
 }
 
-bool DirHtml(lfs_dir_t* dir, const char* dirname, std::vector<uint8_t>* html) {
+void DirHtmlHeader(const char* dirname, std::vector<uint8_t>* html) {
   StrAppend(html, "<!DOCTYPE html>\r\n");
   StrAppend(html, "<html lang=\"en\">\r\n");
   StrAppend(html, "<head>\r\n");
@@ -69,35 +70,108 @@ bool DirHtml(lfs_dir_t* dir, const char* dirname, std::vector<uint8_t>* html) {
   StrAppend(html, "<h1>Directory listing for %s</h1>\r\n", dirname);
   StrAppend(html, "<hr>\r\n");
   StrAppend(html, "<table>\r\n");
-  int res;
-  lfs_info info;
-  while ((res = lfs_dir_read(Lfs(), dir, &info)) != 0) {
-    if (res < 0) return false;
-
-    if (info.type == LFS_TYPE_REG) {
-      StrAppend(html, "<tr>\r\n");
-      StrAppend(html, "<td>&#128462;</td>\r\n");
-      StrAppend(html, "<td><a href=\"%s%s%s\">%s</a></td>\r\n", kUrlPrefix,
-                dirname + 1, info.name, info.name);
-      StrAppend(html, "<td>%d</td>", info.size);
-      StrAppend(html, "</tr>\r\n");
-    } else if (info.type == LFS_TYPE_DIR) {
-      if (std::strcmp(info.name, ".") == 0) continue;
-      StrAppend(html, "<tr>\r\n");
-      StrAppend(html, "<td>&#128193;</td>\r\n");
-      StrAppend(html, "<td><a href=\"%s%s%s/\">%s/</a></td>\r\n", kUrlPrefix,
-                dirname + 1, info.name, info.name);
-      StrAppend(html, "<td></td>\r\n");
-      StrAppend(html, "</tr>\r\n");
-    }
+}
+
+void DirHtmlEntry(const lfs_info& info, const char* dirname,
+                  std::vector<uint8_t>* html) {
+  if (info.type == LFS_TYPE_REG) {
+    StrAppend(html, "<tr>\r\n");
+    StrAppend(html, "<td>&#128462;</td>\r\n");
+    StrAppend(html, "<td><a href=\"%s%s%s\">%s</a></td>\r\n", kUrlPrefix,
+              dirname + 1, info.name, info.name);
+    StrAppend(html, "<td>%d</td>", info.size);
+    StrAppend(html, "</tr>\r\n");
+  } else if (info.type == LFS_TYPE_DIR) {
+    if (std::strcmp(info.name, ".") == 0) return;
+    StrAppend(html, "<tr>\r\n");
+    StrAppend(html, "<td>&#128193;</td>\r\n");
+    StrAppend(html, "<td><a href=\"%s%s%s/\">%s/</a></td>\r\n", kUrlPrefix,
+              dirname + 1, info.name, info.name);
+    StrAppend(html, "<td></td>\r\n");
+    StrAppend(html, "</tr>\r\n");
   }
+}
+
+void DirHtmlFooter(std::vector<uint8_t>* html) {
   StrAppend(html, "</table>\r\n");
   StrAppend(html, "<hr>\r\n");
   StrAppend(html, "</body>\r\n");
   StrAppend(html, "</html>\r\n");
-  return true;
 }
 
+// Generates the HTML listing of a directory one entry at a time, so the page
+// is never held in memory as a whole, no matter how many files there are.
+class DirListing {
+ public:
+  DirListing() = default;
+  DirListing(const DirListing&) = delete;
+  DirListing& operator=(const DirListing&) = delete;
+  ~DirListing() {
+    if (opened_) lfs_dir_close(Lfs(), &dir_);
+  }
+
+  bool Open(const std::string& path) {
+    if (lfs_dir_open(Lfs(), &dir_, path.c_str()) < 0) return false;
+    opened_ = true;
+    dirname_ = path;
+    // Make sure directory path has '/' at the end.
+    if (dirname_.back() != '/') dirname_.push_back('/');
+    html_.reserve(256);
+    return true;
+  }
+
+  int Generate(char* buffer, int size) {
+    while (pos_ == html_.size()) {
+      html_.clear();
+      pos_ = 0;
+      if (!Next()) return error_ ? -1 : 0;
+    }
+    const auto n = std::min<size_t>(size, html_.size() - pos_);
+    std::memcpy(buffer, html_.data() + pos_, n);
+    pos_ += n;
+    return n;
+  }
+
+ private:
+  enum class Stage { kHeader, kEntries, kDone };
+
+  bool Next() {
+    switch (stage_) {
+      case Stage::kHeader:
+        DirHtmlHeader(dirname_.c_str(), &html_);
+        stage_ = Stage::kEntries;
+        return true;
+      case Stage::kEntries: {
+        lfs_info info;
+        int res = lfs_dir_read(Lfs(), &dir_, &info);
+        if (res < 0) {
+          error_ = true;
+          stage_ = Stage::kDone;
+          return false;
+        }
+        if (res == 0) {
+          DirHtmlFooter(&html_);
+          stage_ = Stage::kDone;
+        } else {
+          DirHtmlEntry(info, dirname_.c_str(), &html_);
+        }
+        return true;
+      }
+      case Stage::kDone:
+        return false;
+    }
+    return false;
+  }
+
+  lfs_dir_t dir_;
+  bool opened_ = false;
+  std::string dirname_;
+  std::vector<uint8_t> html_;
+  size_t pos_ = 0;
+  Stage stage_ = Stage::kHeader;
+  bool error_ = false;
+};
+
 HttpServer::Content UriHandler(const char* uri) {
   if (!StrStartsWith(uri, kUrlPrefix)) return {};
   auto path = GetPath(uri + StrLen(kUrlPrefix) - 1);
@@ -105,25 +179,18 @@ HttpServer::Content UriHandler(const char* uri) {
 
   printf("GET %s => %s\r\n", uri, path.c_str());
 
-  lfs_dir_t dir;
-  int res = lfs_dir_open(Lfs(), &dir, path.c_str());
-  if (res < 0) {
+  // The listing owns the open directory and closes it once the response is
+  // finished.
+  auto listing = std::make_shared<DirListing>();
+  if (!listing->Open(path)) {
     if (LfsFileExists(path.c_str())) return path;
     return {};
   }
 
-  // Make sure directory path has '/' at the end.
-  if (path.back() != '/') path.push_back('/');
-
-  std::vector<uint8_t> html;
-  html.reserve(1024);
-  if (!DirHtml(&dir, path.c_str(), &html)) {
-    lfs_dir_close(Lfs(), &dir);
-    return {};
-  }
-
-  lfs_dir_close(Lfs(), &dir);
-  return html;
+  return HttpServer::ChunkedContent{
+      "text/html; charset=utf-8", [listing](char* buffer, int size) {
+        return listing->Generate(buffer, size);
+      }};
 }
 
 class FileHttpServer : public HttpServer {
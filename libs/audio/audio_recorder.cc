@@ -0,0 +1,477 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/audio/audio_recorder.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#include "libs/base/check.h"
+#include "libs/base/filesystem.h"
+#include "libs/base/mutex.h"
+#include "libs/base/timer.h"
+
+namespace coralmicro {
+namespace {
+constexpr size_t kWav16HeaderSize = 44;
+constexpr size_t kImaAdpcmHeaderSize = 60;
+// Every IMA-ADPCM block starts with a 4-byte header holding the first sample
+// and is followed by two 4-bit codes per byte.
+constexpr size_t kImaAdpcmBlockAlign = 512;
+constexpr size_t kImaAdpcmSamplesPerBlock = (kImaAdpcmBlockAlign - 4) * 2 + 1;
+// Samples converted from 32 to 16 bits at once in `Process()`.
+constexpr size_t kConvertBatchSize = 128;
+// Slots of the write queue for open and close messages, enough for two clips.
+constexpr int kControlSlots = 4;
+
+constexpr int kImaIndexTable[16] = {-1, -1, -1, -1, 2, 4, 6, 8,
+                                    -1, -1, -1, -1, 2, 4, 6, 8};
+
+constexpr int16_t kImaStepTable[89] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,
+    19,    21,    23,    25,    28,    31,    34,    37,    41,    45,
+    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,
+    337,   371,   408,   449,   494,   544,   598,   658,   724,   796,
+    876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,
+    5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+
+uint8_t ImaAdpcmEncodeSample(int sample, int* predictor, int* step_index) {
+  const int step = kImaStepTable[*step_index];
+  int diff = sample - *predictor;
+  uint8_t code = 0;
+  if (diff < 0) {
+    code = 8;
+    diff = -diff;
+  }
+
+  // Mirrors the decoder so the encoder tracks exactly what playback sees.
+  int delta = step >> 3;
+  if (diff >= step) {
+    code |= 4;
+    diff -= step;
+    delta += step;
+  }
+  if (diff >= step >> 1) {
+    code |= 2;
+    diff -= step >> 1;
+    delta += step >> 1;
+  }
+  if (diff >= step >> 2) {
+    code |= 1;
+    delta += step >> 2;
+  }
+
+  *predictor += (code & 8) ? -delta : delta;
+  *predictor = std::clamp(*predictor, -32768, 32767);
+  *step_index = std::clamp(*step_index + kImaIndexTable[code], 0, 88);
+  return code;
+}
+
+void Put16(uint8_t* p, uint16_t v) {
+  p[0] = v & 0xff;
+  p[1] = v >> 8;
+}
+
+void Put32(uint8_t* p, uint32_t v) {
+  Put16(p, v & 0xffff);
+  Put16(p + 2, v >> 16);
+}
+
+// Raises `num_chunks` so that the header and the encoded pre-trigger audio,
+// which `StartClip()` emits all at once, fit with a chunk to spare for the
+// audio that follows.
+AudioRecorderConfig WithPreTriggerChunks(AudioSampleRate sample_rate,
+                                         AudioRecorderConfig config) {
+  CHECK(config.chunk_size >= kImaAdpcmHeaderSize);
+  const size_t samples =
+      std::max(1, MsToSamples(sample_rate, config.pre_trigger_ms));
+  const size_t bytes =
+      config.format == AudioRecorderFormat::kWav16
+          ? kWav16HeaderSize + samples * sizeof(int16_t)
+          : kImaAdpcmHeaderSize +
+                (samples + kImaAdpcmSamplesPerBlock - 1) /
+                    kImaAdpcmSamplesPerBlock * kImaAdpcmBlockAlign;
+  const size_t min_chunks = (bytes + config.chunk_size - 1) / config.chunk_size;
+  config.num_chunks = std::max(config.num_chunks, min_chunks + 1);
+  return config;
+}
+}  // namespace
+
+AudioRecorder::AudioRecorder(AudioSampleRate sample_rate,
+                             const AudioRecorderConfig& config)
+    : config_(WithPreTriggerChunks(sample_rate, config)),
+      sample_rate_(static_cast<int>(sample_rate)),
+      post_trigger_samples_(MsToSamples(sample_rate, config.post_trigger_ms)),
+      pre_trigger_(
+          std::max(1, MsToSamples(sample_rate, config.pre_trigger_ms))),
+      mutex_(xSemaphoreCreateMutex()),
+      chunk_storage_(config_.chunk_size * config_.num_chunks),
+      free_chunks_(xQueueCreate(config_.num_chunks, sizeof(uint8_t*))),
+      // Data messages are bounded by the number of chunks, the extra slots
+      // hold open/close messages of clips still being written.
+      write_queue_(
+          xQueueCreate(config_.num_chunks + kControlSlots, sizeof(Message))) {
+  CHECK(mutex_);
+  CHECK(free_chunks_);
+  CHECK(write_queue_);
+  if (config_.format == AudioRecorderFormat::kImaAdpcm)
+    adpcm_block_.resize(kImaAdpcmSamplesPerBlock);
+
+  for (size_t i = 0; i < config_.num_chunks; ++i) {
+    uint8_t* chunk = chunk_storage_.data() + i * config_.chunk_size;
+    CHECK(xQueueSendToBack(free_chunks_, &chunk, 0) == pdTRUE);
+  }
+  CHECK(xTaskCreate(StaticRun, "audio_recorder", configMINIMAL_STACK_SIZE * 10,
+                    this, config_.task_priority, &task_) == pdPASS);
+}
+
+AudioRecorder::~AudioRecorder() {
+  Message msg{};
+  msg.type = MessageType::kStop;
+  CHECK(xQueueSendToBack(write_queue_, &msg, portMAX_DELAY) == pdTRUE);
+
+  while (eTaskGetState(task_) != eSuspended) taskYIELD();
+  vTaskDelete(task_);
+
+  vQueueDelete(write_queue_);
+  vQueueDelete(free_chunks_);
+  vSemaphoreDelete(mutex_);
+}
+
+bool AudioRecorder::Trigger(const char* path) {
+  if (std::strlen(path) >= kMaxPathLength) return false;
+
+  MutexLock lock(mutex_);
+  if (pending_ || recording_) {
+    ++triggers_ignored_;
+    return false;
+  }
+  std::strcpy(pending_path_, path);
+  pending_ = true;
+  recording_ = true;
+  return true;
+}
+
+bool AudioRecorder::Flush(int timeout_ms) {
+  const auto deadline = TimerMillis() + timeout_ms;
+  while (recording_ || writer_busy_ ||
+         uxQueueMessagesWaiting(write_queue_) != 0) {
+    if (TimerMillis() >= deadline) return false;
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+  return true;
+}
+
+AudioRecorderStats AudioRecorder::GetStats() const {
+  return {clips_written_,  clips_truncated_,   clips_failed_,
+          clips_dropped_,  triggers_ignored_,  bytes_written_,
+          max_chunks_queued_, max_write_us_};
+}
+
+void AudioRecorder::Process(const int32_t* samples, size_t num_samples) {
+  bool start = false;
+  {
+    MutexLock lock(mutex_);
+    std::swap(start, pending_);
+  }
+  if (start) StartClip();
+
+  std::array<int16_t, kConvertBatchSize> batch;
+  while (num_samples > 0) {
+    const size_t count = std::min(num_samples, batch.size());
+    for (size_t i = 0; i < count; ++i) batch[i] = samples[i] >> 16;
+    samples += count;
+    num_samples -= count;
+
+    if (post_remaining_ > 0) {
+      const size_t post_count = std::min(count, post_remaining_);
+      Encode(batch.data(), post_count);
+      post_remaining_ = clip_truncated_ ? 0 : post_remaining_ - post_count;
+      if (post_remaining_ == 0) FinishClip();
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      pre_trigger_[pre_trigger_pos_++] = batch[i];
+      if (pre_trigger_pos_ == pre_trigger_.size()) {
+        pre_trigger_pos_ = 0;
+        pre_trigger_full_ = true;
+      }
+    }
+  }
+}
+
+void AudioRecorder::StartClip() {
+  // Reserve the open and close messages up front. Data messages never
+  // outnumber the chunks, so with the reservation no send below can find the
+  // queue full, and the audio task never waits for the filesystem.
+  if (control_slots_.fetch_add(2) + 2 > kControlSlots) {
+    control_slots_ -= 2;
+    ++clips_dropped_;
+    recording_ = false;
+    return;
+  }
+
+  Message msg{};
+  msg.type = MessageType::kOpen;
+  {
+    MutexLock lock(mutex_);
+    std::strcpy(msg.path, pending_path_);
+  }
+  CHECK(xQueueSendToBack(write_queue_, &msg, 0) == pdTRUE);
+
+  clip_samples_ = 0;
+  clip_truncated_ = false;
+  adpcm_block_pos_ = 0;
+  adpcm_step_index_ = 0;
+  post_remaining_ = post_trigger_samples_;
+
+  // Placeholder, the writer fills in the header once the sizes are known.
+  std::array<uint8_t, kImaAdpcmHeaderSize> header{};
+  Emit(header.data(), HeaderSize());
+
+  if (pre_trigger_full_)
+    Encode(pre_trigger_.data() + pre_trigger_pos_,
+           pre_trigger_.size() - pre_trigger_pos_);
+  Encode(pre_trigger_.data(), pre_trigger_pos_);
+
+  if (clip_truncated_ || post_remaining_ == 0) {
+    post_remaining_ = 0;
+    FinishClip();
+  }
+}
+
+void AudioRecorder::FinishClip() {
+  if (!clip_truncated_ && adpcm_block_pos_ > 0) {
+    // The header's sample count excludes this padding.
+    std::fill(adpcm_block_.begin() + adpcm_block_pos_, adpcm_block_.end(),
+              adpcm_block_[adpcm_block_pos_ - 1]);
+    EncodeImaAdpcmBlock();
+  }
+  if (chunk_) SendChunk();
+
+  Message msg{};
+  msg.type = MessageType::kClose;
+  msg.close.num_samples = clip_samples_;
+  msg.close.truncated = clip_truncated_;
+  CHECK(xQueueSendToBack(write_queue_, &msg, 0) == pdTRUE);
+  recording_ = false;
+}
+
+void AudioRecorder::Encode(const int16_t* samples, size_t num_samples) {
+  if (clip_truncated_) return;
+
+  if (config_.format == AudioRecorderFormat::kWav16) {
+    // WAV is little-endian, like the M7.
+    if (Emit(reinterpret_cast<const uint8_t*>(samples),
+             num_samples * sizeof(int16_t)))
+      clip_samples_ += num_samples;
+    return;
+  }
+
+  while (num_samples > 0) {
+    const size_t count =
+        std::min(num_samples, adpcm_block_.size() - adpcm_block_pos_);
+    std::copy_n(samples, count, adpcm_block_.begin() + adpcm_block_pos_);
+    adpcm_block_pos_ += count;
+    samples += count;
+    num_samples -= count;
+    clip_samples_ += count;
+    if (adpcm_block_pos_ == adpcm_block_.size() && !EncodeImaAdpcmBlock())
+      return;
+  }
+}
+
+bool AudioRecorder::EncodeImaAdpcmBlock() {
+  std::array<uint8_t, kImaAdpcmBlockAlign> block;
+  adpcm_predictor_ = adpcm_block_[0];
+  Put16(&block[0], static_cast<uint16_t>(adpcm_predictor_));
+  block[2] = static_cast<uint8_t>(adpcm_step_index_);
+  block[3] = 0;
+  for (size_t i = 1, j = 4; i < adpcm_block_.size(); i += 2, ++j) {
+    const uint8_t lo = ImaAdpcmEncodeSample(adpcm_block_[i], &adpcm_predictor_,
+                                            &adpcm_step_index_);
+    const uint8_t hi = ImaAdpcmEncodeSample(
+        adpcm_block_[i + 1], &adpcm_predictor_, &adpcm_step_index_);
+    block[j] = lo | (hi << 4);
+  }
+  adpcm_block_pos_ = 0;
+  return Emit(block.data(), block.size());
+}
+
+bool AudioRecorder::Emit(const uint8_t* data, size_t size) {
+  while (size > 0) {
+    if (!chunk_) {
+      // Never wait here: this runs on the audio task.
+      if (xQueueReceive(free_chunks_, &chunk_, 0) != pdTRUE) {
+        chunk_ = nullptr;
+        clip_truncated_ = true;
+        return false;
+      }
+      chunk_pos_ = 0;
+    }
+    const size_t count = std::min(size, config_.chunk_size - chunk_pos_);
+    std::memcpy(chunk_ + chunk_pos_, data, count);
+    chunk_pos_ += count;
+    data += count;
+    size -= count;
+    if (chunk_pos_ == config_.chunk_size) SendChunk();
+  }
+  return true;
+}
+
+void AudioRecorder::SendChunk() {
+  Message msg{};
+  msg.type = MessageType::kData;
+  msg.data = chunk_;
+  msg.size = chunk_pos_;
+  CHECK(xQueueSendToBack(write_queue_, &msg, 0) == pdTRUE);
+  chunk_ = nullptr;
+  chunk_pos_ = 0;
+
+  const int queued = static_cast<int>(config_.num_chunks -
+                                      uxQueueMessagesWaiting(free_chunks_));
+  if (queued > max_chunks_queued_) max_chunks_queued_ = queued;
+}
+
+size_t AudioRecorder::HeaderSize() const {
+  return config_.format == AudioRecorderFormat::kWav16 ? kWav16HeaderSize
+                                                       : kImaAdpcmHeaderSize;
+}
+
+void AudioRecorder::WriteHeader(uint8_t* header, uint32_t num_samples,
+                                uint32_t data_size) const {
+  const size_t header_size = HeaderSize();
+  std::memcpy(&header[0], "RIFF", 4);
+  Put32(&header[4], header_size - 8 + data_size);
+  std::memcpy(&header[8], "WAVEfmt ", 8);
+  if (config_.format == AudioRecorderFormat::kWav16) {
+    Put32(&header[16], 16);
+    Put16(&header[20], 1);  // PCM
+    Put16(&header[22], 1);  // Mono
+    Put32(&header[24], sample_rate_);
+    Put32(&header[28], sample_rate_ * sizeof(int16_t));
+    Put16(&header[32], sizeof(int16_t));
+    Put16(&header[34], 16);
+  } else {
+    Put32(&header[16], 20);
+    Put16(&header[20], 0x11);  // IMA-ADPCM
+    Put16(&header[22], 1);     // Mono
+    Put32(&header[24], sample_rate_);
+    Put32(&header[28],
+          sample_rate_ * kImaAdpcmBlockAlign / kImaAdpcmSamplesPerBlock);
+    Put16(&header[32], kImaAdpcmBlockAlign);
+    Put16(&header[34], 4);
+    Put16(&header[36], 2);
+    Put16(&header[38], kImaAdpcmSamplesPerBlock);
+    std::memcpy(&header[40], "fact", 4);
+    Put32(&header[44], 4);
+    Put32(&header[48], num_samples);
+  }
+  std::memcpy(&header[header_size - 8], "data", 4);
+  Put32(&header[header_size - 4], data_size);
+}
+
+void AudioRecorder::StaticRun(void* param) {
+  static_cast<AudioRecorder*>(param)->Run();
+  vTaskSuspend(nullptr);
+}
+
+void AudioRecorder::Run() {
+  lfs_file_t file;
+  bool open = false;
+  bool failed = false;
+  uint32_t file_size = 0;
+
+  Message msg;
+  while (true) {
+    CHECK(xQueueReceive(write_queue_, &msg, portMAX_DELAY) == pdTRUE);
+    writer_busy_ = true;
+    switch (msg.type) {
+      case MessageType::kOpen: {
+        --control_slots_;
+        LfsMakeDirs(LfsDirname(msg.path).c_str());
+        open = lfs_file_open(Lfs(), &file, msg.path,
+                             LFS_O_WRONLY | LFS_O_TRUNC | LFS_O_CREAT) >= 0;
+        failed = !open;
+        file_size = 0;
+      } break;
+
+      case MessageType::kData: {
+        if (open && !failed) {
+          const auto start = TimerMicros();
+          auto n = lfs_file_write(Lfs(), &file, msg.data, msg.size);
+          const auto elapsed = TimerMicros() - start;
+          if (elapsed > max_write_us_) max_write_us_ = elapsed;
+          if (n >= 0 && static_cast<size_t>(n) == msg.size) {
+            file_size += n;
+            bytes_written_ += n;
+          } else {
+            failed = true;
+          }
+        }
+        CHECK(xQueueSendToBack(free_chunks_, &msg.data, portMAX_DELAY) ==
+              pdTRUE);
+      } break;
+
+      case MessageType::kClose: {
+        --control_slots_;
+        if (open) {
+          // A truncated clip may end in the middle of a block or sample.
+          const auto header_size = static_cast<uint32_t>(HeaderSize());
+          uint32_t data_size = 0, num_samples = 0;
+          if (file_size > header_size) {
+            if (config_.format == AudioRecorderFormat::kWav16) {
+              data_size = (file_size - header_size) & ~1u;
+              num_samples = data_size / sizeof(int16_t);
+            } else {
+              const auto blocks =
+                  (file_size - header_size) / kImaAdpcmBlockAlign;
+              data_size = blocks * kImaAdpcmBlockAlign;
+              num_samples = blocks * kImaAdpcmSamplesPerBlock;
+            }
+          }
+          num_samples = std::min(num_samples, msg.close.num_samples);
+
+          std::array<uint8_t, kImaAdpcmHeaderSize> header;
+          WriteHeader(header.data(), num_samples, data_size);
+          if (lfs_file_seek(Lfs(), &file, 0, LFS_SEEK_SET) < 0 ||
+              lfs_file_write(Lfs(), &file, header.data(), header_size) !=
+                  static_cast<lfs_ssize_t>(header_size))
+            failed = true;
+          if (lfs_file_close(Lfs(), &file) < 0) failed = true;
+          open = false;
+        }
+        if (failed) {
+          ++clips_failed_;
+        } else {
+          ++clips_written_;
+          if (msg.close.truncated) ++clips_truncated_;
+        }
+      } break;
+
+      case MessageType::kStop:
+        if (open) lfs_file_close(Lfs(), &file);
+        return;
+    }
+    writer_busy_ = false;
+  }
+}
+
+}  // namespace coralmicro
@@ -0,0 +1,247 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_AUDIO_AUDIO_RECORDER_H_
+#define LIBS_AUDIO_AUDIO_RECORDER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "libs/audio/audio_driver.h"
+#include "third_party/freertos_kernel/include/FreeRTOS.h"
+#include "third_party/freertos_kernel/include/queue.h"
+#include "third_party/freertos_kernel/include/semphr.h"
+#include "third_party/freertos_kernel/include/task.h"
+
+namespace coralmicro {
+
+// File formats written by `AudioRecorder`.
+enum class AudioRecorderFormat {
+  // Mono 16-bit PCM WAV.
+  kWav16,
+  // Mono 4-bit IMA-ADPCM WAV (a quarter the size of `kWav16`).
+  kImaAdpcm,
+};
+
+// Configuration for `AudioRecorder`.
+struct AudioRecorderConfig {
+  // Amount of audio in milliseconds saved from before `Trigger()`.
+  int pre_trigger_ms = 1000;
+  // Amount of audio in milliseconds saved after `Trigger()`.
+  int post_trigger_ms = 2000;
+  // Encoding of the clip files.
+  AudioRecorderFormat format = AudioRecorderFormat::kImaAdpcm;
+  // Size in bytes of each write to the filesystem. The default matches the
+  // NAND flash page size.
+  size_t chunk_size = 2048;
+  // Number of chunks that can be waiting to be written at once.
+  //
+  // `Trigger()` encodes all the pre-trigger audio at once, so the constructor
+  // raises this as needed to hold it plus one more chunk. For example, 1000 ms
+  // at 16 kHz takes 17 chunks of 2048 bytes as `kWav16` (34 KB), or 6 as
+  // `kImaAdpcm`. Each chunk is allocated up front.
+  size_t num_chunks = 8;
+  // Priority of the internal FreeRTOS task that writes to the filesystem.
+  int task_priority = 1;
+};
+
+// Write statistics reported by `AudioRecorder`.
+struct AudioRecorderStats {
+  // Number of clips written to the filesystem, including truncated ones.
+  int clips_written;
+  // Number of clips cut short because the writer task fell behind.
+  int clips_truncated;
+  // Number of clips that failed to open or write.
+  int clips_failed;
+  // Number of clips not recorded because earlier clips were still waiting to
+  // be opened or closed by the writer task.
+  int clips_dropped;
+  // Number of times `Trigger()` was ignored because a clip was in progress.
+  int triggers_ignored;
+  // Total bytes written to the filesystem.
+  uint64_t bytes_written;
+  // Maximum number of chunks waiting to be written at once.
+  int max_chunks_queued;
+  // Longest single chunk write in microseconds.
+  uint64_t max_write_us;
+};
+
+// Records audio clips around trigger events into LittleFS files without
+// blocking the audio task.
+//
+// `AudioRecorder` keeps the latest `AudioRecorderConfig::pre_trigger_ms` of
+// audio in memory. When you call `Trigger()`, it encodes that audio followed
+// by the next `AudioRecorderConfig::post_trigger_ms` of audio into a WAV file.
+// Encoded data is split into fixed-size chunks (one flash page by default)
+// and written from a separate low-priority task, so the task that feeds audio
+// only pays for the encoding. If the writer falls behind and all chunks are
+// in use, the clip is cut short instead of stalling audio, and if earlier
+// clips haven't been opened and closed yet, a new clip is dropped; `GetStats()`
+// reports these and other back-pressure counters.
+//
+// Feed it from an `AudioService` callback:
+//
+// ```
+// AudioService* service = ...
+//
+// AudioRecorder recorder(service->Config().sample_rate, AudioRecorderConfig{});
+// service->AddCallback(
+//     &recorder, +[](void* ctx, const int32_t* samples, size_t num_samples) {
+//         static_cast<AudioRecorder*>(ctx)->Process(samples, num_samples);
+//         return true;
+//     });
+//
+// // Later, for example when a model detects an event:
+// recorder.Trigger("/clips/event_0001.wav");
+// ```
+class AudioRecorder {
+ public:
+  // Maximum length of a clip path, including the null terminator.
+  static constexpr size_t kMaxPathLength = 64;
+
+  // Constructor.
+  //
+  // Allocates all buffers up front and starts the writer task.
+  //
+  // @param sample_rate The sample rate of the audio passed to `Process()`.
+  // @param config The recorder configuration.
+  AudioRecorder(AudioSampleRate sample_rate, const AudioRecorderConfig& config);
+  // @cond
+  AudioRecorder(const AudioRecorder&) = delete;
+  AudioRecorder& operator=(const AudioRecorder&) = delete;
+  ~AudioRecorder();
+  // @endcond
+
+  // Adds new audio samples to the recorder.
+  //
+  // Call this from an `AudioService` callback with the samples it receives.
+  //
+  // @param samples A pointer to the buffer of 32-bit audio samples.
+  // @param num_samples The number of audio samples in the buffer.
+  void Process(const int32_t* samples, size_t num_samples);
+
+  // Starts saving a clip.
+  //
+  // The clip starts with the pre-trigger audio and ends after the post-trigger
+  // audio has been received by `Process()`. Parent directories are created
+  // as needed.
+  //
+  // @param path The file path for the clip.
+  // @return True if the clip was started, false if another clip is still being
+  // recorded or the path is too long.
+  bool Trigger(const char* path);
+
+  // Checks whether a clip is being recorded.
+  //
+  // @return True from `Trigger()` until all post-trigger audio has been
+  // received. The file may still be in the process of being written.
+  bool Recording() const { return recording_; }
+
+  // Waits until all queued chunks have been written to the filesystem.
+  //
+  // @param timeout_ms Maximum time to wait, in milliseconds.
+  // @return True if the writer is idle, false on timeout.
+  bool Flush(int timeout_ms);
+
+  // Gets the write statistics.
+  //
+  // @return A snapshot of the counters.
+  AudioRecorderStats GetStats() const;
+
+ private:
+  // @cond
+  enum class MessageType : uint8_t {
+    kOpen,
+    kData,
+    kClose,
+    kStop,
+  };
+
+  struct Message {
+    MessageType type;
+    uint8_t* data;
+    size_t size;
+    union {
+      char path[kMaxPathLength];
+      struct {
+        uint32_t num_samples;
+        bool truncated;
+      } close;
+    };
+  };
+  // @endcond
+
+  static void StaticRun(void* param);
+  void Run();
+
+  void StartClip();
+  void FinishClip();
+  void Encode(const int16_t* samples, size_t num_samples);
+  bool EncodeImaAdpcmBlock();
+  bool Emit(const uint8_t* data, size_t size);
+  void SendChunk();
+  size_t HeaderSize() const;
+  void WriteHeader(uint8_t* header, uint32_t num_samples,
+                   uint32_t data_size) const;
+
+  AudioRecorderConfig config_;
+  int sample_rate_;
+  size_t post_trigger_samples_;
+
+  // Pre-trigger ring, only touched by the task that calls `Process()`.
+  std::vector<int16_t> pre_trigger_;
+  size_t pre_trigger_pos_ = 0;
+  bool pre_trigger_full_ = false;
+
+  // Encoder state, only touched by the task that calls `Process()`.
+  std::vector<int16_t> adpcm_block_;
+  size_t adpcm_block_pos_ = 0;
+  int adpcm_predictor_ = 0;
+  int adpcm_step_index_ = 0;
+  uint8_t* chunk_ = nullptr;
+  size_t chunk_pos_ = 0;
+  size_t post_remaining_ = 0;
+  uint32_t clip_samples_ = 0;
+  bool clip_truncated_ = false;
+
+  SemaphoreHandle_t mutex_;
+  char pending_path_[kMaxPathLength];  // protected by mutex_
+  bool pending_ = false;               // protected by mutex_
+  volatile bool recording_ = false;
+
+  std::vector<uint8_t> chunk_storage_;
+  QueueHandle_t free_chunks_;
+  QueueHandle_t write_queue_;
+  TaskHandle_t task_;
+  volatile bool writer_busy_ = false;
+  // Slots of `write_queue_` held for open and close messages. Each clip
+  // reserves two when it starts, and the writer frees one per message.
+  std::atomic<int> control_slots_{0};
+
+  volatile int clips_written_ = 0;
+  volatile int clips_truncated_ = 0;
+  volatile int clips_failed_ = 0;
+  volatile int clips_dropped_ = 0;
+  volatile int triggers_ignored_ = 0;
+  volatile uint64_t bytes_written_ = 0;
+  volatile int max_chunks_queued_ = 0;
+  volatile uint64_t max_write_us_ = 0;
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_AUDIO_AUDIO_RECORDER_H_
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/audio/voice_activity.h"
+
+#include <algorithm>
+
+#include "libs/base/check.h"
+
+namespace coralmicro {
+namespace {
+// Noise floor tracks quiet frames with a 1/16 exponential moving average.
+constexpr int kNoiseFloorShift = 4;
+// Loud frames pull the noise floor up with a 1/1024 moving average, so a step
+// up in ambient noise (a fan turning on) stops counting as activity after a
+// few seconds instead of latching the detector on. Speech pauses often enough
+// that this barely moves the floor.
+constexpr int kLoudNoiseFloorShift = 10;
+
+int MsToFrames(int ms, int frame_ms) {
+  return std::max(1, (ms + frame_ms - 1) / frame_ms);
+}
+}  // namespace
+
+VoiceActivityDetector::VoiceActivityDetector(AudioSampleRate sample_rate,
+                                             const VoiceActivityConfig& config,
+                                             void* ctx, EventCallback fn)
+    : config_(config),
+      ctx_(ctx),
+      fn_(fn),
+      frame_size_(MsToSamples(sample_rate, config.frame_ms)),
+      start_frames_(MsToFrames(config.start_ms, config.frame_ms)),
+      hangover_frames_(MsToFrames(config.hangover_ms, config.frame_ms)),
+      pre_roll_(std::max(1, MsToSamples(sample_rate, config.pre_roll_ms))),
+      frame_(frame_size_) {
+  CHECK(frame_size_ > 0);
+}
+
+void VoiceActivityDetector::Reset() {
+  frame_pos_ = 0;
+  noise_floor_ = 0;
+  run_frames_ = 0;
+  active_ = false;
+}
+
+void VoiceActivityDetector::Process(const int32_t* samples,
+                                    size_t num_samples) {
+  while (num_samples > 0) {
+    const size_t count =
+        std::min(num_samples, static_cast<size_t>(frame_size_) - frame_pos_);
+    // Only idle audio is kept as pre-roll, so a start event always sees the
+    // audio that led up to it.
+    if (!active_) pre_roll_.Append(samples, count);
+    for (size_t i = 0; i < count; ++i)
+      frame_[frame_pos_ + i] = static_cast<int16_t>(samples[i] >> 16);
+    frame_pos_ += count;
+    samples += count;
+    num_samples -= count;
+
+    if (frame_pos_ == static_cast<size_t>(frame_size_)) {
+      ProcessFrame();
+      frame_pos_ = 0;
+    }
+  }
+}
+
+bool VoiceActivityDetector::FrameIsActive(const int16_t* frame, size_t size) {
+  uint64_t sum_squares = 0;
+  int zero_crossings = 0;
+  for (size_t i = 0; i < size; ++i) {
+    const int32_t s = frame[i];
+    sum_squares += static_cast<uint64_t>(s * s);
+    if (i > 0 && ((frame[i - 1] < 0) != (s < 0))) ++zero_crossings;
+  }
+  const auto energy = static_cast<uint32_t>(sum_squares / size);
+  const int zcr = static_cast<int>(zero_crossings * 1000 / size);
+
+  // The first frame seeds the noise floor and is never active.
+  if (noise_floor_ == 0) {
+    noise_floor_ = std::max<uint32_t>(energy, 1);
+    return false;
+  }
+
+  const bool loud =
+      energy >= config_.min_energy &&
+      static_cast<uint64_t>(energy) >=
+          static_cast<uint64_t>(noise_floor_) * config_.noise_floor_ratio;
+  const bool active = loud && zcr >= config_.min_zcr && zcr <= config_.max_zcr;
+
+  const int64_t delta = static_cast<int64_t>(energy) - noise_floor_;
+  noise_floor_ = std::max<int64_t>(
+      1, noise_floor_ +
+             (delta >> (loud ? kLoudNoiseFloorShift : kNoiseFloorShift)));
+  return active;
+}
+
+void VoiceActivityDetector::ProcessFrame() {
+  ++frame_count_;
+  const bool frame_active = FrameIsActive(frame_.data(), frame_.size());
+
+  if (!active_) {
+    run_frames_ = frame_active ? run_frames_ + 1 : 0;
+    if (run_frames_ >= start_frames_) {
+      active_ = true;
+      run_frames_ = 0;
+      ++detection_count_;
+      if (fn_) fn_(ctx_, VoiceActivityEvent::kStart, pre_roll_);
+    }
+    return;
+  }
+
+  ++active_frame_count_;
+  run_frames_ = frame_active ? 0 : run_frames_ + 1;
+  if (run_frames_ >= hangover_frames_) {
+    active_ = false;
+    run_frames_ = 0;
+    if (fn_) fn_(ctx_, VoiceActivityEvent::kStop, pre_roll_);
+  }
+}
+
+}  // namespace coralmicro
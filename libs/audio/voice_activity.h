@@ -0,0 +1,189 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_AUDIO_VOICE_ACTIVITY_H_
+#define LIBS_AUDIO_VOICE_ACTIVITY_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "libs/audio/audio_driver.h"
+#include "libs/audio/audio_service.h"
+
+namespace coralmicro {
+
+// Tunable thresholds for `VoiceActivityDetector`.
+//
+// The detector splits incoming audio into short frames and marks a frame as
+// active when its energy is well above the tracked noise floor and its
+// zero-crossing rate is inside the expected range for speech or sound events.
+struct VoiceActivityConfig {
+  // Length in milliseconds of each analysis frame.
+  int frame_ms = 10;
+  // Minimum mean-square energy (of 16-bit samples) for a frame to be active,
+  // regardless of the noise floor.
+  uint32_t min_energy = 2000;
+  // A frame is active when its energy exceeds the noise floor by this factor.
+  int noise_floor_ratio = 4;
+  // Zero crossings per 1000 samples. Frames outside `[min_zcr, max_zcr]` are
+  // treated as inactive (DC offsets and broadband hiss respectively).
+  int min_zcr = 5;
+  int max_zcr = 500;
+  // Consecutive active time in milliseconds before a start event is raised.
+  int start_ms = 30;
+  // Inactive time in milliseconds after which a stop event is raised.
+  int hangover_ms = 300;
+  // Amount of audio in milliseconds kept from before the start event.
+  int pre_roll_ms = 300;
+};
+
+// Events raised by `VoiceActivityDetector`.
+enum class VoiceActivityEvent {
+  // Speech or sound was detected after a period of silence.
+  kStart,
+  // Audio has been silent for `VoiceActivityConfig::hangover_ms`.
+  kStop,
+};
+
+// Provides a cheap energy and zero-crossing voice activity detector (VAD) that
+// gates downstream inference on silence.
+//
+// The detector is fed from an `AudioService` callback (it does not register
+// itself). Every time speech or sound starts or stops it calls the event
+// callback given to the constructor. On a start event, the callback also
+// receives the `LatestSamples` that hold the most recent
+// `VoiceActivityConfig::pre_roll_ms` of audio, so the beginning of the
+// utterance isn't lost. Other tasks can instead poll `Active()` and skip
+// running models while it returns false.
+//
+// For example:
+//
+// ```
+// AudioService* service = ...
+//
+// VoiceActivityDetector vad(service->Config().sample_rate,
+//                           VoiceActivityConfig{}, nullptr, nullptr);
+// service->AddCallback(
+//     &vad, +[](void* ctx, const int32_t* samples, size_t num_samples) {
+//         static_cast<VoiceActivityDetector*>(ctx)->Process(samples,
+//                                                           num_samples);
+//         return true;
+//     });
+//
+// while (true) {
+//     if (vad.Active()) RunModel();
+//     vTaskDelay(pdMS_TO_TICKS(100));
+// }
+// ```
+class VoiceActivityDetector {
+ public:
+  // The function type that receives start and stop events.
+  //
+  // This is called from the `AudioService` task, so it must return quickly.
+  //
+  // @param ctx Extra parameters, defined with the constructor.
+  // @param event The type of event.
+  // @param pre_roll The latest `VoiceActivityConfig::pre_roll_ms` of audio.
+  using EventCallback = void (*)(void* ctx, VoiceActivityEvent event,
+                                 const LatestSamples& pre_roll);
+
+  // Constructor.
+  //
+  // @param sample_rate The sample rate of the audio passed to `Process()`.
+  // @param config The detection thresholds.
+  // @param ctx Extra parameters to pass through to the event callback.
+  // @param fn The function to receive start and stop events, or nullptr.
+  VoiceActivityDetector(AudioSampleRate sample_rate,
+                        const VoiceActivityConfig& config, void* ctx,
+                        EventCallback fn);
+  // @cond
+  VoiceActivityDetector(const VoiceActivityDetector&) = delete;
+  VoiceActivityDetector& operator=(const VoiceActivityDetector&) = delete;
+  // @endcond
+
+  // Runs the detector on new audio samples.
+  //
+  // Call this from an `AudioService` callback with the samples it receives.
+  //
+  // @param samples A pointer to the buffer of 32-bit audio samples.
+  // @param num_samples The number of audio samples in the buffer.
+  void Process(const int32_t* samples, size_t num_samples);
+
+  // Resets the detector to silence and clears the noise floor estimate.
+  void Reset();
+
+  // Checks whether speech or sound is currently present.
+  //
+  // @return True between a start event and the following stop event.
+  bool Active() const { return active_; }
+
+  // Gets the number of start events raised since construction.
+  //
+  // @return The number of detections.
+  int DetectionCount() const { return detection_count_; }
+
+  // Gets the number of analysis frames processed since construction.
+  //
+  // @return The number of frames.
+  int FrameCount() const { return frame_count_; }
+
+  // Gets the number of analysis frames that were processed while active.
+  //
+  // Together with `FrameCount()` this gives the inference duty cycle.
+  //
+  // @return The number of active frames.
+  int ActiveFrameCount() const { return active_frame_count_; }
+
+  // Gets the current noise floor estimate.
+  //
+  // The floor follows quiet frames quickly and rises slowly during loud
+  // ones, so it adapts when the ambient noise level goes up.
+  //
+  // @return The estimated mean-square energy of background noise.
+  uint32_t NoiseFloor() const { return noise_floor_; }
+
+  // Gets the audio kept from before the latest start event.
+  //
+  // @return The pre-roll samples.
+  const LatestSamples& PreRoll() const { return pre_roll_; }
+
+ private:
+  bool FrameIsActive(const int16_t* frame, size_t size);
+  void ProcessFrame();
+
+  VoiceActivityConfig config_;
+  void* ctx_;
+  EventCallback fn_;
+  int frame_size_;
+  int start_frames_;
+  int hangover_frames_;
+
+  LatestSamples pre_roll_;
+  std::vector<int16_t> frame_;
+  size_t frame_pos_ = 0;
+
+  uint32_t noise_floor_ = 0;
+  int run_frames_ = 0;
+  volatile bool active_ = false;
+
+  volatile int detection_count_ = 0;
+  volatile int frame_count_ = 0;
+  volatile int active_frame_count_ = 0;
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_AUDIO_VOICE_ACTIVITY_H_
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/base/boot_sequence.h"
+
+#include <cstdio>
+#include <utility>
+
+#include "libs/base/check.h"
+#include "libs/base/timer.h"
+#include "third_party/freertos_kernel/include/task.h"
+
+namespace coralmicro {
+namespace {
+const char* StatusName(BootStageStatus status) {
+  switch (status) {
+    case BootStageStatus::kPending:
+      return "pending";
+    case BootStageStatus::kRunning:
+      return "running";
+    case BootStageStatus::kSucceeded:
+      return "ok";
+    case BootStageStatus::kFailed:
+      return "FAILED";
+    case BootStageStatus::kSkipped:
+      return "skipped";
+  }
+  return "unknown";
+}
+
+uint32_t ToMillis(uint64_t us) { return static_cast<uint32_t>(us / 1000); }
+}  // namespace
+
+BootSequence::BootSequence()
+    : done_(xEventGroupCreateStatic(&done_storage_)) {
+  CHECK(done_);
+}
+
+BootSequence::~BootSequence() { vEventGroupDelete(done_); }
+
+BootSequence::StageId BootSequence::AddStage(
+    const char* name, StageFn fn, std::initializer_list<StageId> deps,
+    uint32_t stack_depth, UBaseType_t priority) {
+  CHECK(!started_);
+  CHECK(num_stages_ < kMaxStages);
+  const StageId id = num_stages_++;
+
+  auto& stage = stages_[id];
+  stage.sequence = this;
+  stage.info = {name, BootStageStatus::kPending, 0, 0};
+  stage.fn = std::move(fn);
+  stage.bit = 1u << id;
+  stage.deps = 0;
+  for (StageId dep : deps) {
+    CHECK(0 <= dep && dep < id);
+    stage.deps |= stages_[dep].bit;
+  }
+  stage.stack_depth = stack_depth;
+  stage.priority = priority;
+  return id;
+}
+
+void BootSequence::Start() {
+  CHECK(!started_);
+  started_ = true;
+  for (int i = 0; i < num_stages_; ++i) {
+    auto& stage = stages_[i];
+    CHECK(xTaskCreate(StageTask, stage.info.name, stage.stack_depth, &stage,
+                      stage.priority, nullptr) == pdPASS);
+  }
+}
+
+void BootSequence::StageTask(void* param) {
+  auto* stage = static_cast<Stage*>(param);
+  stage->sequence->RunStage(stage);
+  vTaskDelete(nullptr);
+}
+
+bool BootSequence::DepsSucceeded(EventBits_t deps) const {
+  for (int i = 0; i < num_stages_; ++i) {
+    if ((deps & stages_[i].bit) &&
+        stages_[i].info.status != BootStageStatus::kSucceeded)
+      return false;
+  }
+  return true;
+}
+
+void BootSequence::RunStage(Stage* stage) {
+  if (stage->deps)
+    xEventGroupWaitBits(done_, stage->deps, pdFALSE, pdTRUE, portMAX_DELAY);
+
+  stage->info.start_us = TimerMicros();
+  if (DepsSucceeded(stage->deps)) {
+    stage->info.status = BootStageStatus::kRunning;
+    const bool ok = stage->fn();
+    stage->info.status =
+        ok ? BootStageStatus::kSucceeded : BootStageStatus::kFailed;
+  } else {
+    stage->info.status = BootStageStatus::kSkipped;
+  }
+  stage->info.end_us = TimerMicros();
+  // Setting the bit publishes the result to waiting tasks.
+  xEventGroupSetBits(done_, stage->bit);
+}
+
+bool BootSequence::Wait(StageId stage, TickType_t timeout) {
+  CHECK(started_);
+  CHECK(0 <= stage && stage < num_stages_);
+  const EventBits_t bit = stages_[stage].bit;
+  if (!(xEventGroupWaitBits(done_, bit, pdFALSE, pdTRUE, timeout) & bit))
+    return false;
+  return stages_[stage].info.status == BootStageStatus::kSucceeded;
+}
+
+bool BootSequence::WaitAll(TickType_t timeout) {
+  CHECK(started_);
+  if (num_stages_ == 0) return true;
+  const EventBits_t all = (1u << num_stages_) - 1;
+  if ((xEventGroupWaitBits(done_, all, pdFALSE, pdTRUE, timeout) & all) != all)
+    return false;
+  return DepsSucceeded(all);
+}
+
+BootStageInfo BootSequence::GetStageInfo(StageId stage) const {
+  CHECK(0 <= stage && stage < num_stages_);
+  return stages_[stage].info;
+}
+
+void BootSequence::PrintTimeline() const {
+  printf("Boot timeline (ms since power-on):\r\n");
+  printf("  %-16s %8s %8s %8s\r\n", "stage", "start", "end", "time");
+  for (int i = 0; i < num_stages_; ++i) {
+    const auto& info = stages_[i].info;
+    if (info.status == BootStageStatus::kPending ||
+        info.status == BootStageStatus::kRunning) {
+      printf("  %-16s %8s %8s %8s %s\r\n", info.name, "-", "-", "-",
+             StatusName(info.status));
+      continue;
+    }
+    printf("  %-16s %8lu %8lu %8lu %s\r\n", info.name, ToMillis(info.start_us),
+           ToMillis(info.end_us), ToMillis(info.end_us - info.start_us),
+           StatusName(info.status));
+  }
+}
+
+}  // namespace coralmicro
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_BASE_BOOT_SEQUENCE_H_
+#define LIBS_BASE_BOOT_SEQUENCE_H_
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+
+#include "libs/base/tasks.h"
+#include "third_party/freertos_kernel/include/FreeRTOS.h"
+#include "third_party/freertos_kernel/include/event_groups.h"
+
+namespace coralmicro {
+
+// The state of a `BootSequence` stage.
+enum class BootStageStatus {
+  // Waiting for its dependencies, or not started.
+  kPending,
+  // Running.
+  kRunning,
+  // Finished and returned true.
+  kSucceeded,
+  // Finished and returned false.
+  kFailed,
+  // Not run because a dependency failed or was skipped.
+  kSkipped,
+};
+
+// Timing of one `BootSequence` stage.
+struct BootStageInfo {
+  // The stage name.
+  const char* name;
+  // The stage state.
+  BootStageStatus status;
+  // When the stage started running, from `TimerMicros()`.
+  uint64_t start_us;
+  // When the stage finished, from `TimerMicros()`.
+  uint64_t end_us;
+};
+
+// Brings up subsystems concurrently, each in its own task, in the order
+// allowed by their dependencies.
+//
+// Startup code that opens the Edge TPU, reads a model, powers the camera, and
+// waits for DHCP one step after another spends most of its time waiting on
+// hardware. Instead, add each step as a stage that names the stages it
+// needs, then start them all at once. Each stage runs as soon as its
+// dependencies succeed, and `PrintTimeline()` shows when each stage ran,
+// measured from power-on.
+//
+// For example:
+//
+// ```
+// std::vector<uint8_t> model;
+// std::shared_ptr<EdgeTpuContext> tpu_context;
+//
+// BootSequence boot;
+// auto load_model = boot.AddStage(
+//     "model", [&model] { return LfsReadFile(kModelPath, &model); });
+// auto open_tpu = boot.AddStage("tpu", [&tpu_context] {
+//   tpu_context = EdgeTpuManager::GetSingleton()->OpenDevice();
+//   return tpu_context != nullptr;
+// });
+// boot.AddStage("camera", [] {
+//   return CameraTask::GetSingleton()->SetPower(true) &&
+//          CameraTask::GetSingleton()->Enable(CameraMode::kTrigger);
+// });
+// boot.AddStage("ethernet", [] { return EthernetInit(true); });
+// boot.Start();
+//
+// if (!boot.Wait(load_model) || !boot.Wait(open_tpu)) { ... }
+// // The interpreter can run while the camera and network come up.
+// ...
+// boot.WaitAll();
+// boot.PrintTimeline();
+// ```
+//
+// A `BootSequence` must outlive its stages, so call `WaitAll()` before it's
+// destroyed.
+class BootSequence {
+ public:
+  // A stage function. Returns true on success.
+  using StageFn = std::function<bool()>;
+  // Identifies a stage, returned by `AddStage()`.
+  using StageId = int;
+
+  // Most stages in one sequence.
+  static constexpr int kMaxStages = 16;
+
+  BootSequence();
+  ~BootSequence();
+  BootSequence(const BootSequence&) = delete;
+  BootSequence& operator=(const BootSequence&) = delete;
+
+  // Adds a stage. Call this before `Start()`.
+  //
+  // @param name The stage name, also used for its task. Must outlive the
+  // sequence.
+  // @param fn The function to run.
+  // @param deps Stages that must succeed before this one starts. Only stages
+  // added earlier can be named, so there are no cycles.
+  // @param stack_depth The stack size of the stage's task, in words.
+  // @param priority The priority of the stage's task.
+  // @return The stage ID.
+  StageId AddStage(const char* name, StageFn fn,
+                   std::initializer_list<StageId> deps = {},
+                   uint32_t stack_depth = configMINIMAL_STACK_SIZE * 10,
+                   UBaseType_t priority = kAppTaskPriority);
+
+  // Starts a task for every stage and returns immediately.
+  void Start();
+
+  // Waits for a stage to finish.
+  //
+  // @param stage The stage ID.
+  // @param timeout The most ticks to wait.
+  // @return True if the stage succeeded, false if it failed, was skipped, or
+  // didn't finish in time.
+  bool Wait(StageId stage, TickType_t timeout = portMAX_DELAY);
+
+  // Waits for all stages to finish.
+  //
+  // @param timeout The most ticks to wait.
+  // @return True if every stage succeeded.
+  bool WaitAll(TickType_t timeout = portMAX_DELAY);
+
+  // Gets the state and timing of a stage.
+  //
+  // @param stage The stage ID.
+  // @return The stage info.
+  BootStageInfo GetStageInfo(StageId stage) const;
+
+  // Prints when each stage started and finished, in milliseconds since
+  // power-on, and how long it took.
+  void PrintTimeline() const;
+
+ private:
+  struct Stage {
+    BootSequence* sequence;
+    BootStageInfo info;
+    StageFn fn;
+    // The bit of this stage in `done_`.
+    EventBits_t bit;
+    // The bits of the stages this one depends on.
+    EventBits_t deps;
+    uint32_t stack_depth;
+    UBaseType_t priority;
+  };
+
+  static void StageTask(void* param);
+  void RunStage(Stage* stage);
+  bool DepsSucceeded(EventBits_t deps) const;
+
+  std::array<Stage, kMaxStages> stages_;
+  int num_stages_ = 0;
+  bool started_ = false;
+  // Bit N is set once stage N finishes, whatever the result.
+  EventGroupHandle_t done_;
+  StaticEventGroup_t done_storage_;
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_BASE_BOOT_SEQUENCE_H_
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/base/buffer_pool.h"
+
+#include "libs/base/check.h"
+#include "libs/base/mutex.h"
+
+namespace coralmicro {
+namespace {
+// Buffers start on cache line boundaries so DMA and cache maintenance on one
+// buffer never touch its neighbors.
+constexpr size_t kBufferAlignment = 32;
+
+size_t AlignUp(size_t n) {
+  return (n + kBufferAlignment - 1) & ~(kBufferAlignment - 1);
+}
+}  // namespace
+
+BufferPool::BufferPool(size_t num_buffers, size_t buffer_size)
+    : buffer_size_(buffer_size),
+      storage_(num_buffers * AlignUp(buffer_size) + kBufferAlignment),
+      buffers_(num_buffers),
+      free_buffers_(xQueueCreate(num_buffers, sizeof(Buffer*))),
+      mutex_(xSemaphoreCreateMutex()) {
+  CHECK(num_buffers > 0);
+  CHECK(free_buffers_);
+  CHECK(mutex_);
+
+  auto* data = reinterpret_cast<uint8_t*>(
+      AlignUp(reinterpret_cast<uintptr_t>(storage_.data())));
+  for (auto& buffer : buffers_) {
+    buffer = {this, data, 0, 0};
+    Buffer* p = &buffer;
+    CHECK(xQueueSend(free_buffers_, &p, 0) == pdTRUE);
+    data += AlignUp(buffer_size);
+  }
+}
+
+BufferPool::~BufferPool() {
+  CHECK(uxQueueMessagesWaiting(free_buffers_) == buffers_.size());
+  vQueueDelete(free_buffers_);
+  vSemaphoreDelete(mutex_);
+}
+
+BufferPool::Handle BufferPool::Acquire(int timeout_ms) {
+  Buffer* buffer;
+  if (xQueueReceive(free_buffers_, &buffer, pdMS_TO_TICKS(timeout_ms)) !=
+      pdTRUE) {
+    ++acquire_failures_;
+    return Handle();
+  }
+
+  MutexLock lock(mutex_);
+  buffer->size = 0;
+  buffer->refs = 1;
+  if (++in_use_ > max_in_use_) max_in_use_ = in_use_;
+  return Handle(buffer);
+}
+
+size_t BufferPool::NumFree() const {
+  return uxQueueMessagesWaiting(free_buffers_);
+}
+
+BufferPoolStats BufferPool::GetStats() const {
+  return {max_size_, oversize_count_, max_in_use_, acquire_failures_};
+}
+
+void BufferPool::AddRef(Buffer* buffer) {
+  MutexLock lock(mutex_);
+  CHECK(buffer->refs > 0);
+  ++buffer->refs;
+}
+
+void BufferPool::Unref(Buffer* buffer) {
+  {
+    MutexLock lock(mutex_);
+    CHECK(buffer->refs > 0);
+    if (--buffer->refs > 0) return;
+    --in_use_;
+  }
+  CHECK(xQueueSend(free_buffers_, &buffer, 0) == pdTRUE);
+}
+
+BufferPool::Handle::Handle(const Handle& other) : buffer_(other.buffer_) {
+  if (buffer_) buffer_->pool->AddRef(buffer_);
+}
+
+BufferPool::Handle& BufferPool::Handle::operator=(const Handle& other) {
+  if (this != &other) {
+    if (other.buffer_) other.buffer_->pool->AddRef(other.buffer_);
+    Reset();
+    buffer_ = other.buffer_;
+  }
+  return *this;
+}
+
+BufferPool::Handle::Handle(Handle&& other) noexcept : buffer_(other.buffer_) {
+  other.buffer_ = nullptr;
+}
+
+BufferPool::Handle& BufferPool::Handle::operator=(Handle&& other) noexcept {
+  if (this != &other) {
+    Reset();
+    buffer_ = other.buffer_;
+    other.buffer_ = nullptr;
+  }
+  return *this;
+}
+
+BufferPool::Handle::~Handle() { Reset(); }
+
+uint8_t* BufferPool::Handle::Data() const {
+  return buffer_ ? buffer_->data : nullptr;
+}
+
+size_t BufferPool::Handle::Size() const { return buffer_ ? buffer_->size : 0; }
+
+size_t BufferPool::Handle::Capacity() const {
+  return buffer_ ? buffer_->pool->buffer_size_ : 0;
+}
+
+bool BufferPool::Handle::SetSize(size_t size) {
+  if (!buffer_) return false;
+  auto* pool = buffer_->pool;
+  if (size > pool->max_size_) pool->max_size_ = size;
+  if (size > pool->buffer_size_) {
+    ++pool->oversize_count_;
+    return false;
+  }
+  buffer_->size = size;
+  return true;
+}
+
+void BufferPool::Handle::Reset() {
+  if (buffer_) {
+    buffer_->pool->Unref(buffer_);
+    buffer_ = nullptr;
+  }
+}
+
+BufferPool::Buffer* BufferPool::Handle::Release() {
+  auto* buffer = buffer_;
+  buffer_ = nullptr;
+  return buffer;
+}
+
+BufferPool::Handle BufferPool::Handle::Adopt(Buffer* buffer) {
+  return Handle(buffer);
+}
+
+}  // namespace coralmicro
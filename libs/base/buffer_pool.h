@@ -0,0 +1,197 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_BASE_BUFFER_POOL_H_
+#define LIBS_BASE_BUFFER_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "third_party/freertos_kernel/include/FreeRTOS.h"
+#include "third_party/freertos_kernel/include/queue.h"
+#include "third_party/freertos_kernel/include/semphr.h"
+
+namespace coralmicro {
+
+// Usage statistics reported by `BufferPool`.
+struct BufferPoolStats {
+  // Largest size ever passed to `BufferPool::Handle::SetSize()`, including
+  // sizes that didn't fit. Use this to choose the buffer size of the pool.
+  size_t max_size;
+  // Number of times `BufferPool::Handle::SetSize()` was called with a size
+  // larger than the buffers.
+  int oversize_count;
+  // Most buffers that were in use at once.
+  int max_in_use;
+  // Number of times `BufferPool::Acquire()` timed out.
+  int acquire_failures;
+};
+
+// Provides a fixed set of equally sized buffers with reference-counted
+// handles.
+//
+// All memory is allocated by the constructor. A buffer returns to the pool
+// when the last `BufferPool::Handle` that refers to it is destroyed, so one
+// encoded frame can be handed to the HTTP server, an RPC response, and a
+// recorder at the same time without being copied or reallocated.
+//
+// For example, to encode camera frames with `JpegEncoder`:
+//
+// ```
+// BufferPool pool(/*num_buffers=*/3, /*buffer_size=*/64 * 1024);
+//
+// BufferPool::Handle jpeg = pool.Acquire(/*timeout_ms=*/100);
+// if (jpeg) {
+//   encoder.Encode(rgb, width, height, JpegPixelFormat::kRgb,
+//                  /*quality=*/75, jpeg.Data(), jpeg.Capacity());
+//   // A frame that didn't fit is counted in `BufferPoolStats`.
+//   jpeg.SetSize(encoder.RequiredSize());
+// }
+// ```
+//
+// Handles can be used from any task. The pool must outlive all of its handles.
+class BufferPool {
+ public:
+  // @cond
+  struct Buffer;
+  // @endcond
+
+  // A shared reference to a buffer from a `BufferPool`.
+  //
+  // Copying a handle shares the buffer; the buffer goes back to the pool when
+  // the last copy is destroyed or reset. A default-constructed handle is empty.
+  class Handle {
+   public:
+    Handle() = default;
+    // @cond
+    Handle(const Handle& other);
+    Handle& operator=(const Handle& other);
+    Handle(Handle&& other) noexcept;
+    Handle& operator=(Handle&& other) noexcept;
+    ~Handle();
+    // @endcond
+
+    // Gets the buffer memory.
+    //
+    // @return A pointer to the buffer, or nullptr if the handle is empty.
+    uint8_t* Data() const;
+
+    // Gets the number of valid bytes in the buffer.
+    //
+    // @return The size set with `SetSize()`, initially 0.
+    size_t Size() const;
+
+    // Gets the size of the buffer memory.
+    //
+    // @return The buffer size of the pool, or 0 if the handle is empty.
+    size_t Capacity() const;
+
+    // Sets the number of valid bytes in the buffer.
+    //
+    // The size is shared by all copies of the handle and is recorded in the
+    // pool's `BufferPoolStats::max_size`, even if it is too large, so pass the
+    // size the data needed rather than 0 when it didn't fit.
+    //
+    // @param size The number of valid bytes.
+    // @return True on success, false if the handle is empty or `size` is
+    // larger than `Capacity()`.
+    bool SetSize(size_t size);
+
+    // Releases this reference to the buffer and makes the handle empty.
+    void Reset();
+
+    // Checks whether the handle refers to a buffer.
+    //
+    // @return True if the handle is not empty.
+    explicit operator bool() const { return buffer_ != nullptr; }
+
+    // @cond
+    // Transfers this reference to the caller as an opaque pointer, for APIs
+    // that can only store a `void*`. Pass it to `Adopt()` to release it.
+    Buffer* Release();
+    static Handle Adopt(Buffer* buffer);
+    // @endcond
+
+   private:
+    friend class BufferPool;
+    explicit Handle(Buffer* buffer) : buffer_(buffer) {}
+
+    Buffer* buffer_ = nullptr;
+  };
+
+  // Constructor.
+  //
+  // @param num_buffers The number of buffers in the pool.
+  // @param buffer_size The size in bytes of each buffer.
+  BufferPool(size_t num_buffers, size_t buffer_size);
+  // @cond
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+  ~BufferPool();
+  // @endcond
+
+  // Gets a free buffer.
+  //
+  // @param timeout_ms Maximum time to wait for a buffer, in milliseconds.
+  // @return A handle to a buffer with a size of 0, or an empty handle if no
+  // buffer became free in time.
+  Handle Acquire(int timeout_ms = 0);
+
+  // Gets the size of each buffer.
+  //
+  // @return The buffer size in bytes.
+  size_t BufferSize() const { return buffer_size_; }
+
+  // Gets the number of buffers that aren't in use.
+  //
+  // @return The number of free buffers.
+  size_t NumFree() const;
+
+  // Gets the usage statistics.
+  //
+  // @return A snapshot of the counters.
+  BufferPoolStats GetStats() const;
+
+ private:
+  void AddRef(Buffer* buffer);
+  void Unref(Buffer* buffer);
+
+  size_t buffer_size_;
+  std::vector<uint8_t> storage_;
+  std::vector<Buffer> buffers_;
+  QueueHandle_t free_buffers_;
+  SemaphoreHandle_t mutex_;
+
+  int in_use_ = 0;  // protected by mutex_
+  volatile size_t max_size_ = 0;
+  volatile int oversize_count_ = 0;
+  volatile int max_in_use_ = 0;
+  volatile int acquire_failures_ = 0;
+};
+
+// @cond
+struct alignas(8) BufferPool::Buffer {
+  BufferPool* pool;
+  uint8_t* data;
+  size_t size;
+  int refs;  // protected by pool->mutex_
+};
+// @endcond
+
+}  // namespace coralmicro
+
+#endif  // LIBS_BASE_BUFFER_POOL_H_
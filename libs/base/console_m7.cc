@@ -18,7 +18,9 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include <functional>
 
 #include "libs/base/check.h"
@@ -27,6 +29,8 @@
 #include "libs/base/mutex.h"
 #include "libs/base/tasks.h"
 #include "libs/usb/usb_device_task.h"
+#include "third_party/freertos_kernel/include/task.h"
+#include "third_party/nxp/rt1176-sdk/devices/MIMXRT1176/drivers/fsl_common.h"
 #include "third_party/nxp/rt1176-sdk/devices/MIMXRT1176/utilities/debug_console/fsl_debug_console.h"
 
 using namespace std::placeholders;
@@ -69,23 +73,39 @@ void ConsoleM7::EmergencyWrite(const char* fmt, ...) {
   cdc_acm_.Transmit(reinterpret_cast<uint8_t*>(emergency_buffer_.data()), len);
 }
 
+void ConsoleM7::NotifyTx() {
+  // If IPSR is non-zero, we are in an interrupt.
+  if (__get_IPSR() != 0) {
+    BaseType_t reschedule = pdFALSE;
+    vTaskNotifyGiveFromISR(tx_task_, &reschedule);
+    portYIELD_FROM_ISR(reschedule);
+  } else {
+    xTaskNotifyGive(tx_task_);
+  }
+}
+
 void ConsoleM7::Write(char* buffer, int size) {
   if (!tx_task_) {
     return;
   }
-  ConsoleMessage msg = {
-      size,
-      new uint8_t[size],
-  };
+  // Split large writes so each record fits in the ring.
+  for (int offset = 0; offset < size;) {
+    const int len =
+        std::min(size - offset, static_cast<int>(log_ring_.max_record_size()));
+    LogRing::Span span;
 #ifdef BLOCKING_PRINTF
-  msg.semaphore = xSemaphoreCreateBinaryStatic(&msg.semaphore_storage);
+    while (!log_ring_.TryReserve(len, &span)) vTaskDelay(1);
+#else
+    if (!log_ring_.Reserve(len, &span)) return;
 #endif
-  memcpy(msg.str, buffer, size);
-  xQueueSend(console_queue_, &msg, portMAX_DELAY);
+    memcpy(span.data, buffer + offset, len);
+    log_ring_.Commit(span);
+    NotifyTx();
+    offset += len;
 #ifdef BLOCKING_PRINTF
-  xSemaphoreTake(msg.semaphore, portMAX_DELAY);
-  vSemaphoreDelete(msg.semaphore);
+    while (static_cast<int32_t>(tx_position_ - span.end) < 0) vTaskDelay(1);
 #endif
+  }
 }
 
 int ConsoleM7::Read(char* buffer, int size) {
@@ -117,6 +137,27 @@ int ConsoleM7::Read(char* buffer, int size) {
   return bytes_to_return;
 }
 
+void ConsoleM7::ForwardM4Output(const char* data, size_t size) {
+  // Each line becomes one record, so it is prefixed without a staging copy.
+  const size_t max_piece = log_ring_.max_record_size() - kM4LinePrefixSize;
+  while (size > 0) {
+    const auto* newline = static_cast<const char*>(memchr(data, '\n', size));
+    const size_t piece =
+        std::min(newline ? newline - data + 1 : size, max_piece);
+    const size_t prefix = m4_line_start_ ? kM4LinePrefixSize : 0;
+
+    LogRing::Span span;
+    if (log_ring_.Reserve(prefix + piece, &span)) {
+      memcpy(span.data, kM4LinePrefix, prefix);
+      memcpy(span.data + prefix, data, piece);
+      log_ring_.Commit(span);
+    }
+    m4_line_start_ = data[piece - 1] == '\n';
+    data += piece;
+    size -= piece;
+  }
+}
+
 void ConsoleM7::M4ConsoleTaskFn(void* param) {
   IpcMessage m4_console_buffer_msg;
   m4_console_buffer_msg.type = IpcMessageType::kSystem;
@@ -126,14 +167,17 @@ void ConsoleM7::M4ConsoleTaskFn(void* param) {
       GetM4ConsoleBufferPtr();
   IpcM7::GetSingleton()->SendMessage(m4_console_buffer_msg);
 
-  size_t rx_bytes;
-  char buf[16];
+  char buf[kM4ReadSize];
   while (true) {
-    rx_bytes = xStreamBufferReceive(m4_console_buffer_->stream_buffer, buf,
-                                    sizeof(buf), pdMS_TO_TICKS(10));
-    if (rx_bytes > 0) {
-      fwrite(buf, 1, rx_bytes, stdout);
-    }
+    // The M4 raises an MCMGR event each time it writes to the stream buffer,
+    // which wakes this task, so there's no need to poll.
+    size_t rx_bytes = xStreamBufferReceive(m4_console_buffer_->stream_buffer,
+                                           buf, sizeof(buf), portMAX_DELAY);
+    if (rx_bytes == 0) continue;
+    // Goes straight into the log ring rather than through stdout, so M4
+    // output doesn't take the M7's stdio lock.
+    ForwardM4Output(buf, rx_bytes);
+    if (tx_task_) NotifyTx();
   }
 }
 
@@ -159,14 +203,14 @@ void ConsoleM7::M7ConsoleTaskRxFn(void* param) {
 
 void ConsoleM7::M7ConsoleTaskTxFn(void* param) {
   while (true) {
-    ConsoleMessage msg;
-    if (xQueueReceive(console_queue_, &msg, portMAX_DELAY) == pdTRUE) {
-      DbgConsole_SendDataReliable(msg.str, msg.len);
-      cdc_acm_.Transmit(msg.str, msg.len);
-      delete[] msg.str;
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    size_t len;
+    while ((len = log_ring_.Read(tx_batch_.data(), tx_batch_.size())) > 0) {
+      DbgConsole_SendDataReliable(tx_batch_.data(), len);
+      cdc_acm_.Transmit(tx_batch_.data(), len);
 #ifdef BLOCKING_PRINTF
       DbgConsole_Flush();
-      xSemaphoreGive(msg.semaphore);
+      tx_position_ = log_ring_.ReadPosition();
 #endif
     }
   }
@@ -199,9 +243,6 @@ void ConsoleM7::Init(bool init_tx, bool init_rx) {
       std::bind(&coralmicro::CdcAcm::HandleEvent, &cdc_acm_, _1, _2),
       cdc_acm_.descriptor_data(), cdc_acm_.descriptor_data_size());
 
-  console_queue_ = xQueueCreate(16, sizeof(ConsoleMessage));
-  CHECK(console_queue_);
-
   rx_mutex_ = xSemaphoreCreateMutex();
   CHECK(rx_mutex_);
 
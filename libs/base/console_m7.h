@@ -20,6 +20,7 @@
 #include <array>
 
 #include "libs/base/ipc_message_buffer.h"
+#include "libs/base/log_ring.h"
 #include "libs/cdc_acm/cdc_acm.h"
 #include "third_party/freertos_kernel/include/FreeRTOS.h"
 
@@ -33,7 +34,13 @@ class ConsoleM7 {
   }
   void Init(bool init_tx, bool init_rx);
   IpcStreamBuffer* GetM4ConsoleBufferPtr();
+  // Queues console output for the TX task, which sends it to the debug UART
+  // and USB serial. Never allocates or blocks (unless built with
+  // BLOCKING_PRINTF); if the log ring is full the output is dropped and
+  // counted in `GetStats()`. Safe to call from interrupts.
   void Write(char* buffer, int size);
+  // Gets statistics for the console log ring, including dropped output.
+  LogRingStats GetStats() const { return log_ring_.GetStats(); }
   // NOTE: This reads from the internal buffer, not directly from a serial
   // device.
   int Read(char* buffer, int size);
@@ -45,19 +52,11 @@ class ConsoleM7 {
   void EmergencyWrite(const char* fmt, ...);
 
  private:
-  struct ConsoleMessage {
-    int len;
-    uint8_t* str;
-#ifdef BLOCKING_PRINTF
-    SemaphoreHandle_t semaphore;
-    StaticSemaphore_t semaphore_storage;
-#endif
-  };
-
   static void StaticM4ConsoleTaskFn(void* param) {
     GetSingleton()->M4ConsoleTaskFn(param);
   }
   void M4ConsoleTaskFn(void* param);
+  void ForwardM4Output(const char* data, size_t size);
 
   static void StaticM7ConsoleTaskTxFn(void* param) {
     GetSingleton()->M7ConsoleTaskTxFn(param);
@@ -73,11 +72,34 @@ class ConsoleM7 {
   ConsoleM7(const ConsoleM7&) = delete;
   ConsoleM7& operator=(const ConsoleM7&) = delete;
 
-  QueueHandle_t console_queue_ = nullptr;
+  void NotifyTx();
+
+  // Output waiting for the TX task. Writers from any task or interrupt
+  // reserve and commit records without locks, and the TX task drains it in
+  // batches of up to `kTxBatchSize`.
+  static constexpr size_t kLogRingSize = 8192;
+  alignas(4) uint8_t log_ring_storage_[kLogRingSize];
+  LogRing log_ring_{log_ring_storage_, kLogRingSize};
+  // The most that `CdcAcm::Transmit()` sends at once.
+  static constexpr size_t kTxBatchSize = 512;
+  std::array<uint8_t, kTxBatchSize> tx_batch_;
+#ifdef BLOCKING_PRINTF
+  // Ring position up to which output has been sent.
+  volatile uint32_t tx_position_ = 0;
+#endif
   CdcAcm cdc_acm_;
 
   IpcStreamBuffer* m4_console_buffer_ = nullptr;
-  static constexpr size_t kM4ConsoleBufferBytes = 128;
+  // Large enough that an M4 logging burst rarely blocks the M4 while the M7
+  // drains it.
+  static constexpr size_t kM4ConsoleBufferBytes = 2048;
+  // Most bytes taken from the M4 console buffer at once.
+  static constexpr size_t kM4ReadSize = 512;
+  // Added to the start of each line of M4 output, to tell it apart from M7
+  // output.
+  static constexpr char kM4LinePrefix[] = "[M4] ";
+  static constexpr size_t kM4LinePrefixSize = sizeof(kM4LinePrefix) - 1;
+  bool m4_line_start_ = true;
   static constexpr size_t kM4ConsoleBufferSize =
       kM4ConsoleBufferBytes + sizeof(IpcStreamBuffer);
   static uint8_t m4_console_buffer_storage_[kM4ConsoleBufferSize];
@@ -90,7 +112,7 @@ class ConsoleM7 {
   size_t rx_buffer_read_ = 0, rx_buffer_write_ = 0, rx_buffer_available_ = 0;
   SemaphoreHandle_t rx_mutex_;
 
-  TaskHandle_t tx_task_, rx_task_;
+  TaskHandle_t tx_task_ = nullptr, rx_task_ = nullptr;
 };
 
 }  // namespace coralmicro
@@ -21,6 +21,8 @@
 #include <cstring>
 #include <memory>
 
+#include "libs/base/mutex.h"
+#include "libs/base/timer.h"
 #include "third_party/freertos_kernel/include/FreeRTOS.h"
 #include "third_party/freertos_kernel/include/semphr.h"
 #include "third_party/nxp/rt1176-sdk/components/flash/nand/fsl_nand_flash.h"
@@ -35,6 +37,8 @@ SemaphoreHandle_t g_lfs_mutex;
 
 constexpr int kPagesPerBlock = 64;
 constexpr int kFilesystemBaseBlock = 12;
+constexpr int kFilesystemBasePage = kFilesystemBaseBlock * kPagesPerBlock;
+constexpr int kBlockCount = 512;
 constexpr lfs_size_t kPageSize = 2048;
 
 struct AutoClose {
@@ -42,56 +46,39 @@ struct AutoClose {
   ~AutoClose() { lfs_file_close(&g_lfs, file); }
 };
 
-int LfsRead(const struct lfs_config* c, lfs_block_t block, lfs_off_t off,
-            void* buffer, lfs_size_t size) {
-  nand_handle_t* nand = BOARD_GetNANDHandle();
-  if (!nand) return LFS_ERR_IO;
-
-  auto* buf = reinterpret_cast<uint8_t*>(buffer);
-  while (size != 0) {
-    auto page_index = off / kPageSize;
-    auto read_size = std::min(kPageSize, size);
-    status_t status = Nand_Flash_Read_Page(
-        nand, (kFilesystemBaseBlock + block) * kPagesPerBlock + page_index, buf,
-        read_size);
-    if (status != kStatus_Success) return LFS_ERR_IO;
-
-    off += read_size;
-    buf += read_size;
-    size -= read_size;
+class NandFlash : public LfsFlash {
+ public:
+  bool ReadPage(uint32_t page, uint8_t* data, size_t size) override {
+    nand_handle_t* nand = BOARD_GetNANDHandle();
+    return nand &&
+           Nand_Flash_Read_Page(nand, kFilesystemBasePage + page, data,
+                                size) == kStatus_Success;
   }
-  return LFS_ERR_OK;
-}
 
-int LfsProg(const struct lfs_config* c, lfs_block_t block, lfs_off_t off,
-            const void* buffer, lfs_size_t size) {
-  nand_handle_t* nand = BOARD_GetNANDHandle();
-  if (!nand) return LFS_ERR_IO;
-
-  auto* buf = reinterpret_cast<const uint8_t*>(buffer);
-  while (size != 0) {
-    auto page_index = off / kPageSize;
-    auto write_size = std::min(kPageSize, size);
-    status_t status = Nand_Flash_Page_Program(
-        nand, (kFilesystemBaseBlock + block) * kPagesPerBlock + page_index, buf,
-        write_size);
-    if (status != kStatus_Success) return LFS_ERR_IO;
-
-    off += write_size;
-    buf += write_size;
-    size -= write_size;
+  bool ProgramPage(uint32_t page, const uint8_t* data, size_t size) override {
+    nand_handle_t* nand = BOARD_GetNANDHandle();
+    return nand &&
+           Nand_Flash_Page_Program(nand, kFilesystemBasePage + page, data,
+                                   size) == kStatus_Success;
   }
 
-  return LFS_ERR_OK;
-}
+  bool EraseBlock(uint32_t block) override {
+    nand_handle_t* nand = BOARD_GetNANDHandle();
+    return nand && Nand_Flash_Erase_Block(nand, kFilesystemBaseBlock +
+                                                    block) == kStatus_Success;
+  }
+};
 
-int LfsErase(const struct lfs_config* c, lfs_block_t block) {
-  nand_handle_t* nand = BOARD_GetNANDHandle();
-  if (!nand) return LFS_ERR_IO;
-  status_t status = Nand_Flash_Erase_Block(nand, kFilesystemBaseBlock + block);
-  if (status != kStatus_Success) return LFS_ERR_IO;
-  return LFS_ERR_OK;
-}
+NandFlash g_nand_flash;
+std::unique_ptr<LfsBlockDevice> g_block_device;
+
+#if defined(ELFLOADER)
+// The ELF loader doesn't start the timer, so flash operations aren't timed.
+constexpr LfsBlockDevice::ClockFn kFlashClock = nullptr;
+#else
+uint64_t Micros(void* ctx) { return TimerMicros(); }
+constexpr LfsBlockDevice::ClockFn kFlashClock = Micros;
+#endif
 
 int LfsSync(const struct lfs_config* c) { return LFS_ERR_OK; }
 
@@ -108,26 +95,33 @@ int LfsUnlock(const struct lfs_config* c) {
 
 lfs_t* Lfs() { return &g_lfs; }
 
-bool LfsInit(bool force_format) {
+LfsBlockDeviceStats LfsGetBlockDeviceStats() {
+  if (!g_block_device) return {};
+  MutexLock lock(g_lfs_mutex);
+  return g_block_device->GetStats();
+}
+
+void LfsResetBlockDeviceStats() {
+  if (!g_block_device) return;
+  MutexLock lock(g_lfs_mutex);
+  g_block_device->ResetStats();
+}
+
+bool LfsInit(bool force_format, const LfsBlockDeviceConfig& config) {
   if (g_lfs_mutex) vSemaphoreDelete(g_lfs_mutex);
 
   g_lfs_mutex = xSemaphoreCreateMutex();
   if (!g_lfs_mutex) return false;
 
+  g_block_device = std::make_unique<LfsBlockDevice>(
+      &g_nand_flash, kPageSize, kPagesPerBlock, kBlockCount, config, kFlashClock);
+
   std::memset(&g_lfs_config, 0, sizeof(g_lfs_config));
-  g_lfs_config.read = LfsRead;
-  g_lfs_config.prog = LfsProg;
-  g_lfs_config.erase = LfsErase;
+  g_block_device->Configure(&g_lfs_config);
   g_lfs_config.sync = LfsSync;
   g_lfs_config.lock = LfsLock;
   g_lfs_config.unlock = LfsUnlock;
-  g_lfs_config.read_size = kPageSize;
-  g_lfs_config.prog_size = kPageSize;
-  g_lfs_config.block_size = 131072;
-  g_lfs_config.block_count = 512;
   g_lfs_config.block_cycles = 250;
-  g_lfs_config.cache_size = kPageSize;
-  g_lfs_config.lookahead_size = kPageSize;
 
   if (force_format) {
     int ret = lfs_format(&g_lfs, &g_lfs_config);
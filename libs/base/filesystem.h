@@ -21,6 +21,7 @@
 #include <string>
 #include <vector>
 
+#include "libs/base/lfs_block_device.h"
 #include "third_party/nxp/rt1176-sdk/middleware/littlefs/lfs.h"
 
 namespace coralmicro {
@@ -31,9 +32,19 @@ namespace coralmicro {
 lfs_t* Lfs();
 
 // @cond Do not generate docs
-bool LfsInit(bool force_format = false);
+bool LfsInit(bool force_format = false,
+             const LfsBlockDeviceConfig& config = {});
 // @endcond
 
+// Gets statistics for the flash underneath the filesystem, such as page
+// reads and writes, erase counts, and time spent in each operation.
+//
+// @returns A snapshot of the counters.
+LfsBlockDeviceStats LfsGetBlockDeviceStats();
+
+// Resets the statistics returned by `LfsGetBlockDeviceStats()`.
+void LfsResetBlockDeviceStats();
+
 // Creates directory, similar to `mkdir -p <path>`.
 //
 // @param path Directory path.
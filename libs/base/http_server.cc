@@ -16,19 +16,33 @@
 
 #include "libs/base/http_server.h"
 
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <memory>
 
 #include "libs/base/filesystem.h"
+#include "libs/base/strings.h"
+#include "libs/base/timer.h"
+#include "third_party/nxp/rt1176-sdk/middleware/lwip/src/include/lwip/tcpip.h"
 
 namespace coralmicro {
 namespace {
 
 HttpServer* g_server = nullptr;
 
-constexpr uintptr_t kTagVector = 0b01;
-constexpr uintptr_t kTagFileHolder = 0b10;
-constexpr uintptr_t kTagMask = 0b11;
+// Tagged pointers need 8-byte alignment, which heap allocations on the M7
+// already have.
+constexpr uintptr_t kTagVector = 0b001;
+constexpr uintptr_t kTagFileHolder = 0b010;
+constexpr uintptr_t kTagPoolBuffer = 0b011;
+constexpr uintptr_t kTagMjpegClient = 0b100;
+constexpr uintptr_t kTagChunked = 0b101;
+constexpr uintptr_t kTagMask = 0b111;
+
+constexpr char kMjpegBoundary[] = "coralmicro-frame";
 
 template <uintptr_t Tag, typename T>
 void* TaggedPointer(T* p) {
@@ -43,16 +57,472 @@ T* Pointer(void* p) {
   return reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(p) & ~kTagMask);
 }
 
+// Each chunk is framed as "XXXX\r\n<data>\r\n" with a fixed-width size, so the
+// generator can write its data in place.
+constexpr int kChunkPrefixSize = 6;
+constexpr int kChunkOverhead = kChunkPrefixSize + 2;
+constexpr int kMaxChunkSize = 0xffff;
+constexpr char kLastChunk[] = "0\r\n\r\n";
+
+struct ChunkedResponse {
+  HttpServer::ContentGenerator generator;
+  // HTTP header or last chunk waiting to be sent.
+  std::string pending;
+  size_t pending_pos = 0;
+  bool done = false;
+};
+
+int ReadChunked(ChunkedResponse* response, char* buffer, int count) {
+  int total = 0;
+  while (total < count) {
+    if (response->pending_pos < response->pending.size()) {
+      const auto n = std::min<size_t>(
+          count - total, response->pending.size() - response->pending_pos);
+      std::memcpy(buffer + total,
+                  response->pending.data() + response->pending_pos, n);
+      response->pending_pos += n;
+      total += n;
+      continue;
+    }
+
+    const int space = count - total - kChunkOverhead;
+    if (response->done || space <= 0) break;
+
+    char* chunk = buffer + total;
+    const int len = response->generator(chunk + kChunkPrefixSize,
+                                        std::min(space, kMaxChunkSize));
+    if (len < 0 || len > space) {
+      // Without the last chunk the client sees an incomplete response.
+      response->done = true;
+      break;
+    }
+    if (len == 0) {
+      response->pending = kLastChunk;
+      response->pending_pos = 0;
+      response->done = true;
+      continue;
+    }
+
+    char prefix[kChunkPrefixSize + 1];
+    std::snprintf(prefix, sizeof(prefix), "%04x\r\n", len);
+    std::memcpy(chunk, prefix, kChunkPrefixSize);
+    std::memcpy(chunk + kChunkPrefixSize + len, "\r\n", 2);
+    total += kChunkOverhead + len;
+  }
+
+  if (total == 0 && response->done) return FS_READ_EOF;
+  return total;
+}
+
+// Files are read ahead in page-aligned windows of several NAND pages, so the
+// small reads that lwIP asks for don't each become a flash operation.
+constexpr lfs_soff_t kFilePageSize = 2048;
+constexpr size_t kFileReadAheadSize = 4 * kFilePageSize;
+constexpr size_t kFileReadAheadBuffers = 4;
+
+BufferPool* FileReadAheadPool() {
+  static BufferPool pool(kFileReadAheadBuffers, kFileReadAheadSize);
+  return &pool;
+}
+
+struct ContentType {
+  const char* extension;
+  const char* type;
+};
+
+constexpr ContentType kContentTypes[] = {
+    {".html", "text/html"},
+    {".htm", "text/html"},
+    {".shtml", "text/html"},
+    {".css", "text/css"},
+    {".js", "application/javascript"},
+    {".json", "application/json"},
+    {".txt", "text/plain"},
+    {".csv", "text/csv"},
+    {".png", "image/png"},
+    {".jpg", "image/jpeg"},
+    {".jpeg", "image/jpeg"},
+    {".gif", "image/gif"},
+    {".bmp", "image/bmp"},
+    {".ico", "image/x-icon"},
+    {".svg", "image/svg+xml"},
+    {".wav", "audio/wav"},
+};
+
+const char* GetContentType(const std::string& filename) {
+  const auto dot = filename.rfind('.');
+  if (dot != std::string::npos) {
+    for (const auto& content_type : kContentTypes) {
+      if (filename.compare(dot, std::string::npos, content_type.extension) ==
+          0)
+        return content_type.type;
+    }
+  }
+  return "application/octet-stream";
+}
+
+uint32_t Fnv1a(const uint8_t* data, size_t size, uint32_t hash = 2166136261u) {
+  for (size_t i = 0; i < size; ++i) hash = (hash ^ data[i]) * 16777619u;
+  return hash;
+}
+
 struct FileHolder {
+  enum class RangeState { kNone, kSatisfiable, kUnsatisfiable };
+
   lfs_file_t file;
   bool opened = false;
+  const char* content_type = nullptr;
+  // Weak ETag without quotes, or empty if unknown.
+  char etag[24] = {};
+  // Set by `HttpServer::CgiHandler()` from the query parameters.
+  RangeState range = RangeState::kNone;
+  bool not_modified = false;
+
+  // The file is sent from `begin` up to but not including `end`.
+  lfs_soff_t size = 0;
+  lfs_soff_t begin = 0;
+  lfs_soff_t end = 0;
+  lfs_soff_t pos = 0;
+
+  // HTTP header, built on the first read once the query is known.
+  std::string header;
+  size_t header_pos = 0;
+  bool started = false;
+
+  // Read-ahead window; reads go straight to LittleFS if no buffer was free.
+  BufferPool::Handle window;
+  lfs_soff_t window_offset = 0;
+  lfs_soff_t window_size = 0;
 
   ~FileHolder() {
     if (opened) lfs_file_close(Lfs(), &file);
   }
 };
+
+// LittleFS is copy-on-write, so rewriting any part of a file moves its last
+// block, and the block and size identify the contents. Inline files are
+// stored in directory metadata instead, and are small enough to hash.
+void ComputeEtag(FileHolder* holder) {
+  uint32_t hash;
+  if (holder->file.flags & LFS_F_INLINE) {
+    if (!holder->window ||
+        holder->size > static_cast<lfs_soff_t>(holder->window.Capacity()))
+      return;
+    auto len = lfs_file_read(Lfs(), &holder->file, holder->window.Data(),
+                             holder->size);
+    if (len != holder->size) return;
+    hash = Fnv1a(holder->window.Data(), len);
+    // Keep the contents as the first read-ahead window.
+    holder->window_offset = 0;
+    holder->window_size = len;
+  } else {
+    hash = Fnv1a(reinterpret_cast<const uint8_t*>(&holder->file.ctz.head),
+                 sizeof(holder->file.ctz.head));
+  }
+  std::snprintf(holder->etag, sizeof(holder->etag), "%lx-%lx",
+                static_cast<unsigned long>(holder->size),
+                static_cast<unsigned long>(hash));
+}
+
+// Parses a byte range in the format of the HTTP `Range` header, with or
+// without the "bytes=" prefix: "first-last", "first-", or "-suffix_length".
+FileHolder::RangeState ParseRange(const char* value, lfs_soff_t size,
+                                  lfs_soff_t* begin, lfs_soff_t* end) {
+  if (StrStartsWith(value, "bytes=")) value += StrLen("bytes=");
+  const char* dash = std::strchr(value, '-');
+  if (!dash) return FileHolder::RangeState::kNone;
+
+  char* parse_end;
+  if (dash == value) {
+    const long suffix = std::strtol(dash + 1, &parse_end, 10);
+    if (*parse_end != '\0' || suffix < 0) return FileHolder::RangeState::kNone;
+    if (suffix == 0) return FileHolder::RangeState::kUnsatisfiable;
+    *begin = suffix < size ? size - suffix : 0;
+    *end = size;
+  } else {
+    const long first = std::strtol(value, &parse_end, 10);
+    if (parse_end != dash || first < 0) return FileHolder::RangeState::kNone;
+    long last = size - 1;
+    if (dash[1] != '\0') {
+      last = std::strtol(dash + 1, &parse_end, 10);
+      if (*parse_end != '\0' || last < first)
+        return FileHolder::RangeState::kNone;
+    }
+    if (first >= size) return FileHolder::RangeState::kUnsatisfiable;
+    *begin = first;
+    *end = last < size ? last + 1 : size;
+  }
+  return *begin < *end ? FileHolder::RangeState::kSatisfiable
+                       : FileHolder::RangeState::kUnsatisfiable;
+}
+
+void StartFile(FileHolder* holder) {
+  holder->started = true;
+  auto& header = holder->header;
+  const char* etag = holder->etag;
+
+  if (holder->not_modified) {
+    StrAppend(&header,
+              "HTTP/1.1 304 Not Modified\r\nETag: W/\"%s\"\r\n"
+              "Connection: close\r\n\r\n",
+              etag);
+    holder->begin = holder->end = 0;
+    return;
+  }
+
+  if (holder->range == FileHolder::RangeState::kUnsatisfiable) {
+    StrAppend(&header,
+              "HTTP/1.1 416 Range Not Satisfiable\r\n"
+              "Content-Range: bytes */%ld\r\nContent-Length: 0\r\n"
+              "Connection: close\r\n\r\n",
+              static_cast<long>(holder->size));
+    holder->begin = holder->end = 0;
+    return;
+  }
+
+  if (holder->range == FileHolder::RangeState::kSatisfiable) {
+    StrAppend(&header,
+              "HTTP/1.1 206 Partial Content\r\n"
+              "Content-Range: bytes %ld-%ld/%ld\r\n",
+              static_cast<long>(holder->begin),
+              static_cast<long>(holder->end - 1),
+              static_cast<long>(holder->size));
+  } else {
+    StrAppend(&header, "HTTP/1.1 200 OK\r\n");
+  }
+  // No `Accept-Ranges`: ranges only come from the query, because lwIP's
+  // httpd doesn't pass on the `Range` header.
+  StrAppend(&header, "Content-Type: %s\r\nContent-Length: %ld\r\n",
+            holder->content_type,
+            static_cast<long>(holder->end - holder->begin));
+  if (etag[0] != '\0') StrAppend(&header, "ETag: W/\"%s\"\r\n", etag);
+  StrAppend(&header, "Connection: close\r\n\r\n");
+
+  holder->pos = holder->begin;
+  if (!holder->window && holder->begin > 0)
+    lfs_file_seek(Lfs(), &holder->file, holder->begin, LFS_SEEK_SET);
+}
+
+bool FillWindow(FileHolder* holder) {
+  const lfs_soff_t offset = holder->pos - holder->pos % kFilePageSize;
+  if (lfs_file_tell(Lfs(), &holder->file) != offset &&
+      lfs_file_seek(Lfs(), &holder->file, offset, LFS_SEEK_SET) < 0)
+    return false;
+  const auto len = lfs_file_read(
+      Lfs(), &holder->file, holder->window.Data(),
+      std::min<lfs_soff_t>(holder->window.Capacity(), holder->end - offset));
+  if (len <= 0) return false;
+  holder->window_offset = offset;
+  holder->window_size = len;
+  return true;
+}
+
+int ReadFile(FileHolder* holder, char* buffer, int count) {
+  if (!holder->started) StartFile(holder);
+
+  int total = 0;
+  while (total < count) {
+    if (holder->header_pos < holder->header.size()) {
+      const auto n = std::min<size_t>(
+          count - total, holder->header.size() - holder->header_pos);
+      std::memcpy(buffer + total, holder->header.data() + holder->header_pos,
+                  n);
+      holder->header_pos += n;
+      total += n;
+      continue;
+    }
+
+    if (holder->pos >= holder->end) break;
+    const auto want =
+        std::min<lfs_soff_t>(count - total, holder->end - holder->pos);
+
+    if (!holder->window) {
+      const auto len =
+          lfs_file_read(Lfs(), &holder->file, buffer + total, want);
+      if (len <= 0) break;
+      holder->pos += len;
+      total += len;
+      continue;
+    }
+
+    if (holder->pos < holder->window_offset ||
+        holder->pos >= holder->window_offset + holder->window_size) {
+      if (!FillWindow(holder)) break;
+    }
+    const auto n = std::min<lfs_soff_t>(
+        want, holder->window_offset + holder->window_size - holder->pos);
+    std::memcpy(buffer + total,
+                holder->window.Data() + (holder->pos - holder->window_offset),
+                n);
+    holder->pos += n;
+    total += n;
+  }
+
+  return total > 0 ? total : FS_READ_EOF;
+}
 }  // namespace
 
+// @cond
+struct alignas(8) MjpegStream::Client {
+  MjpegStream* stream;
+  uint64_t min_interval_ms;
+  int max_fps;
+
+  // HTTP or part header waiting to be sent, followed by the frame.
+  char header[192];
+  size_t header_size = 0;
+  size_t header_pos = 0;
+  BufferPool::Handle frame;
+  size_t frame_pos = 0;
+
+  uint32_t seq = 0;
+  uint64_t last_frame_ms = 0;
+  HttpWaitCallback wait_fn = nullptr;
+  void* wait_arg = nullptr;
+
+  uint32_t frames_sent = 0;
+  uint32_t frames_dropped = 0;
+};
+// @endcond
+
+MjpegStream::MjpegStream(int max_fps) : max_fps_(max_fps) {}
+
+void MjpegStream::Publish(BufferPool::Handle frame) {
+  if (!frame || frame.Size() == 0) return;
+
+  LOCK_TCPIP_CORE();
+  latest_ = std::move(frame);
+  ++latest_seq_;
+  ++frames_published_;
+
+  // Callbacks can close their own connection, which removes the client, so
+  // collect them before calling any.
+  const auto now = TimerMillis();
+  wakeups_.clear();
+  for (auto* client : clients_) {
+    if (client->wait_fn && FrameReady(client, now)) {
+      wakeups_.emplace_back(client->wait_fn, client->wait_arg);
+      client->wait_fn = nullptr;
+    }
+  }
+  for (auto& [fn, arg] : wakeups_) fn(arg);
+  UNLOCK_TCPIP_CORE();
+}
+
+MjpegStreamStats MjpegStream::GetStats() const {
+  return {num_clients_, frames_published_, frames_sent_, frames_dropped_};
+}
+
+std::vector<MjpegClientStats> MjpegStream::GetClientStats() const {
+  std::vector<MjpegClientStats> stats;
+  LOCK_TCPIP_CORE();
+  stats.reserve(clients_.size());
+  for (const auto* client : clients_)
+    stats.push_back(
+        {client->max_fps, client->frames_sent, client->frames_dropped});
+  UNLOCK_TCPIP_CORE();
+  return stats;
+}
+
+MjpegStream::Client* MjpegStream::AddClient(int max_fps) {
+  auto* client = new Client;
+  client->stream = this;
+  client->max_fps = max_fps > 0 ? max_fps : max_fps_;
+  client->min_interval_ms = client->max_fps > 0 ? 1000 / client->max_fps : 0;
+  // A new client starts with the latest frame instead of waiting for the next.
+  client->seq = latest_ ? latest_seq_ - 1 : latest_seq_;
+  client->header_size = std::snprintf(
+      client->header, sizeof(client->header),
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Type: multipart/x-mixed-replace; boundary=%s\r\n"
+      "Cache-Control: no-cache\r\n"
+      "Connection: close\r\n\r\n",
+      kMjpegBoundary);
+  clients_.push_back(client);
+  num_clients_ = clients_.size();
+  return client;
+}
+
+void MjpegStream::RemoveClient(Client* client) {
+  for (auto it = clients_.begin(); it != clients_.end(); ++it) {
+    if (*it == client) {
+      clients_.erase(it);
+      break;
+    }
+  }
+  num_clients_ = clients_.size();
+  // Don't hold a pool buffer (or show a stale frame) while nobody is watching.
+  if (clients_.empty()) latest_.Reset();
+  delete client;
+}
+
+bool MjpegStream::FrameReady(const Client* client, uint64_t now_ms) const {
+  if (!latest_ || client->seq == latest_seq_) return false;
+  return client->frames_sent == 0 ||
+         now_ms - client->last_frame_ms >= client->min_interval_ms;
+}
+
+void MjpegStream::TakeFrame(Client* client, uint64_t now_ms) {
+  const uint32_t skipped = latest_seq_ - client->seq - 1;
+  client->frames_dropped += skipped;
+  frames_dropped_ += skipped;
+  client->seq = latest_seq_;
+  client->last_frame_ms = now_ms;
+  client->frame = latest_;
+  client->frame_pos = 0;
+  client->header_pos = 0;
+  client->header_size = std::snprintf(
+      client->header, sizeof(client->header),
+      "\r\n--%s\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n",
+      kMjpegBoundary, static_cast<unsigned>(client->frame.Size()));
+}
+
+bool MjpegStream::CanRead(Client* client) {
+  return client->header_pos < client->header_size ||
+         client->frame_pos < client->frame.Size() ||
+         FrameReady(client, TimerMillis());
+}
+
+int MjpegStream::Read(Client* client, char* buffer, int count) {
+  int total = 0;
+  while (total < count) {
+    if (client->header_pos < client->header_size) {
+      const auto n = std::min<size_t>(count - total,
+                                      client->header_size - client->header_pos);
+      std::memcpy(buffer + total, client->header + client->header_pos, n);
+      client->header_pos += n;
+      total += n;
+      continue;
+    }
+
+    if (client->frame_pos < client->frame.Size()) {
+      const auto n = std::min<size_t>(count - total,
+                                      client->frame.Size() - client->frame_pos);
+      std::memcpy(buffer + total, client->frame.Data() + client->frame_pos, n);
+      client->frame_pos += n;
+      total += n;
+      continue;
+    }
+
+    if (client->frame) {
+      // The whole frame is in lwIP's buffers, so the pool can have it back.
+      client->frame.Reset();
+      ++client->frames_sent;
+      ++frames_sent_;
+    }
+
+    const auto now = TimerMillis();
+    if (!FrameReady(client, now)) break;
+    TakeFrame(client, now);
+  }
+  return total > 0 ? total : FS_READ_DELAYED;
+}
+
+void MjpegStream::Wait(Client* client, HttpWaitCallback fn, void* arg) {
+  client->wait_fn = fn;
+  client->wait_arg = arg;
+}
+
 void UseHttpServer(HttpServer* server) {
   static bool initialized = false;
   if (!initialized) {
@@ -76,10 +546,18 @@ int HttpServer::FsOpenCustom(struct fs_file* file, const char* name) {
       if (lfs_file_open(Lfs(), &file_holder->file, filename->c_str(),
                         LFS_O_RDONLY) >= 0) {
         file_holder->opened = true;
+        file_holder->content_type = GetContentType(*filename);
+        file_holder->size = lfs_file_size(Lfs(), &file_holder->file);
+        file_holder->end = file_holder->size;
+        file_holder->window = FileReadAheadPool()->Acquire();
+        ComputeEtag(file_holder.get());
+        // The headers depend on the query, which `CgiHandler()` sees after
+        // this, so they're written on the first read and the length is left
+        // open.
         file->data = nullptr;
-        file->len = lfs_file_size(Lfs(), &file_holder->file);
+        file->len = INT_MAX;
         file->index = 0;
-        file->flags = FS_FILE_FLAGS_HEADER_PERSISTENT;
+        file->flags = FS_FILE_FLAGS_HEADER_INCLUDED;
         file->pextension = TaggedPointer<kTagFileHolder>(file_holder.release());
         return 1;
       }
@@ -103,6 +581,49 @@ int HttpServer::FsOpenCustom(struct fs_file* file, const char* name) {
           TaggedPointer<kTagVector>(new std::vector<uint8_t>(std::move(*v)));
       return 1;
     }
+
+    if (auto* handle = std::get_if<BufferPool::Handle>(&content)) {
+      if (!*handle) continue;
+      // With no data pointer, lwIP reads through `FsReadCustom()` and copies
+      // into its send buffers, so the buffer can go back to the pool as soon
+      // as the file is closed, even if segments are still unacknowledged.
+      file->data = nullptr;
+      file->len = handle->Size();
+      file->index = 0;
+      file->flags = FS_FILE_FLAGS_HEADER_PERSISTENT;
+      // The reference is held by the open file instead of a heap copy.
+      file->pextension = TaggedPointer<kTagPoolBuffer>(handle->Release());
+      return 1;
+    }
+
+    if (auto* subscription = std::get_if<MjpegSubscription>(&content)) {
+      if (!subscription->stream) continue;
+      // The stream writes its own headers and never ends; the connection is
+      // closed by the client.
+      file->data = nullptr;
+      file->len = INT_MAX;
+      file->index = 0;
+      file->flags = FS_FILE_FLAGS_HEADER_INCLUDED;
+      file->pextension = TaggedPointer<kTagMjpegClient>(
+          subscription->stream->AddClient(subscription->max_fps));
+      return 1;
+    }
+
+    if (auto* chunked = std::get_if<ChunkedContent>(&content)) {
+      if (!chunked->generator) continue;
+      auto response = std::make_unique<ChunkedResponse>();
+      response->generator = std::move(chunked->generator);
+      response->pending =
+          "HTTP/1.1 200 OK\r\nContent-Type: " + chunked->content_type +
+          "\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+      // The length is unknown, so the response ends when the generator says so.
+      file->data = nullptr;
+      file->len = INT_MAX;
+      file->index = 0;
+      file->flags = FS_FILE_FLAGS_HEADER_INCLUDED;
+      file->pextension = TaggedPointer<kTagChunked>(response.release());
+      return 1;
+    }
   }
 
   return 0;
@@ -112,11 +633,8 @@ int HttpServer::FsReadCustom(struct fs_file* file, char* buffer, int count) {
   auto tag = Tag(file->pextension);
 
   if (tag == kTagFileHolder) {
-    auto* file_holder = Pointer<FileHolder>(file->pextension);
-
-    auto len = lfs_file_read(Lfs(), &file_holder->file, buffer, count);
-    if (len < 0) return FS_READ_EOF;
-    file->index += len;
+    auto len = ReadFile(Pointer<FileHolder>(file->pextension), buffer, count);
+    if (len > 0) file->index += len;
     return len;
   }
 
@@ -127,18 +645,88 @@ int HttpServer::FsReadCustom(struct fs_file* file, char* buffer, int count) {
     return count;
   }
 
+  if (tag == kTagPoolBuffer) {
+    auto* pool_buffer = Pointer<BufferPool::Buffer>(file->pextension);
+    std::memcpy(buffer, pool_buffer->data + file->index, count);
+    file->index += count;
+    return count;
+  }
+
+  if (tag == kTagMjpegClient) {
+    auto* client = Pointer<MjpegStream::Client>(file->pextension);
+    auto len = client->stream->Read(client, buffer, count);
+    if (len > 0) file->index += len;
+    return len;
+  }
+
+  if (tag == kTagChunked) {
+    auto len = ReadChunked(Pointer<ChunkedResponse>(file->pextension), buffer,
+                           count);
+    if (len > 0) file->index += len;
+    return len;
+  }
+
   return FS_READ_EOF;
 };
 
+void HttpServer::CgiHandler(struct fs_file* file, const char* uri,
+                            int iNumParams, char** pcParam, char** pcValue) {
+  (void)uri;
+  if (Tag(file->pextension) != kTagFileHolder) return;
+
+  auto* holder = Pointer<FileHolder>(file->pextension);
+  for (int i = 0; i < iNumParams; ++i) {
+    if (!pcValue[i]) continue;
+    if (std::strcmp(pcParam[i], "range") == 0) {
+      holder->range = ParseRange(pcValue[i], holder->size, &holder->begin,
+                                 &holder->end);
+      if (holder->range != FileHolder::RangeState::kSatisfiable) {
+        holder->begin = 0;
+        holder->end = holder->size;
+      }
+    } else if (std::strcmp(pcParam[i], "etag") == 0) {
+      holder->not_modified = holder->etag[0] != '\0' &&
+                             std::strcmp(pcValue[i], holder->etag) == 0;
+    }
+  }
+}
+
 void HttpServer::FsCloseCustom(struct fs_file* file) {
   auto tag = Tag(file->pextension);
   if (tag == kTagFileHolder) {
     delete Pointer<FileHolder>(file->pextension);
   } else if (tag == kTagVector) {
     delete Pointer<std::vector<uint8_t>>(file->pextension);
+  } else if (tag == kTagPoolBuffer) {
+    // The adopted handle is destroyed right away, releasing the buffer.
+    BufferPool::Handle::Adopt(Pointer<BufferPool::Buffer>(file->pextension));
+  } else if (tag == kTagMjpegClient) {
+    auto* client = Pointer<MjpegStream::Client>(file->pextension);
+    client->stream->RemoveClient(client);
+  } else if (tag == kTagChunked) {
+    delete Pointer<ChunkedResponse>(file->pextension);
   }
 }
 
+bool HttpServer::FsCanReadCustom(struct fs_file* file) {
+  if (Tag(file->pextension) == kTagMjpegClient) {
+    auto* client = Pointer<MjpegStream::Client>(file->pextension);
+    return client->stream->CanRead(client);
+  }
+  return true;
+}
+
+bool HttpServer::FsWaitReadCustom(struct fs_file* file,
+                                  HttpWaitCallback callback_fn,
+                                  void* callback_arg) {
+  if (Tag(file->pextension) == kTagMjpegClient) {
+    auto* client = Pointer<MjpegStream::Client>(file->pextension);
+    client->stream->Wait(client, callback_fn, callback_arg);
+    return true;
+  }
+  return false;
+}
+
 extern "C" {
 err_t httpd_post_begin(void* connection, const char* uri,
                        const char* http_request, u16_t http_request_len,
@@ -167,9 +755,28 @@ int fs_open_custom(struct fs_file* file, const char* name) {
   return g_server->FsOpenCustom(file, name);
 }
 
+#if LWIP_HTTPD_FS_ASYNC_READ
+u8_t fs_canread_custom(struct fs_file* file) {
+  return g_server->FsCanReadCustom(file);
+}
+
+u8_t fs_wait_read_custom(struct fs_file* file, fs_wait_cb callback_fn,
+                         void* callback_arg) {
+  return g_server->FsWaitReadCustom(file, callback_fn, callback_arg);
+}
+
+int fs_read_async_custom(struct fs_file* file, char* buffer, int count,
+                         fs_wait_cb callback_fn, void* callback_arg) {
+  auto len = g_server->FsReadCustom(file, buffer, count);
+  if (len == FS_READ_DELAYED)
+    g_server->FsWaitReadCustom(file, callback_fn, callback_arg);
+  return len;
+}
+#else
 int fs_read_custom(struct fs_file* file, char* buffer, int count) {
   return g_server->FsReadCustom(file, buffer, count);
 }
+#endif  // LWIP_HTTPD_FS_ASYNC_READ
 
 void fs_close_custom(struct fs_file* file) { g_server->FsCloseCustom(file); }
 }  // extern "C"
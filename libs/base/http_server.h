@@ -23,11 +23,29 @@
 #include <variant>
 #include <vector>
 
+#include "libs/base/buffer_pool.h"
 #include "third_party/nxp/rt1176-sdk/middleware/lwip/src/include/lwip/apps/fs.h"
 #include "third_party/nxp/rt1176-sdk/middleware/lwip/src/include/lwip/apps/httpd.h"
 
 namespace coralmicro {
 
+class MjpegStream;
+
+// Subscribes the requesting HTTP client to an `MjpegStream`.
+//
+// Return one from a URI handler, usually with `MjpegStream::Subscribe()`.
+struct MjpegSubscription {
+  // The stream to send to the client.
+  MjpegStream* stream;
+  // Maximum frames per second sent to this client, or 0 for the stream's
+  // default.
+  int max_fps;
+};
+
+// The function type that lwIP passes to `HttpServer::FsWaitReadCustom()` to be
+// called once a file can be read again.
+using HttpWaitCallback = void (*)(void* arg);
+
 // Defines an HTTP server on the device.
 //
 // This is a light wrapper around the lwIP stack. For more detail,
@@ -98,6 +116,22 @@ class HttpServer {
 
   // Called once to handle CGI for every URI with parameters.
   //
+  // The default implementation handles these parameters for files returned
+  // by a URI handler as a filename, because lwIP's httpd doesn't pass request
+  // headers on to custom files:
+  //
+  //   * `range`: A byte range in the format of the HTTP `Range` header, such
+  //     as `?range=bytes=1048576-`, to resume a download. The response is
+  //     `206 Partial Content`, or `416 Range Not Satisfiable`.
+  //   * `etag`: The `ETag` of a previous response, without the `W/` prefix or
+  //     quotes. If the file hasn't changed, the response is
+  //     `304 Not Modified` with no body.
+  //
+  // `Range` and `If-None-Match` headers are ignored, so responses don't send
+  // `Accept-Ranges`.
+  //
+  // Subclasses that override this should call it for files they don't handle.
+  //
   // @param file The file received.
   // @param uri The HTTP header URI.
   // @param iNumParams The number of parameters in the URI.
@@ -105,13 +139,7 @@ class HttpServer {
   // @param pcValue Values for each parameter.
   // file, uri, count, http_cgi_params, http_cgi_param_vals
   virtual void CgiHandler(struct fs_file* file, const char* uri, int iNumParams,
-                          char** pcParam, char** pcValue) {
-    (void)file;
-    (void)uri;
-    (void)iNumParams;
-    (void)pcParam;
-    (void)pcValue;
-  };
+                          char** pcParam, char** pcValue);
 
   // Called first for every opened file to allow opening custom files
   // that are not included in fsdata(_custom).c.
@@ -123,6 +151,21 @@ class HttpServer {
   // Called to close custom files.
   virtual void FsCloseCustom(struct fs_file* file);
 
+  // Called before reading custom files to check whether data is available.
+  //
+  // Files that produce data over time (such as an `MjpegStream`) return false
+  // until they have more to send.
+  virtual bool FsCanReadCustom(struct fs_file* file);
+
+  // Called when `FsCanReadCustom()` returns false or `FsReadCustom()` returns
+  // `FS_READ_DELAYED`. Implementations call `callback_fn(callback_arg)` from
+  // the TCP/IP thread (or with `LOCK_TCPIP_CORE()` held) once data is ready.
+  //
+  // @return True if the callback will be called, false to read right away.
+  virtual bool FsWaitReadCustom(struct fs_file* file,
+                                HttpWaitCallback callback_fn,
+                                void* callback_arg);
+
  public:
   // Defines a static buffer in which to return data from the server
   struct StaticBuffer {
@@ -132,14 +175,45 @@ class HttpServer {
     size_t size;
   };
 
+  // Represents the callback function type that generates a `ChunkedContent`
+  // body.
+  //
+  // The generator is called each time lwIP has room to send more data, from
+  // the TCP/IP thread, so it must not block.
+  //
+  // @param buffer The buffer to fill.
+  // @param size The size of the buffer in bytes.
+  // @return The number of bytes written to `buffer` (at most `size`), 0 when
+  // the body is complete, or -1 to abort the response.
+  using ContentGenerator = std::function<int(char* buffer, int size)>;
+
+  // Defines a response whose body is produced while it is sent, with
+  // `Transfer-Encoding: chunked`.
+  //
+  // The body is never held in memory as a whole: the generator writes
+  // straight into lwIP's send buffer, and the first bytes go out as soon as
+  // the generator produces them.
+  struct ChunkedContent {
+    // The value of the `Content-Type` header.
+    std::string content_type;
+    // The function that generates the body.
+    ContentGenerator generator;
+  };
+
   // Defines the allowed response types returned by `AddUriHandler()`.
   // Successful requests will typically respond with the content in
-  // a string, a dynamic buffer (a vector), or a `StaticBuffer`, or an
-  // empty vector if the URI is unhandled.
+  // a string, a dynamic buffer (a vector), a `StaticBuffer`, a
+  // `BufferPool::Handle`, or a `ChunkedContent`, or an empty vector if the URI
+  // is unhandled. A pooled buffer is sent without being copied into a new
+  // allocation and returns to its pool once the response is finished. An
+  // `MjpegSubscription` keeps the connection open and streams frames to it.
   using Content = std::variant<std::monostate,        // Not found
                                std::string,           // Filename
                                std::vector<uint8_t>,  // Dynamic buffer
-                               StaticBuffer>;         // Static buffer
+                               StaticBuffer,          // Static buffer
+                               BufferPool::Handle,    // Pooled buffer
+                               MjpegSubscription,     // MJPEG stream
+                               ChunkedContent>;       // Generated body
 
   // Represents the callback function type required by `AddUriHandler()`.
   using UriHandler = std::function<Content(const char* uri)>;
@@ -162,6 +236,131 @@ class HttpServer {
   std::vector<UriHandler> uri_handlers_;
 };
 
+// Aggregate statistics reported by `MjpegStream`.
+struct MjpegStreamStats {
+  // Number of connected clients.
+  int clients;
+  // Number of frames passed to `MjpegStream::Publish()`.
+  uint32_t frames_published;
+  // Number of frames sent, summed over all clients.
+  uint32_t frames_sent;
+  // Number of frames that clients skipped because they were busy sending an
+  // older frame or limited by their frame rate, summed over all clients.
+  uint32_t frames_dropped;
+};
+
+// Statistics for one client of an `MjpegStream`.
+struct MjpegClientStats {
+  // The frame rate limit of the client, or 0 if unlimited.
+  int max_fps;
+  // Number of frames sent to the client.
+  uint32_t frames_sent;
+  // Number of frames the client skipped.
+  uint32_t frames_dropped;
+};
+
+// Streams JPEG frames to any number of HTTP clients as a
+// `multipart/x-mixed-replace` (MJPEG) response, which browsers show in a plain
+// `<img>` tag.
+//
+// One producer captures and encodes each frame once and calls `Publish()`.
+// Every connected client then receives the most recent frame: a client that
+// is still sending an older frame, or that is limited by its frame rate, skips
+// the frames published in the meantime instead of queueing them. Connections
+// stay open, so there is no per-frame TCP or HTTP setup.
+//
+// For example:
+//
+// ```
+// MjpegStream stream(/*max_fps=*/15);
+// http_server.AddUriHandler([&stream](const char* uri) -> HttpServer::Content {
+//   if (StrEndsWith(uri, "/camera.mjpeg")) return stream.Subscribe();
+//   return {};
+// });
+//
+// BufferPool pool(/*num_buffers=*/3, /*buffer_size=*/64 * 1024);
+// while (true) {
+//   if (stream.NumClients() == 0) {
+//     vTaskDelay(pdMS_TO_TICKS(100));
+//     continue;
+//   }
+//   auto jpeg = pool.Acquire(/*timeout_ms=*/100);
+//   // Capture and encode a frame into `jpeg`...
+//   stream.Publish(std::move(jpeg));
+// }
+// ```
+//
+// Frames are held by reference, so the pool needs one buffer per client that
+// may be mid-frame, plus one for the latest frame and one for the producer.
+// The stream must outlive its clients, which usually means it's static or
+// lives in a task that never exits.
+class MjpegStream {
+ public:
+  // Constructor.
+  //
+  // @param max_fps Default maximum frames per second sent to each client, or
+  // 0 for no limit.
+  explicit MjpegStream(int max_fps = 0);
+  // @cond
+  MjpegStream(const MjpegStream&) = delete;
+  MjpegStream& operator=(const MjpegStream&) = delete;
+  // @endcond
+
+  // Creates a subscription to return from a URI handler.
+  //
+  // @param max_fps Maximum frames per second sent to this client, or 0 for the
+  // stream's default.
+  // @return The subscription.
+  MjpegSubscription Subscribe(int max_fps = 0) { return {this, max_fps}; }
+
+  // Makes a new frame the latest one and wakes clients that are ready for it.
+  //
+  // @param frame A complete JPEG image. Empty handles are ignored.
+  void Publish(BufferPool::Handle frame);
+
+  // Gets the number of connected clients.
+  //
+  // A producer can use this to stop capturing while nobody is watching.
+  //
+  // @return The number of clients.
+  int NumClients() const { return num_clients_; }
+
+  // Gets the aggregate statistics.
+  //
+  // @return A snapshot of the counters.
+  MjpegStreamStats GetStats() const;
+
+  // Gets the statistics of each connected client.
+  //
+  // @return One entry per client, in connection order.
+  std::vector<MjpegClientStats> GetClientStats() const;
+
+  // @cond
+  struct Client;
+  Client* AddClient(int max_fps);
+  void RemoveClient(Client* client);
+  bool CanRead(Client* client);
+  int Read(Client* client, char* buffer, int count);
+  void Wait(Client* client, HttpWaitCallback fn, void* arg);
+  // @endcond
+
+ private:
+  bool FrameReady(const Client* client, uint64_t now_ms) const;
+  void TakeFrame(Client* client, uint64_t now_ms);
+
+  int max_fps_;
+  // Everything below is protected by the lwIP core lock.
+  std::vector<Client*> clients_;
+  std::vector<std::pair<HttpWaitCallback, void*>> wakeups_;
+  BufferPool::Handle latest_;
+  uint32_t latest_seq_ = 0;
+
+  volatile int num_clients_ = 0;
+  volatile uint32_t frames_published_ = 0;
+  volatile uint32_t frames_sent_ = 0;
+  volatile uint32_t frames_dropped_ = 0;
+};
+
 // Starts an HTTP server.
 //
 // To handle server requests, you must pass your implementation of
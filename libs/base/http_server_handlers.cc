@@ -23,6 +23,7 @@
 #include <vector>
 
 #include "libs/base/strings.h"
+#include "libs/base/trace.h"
 #include "third_party/freertos_kernel/include/FreeRTOS.h"
 #include "third_party/freertos_kernel/include/semphr.h"
 #include "third_party/freertos_kernel/include/task.h"
@@ -81,4 +82,17 @@ HttpServer::Content TaskStatsUriHandler::operator()(const char* uri) {
   return {};
 }
 
+HttpServer::Content TraceUriHandler::operator()(const char* uri) {
+  if (std::strcmp(uri, name) == 0) {
+    // Sends what is in the ring now; events recorded while sending go out
+    // too, until the ring is empty.
+    return HttpServer::ChunkedContent{
+        "application/octet-stream", [](char* buffer, int size) {
+          return static_cast<int>(Trace::GetSingleton()->Read(
+              reinterpret_cast<uint8_t*>(buffer), size));
+        }};
+  }
+  return {};
+}
+
 }  // namespace coralmicro
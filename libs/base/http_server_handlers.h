@@ -31,6 +31,13 @@ struct TaskStatsUriHandler {
   HttpServer::Content operator()(const char* uri);
 };
 
+// Serves the events recorded by `Trace` and removes them from the ring, for
+// `scripts/trace_decode.py`. Save successive responses to the same file.
+struct TraceUriHandler {
+  const char* name = "/trace.bin";
+  HttpServer::Content operator()(const char* uri);
+};
+
 }  // namespace coralmicro
 
 #endif  // LIBS_BASE_HTTP_SERVER_HANDLERS_H_
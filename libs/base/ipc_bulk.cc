@@ -0,0 +1,166 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/base/ipc_bulk.h"
+
+#include <atomic>
+
+namespace coralmicro {
+
+void IpcBulkRing::Reset() {
+  head = 0;
+  tail = 0;
+}
+
+bool IpcBulkRing::Push(const IpcBulkDescriptor& descriptor) {
+  const uint32_t h = head;
+  if (h - tail == kIpcBulkRingSize) return false;
+  auto& entry = entries[h % kIpcBulkRingSize];
+  entry.offset = descriptor.offset;
+  entry.size = descriptor.size;
+  entry.type = descriptor.type;
+  // The other core must see the entry before the new head.
+  std::atomic_thread_fence(std::memory_order_release);
+  head = h + 1;
+  return true;
+}
+
+bool IpcBulkRing::Pop(IpcBulkDescriptor* descriptor) {
+  const uint32_t t = tail;
+  if (head == t) return false;
+  // Read the entry only after seeing the head that published it.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const auto& entry = entries[t % kIpcBulkRingSize];
+  descriptor->offset = entry.offset;
+  descriptor->size = entry.size;
+  descriptor->type = entry.type;
+  // The entry must be read before the producer can reuse it.
+  std::atomic_thread_fence(std::memory_order_release);
+  tail = t + 1;
+  return true;
+}
+
+size_t IpcBulkRing::Size() const { return head - tail; }
+
+void IpcBulkLane::Init(uint8_t* slabs, size_t slab_size, size_t num_slabs) {
+  base = reinterpret_cast<uintptr_t>(slabs);
+  this->slab_size = slab_size;
+  this->num_slabs = num_slabs;
+  submit.Reset();
+  release.Reset();
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+bool IpcBulkLane::Valid(const IpcBulkDescriptor& descriptor) const {
+  return descriptor.offset % slab_size == 0 &&
+         descriptor.offset / slab_size < num_slabs &&
+         descriptor.size <= slab_size;
+}
+
+IpcBulkEndpoint::IpcBulkEndpoint(IpcBulkLane* tx, IpcBulkLane* rx,
+                                 const IpcBulkCacheOps& cache)
+    : tx_(tx),
+      rx_(rx),
+      cache_(cache),
+      free_slabs_(tx->num_slabs),
+      send_us_(tx->num_slabs) {
+  // Hand out low slabs first.
+  for (uint32_t i = 0; i < tx->num_slabs; ++i)
+    free_slabs_[i] = tx->num_slabs - 1 - i;
+}
+
+uint32_t IpcBulkEndpoint::SlabIndex(uintptr_t data) const {
+  return (data - tx_->base) / tx_->slab_size;
+}
+
+void IpcBulkEndpoint::Reclaim(uint64_t now_us) {
+  IpcBulkDescriptor descriptor;
+  while (tx_->release.Pop(&descriptor)) {
+    if (!tx_->Valid(descriptor)) {
+      ++stats_.invalid_descriptors;
+      continue;
+    }
+    const uint32_t index = descriptor.offset / tx_->slab_size;
+    const uint64_t latency_us = now_us - send_us_[index];
+    ++stats_.messages_completed;
+    stats_.total_latency_us += latency_us;
+    if (latency_us > stats_.max_latency_us) stats_.max_latency_us = latency_us;
+    free_slabs_.push_back(index);
+    --in_flight_;
+  }
+}
+
+IpcBulkBuffer IpcBulkEndpoint::Allocate(uint64_t now_us) {
+  Reclaim(now_us);
+  if (free_slabs_.empty()) {
+    ++stats_.allocation_failures;
+    return {nullptr, 0};
+  }
+
+  const uint32_t index = free_slabs_.back();
+  free_slabs_.pop_back();
+  return {reinterpret_cast<uint8_t*>(tx_->base) + index * tx_->slab_size,
+          tx_->slab_size};
+}
+
+bool IpcBulkEndpoint::Send(const IpcBulkBuffer& buffer, size_t size,
+                           uint32_t type, uint64_t now_us) {
+  if (size > tx_->slab_size) return false;
+
+  const uint32_t index = SlabIndex(reinterpret_cast<uintptr_t>(buffer.data));
+  if (cache_.clean) cache_.clean(buffer.data, size);
+  send_us_[index] = now_us;
+  // There are never more slabs than ring entries, so this can't fail.
+  tx_->submit.Push({index * tx_->slab_size, static_cast<uint32_t>(size), type});
+
+  ++stats_.messages_sent;
+  stats_.bytes_sent += size;
+  if (++in_flight_ > stats_.max_in_flight) stats_.max_in_flight = in_flight_;
+  return true;
+}
+
+void IpcBulkEndpoint::Free(const IpcBulkBuffer& buffer) {
+  free_slabs_.push_back(SlabIndex(reinterpret_cast<uintptr_t>(buffer.data)));
+}
+
+bool IpcBulkEndpoint::Receive(IpcBulkMessage* message) {
+  IpcBulkDescriptor descriptor;
+  while (rx_->submit.Pop(&descriptor)) {
+    if (!rx_->Valid(descriptor)) {
+      ++stats_.invalid_descriptors;
+      continue;
+    }
+
+    message->data = reinterpret_cast<uint8_t*>(rx_->base) + descriptor.offset;
+    message->size = descriptor.size;
+    message->type = descriptor.type;
+    if (cache_.invalidate) cache_.invalidate(message->data, message->size);
+
+    ++stats_.messages_received;
+    stats_.bytes_received += descriptor.size;
+    return true;
+  }
+  return false;
+}
+
+void IpcBulkEndpoint::Release(const IpcBulkMessage& message) {
+  const auto offset =
+      static_cast<uint32_t>(reinterpret_cast<uintptr_t>(message.data) -
+                            rx_->base);
+  rx_->release.Push({offset, 0, 0});
+}
+
+}  // namespace coralmicro
@@ -0,0 +1,201 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_BASE_IPC_BULK_H_
+#define LIBS_BASE_IPC_BULK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace coralmicro {
+
+// Number of descriptors in each ring, which is also the most slabs a lane can
+// have.
+inline constexpr size_t kIpcBulkRingSize = 16;
+
+// Alignment of slabs, so cache maintenance on one slab never touches another.
+inline constexpr size_t kIpcBulkSlabAlignment = 32;
+
+// @cond Do not generate docs
+// Describes one slab of data in a lane's slab region.
+struct IpcBulkDescriptor {
+  uint32_t offset;
+  uint32_t size;
+  uint32_t type;
+};
+
+// A single-producer, single-consumer ring of descriptors in shared memory.
+// `head` is only written by the producer and `tail` only by the consumer, so
+// neither core needs atomic read-modify-write instructions.
+struct IpcBulkRing {
+  volatile uint32_t head;
+  volatile uint32_t tail;
+  IpcBulkDescriptor entries[kIpcBulkRingSize];
+
+  void Reset();
+  bool Push(const IpcBulkDescriptor& descriptor);
+  bool Pop(IpcBulkDescriptor* descriptor);
+  size_t Size() const;
+};
+
+// Everything shared between the two cores for one direction of transfer: the
+// geometry of the sender's slab region, a ring of filled slabs for the
+// receiver, and a ring of consumed slabs back to the sender.
+struct IpcBulkLane {
+  uintptr_t base;
+  uint32_t slab_size;
+  uint32_t num_slabs;
+  IpcBulkRing submit;
+  IpcBulkRing release;
+
+  void Init(uint8_t* slabs, size_t slab_size, size_t num_slabs);
+  bool Valid(const IpcBulkDescriptor& descriptor) const;
+};
+// @endcond
+
+// Cache maintenance used by `IpcBulkEndpoint` on slab memory.
+//
+// On a core with a data cache, set both functions so slabs are cleaned before
+// they are handed to the other core and invalidated before they are read.
+struct IpcBulkCacheOps {
+  // Writes cached data in the range back to memory.
+  void (*clean)(const void* data, size_t size) = nullptr;
+  // Discards cached data in the range so it is read again from memory.
+  void (*invalidate)(const void* data, size_t size) = nullptr;
+};
+
+// A slab allocated by `IpcBulkEndpoint::Allocate()`.
+struct IpcBulkBuffer {
+  // A pointer to the slab, or nullptr if no slab was free.
+  uint8_t* data;
+  // The size of the slab in bytes.
+  size_t capacity;
+};
+
+// A message received with `IpcBulkEndpoint::Receive()`.
+struct IpcBulkMessage {
+  // A pointer to the data in the sender's slab. Treat it as read-only.
+  uint8_t* data;
+  // The number of valid bytes.
+  size_t size;
+  // The type given to `IpcBulkEndpoint::Send()`.
+  uint32_t type;
+};
+
+// Transfer statistics reported by `IpcBulkEndpoint`.
+struct IpcBulkStats {
+  // Number of messages sent.
+  uint32_t messages_sent;
+  // Total bytes sent.
+  uint64_t bytes_sent;
+  // Number of messages received.
+  uint32_t messages_received;
+  // Total bytes received.
+  uint64_t bytes_received;
+  // Number of times `IpcBulkEndpoint::Allocate()` found no free slab.
+  uint32_t allocation_failures;
+  // Number of received descriptors dropped because they were out of bounds.
+  uint32_t invalid_descriptors;
+  // Most slabs that were in flight to the other core at once.
+  uint32_t max_in_flight;
+  // Number of sent messages that the other core has released.
+  uint32_t messages_completed;
+  // Total time from `Send()` until the other core released the slab, in
+  // microseconds, for all completed messages.
+  uint64_t total_latency_us;
+  // Longest time from `Send()` until the other core released the slab, in
+  // microseconds.
+  uint64_t max_latency_us;
+};
+
+// One core's end of a zero-copy channel between the M7 and the M4.
+//
+// Each direction of the channel is an `IpcBulkLane` in memory that both cores
+// can access. The sender owns a region of equally sized slabs: it fills a
+// slab in place and passes its offset, size, and type to the receiver through
+// a descriptor ring. The receiver reads the data where it is and then hands
+// the slab back through a second ring, where the sender reclaims it. No data
+// is copied and, because each ring index is written by only one core, no
+// cross-core locks are needed.
+//
+// On the device, use `IpcBulkChannel`, which sets up the shared lanes, cache
+// maintenance, and wakeups. Calls on the sending side, and calls on the
+// receiving side, must each be serialized by the caller.
+class IpcBulkEndpoint {
+ public:
+  // Constructor.
+  //
+  // @param tx The lane to send on, which must already be initialized.
+  // @param rx The lane to receive on.
+  // @param cache Cache maintenance for slab memory.
+  IpcBulkEndpoint(IpcBulkLane* tx, IpcBulkLane* rx,
+                  const IpcBulkCacheOps& cache = {});
+
+  // Gets a free slab to fill.
+  //
+  // @param now_us The current time in microseconds, for latency statistics.
+  // @return A slab, or a buffer with a null `data` if all slabs are in use.
+  IpcBulkBuffer Allocate(uint64_t now_us);
+
+  // Sends a slab from `Allocate()` to the other core.
+  //
+  // @param buffer The slab to send. It must not be used after this call.
+  // @param size The number of valid bytes in the slab.
+  // @param type An app-defined message type.
+  // @param now_us The current time in microseconds, for latency statistics.
+  // @return True on success, false if `size` is larger than the slab.
+  bool Send(const IpcBulkBuffer& buffer, size_t size, uint32_t type,
+            uint64_t now_us);
+
+  // Returns a slab from `Allocate()` without sending it.
+  //
+  // @param buffer The slab to return.
+  void Free(const IpcBulkBuffer& buffer);
+
+  // Gets the next message from the other core.
+  //
+  // @param message The received message.
+  // @return True if a message was received, false if none is waiting.
+  bool Receive(IpcBulkMessage* message);
+
+  // Hands a received slab back to the other core.
+  //
+  // @param message A message from `Receive()`. Its data must not be used after
+  // this call.
+  void Release(const IpcBulkMessage& message);
+
+  // Gets the transfer statistics.
+  //
+  // @return A snapshot of the counters.
+  IpcBulkStats GetStats() const { return stats_; }
+
+ private:
+  uint32_t SlabIndex(uintptr_t data) const;
+  void Reclaim(uint64_t now_us);
+
+  IpcBulkLane* tx_;
+  IpcBulkLane* rx_;
+  IpcBulkCacheOps cache_;
+  std::vector<uint32_t> free_slabs_;
+  std::vector<uint64_t> send_us_;
+  uint32_t in_flight_ = 0;
+  IpcBulkStats stats_ = {};
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_BASE_IPC_BULK_H_
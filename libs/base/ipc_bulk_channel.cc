@@ -0,0 +1,224 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/base/ipc_bulk_channel.h"
+
+#include "libs/base/check.h"
+#include "libs/base/ipc_message_buffer.h"
+#include "libs/base/mutex.h"
+#include "libs/base/timer.h"
+#include "third_party/freertos_kernel/include/stream_buffer.h"
+#include "third_party/freertos_kernel/include/task.h"
+
+#if (__CORTEX_M == 7)
+#include "libs/base/ipc_m7.h"
+#include "third_party/nxp/rt1176-sdk/devices/MIMXRT1176/drivers/cm7/fsl_cache.h"
+#elif (__CORTEX_M == 4)
+#include "third_party/nxp/rt1176-sdk/devices/MIMXRT1176/drivers/cm4/fsl_cache.h"
+#endif
+
+namespace coralmicro {
+namespace {
+constexpr size_t kDoorbellSize = 4;
+
+// Doorbells wake a task on one core when the other core has pushed to a ring.
+// They are named by the core that waits on them.
+enum Doorbell {
+  kM7Data,
+  kM7Free,
+  kM4Data,
+  kM4Free,
+  kNumDoorbells,
+};
+
+#if (__CORTEX_M == 7)
+constexpr int kTxLane = 0;
+constexpr int kRxLane = 1;
+constexpr int kOwnData = kM7Data;
+constexpr int kOwnFree = kM7Free;
+constexpr int kPeerData = kM4Data;
+constexpr int kPeerFree = kM4Free;
+#else
+constexpr int kTxLane = 1;
+constexpr int kRxLane = 0;
+constexpr int kOwnData = kM4Data;
+constexpr int kOwnFree = kM4Free;
+constexpr int kPeerData = kM7Data;
+constexpr int kPeerFree = kM7Free;
+#endif
+
+void CleanCache(const void* data, size_t size) {
+  DCACHE_CleanByRange(reinterpret_cast<uint32_t>(data), size);
+}
+
+void InvalidateCache(const void* data, size_t size) {
+  DCACHE_InvalidateByRange(reinterpret_cast<uint32_t>(data), size);
+}
+}  // namespace
+
+// Lives in the uncached shared memory region, so the rings need no cache
+// maintenance. The doorbells must be there too, because the interrupt that
+// signals them only carries the low bits of their address.
+struct IpcBulkShared {
+  // M7 to M4, then M4 to M7.
+  IpcBulkLane lanes[2];
+  alignas(8) uint8_t
+      doorbells[kNumDoorbells][sizeof(IpcStreamBuffer) + kDoorbellSize + 1];
+
+  StreamBufferHandle_t Doorbell(int index) {
+    return reinterpret_cast<IpcStreamBuffer*>(doorbells[index])->stream_buffer;
+  }
+};
+
+#if (__CORTEX_M == 7)
+namespace {
+IpcBulkShared g_shared __attribute__((section(".noinit.$rpmsg_sh_mem")));
+}  // namespace
+
+void IpcBulkChannel::Init(uint8_t* slabs, size_t slab_size,
+                          size_t num_slabs) {
+  CHECK(!shared_);
+  CHECK(reinterpret_cast<uintptr_t>(slabs) % kIpcBulkSlabAlignment == 0);
+  CHECK(slab_size > 0 && slab_size % kIpcBulkSlabAlignment == 0);
+  CHECK(num_slabs > 0 && num_slabs <= kIpcBulkRingSize);
+
+  g_shared.lanes[0].Init(slabs, slab_size, num_slabs);
+  g_shared.lanes[1].Init(slabs + slab_size * num_slabs, slab_size, num_slabs);
+  for (auto& storage : g_shared.doorbells) {
+    auto* doorbell = reinterpret_cast<IpcStreamBuffer*>(storage);
+    doorbell->stream_buffer = xStreamBufferCreateStatic(
+        kDoorbellSize, /*xTriggerLevelBytes=*/1,
+        doorbell->stream_buffer_storage, &doorbell->static_stream_buffer);
+    CHECK(doorbell->stream_buffer);
+  }
+  Setup(&g_shared);
+
+  IpcMessage message;
+  message.type = IpcMessageType::kSystem;
+  message.message.system.type = IpcSystemMessageType::kBulkChannelPtr;
+  message.message.system.message.bulk_channel_ptr = &g_shared;
+  IpcM7::GetSingleton()->SendMessage(message);
+}
+#endif
+
+IpcBulkChannel::IpcBulkChannel()
+    : ready_(xSemaphoreCreateBinary()),
+      tx_mutex_(xSemaphoreCreateMutex()),
+      rx_mutex_(xSemaphoreCreateMutex()) {
+  CHECK(ready_);
+  CHECK(tx_mutex_);
+  CHECK(rx_mutex_);
+}
+
+void IpcBulkChannel::Attach(void* shared) {
+  Setup(static_cast<IpcBulkShared*>(shared));
+}
+
+void IpcBulkChannel::Setup(IpcBulkShared* shared) {
+  IpcBulkCacheOps cache;
+  cache.clean = CleanCache;
+  cache.invalidate = InvalidateCache;
+  endpoint_ = std::make_unique<IpcBulkEndpoint>(
+      &shared->lanes[kTxLane], &shared->lanes[kRxLane], cache);
+  shared_ = shared;
+  CHECK(xSemaphoreGive(ready_) == pdTRUE);
+}
+
+bool IpcBulkChannel::WaitReady(int timeout_ms) {
+  if (xSemaphoreTake(ready_, pdMS_TO_TICKS(timeout_ms)) != pdTRUE)
+    return false;
+  CHECK(xSemaphoreGive(ready_) == pdTRUE);
+  return true;
+}
+
+bool IpcBulkChannel::WaitDoorbell(int doorbell, TickType_t ticks) {
+  uint8_t rings[kDoorbellSize];
+  return xStreamBufferReceive(shared_->Doorbell(doorbell), rings,
+                              sizeof(rings), ticks) > 0;
+}
+
+void IpcBulkChannel::Ring(int doorbell) {
+  // A full doorbell already has a wakeup pending, so a failed send is fine.
+  const uint8_t ring = 1;
+  xStreamBufferSend(shared_->Doorbell(doorbell), &ring, sizeof(ring), 0);
+}
+
+IpcBulkBuffer IpcBulkChannel::Allocate(int timeout_ms) {
+  if (!shared_) return {nullptr, 0};
+
+  TimeOut_t timeout;
+  vTaskSetTimeOutState(&timeout);
+  TickType_t ticks = pdMS_TO_TICKS(timeout_ms);
+  while (true) {
+    {
+      MutexLock lock(tx_mutex_);
+      auto buffer = endpoint_->Allocate(TimerMicros());
+      if (buffer.data) return buffer;
+    }
+    if (xTaskCheckForTimeOut(&timeout, &ticks) == pdTRUE ||
+        !WaitDoorbell(kOwnFree, ticks))
+      return {nullptr, 0};
+  }
+}
+
+bool IpcBulkChannel::Send(const IpcBulkBuffer& buffer, size_t size,
+                          uint32_t type) {
+  {
+    MutexLock lock(tx_mutex_);
+    if (!endpoint_->Send(buffer, size, type, TimerMicros())) return false;
+  }
+  Ring(kPeerData);
+  return true;
+}
+
+void IpcBulkChannel::Free(const IpcBulkBuffer& buffer) {
+  MutexLock lock(tx_mutex_);
+  endpoint_->Free(buffer);
+}
+
+bool IpcBulkChannel::Receive(IpcBulkMessage* message, int timeout_ms) {
+  if (!shared_) return false;
+
+  TimeOut_t timeout;
+  vTaskSetTimeOutState(&timeout);
+  TickType_t ticks = pdMS_TO_TICKS(timeout_ms);
+  while (true) {
+    {
+      MutexLock lock(rx_mutex_);
+      if (endpoint_->Receive(message)) return true;
+    }
+    if (xTaskCheckForTimeOut(&timeout, &ticks) == pdTRUE ||
+        !WaitDoorbell(kOwnData, ticks))
+      return false;
+  }
+}
+
+void IpcBulkChannel::Release(const IpcBulkMessage& message) {
+  {
+    MutexLock lock(rx_mutex_);
+    endpoint_->Release(message);
+  }
+  Ring(kPeerFree);
+}
+
+IpcBulkStats IpcBulkChannel::GetStats() {
+  if (!shared_) return {};
+  MutexLock tx_lock(tx_mutex_);
+  MutexLock rx_lock(rx_mutex_);
+  return endpoint_->GetStats();
+}
+
+}  // namespace coralmicro
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_BASE_IPC_BULK_CHANNEL_H_
+#define LIBS_BASE_IPC_BULK_CHANNEL_H_
+
+#include <memory>
+
+#include "libs/base/ipc_bulk.h"
+#include "third_party/freertos_kernel/include/FreeRTOS.h"
+#include "third_party/freertos_kernel/include/semphr.h"
+
+namespace coralmicro {
+
+// @cond Do not generate docs
+struct IpcBulkShared;
+// @endcond
+
+// Singleton object that moves large buffers, such as camera frames and
+// tensors, between the M7 and the M4 without copying them.
+//
+// Unlike `Ipc::SendMessage()`, which copies up to 127 bytes per message,
+// the channel sends a descriptor that points into a slab of memory that both
+// cores can access. Descriptor rings live in the uncached `rpmsg_sh_mem`
+// region; slabs should be in SDRAM, and are cleaned from and invalidated in
+// the data cache around each handoff.
+//
+// The M7 sets up the channel after starting the M4, with memory for
+// `2 * num_slabs` slabs (half for each direction):
+//
+// ```
+// uint8_t slabs[2 * 4 * 64 * 1024] __attribute__((aligned(32)))
+//     __attribute__((section(".sdram_bss,\"aw\",%nobits @")));
+//
+// IpcM7::GetSingleton()->StartM4();
+// auto* channel = IpcBulkChannel::GetSingleton();
+// channel->Init(slabs, /*slab_size=*/64 * 1024, /*num_slabs=*/4);
+//
+// IpcBulkBuffer buffer = channel->Allocate(/*timeout_ms=*/100);
+// if (buffer.data) {
+//   auto size = FillFrame(buffer.data, buffer.capacity);
+//   channel->Send(buffer, size, kFrameType);
+// }
+// ```
+//
+// The M4 waits for the channel and then receives from it:
+//
+// ```
+// auto* channel = IpcBulkChannel::GetSingleton();
+// while (!channel->WaitReady(/*timeout_ms=*/1000)) {}
+// while (true) {
+//   IpcBulkMessage message;
+//   if (!channel->Receive(&message, /*timeout_ms=*/1000)) continue;
+//   Process(message.data, message.size);
+//   channel->Release(message);
+// }
+// ```
+//
+// Any task can send and receive, but on each core only one task at a time may
+// wait in `Allocate()` and one in `Receive()`.
+class IpcBulkChannel {
+ public:
+  // Gets the `IpcBulkChannel` singleton for this core.
+  //
+  // @return A pointer to the singleton.
+  static IpcBulkChannel* GetSingleton() {
+    static IpcBulkChannel channel;
+    return &channel;
+  }
+
+#if (__CORTEX_M == 7)
+  // Sets up the channel and shares it with the M4.
+  //
+  // Call this once on the M7, after `IpcM7::StartM4()`.
+  //
+  // @param slabs Memory for `2 * num_slabs` slabs, aligned to
+  // `kIpcBulkSlabAlignment` bytes, that both cores can access.
+  // @param slab_size The size of each slab in bytes; a multiple of
+  // `kIpcBulkSlabAlignment`.
+  // @param num_slabs The number of slabs for each direction, at most
+  // `kIpcBulkRingSize`.
+  void Init(uint8_t* slabs, size_t slab_size, size_t num_slabs);
+#endif
+
+  // @cond Do not generate docs
+  // Attaches the M4 to the channel set up by the M7.
+  void Attach(void* shared);
+  // @endcond
+
+  // Waits until the channel is set up on both cores.
+  //
+  // @param timeout_ms Maximum time to wait, in milliseconds.
+  // @return True if the channel is ready, false on timeout.
+  bool WaitReady(int timeout_ms);
+
+  // Gets a free slab to send to the other core.
+  //
+  // @param timeout_ms Maximum time to wait for the other core to release a
+  // slab, in milliseconds.
+  // @return A slab, or a buffer with a null `data` on timeout.
+  IpcBulkBuffer Allocate(int timeout_ms);
+
+  // Sends a slab from `Allocate()` to the other core.
+  //
+  // @param buffer The slab to send. It must not be used after this call.
+  // @param size The number of valid bytes in the slab.
+  // @param type An app-defined message type.
+  // @return True on success, false if `size` is larger than the slab.
+  bool Send(const IpcBulkBuffer& buffer, size_t size, uint32_t type);
+
+  // Returns a slab from `Allocate()` without sending it.
+  //
+  // @param buffer The slab to return.
+  void Free(const IpcBulkBuffer& buffer);
+
+  // Waits for a message from the other core.
+  //
+  // @param message The received message.
+  // @param timeout_ms Maximum time to wait, in milliseconds.
+  // @return True if a message was received, false on timeout.
+  bool Receive(IpcBulkMessage* message, int timeout_ms);
+
+  // Hands a received slab back to the other core.
+  //
+  // @param message A message from `Receive()`. Its data must not be used after
+  // this call.
+  void Release(const IpcBulkMessage& message);
+
+  // Gets the transfer statistics for this core.
+  //
+  // @return A snapshot of the counters, or all zeros before the channel is
+  // ready.
+  IpcBulkStats GetStats();
+
+ private:
+  IpcBulkChannel();
+  IpcBulkChannel(const IpcBulkChannel&) = delete;
+  IpcBulkChannel& operator=(const IpcBulkChannel&) = delete;
+
+  void Setup(IpcBulkShared* shared);
+  bool WaitDoorbell(int doorbell, TickType_t ticks);
+  void Ring(int doorbell);
+
+  IpcBulkShared* shared_ = nullptr;
+  std::unique_ptr<IpcBulkEndpoint> endpoint_;
+  SemaphoreHandle_t ready_;
+  SemaphoreHandle_t tx_mutex_;
+  SemaphoreHandle_t rx_mutex_;
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_BASE_IPC_BULK_CHANNEL_H_
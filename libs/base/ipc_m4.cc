@@ -19,6 +19,7 @@
 #include <cstdio>
 
 #include "libs/base/console_m4.h"
+#include "libs/base/ipc_bulk_channel.h"
 #include "libs/base/ipc_message_buffer.h"
 #include "third_party/freertos_kernel/include/FreeRTOS.h"
 #include "third_party/freertos_kernel/include/message_buffer.h"
@@ -33,6 +34,10 @@ void IpcM4::HandleSystemMessage(const IpcSystemMessage& message) {
       ConsoleM4SetBuffer(
           static_cast<IpcStreamBuffer*>(message.message.console_buffer_ptr));
       break;
+    case IpcSystemMessageType::kBulkChannelPtr:
+      IpcBulkChannel::GetSingleton()->Attach(
+          message.message.bulk_channel_ptr);
+      break;
     default:
       printf("Unhandled system message type: %d\r\n",
              static_cast<int>(message.type));
@@ -27,6 +27,8 @@ namespace coralmicro {
 enum class IpcSystemMessageType : uint8_t {
   // A message with a pointer to a console buffer.
   kConsoleBufferPtr,
+  // A message with a pointer to the shared state of `IpcBulkChannel`.
+  kBulkChannelPtr,
 };
 
 // System message to be sent from `IpcM4` or `IpcM7`.
@@ -37,6 +39,7 @@ struct IpcSystemMessage {
   // Pointer to console buffer.
   union {
     void* console_buffer_ptr;
+    void* bulk_channel_ptr;
   } message;
 } __attribute__((packed));
 // @endcond
@@ -0,0 +1,268 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/base/lfs_async_writer.h"
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include "libs/base/check.h"
+#include "libs/base/mutex.h"
+#include "libs/base/timer.h"
+
+namespace coralmicro {
+namespace {
+// Lets a `Flush()` that timed out return while the writer task still holds
+// the record.
+struct FlushState {
+  SemaphoreHandle_t done = xSemaphoreCreateBinary();
+  ~FlushState() { vSemaphoreDelete(done); }
+};
+}  // namespace
+
+struct LfsAsyncWriter::Record {
+  enum class Type { kWriteFile, kAppend, kFlush };
+
+  Type type;
+  std::string path;
+  BufferPool::Handle handle;
+  std::vector<uint8_t> bytes;
+  std::shared_ptr<FlushState> flush;
+
+  const uint8_t* Data() const {
+    return handle ? handle.Data() : bytes.data();
+  }
+  size_t Size() const { return handle ? handle.Size() : bytes.size(); }
+};
+
+LfsAsyncWriter::LfsAsyncWriter() : mutex_(xSemaphoreCreateMutex()) {
+  CHECK(mutex_);
+}
+
+void LfsAsyncWriter::Start(const LfsAsyncWriterConfig& config) {
+  CHECK(!queue_);
+  CHECK(config.queue_size > 0 && config.max_open_files > 0);
+  config_ = config;
+  queue_ = xQueueCreate(config.queue_size, sizeof(Record*));
+  CHECK(queue_);
+  CHECK(xTaskCreate(StaticTask, "lfs_async_writer", config.stack_size, this,
+                    config.task_priority, nullptr) == pdPASS);
+}
+
+bool LfsAsyncWriter::Reserve(size_t bytes) {
+  MutexLock lock(mutex_);
+  if (!queue_ || stats_.queued_bytes + bytes > config_.max_queued_bytes) {
+    ++stats_.dropped_writes;
+    return false;
+  }
+  stats_.queued_bytes += bytes;
+  return true;
+}
+
+bool LfsAsyncWriter::Enqueue(Record* record) {
+  if (xQueueSend(queue_, &record, 0) != pdTRUE) {
+    MutexLock lock(mutex_);
+    stats_.queued_bytes -= record->bytes.size();
+    ++stats_.dropped_writes;
+    delete record;
+    return false;
+  }
+
+  MutexLock lock(mutex_);
+  stats_.max_queue_depth = std::max(
+      stats_.max_queue_depth, static_cast<int>(uxQueueMessagesWaiting(queue_)));
+  return true;
+}
+
+bool LfsAsyncWriter::WriteFile(const char* path, BufferPool::Handle data) {
+  if (!Reserve(0)) return false;
+  return Enqueue(
+      new Record{Record::Type::kWriteFile, path, std::move(data), {}, {}});
+}
+
+bool LfsAsyncWriter::WriteFile(const char* path, const uint8_t* data,
+                               size_t size) {
+  if (!Reserve(size)) return false;
+  return Enqueue(new Record{
+      Record::Type::kWriteFile, path, {}, {data, data + size}, {}});
+}
+
+bool LfsAsyncWriter::Append(const char* path, const uint8_t* data,
+                            size_t size) {
+  if (!Reserve(size)) return false;
+  return Enqueue(
+      new Record{Record::Type::kAppend, path, {}, {data, data + size}, {}});
+}
+
+bool LfsAsyncWriter::Flush(int timeout_ms) {
+  if (!queue_) return false;
+
+  auto flush = std::make_shared<FlushState>();
+  if (!flush->done) return false;
+  auto* record = new Record{Record::Type::kFlush, {}, {}, {}, flush};
+  if (xQueueSend(queue_, &record, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+    delete record;
+    return false;
+  }
+  return xSemaphoreTake(flush->done, pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
+}
+
+LfsAsyncWriterStats LfsAsyncWriter::GetStats() {
+  MutexLock lock(mutex_);
+  auto stats = stats_;
+  stats.queue_depth = queue_ ? uxQueueMessagesWaiting(queue_) : 0;
+  return stats;
+}
+
+void LfsAsyncWriter::StaticTask(void* param) {
+  static_cast<LfsAsyncWriter*>(param)->Task();
+}
+
+void LfsAsyncWriter::Task() {
+  const uint64_t sync_interval_us = config_.sync_interval_ms * 1000ull;
+  while (true) {
+    // Sleep until the next write, or until unsynced appends are due.
+    TickType_t wait = portMAX_DELAY;
+    if (unsynced_bytes_ != 0) {
+      const uint64_t age_us = TimerMicros() - first_unsynced_us_;
+      wait = age_us >= sync_interval_us
+                 ? 0
+                 : pdMS_TO_TICKS((sync_interval_us - age_us) / 1000 + 1);
+    }
+
+    Record* record;
+    if (xQueueReceive(queue_, &record, wait) == pdTRUE) {
+      Process(record);
+      MutexLock lock(mutex_);
+      stats_.queued_bytes -= record->bytes.size();
+      delete record;
+    }
+
+    if (unsynced_bytes_ != 0 &&
+        (unsynced_bytes_ >= config_.sync_bytes ||
+         TimerMicros() - first_unsynced_us_ >= sync_interval_us))
+      SyncAll();
+  }
+}
+
+void LfsAsyncWriter::Process(Record* record) {
+  const auto start_us = TimerMicros();
+  bool ok = true;
+  switch (record->type) {
+    case Record::Type::kWriteFile:
+      Close(record->path);
+      ok = LfsWriteFile(record->path.c_str(), record->Data(), record->Size());
+      break;
+    case Record::Type::kAppend: {
+      auto* open_file = OpenForAppend(record->path);
+      ok = open_file != nullptr;
+      if (ok) {
+        auto n = lfs_file_write(Lfs(), &open_file->file, record->Data(),
+                                record->Size());
+        ok = n >= 0 && static_cast<size_t>(n) == record->Size();
+        if (!ok) Close(record->path);
+      }
+      if (ok) {
+        if (unsynced_bytes_ == 0) first_unsynced_us_ = start_us;
+        unsynced_bytes_ += record->Size();
+      }
+      break;
+    }
+    case Record::Type::kFlush:
+      CloseAll();
+      xSemaphoreGive(record->flush->done);
+      return;
+  }
+
+  const auto write_us = TimerMicros() - start_us;
+  MutexLock lock(mutex_);
+  stats_.max_write_us = std::max(stats_.max_write_us, write_us);
+  if (!ok) {
+    ++stats_.failed_writes;
+    return;
+  }
+  if (record->type == Record::Type::kWriteFile) {
+    ++stats_.files_written;
+  } else {
+    ++stats_.appends_written;
+  }
+  stats_.bytes_written += record->Size();
+}
+
+LfsAsyncWriter::OpenFile* LfsAsyncWriter::OpenForAppend(
+    const std::string& path) {
+  const auto now_us = TimerMicros();
+  for (auto* open_file : open_files_) {
+    if (open_file->path == path) {
+      open_file->last_use_us = now_us;
+      return open_file;
+    }
+  }
+
+  if (open_files_.size() >= static_cast<size_t>(config_.max_open_files)) {
+    auto lru = std::min_element(open_files_.begin(), open_files_.end(),
+                                [](const OpenFile* a, const OpenFile* b) {
+                                  return a->last_use_us < b->last_use_us;
+                                });
+    Close((*lru)->path);
+  }
+
+  auto* open_file = new OpenFile{path, {}, now_us};
+  if (lfs_file_open(Lfs(), &open_file->file, path.c_str(),
+                    LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND) < 0) {
+    delete open_file;
+    return nullptr;
+  }
+  open_files_.push_back(open_file);
+  return open_file;
+}
+
+void LfsAsyncWriter::Close(const std::string& path) {
+  for (auto it = open_files_.begin(); it != open_files_.end(); ++it) {
+    if ((*it)->path == path) {
+      lfs_file_close(Lfs(), &(*it)->file);
+      delete *it;
+      open_files_.erase(it);
+      return;
+    }
+  }
+}
+
+void LfsAsyncWriter::SyncAll() {
+  const auto start_us = TimerMicros();
+  bool ok = true;
+  for (auto* open_file : open_files_)
+    ok = lfs_file_sync(Lfs(), &open_file->file) >= 0 && ok;
+  unsynced_bytes_ = 0;
+
+  const auto sync_us = TimerMicros() - start_us;
+  MutexLock lock(mutex_);
+  stats_.max_write_us = std::max(stats_.max_write_us, sync_us);
+  ++stats_.syncs;
+  if (!ok) ++stats_.failed_writes;
+}
+
+void LfsAsyncWriter::CloseAll() {
+  if (unsynced_bytes_ != 0) SyncAll();
+  for (auto* open_file : open_files_) {
+    lfs_file_close(Lfs(), &open_file->file);
+    delete open_file;
+  }
+  open_files_.clear();
+}
+
+}  // namespace coralmicro
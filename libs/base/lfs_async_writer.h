@@ -0,0 +1,207 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_BASE_LFS_ASYNC_WRITER_H_
+#define LIBS_BASE_LFS_ASYNC_WRITER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "libs/base/buffer_pool.h"
+#include "libs/base/filesystem.h"
+#include "third_party/freertos_kernel/include/FreeRTOS.h"
+#include "third_party/freertos_kernel/include/queue.h"
+#include "third_party/freertos_kernel/include/semphr.h"
+#include "third_party/freertos_kernel/include/task.h"
+
+namespace coralmicro {
+
+// Configuration for `LfsAsyncWriter::Start()`.
+struct LfsAsyncWriterConfig {
+  // Number of writes that can wait for the writer task. Writes beyond this
+  // are dropped.
+  int queue_size = 32;
+  // Most bytes that can be copied into the queue by `Append()` and the
+  // copying `WriteFile()` at once. Writes beyond this are dropped. Buffers
+  // passed as a `BufferPool::Handle` don't count.
+  size_t max_queued_bytes = 64 * 1024;
+  // Most files kept open for appending. The least recently used file is
+  // closed to open another.
+  int max_open_files = 4;
+  // Appended data is synced to flash at least this often, in milliseconds.
+  int sync_interval_ms = 1000;
+  // Appended data is also synced once this many bytes are unsynced.
+  size_t sync_bytes = 32 * 1024;
+  // Priority of the writer task. Keep it below the tasks it offloads.
+  int task_priority = tskIDLE_PRIORITY + 1;
+  // Stack size of the writer task, in words. littlefs needs a deep stack to
+  // commit and compact metadata, so don't go much below the default.
+  uint32_t stack_size = configMINIMAL_STACK_SIZE * 10;
+};
+
+// Statistics reported by `LfsAsyncWriter`.
+struct LfsAsyncWriterStats {
+  // Number of writes waiting in the queue.
+  int queue_depth;
+  // Most writes that waited in the queue at once.
+  int max_queue_depth;
+  // Bytes copied into the queue and not yet written.
+  size_t queued_bytes;
+  // Number of whole files written.
+  uint32_t files_written;
+  // Number of appends written.
+  uint32_t appends_written;
+  // Total bytes written to flash.
+  uint64_t bytes_written;
+  // Number of writes dropped because the queue was full.
+  uint32_t dropped_writes;
+  // Number of writes that failed in littlefs.
+  uint32_t failed_writes;
+  // Number of times appended files were synced.
+  uint32_t syncs;
+  // Longest time the writer task spent on one write or sync, in
+  // microseconds.
+  uint64_t max_write_us;
+};
+
+// Singleton object that writes files on a low-priority task so callers don't
+// wait for flash.
+//
+// `LfsWriteFile()` opens, writes, and closes a file on the caller's task,
+// which can block it for many milliseconds while NAND pages are programmed.
+// `LfsAsyncWriter` instead queues the write and returns right away. Its task
+// keeps appended files open, so a stream of small appends fills whole pages
+// in the littlefs file cache instead of programming a partial page each
+// time, and syncs them when `LfsAsyncWriterConfig::sync_interval_ms` or
+// `LfsAsyncWriterConfig::sync_bytes` is reached.
+//
+// RAM use is bounded: when the queue is full, writes are dropped and counted
+// in `LfsAsyncWriterStats::dropped_writes` rather than blocking the caller.
+//
+// For example, to log detections and save frames from an inference loop:
+//
+// ```
+// auto* writer = LfsAsyncWriter::GetSingleton();
+// writer->Start(LfsAsyncWriterConfig{});
+//
+// writer->Append("/log/detections.csv", line);
+// writer->WriteFile("/frames/latest.jpg", std::move(jpeg));
+// ```
+//
+// Appended data is only visible to other readers of the file after it is
+// synced; call `Flush()` to sync everything.
+class LfsAsyncWriter {
+ public:
+  // Gets the `LfsAsyncWriter` singleton.
+  //
+  // @return A pointer to the singleton.
+  static LfsAsyncWriter* GetSingleton() {
+    static LfsAsyncWriter writer;
+    return &writer;
+  }
+
+  // Starts the writer task. Call this once, after the filesystem is
+  // initialized.
+  //
+  // @param config The writer configuration.
+  void Start(const LfsAsyncWriterConfig& config);
+
+  // Queues a write that replaces the contents of a file.
+  //
+  // @param path The file path.
+  // @param data The file contents. The buffer is held until it is written.
+  // @return True if the write was queued, false if it was dropped.
+  bool WriteFile(const char* path, BufferPool::Handle data);
+
+  // Queues a write that replaces the contents of a file, with a copy of the
+  // data.
+  //
+  // @param path The file path.
+  // @param data The file contents.
+  // @param size The size of the data in bytes.
+  // @return True if the write was queued, false if it was dropped.
+  bool WriteFile(const char* path, const uint8_t* data, size_t size);
+
+  // Queues data to append to a file, creating the file if needed.
+  //
+  // @param path The file path.
+  // @param data The data to append. It is copied.
+  // @param size The size of the data in bytes.
+  // @return True if the append was queued, false if it was dropped.
+  bool Append(const char* path, const uint8_t* data, size_t size);
+
+  // Queues a string to append to a file, creating the file if needed.
+  //
+  // @param path The file path.
+  // @param str The string to append. It is copied.
+  // @return True if the append was queued, false if it was dropped.
+  bool Append(const char* path, const std::string& str) {
+    return Append(path, reinterpret_cast<const uint8_t*>(str.data()),
+                  str.size());
+  }
+
+  // Waits until all queued writes are done, then syncs and closes all open
+  // files.
+  //
+  // @param timeout_ms Maximum time to wait, in milliseconds.
+  // @return True if everything was written, false on timeout.
+  bool Flush(int timeout_ms);
+
+  // Gets the writer statistics.
+  //
+  // @return A snapshot of the counters.
+  LfsAsyncWriterStats GetStats();
+
+ private:
+  struct Record;
+  struct OpenFile {
+    std::string path;
+    lfs_file_t file;
+    uint64_t last_use_us;
+  };
+
+  LfsAsyncWriter();
+  LfsAsyncWriter(const LfsAsyncWriter&) = delete;
+  LfsAsyncWriter& operator=(const LfsAsyncWriter&) = delete;
+
+  bool Reserve(size_t bytes);
+  bool Enqueue(Record* record);
+  static void StaticTask(void* param);
+  void Task();
+  void Process(Record* record);
+  OpenFile* OpenForAppend(const std::string& path);
+  void Close(const std::string& path);
+  void SyncAll();
+  void CloseAll();
+
+  LfsAsyncWriterConfig config_;
+  QueueHandle_t queue_ = nullptr;
+  SemaphoreHandle_t mutex_;
+
+  // Used only by the writer task.
+  std::vector<OpenFile*> open_files_;
+  size_t unsynced_bytes_ = 0;
+  uint64_t first_unsynced_us_ = 0;
+
+  // Protected by mutex_.
+  LfsAsyncWriterStats stats_ = {};
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_BASE_LFS_ASYNC_WRITER_H_
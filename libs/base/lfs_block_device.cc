@@ -0,0 +1,161 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/base/lfs_block_device.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace coralmicro {
+
+LfsRamFlash::LfsRamFlash(size_t page_size, size_t pages_per_block,
+                         size_t block_count, const LfsRamFlashTiming& timing)
+    : page_size_(page_size),
+      pages_per_block_(pages_per_block),
+      timing_(timing),
+      data_(page_size * pages_per_block * block_count, 0xFF),
+      programmed_(pages_per_block * block_count, false) {}
+
+bool LfsRamFlash::ReadPage(uint32_t page, uint8_t* data, size_t size) {
+  if (page >= programmed_.size() || size > page_size_) return false;
+  std::memcpy(data, &data_[page * page_size_], size);
+  elapsed_us_ += timing_.read_us;
+  return true;
+}
+
+bool LfsRamFlash::ProgramPage(uint32_t page, const uint8_t* data,
+                              size_t size) {
+  if (page >= programmed_.size() || size > page_size_ || programmed_[page])
+    return false;
+  std::memcpy(&data_[page * page_size_], data, size);
+  programmed_[page] = true;
+  elapsed_us_ += timing_.prog_us;
+  return true;
+}
+
+bool LfsRamFlash::EraseBlock(uint32_t block) {
+  const size_t first = block * pages_per_block_;
+  if (first >= programmed_.size()) return false;
+  std::fill_n(&data_[first * page_size_], pages_per_block_ * page_size_, 0xFF);
+  std::fill_n(programmed_.begin() + first, pages_per_block_, false);
+  elapsed_us_ += timing_.erase_us;
+  return true;
+}
+
+LfsBlockDevice::LfsBlockDevice(LfsFlash* flash, size_t page_size,
+                               size_t pages_per_block, size_t block_count,
+                               const LfsBlockDeviceConfig& config,
+                               ClockFn clock, void* clock_ctx)
+    : flash_(flash),
+      page_size_(page_size),
+      pages_per_block_(pages_per_block),
+      block_count_(block_count),
+      config_(config),
+      clock_(clock),
+      clock_ctx_(clock_ctx),
+      erase_counts_(block_count) {
+  if (config_.cache_pages == 0 || pages_per_block % config_.cache_pages != 0)
+    config_.cache_pages = 1;
+}
+
+void LfsBlockDevice::Configure(lfs_config* config) {
+  config->context = this;
+  config->read = [](const lfs_config* c, lfs_block_t block, lfs_off_t off,
+                    void* buffer, lfs_size_t size) {
+    return static_cast<LfsBlockDevice*>(c->context)->Read(block, off, buffer,
+                                                          size);
+  };
+  config->prog = [](const lfs_config* c, lfs_block_t block, lfs_off_t off,
+                    const void* buffer, lfs_size_t size) {
+    return static_cast<LfsBlockDevice*>(c->context)->Prog(block, off, buffer,
+                                                          size);
+  };
+  config->erase = [](const lfs_config* c, lfs_block_t block) {
+    return static_cast<LfsBlockDevice*>(c->context)->Erase(block);
+  };
+  config->read_size = page_size_;
+  config->prog_size = page_size_;
+  config->block_size = page_size_ * pages_per_block_;
+  config->block_count = block_count_;
+  config->cache_size = page_size_ * config_.cache_pages;
+  // One bit per block, in multiples of 8 bytes.
+  config->lookahead_size = config_.lookahead_size
+                               ? config_.lookahead_size
+                               : (block_count_ + 63) / 64 * 8;
+}
+
+LfsBlockDeviceStats LfsBlockDevice::GetStats() const {
+  auto stats = stats_;
+  stats.max_block_erases =
+      *std::max_element(erase_counts_.begin(), erase_counts_.end());
+  return stats;
+}
+
+void LfsBlockDevice::ResetStats() {
+  stats_ = {};
+  std::fill(erase_counts_.begin(), erase_counts_.end(), 0);
+}
+
+int LfsBlockDevice::Read(lfs_block_t block, lfs_off_t off, void* buffer,
+                         lfs_size_t size) {
+  // littlefs only reads whole pages because read_size is the page size.
+  if (off % page_size_ != 0 || size % page_size_ != 0) return LFS_ERR_INVAL;
+
+  const uint32_t first = block * pages_per_block_ + off / page_size_;
+  const uint32_t count = size / page_size_;
+  auto* data = static_cast<uint8_t*>(buffer);
+  const auto start = Now();
+  for (uint32_t i = 0; i < count; ++i) {
+    if (!flash_->ReadPage(first + i, data + i * page_size_, page_size_)) {
+      stats_.read_us += Now() - start;
+      return LFS_ERR_IO;
+    }
+    ++stats_.page_reads;
+  }
+  stats_.read_us += Now() - start;
+  return LFS_ERR_OK;
+}
+
+int LfsBlockDevice::Prog(lfs_block_t block, lfs_off_t off, const void* buffer,
+                         lfs_size_t size) {
+  if (off % page_size_ != 0 || size % page_size_ != 0) return LFS_ERR_INVAL;
+
+  const uint32_t first = block * pages_per_block_ + off / page_size_;
+  const uint32_t count = size / page_size_;
+  const auto* data = static_cast<const uint8_t*>(buffer);
+  const auto start = Now();
+  for (uint32_t i = 0; i < count; ++i) {
+    if (!flash_->ProgramPage(first + i, data + i * page_size_, page_size_)) {
+      stats_.prog_us += Now() - start;
+      return LFS_ERR_IO;
+    }
+    ++stats_.page_writes;
+  }
+  stats_.prog_us += Now() - start;
+  return LFS_ERR_OK;
+}
+
+int LfsBlockDevice::Erase(lfs_block_t block) {
+  const auto start = Now();
+  const bool ok = flash_->EraseBlock(block);
+  stats_.erase_us += Now() - start;
+  if (!ok) return LFS_ERR_IO;
+  ++erase_counts_[block];
+  ++stats_.block_erases;
+  return LFS_ERR_OK;
+}
+
+}  // namespace coralmicro
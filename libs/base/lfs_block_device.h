@@ -0,0 +1,209 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_BASE_LFS_BLOCK_DEVICE_H_
+#define LIBS_BASE_LFS_BLOCK_DEVICE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "third_party/nxp/rt1176-sdk/middleware/littlefs/lfs.h"
+
+namespace coralmicro {
+
+// Tunable parameters of the littlefs block device.
+//
+// None of these change the on-flash format, so they can be changed between
+// boots without reformatting.
+struct LfsBlockDeviceConfig {
+  // Size of the littlefs read, program, and per-file caches, in flash pages.
+  // Larger caches let littlefs read and program several pages per call.
+  // Must divide the number of pages per block.
+  size_t cache_pages = 4;
+  // Size of the littlefs lookahead buffer in bytes, or 0 to size it for the
+  // whole device (one bit per block).
+  size_t lookahead_size = 0;
+};
+
+// Block device statistics reported by `LfsBlockDevice`. The times are 0 if
+// the device was created without a clock.
+struct LfsBlockDeviceStats {
+  // Number of pages read from flash.
+  uint32_t page_reads;
+  // Number of pages programmed.
+  uint32_t page_writes;
+  // Number of blocks erased.
+  uint32_t block_erases;
+  // Largest number of times any one block was erased.
+  uint32_t max_block_erases;
+  // Time spent reading from flash, in microseconds.
+  uint64_t read_us;
+  // Time spent programming flash, in microseconds.
+  uint64_t prog_us;
+  // Time spent erasing flash, in microseconds.
+  uint64_t erase_us;
+};
+
+// Page-level access to NAND flash, used by `LfsBlockDevice`.
+//
+// Pages and blocks are numbered from the start of the filesystem region.
+class LfsFlash {
+ public:
+  virtual ~LfsFlash() = default;
+
+  // Reads one page.
+  //
+  // @param page The page number.
+  // @param data The buffer to read into.
+  // @param size The number of bytes to read, at most one page.
+  // @return True on success, false otherwise.
+  virtual bool ReadPage(uint32_t page, uint8_t* data, size_t size) = 0;
+
+  // Programs one erased page.
+  //
+  // @param page The page number.
+  // @param data The data to program.
+  // @param size The number of bytes to program, at most one page.
+  // @return True on success, false otherwise.
+  virtual bool ProgramPage(uint32_t page, const uint8_t* data,
+                           size_t size) = 0;
+
+  // Erases one block.
+  //
+  // @param block The block number.
+  // @return True on success, false otherwise.
+  virtual bool EraseBlock(uint32_t block) = 0;
+};
+
+// Flash timing used by `LfsRamFlash` to estimate how long operations would
+// take on the device.
+struct LfsRamFlashTiming {
+  // Time to read one page, in microseconds.
+  uint32_t read_us = 80;
+  // Time to program one page, in microseconds.
+  uint32_t prog_us = 300;
+  // Time to erase one block, in microseconds.
+  uint32_t erase_us = 2000;
+};
+
+// NAND flash simulated in RAM, for trying `LfsBlockDeviceConfig` choices on a
+// host.
+//
+// Like real NAND, erased bytes read as 0xFF and programming can only clear
+// bits, so programming a page twice without an erase is reported as an
+// error. `ElapsedMicros()` is a simulated clock that advances by
+// `LfsRamFlashTiming` on each operation; pass it as the clock of
+// `LfsBlockDevice` to compare configurations.
+class LfsRamFlash : public LfsFlash {
+ public:
+  // Constructor.
+  //
+  // @param page_size The page size in bytes.
+  // @param pages_per_block The number of pages in each erase block.
+  // @param block_count The number of blocks.
+  // @param timing Simulated operation times.
+  LfsRamFlash(size_t page_size, size_t pages_per_block, size_t block_count,
+              const LfsRamFlashTiming& timing = {});
+
+  bool ReadPage(uint32_t page, uint8_t* data, size_t size) override;
+  bool ProgramPage(uint32_t page, const uint8_t* data, size_t size) override;
+  bool EraseBlock(uint32_t block) override;
+
+  // Gets the simulated time spent in flash operations.
+  //
+  // @return The simulated time in microseconds.
+  uint64_t ElapsedMicros() const { return elapsed_us_; }
+
+ private:
+  size_t page_size_;
+  size_t pages_per_block_;
+  LfsRamFlashTiming timing_;
+  std::vector<uint8_t> data_;
+  std::vector<bool> programmed_;
+  uint64_t elapsed_us_ = 0;
+};
+
+// Connects littlefs to page-based NAND flash, with instrumentation.
+//
+// littlefs serializes all calls to the block device, so this class has no
+// locking of its own.
+class LfsBlockDevice {
+ public:
+  // Function that returns the current time in microseconds.
+  using ClockFn = uint64_t (*)(void* ctx);
+
+  // Constructor.
+  //
+  // @param flash The flash to use.
+  // @param page_size The page size in bytes.
+  // @param pages_per_block The number of pages in each erase block.
+  // @param block_count The number of blocks.
+  // @param config Tunable parameters.
+  // @param clock Clock used to time flash operations, or nullptr to not
+  // measure time.
+  // @param clock_ctx Context passed to `clock`.
+  LfsBlockDevice(LfsFlash* flash, size_t page_size, size_t pages_per_block,
+                 size_t block_count, const LfsBlockDeviceConfig& config = {},
+                 ClockFn clock = nullptr, void* clock_ctx = nullptr);
+
+  // Fills in the geometry, cache sizes, and callbacks of a littlefs
+  // configuration. The caller sets the remaining fields, such as
+  // `block_cycles` and the lock callbacks.
+  //
+  // @param config The littlefs configuration.
+  void Configure(lfs_config* config);
+
+  // Gets the block device statistics.
+  //
+  // @return A snapshot of the counters.
+  LfsBlockDeviceStats GetStats() const;
+
+  // Gets the number of times a block was erased since the device was
+  // created.
+  //
+  // @param block The block number.
+  // @return The erase count.
+  uint32_t EraseCount(uint32_t block) const { return erase_counts_[block]; }
+
+  // Resets all statistics, including erase counts.
+  void ResetStats();
+
+  // @cond Do not generate docs
+  int Read(lfs_block_t block, lfs_off_t off, void* buffer, lfs_size_t size);
+  int Prog(lfs_block_t block, lfs_off_t off, const void* buffer,
+           lfs_size_t size);
+  int Erase(lfs_block_t block);
+  // @endcond
+
+ private:
+  uint64_t Now() { return clock_ ? clock_(clock_ctx_) : 0; }
+
+  LfsFlash* flash_;
+  size_t page_size_;
+  size_t pages_per_block_;
+  size_t block_count_;
+  LfsBlockDeviceConfig config_;
+  ClockFn clock_;
+  void* clock_ctx_;
+
+  std::vector<uint32_t> erase_counts_;
+  LfsBlockDeviceStats stats_ = {};
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_BASE_LFS_BLOCK_DEVICE_H_
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/base/log_ring.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace coralmicro {
+namespace {
+// Each record starts with a 4-byte header. A header of zero means the record
+// is reserved but not yet committed; the reader clears everything it has
+// read, so unwritten headers always read as zero.
+constexpr uint32_t kHeaderSize = sizeof(uint32_t);
+constexpr uint32_t kCommitted = 1u << 31;
+// Skips from the header to the end of the ring, when a record didn't fit
+// before the end. The length counts the whole skipped space.
+constexpr uint32_t kPadding = 1u << 30;
+constexpr uint32_t kLengthMask = kPadding - 1;
+
+uint32_t RecordSize(size_t size) {
+  return (kHeaderSize + size + kHeaderSize - 1) & ~(kHeaderSize - 1);
+}
+}  // namespace
+
+LogRing::LogRing(uint8_t* storage, size_t size)
+    : storage_(storage),
+      size_(size),
+      max_record_size_(size / 4 - kHeaderSize) {
+  std::memset(storage_, 0, size_);
+}
+
+void LogRing::Drop(size_t size) {
+  writes_dropped_.fetch_add(1, std::memory_order_relaxed);
+  bytes_dropped_.fetch_add(size, std::memory_order_relaxed);
+}
+
+bool LogRing::Reserve(size_t size, Span* span) {
+  if (TryReserve(size, span)) return true;
+  Drop(size);
+  return false;
+}
+
+bool LogRing::TryReserve(size_t size, Span* span) {
+  if (size > max_record_size_) return false;
+
+  // Records are contiguous; one that would cross the end of the ring starts
+  // at the beginning instead, after a padding record.
+  const uint32_t total = RecordSize(size);
+  uint32_t head = head_.load(std::memory_order_relaxed);
+  uint32_t start, next;
+  do {
+    const uint32_t offset = head & (size_ - 1);
+    start = offset + total > size_ ? head + (size_ - offset) : head;
+    next = start + total;
+    if (next - tail_.load(std::memory_order_acquire) > size_) return false;
+  } while (!head_.compare_exchange_weak(head, next, std::memory_order_acq_rel,
+                                        std::memory_order_relaxed));
+
+  if (start != head) {
+    auto* padding =
+        reinterpret_cast<uint32_t*>(storage_ + (head & (size_ - 1)));
+    __atomic_store_n(padding, kCommitted | kPadding | (start - head),
+                     __ATOMIC_RELEASE);
+  }
+
+  const uint32_t used = next - tail_.load(std::memory_order_relaxed);
+  uint32_t max_used = max_used_bytes_.load(std::memory_order_relaxed);
+  while (used > max_used &&
+         !max_used_bytes_.compare_exchange_weak(max_used, used,
+                                                std::memory_order_relaxed)) {
+  }
+
+  auto* record = storage_ + (start & (size_ - 1));
+  span->data = record + kHeaderSize;
+  span->size = size;
+  span->end = next;
+  span->header = reinterpret_cast<uint32_t*>(record);
+  return true;
+}
+
+void LogRing::Commit(const Span& span) {
+  bytes_written_.fetch_add(span.size, std::memory_order_relaxed);
+  // The reader must see the data before the header that publishes it.
+  __atomic_store_n(span.header, kCommitted | span.size, __ATOMIC_RELEASE);
+}
+
+bool LogRing::Write(const void* data, size_t size) {
+  if (size == 0) return true;
+  Span span;
+  if (!Reserve(size, &span)) return false;
+  std::memcpy(span.data, data, size);
+  Commit(span);
+  return true;
+}
+
+size_t LogRing::Read(uint8_t* buffer, size_t size) {
+  size_t copied = 0;
+  uint32_t tail = tail_.load(std::memory_order_relaxed);
+  while (copied < size) {
+    auto* record = storage_ + (tail & (size_ - 1));
+    const uint32_t header =
+        __atomic_load_n(reinterpret_cast<uint32_t*>(record), __ATOMIC_ACQUIRE);
+    if (!(header & kCommitted)) break;
+
+    const uint32_t length = header & kLengthMask;
+    uint32_t total = length;
+    if (!(header & kPadding)) {
+      total = RecordSize(length);
+      const size_t n = std::min<size_t>(length - read_offset_, size - copied);
+      std::memcpy(buffer + copied, record + kHeaderSize + read_offset_, n);
+      copied += n;
+      read_offset_ += n;
+      if (read_offset_ < length) break;
+      read_offset_ = 0;
+    }
+
+    // Clear the record so its space reads as uncommitted when reused, then
+    // hand the space back to writers.
+    std::memset(record, 0, total);
+    tail += total;
+    tail_.store(tail, std::memory_order_release);
+  }
+  return copied;
+}
+
+LogRingStats LogRing::GetStats() const {
+  return {bytes_written_.load(std::memory_order_relaxed),
+          writes_dropped_.load(std::memory_order_relaxed),
+          bytes_dropped_.load(std::memory_order_relaxed),
+          max_used_bytes_.load(std::memory_order_relaxed)};
+}
+
+}  // namespace coralmicro
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_BASE_LOG_RING_H_
+#define LIBS_BASE_LOG_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace coralmicro {
+
+// Statistics reported by `LogRing`.
+struct LogRingStats {
+  // Total bytes committed to the ring.
+  uint32_t bytes_written;
+  // Number of writes dropped because the ring was full.
+  uint32_t writes_dropped;
+  // Total bytes of the dropped writes.
+  uint32_t bytes_dropped;
+  // Most bytes, including record headers, that were in the ring at once.
+  uint32_t max_used_bytes;
+};
+
+// A fixed-size byte ring with many lock-free writers and one reader.
+//
+// Each write is a record: a writer reserves space with a single
+// compare-and-swap, copies its data in, and commits the record. Writers never
+// wait for each other or for the reader, and never allocate; when the ring is
+// full the write is dropped and counted in `LogRingStats`. The reader takes
+// committed records in order and stops at the first one still being written.
+//
+// Writers may run in any task or interrupt; `Read()` must only be called from
+// one task at a time.
+class LogRing {
+ public:
+  // Space reserved by `Reserve()`.
+  struct Span {
+    // Where to write the record data.
+    uint8_t* data;
+    // The size of the record data in bytes.
+    size_t size;
+    // The ring position just past the record, for `ReadPosition()`.
+    uint32_t end;
+    // @cond Do not generate docs
+    uint32_t* header;
+    // @endcond
+  };
+
+  // Constructor.
+  //
+  // @param storage Memory for the ring, aligned to 4 bytes. It is cleared.
+  // @param size The size of the memory in bytes, a power of two.
+  LogRing(uint8_t* storage, size_t size);
+  LogRing(const LogRing&) = delete;
+  LogRing& operator=(const LogRing&) = delete;
+
+  // Gets the largest record that can be written.
+  //
+  // @return The size in bytes.
+  size_t max_record_size() const { return max_record_size_; }
+
+  // Reserves space for a record.
+  //
+  // @param size The size of the record in bytes.
+  // @param span Receives the reserved space.
+  // @return True on success; false if the ring is full or `size` is larger
+  // than `max_record_size()`, in which case the write is counted as dropped.
+  bool Reserve(size_t size, Span* span);
+
+  // Reserves space for a record without counting a failure as a drop, for
+  // writers that wait and try again.
+  //
+  // @param size The size of the record in bytes.
+  // @param span Receives the reserved space.
+  // @return True on success; false if the ring is full or `size` is larger
+  // than `max_record_size()`.
+  bool TryReserve(size_t size, Span* span);
+
+  // Makes a reserved record visible to the reader.
+  //
+  // @param span The span from `Reserve()`.
+  void Commit(const Span& span);
+
+  // Copies data into the ring as one record.
+  //
+  // @param data The data.
+  // @param size The size of the data in bytes.
+  // @return True on success, false if the write was dropped.
+  bool Write(const void* data, size_t size);
+
+  // Takes committed data from the ring. Records are returned in order and
+  // back to back; a record larger than the buffer is returned over several
+  // calls.
+  //
+  // @param buffer The buffer to copy data into.
+  // @param size The size of the buffer in bytes.
+  // @return The number of bytes copied, or 0 if no committed data is ready.
+  size_t Read(uint8_t* buffer, size_t size);
+
+  // Gets how far the reader has taken data. A record is fully read once this
+  // reaches its `Span::end`.
+  //
+  // @return The current read position.
+  uint32_t ReadPosition() const {
+    return tail_.load(std::memory_order_acquire);
+  }
+
+  // Gets the ring statistics.
+  //
+  // @return A snapshot of the counters.
+  LogRingStats GetStats() const;
+
+ private:
+  void Drop(size_t size);
+
+  uint8_t* storage_;
+  uint32_t size_;
+  size_t max_record_size_;
+  // Next position to reserve, advanced by writers.
+  std::atomic<uint32_t> head_{0};
+  // Start of the oldest unread record, advanced by the reader.
+  std::atomic<uint32_t> tail_{0};
+  // Bytes of the record at `tail_` already returned by `Read()`.
+  size_t read_offset_ = 0;
+
+  std::atomic<uint32_t> bytes_written_{0};
+  std::atomic<uint32_t> writes_dropped_{0};
+  std::atomic<uint32_t> bytes_dropped_{0};
+  std::atomic<uint32_t> max_used_bytes_{0};
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_BASE_LOG_RING_H_
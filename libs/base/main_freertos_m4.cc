@@ -49,9 +49,9 @@ extern "C" int main(int argc, char** argv) __attribute__((weak));
 extern "C" int main(int argc, char** argv) {
   BOARD_InitHardware(true);
 
+  coralmicro::TimerInit();
   CHECK(coralmicro::LfsInit());
   coralmicro::GpioInit();
-  coralmicro::TimerInit();
 
   // Initialize I2C5 state
   NVIC_SetPriority(LPI2C5_IRQn, 3);
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/base/model_store.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "libs/base/check.h"
+#include "libs/base/filesystem.h"
+#include "libs/base/mutex.h"
+#include "libs/base/timer.h"
+
+namespace coralmicro {
+namespace {
+constexpr size_t kAlignment = 16;
+
+size_t AlignUp(size_t n) { return (n + kAlignment - 1) & ~(kAlignment - 1); }
+}  // namespace
+
+ModelStore::ModelStore() : mutex_(xSemaphoreCreateMutex()) { CHECK(mutex_); }
+
+void ModelStore::Init(uint8_t* window, size_t size) {
+  CHECK(reinterpret_cast<uintptr_t>(window) % kAlignment == 0);
+  MutexLock lock(mutex_);
+  CHECK(!window_);
+  window_ = window;
+  capacity_ = size;
+  stats_.capacity = size;
+}
+
+const uint8_t* ModelStore::Map(const char* path, size_t* size) {
+  MutexLock lock(mutex_);
+  for (const auto& entry : entries_) {
+    if (entry.path == path) {
+      ++stats_.hits;
+      if (size) *size = entry.size;
+      return window_ + entry.offset;
+    }
+  }
+
+  const auto start_us = TimerMicros();
+  lfs_file_t file;
+  if (!window_ || lfs_file_open(Lfs(), &file, path, LFS_O_RDONLY) < 0) {
+    ++stats_.failures;
+    return nullptr;
+  }
+
+  // Large reads go from flash straight into the window without passing
+  // through the littlefs cache.
+  const auto file_size = lfs_file_size(Lfs(), &file);
+  lfs_ssize_t n = -1;
+  if (file_size >= 0 && static_cast<size_t>(file_size) <= capacity_ - used_)
+    n = lfs_file_read(Lfs(), &file, window_ + used_, file_size);
+  lfs_file_close(Lfs(), &file);
+  if (n < 0 || n != file_size) {
+    printf("ModelStore: Failed to map %s (%ld bytes, %u free)\r\n", path,
+           static_cast<long>(file_size),
+           static_cast<unsigned>(capacity_ - used_));
+    ++stats_.failures;
+    return nullptr;
+  }
+
+  entries_.push_back({path, used_, static_cast<size_t>(file_size)});
+  const uint8_t* data = window_ + used_;
+  used_ = std::min(capacity_, used_ + AlignUp(file_size));
+  ++stats_.num_files;
+  stats_.used_bytes = used_;
+  stats_.total_load_us += TimerMicros() - start_us;
+  if (size) *size = file_size;
+  return data;
+}
+
+bool ModelStore::Preload(const std::vector<std::string>& paths) {
+  bool ok = true;
+  for (const auto& path : paths) ok = Map(path.c_str()) && ok;
+  return ok;
+}
+
+ModelStoreStats ModelStore::GetStats() {
+  MutexLock lock(mutex_);
+  return stats_;
+}
+
+}  // namespace coralmicro
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_BASE_MODEL_STORE_H_
+#define LIBS_BASE_MODEL_STORE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "third_party/freertos_kernel/include/FreeRTOS.h"
+#include "third_party/freertos_kernel/include/semphr.h"
+
+// Allocates a uint8_t window for `ModelStore` statically in SDRAM.
+//
+// @param name The variable name for the window.
+// @param size The size of the window in bytes.
+#define STATIC_MODEL_STORE_IN_SDRAM(name, size)          \
+  static uint8_t name[size] __attribute__((aligned(16))) \
+  __attribute__((section(".sdram_bss,\"aw\",%nobits @")))
+
+namespace coralmicro {
+
+// Usage statistics reported by `ModelStore`.
+struct ModelStoreStats {
+  // Number of files mapped into the window.
+  int num_files;
+  // Bytes of the window in use.
+  size_t used_bytes;
+  // Size of the window in bytes.
+  size_t capacity;
+  // Number of `ModelStore::Map()` calls that found the file already mapped.
+  int hits;
+  // Number of `ModelStore::Map()` calls that failed, because the file
+  // couldn't be read or didn't fit in the window.
+  int failures;
+  // Total time spent reading files into the window, in microseconds.
+  uint64_t total_load_us;
+};
+
+// Singleton object that keeps model files at fixed addresses in memory.
+//
+// `LfsReadFile()` reads a model into a vector that the caller owns, so each
+// caller that loads the same model gets its own heap copy, at whatever
+// address the allocator picks, which is freed along with the vector.
+// `ModelStore` instead reads each file once into the next free spot of a
+// window you provide, and returns the same pointer every time the file is
+// mapped again. Every user of a model shares that single copy, and because
+// its address never changes, `EdgeTpuManager::RegisterPackage()` finds the
+// Edge TPU package it already registered instead of parsing the model again.
+// The window also decides where models live: one defined with
+// `STATIC_MODEL_STORE_IN_SDRAM` keeps them in SDRAM, out of the heap.
+//
+// For example, map models once at boot and then use them anywhere:
+//
+// ```
+// STATIC_MODEL_STORE_IN_SDRAM(model_window, 8 * 1024 * 1024);
+//
+// auto* store = ModelStore::GetSingleton();
+// store->Init(model_window, sizeof(model_window));
+//
+// size_t model_size;
+// const uint8_t* model = store->Map(kModelPath, &model_size);
+// if (!model) {
+//   printf("ERROR: Failed to load %s\r\n", kModelPath);
+// }
+// tflite::MicroInterpreter interpreter(tflite::GetModel(model), ...);
+// ```
+//
+// Mapped files are never unmapped, so the window should be sized for every
+// model the app uses.
+class ModelStore {
+ public:
+  // Gets the `ModelStore` singleton.
+  //
+  // @return A pointer to the singleton.
+  static ModelStore* GetSingleton() {
+    static ModelStore store;
+    return &store;
+  }
+
+  // Sets the memory that files are mapped into. Call this once, before
+  // `Map()`.
+  //
+  // @param window Memory aligned to 16 bytes, such as one defined with
+  // `STATIC_MODEL_STORE_IN_SDRAM`.
+  // @param size The size of the window in bytes.
+  void Init(uint8_t* window, size_t size);
+
+  // Maps a file into the window, reading it from the filesystem the first
+  // time.
+  //
+  // @param path The file path.
+  // @param size If not null, set to the file size.
+  // @return A pointer to the file contents aligned to 16 bytes, which stays
+  // valid for the lifetime of the app, or nullptr if the file can't be read
+  // or doesn't fit.
+  const uint8_t* Map(const char* path, size_t* size = nullptr);
+
+  // Maps several files at once, for example at boot.
+  //
+  // @param paths The file paths.
+  // @return True if all files were mapped, false otherwise.
+  bool Preload(const std::vector<std::string>& paths);
+
+  // Gets the usage statistics.
+  //
+  // @return A snapshot of the counters.
+  ModelStoreStats GetStats();
+
+ private:
+  struct Entry {
+    std::string path;
+    size_t offset;
+    size_t size;
+  };
+
+  ModelStore();
+  ModelStore(const ModelStore&) = delete;
+  ModelStore& operator=(const ModelStore&) = delete;
+
+  SemaphoreHandle_t mutex_;
+  uint8_t* window_ = nullptr;
+  size_t capacity_ = 0;
+  size_t used_ = 0;
+  std::vector<Entry> entries_;
+  ModelStoreStats stats_ = {};
+};
+
+}  // namespace coralmicro
+
+#endif  // LIBS_BASE_MODEL_STORE_H_
@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 
 #include "libs/base/filesystem.h"
@@ -32,8 +33,107 @@ namespace coralmicro {
 
 namespace {
 inline constexpr const char kDnsServerPath[] = "/dns_server";
+
+// Most buffers passed to one `lwip_writev()` call.
+constexpr int kMaxIov = 8;
+
+// Buffers with an optional header buffer in front, such as the size and type
+// prefix of a message.
+class IoBufferList {
+ public:
+  IoBufferList(const IoBuffer& header, const IoBuffer* buffers, size_t count)
+      : header_(header), buffers_(buffers), count_(count) {}
+
+  size_t Count() const { return count_ + 1; }
+  const IoBuffer& operator[](size_t i) const {
+    return i == 0 ? header_ : buffers_[i - 1];
+  }
+
+ private:
+  IoBuffer header_;
+  const IoBuffer* buffers_;
+  size_t count_;
+};
+
+struct IoPosition {
+  size_t index = 0;
+  size_t offset = 0;
+};
+
+// Moves `pos` forward by `n` bytes, skipping empty and finished buffers.
+void Advance(const IoBufferList& list, size_t n, IoPosition* pos) {
+  while (pos->index < list.Count()) {
+    const auto left = list[pos->index].size - pos->offset;
+    if (n < left) {
+      pos->offset += n;
+      return;
+    }
+    n -= left;
+    ++pos->index;
+    pos->offset = 0;
+  }
+}
+
+// Writes `list` from `pos` with at most `chunk_size` bytes per call, leaving
+// `pos` after the last byte written. Without `block`, stops with
+// `IOStatus::kWouldBlock` as soon as the socket's send buffer is full.
+IOStatus WriteList(int fd, const IoBufferList& list, size_t chunk_size,
+                   bool block, IoPosition* pos) {
+  Advance(list, 0, pos);
+  while (pos->index < list.Count()) {
+    struct iovec iov[kMaxIov];
+    int iovcnt = 0;
+    size_t len = 0;
+    for (size_t i = pos->index, offset = pos->offset;
+         i < list.Count() && iovcnt < kMaxIov && len < chunk_size;
+         ++i, offset = 0) {
+      const auto size = std::min(list[i].size - offset, chunk_size - len);
+      if (size == 0) continue;
+      iov[iovcnt].iov_base = const_cast<uint8_t*>(
+          static_cast<const uint8_t*>(list[i].data) + offset);
+      iov[iovcnt].iov_len = size;
+      ++iovcnt;
+      len += size;
+    }
+
+    ssize_t ret;
+    if (block) {
+      ret = lwip_writev(fd, iov, iovcnt);
+    } else {
+      struct msghdr msg = {};
+      msg.msg_iov = iov;
+      msg.msg_iovlen = iovcnt;
+      ret = lwip_sendmsg(fd, &msg, MSG_DONTWAIT);
+    }
+    if (ret == -1) {
+      if (errno == EINTR) continue;
+      if (!block && errno == EWOULDBLOCK) return IOStatus::kWouldBlock;
+      return IOStatus::kError;
+    }
+
+    // The socket may take fewer bytes than offered, even when blocking.
+    Advance(list, ret, pos);
+    if (!block && static_cast<size_t>(ret) < len) return IOStatus::kWouldBlock;
+  }
+  return IOStatus::kOk;
 }
 
+IoBuffer MessageHeader(uint8_t type, size_t size, uint8_t (&header)[5]) {
+  header[0] = static_cast<uint8_t>(size);
+  header[1] = static_cast<uint8_t>(size >> 8);
+  header[2] = static_cast<uint8_t>(size >> 16);
+  header[3] = static_cast<uint8_t>(size >> 24);
+  header[4] = type;
+  return {header, sizeof(header)};
+}
+
+size_t TotalSize(const IoBuffer* buffers, size_t count) {
+  size_t size = 0;
+  for (size_t i = 0; i < count; ++i) size += buffers[i].size;
+  return size;
+}
+}  // namespace
+
 IOStatus ReadBytes(int fd, void* bytes, size_t size) {
   assert(fd >= 0);
   assert(bytes);
@@ -56,31 +156,94 @@ IOStatus WriteBytes(int fd, const void* bytes, size_t size, size_t chunk_size) {
   assert(fd >= 0);
   assert(bytes);
 
-  const char* buf = static_cast<const char*>(bytes);
-  while (size != 0) {
-    auto len = std::min(size, chunk_size);
-    auto ret = lwip_write(fd, buf, len);
-    if (ret == -1) {
-      if (errno == EINTR) continue;
-      return IOStatus::kError;
-    }
-    size -= len;
-    buf += len;
-  }
-
-  return IOStatus::kOk;
+  IoPosition pos;
+  return WriteList(fd, IoBufferList({bytes, size}, nullptr, 0), chunk_size,
+                   /*block=*/true, &pos);
 }
 
 IOStatus WriteMessage(int fd, uint8_t type, const void* bytes, size_t size,
                       size_t chunk_size) {
-  const uint8_t header[] = {
-      static_cast<uint8_t>(size), static_cast<uint8_t>(size >> 8),
-      static_cast<uint8_t>(size >> 16), static_cast<uint8_t>(size >> 24), type};
+  assert(fd >= 0);
+
+  uint8_t header[5];
+  const IoBuffer payload = {bytes, size};
+  IoPosition pos;
+  return WriteList(fd,
+                   IoBufferList(MessageHeader(type, size, header), &payload, 1),
+                   chunk_size, /*block=*/true, &pos);
+}
+
+IOStatus WriteBytesV(int fd, const IoBuffer* buffers, size_t count) {
+  assert(fd >= 0);
+
+  IoPosition pos;
+  return WriteList(fd, IoBufferList({nullptr, 0}, buffers, count), SIZE_MAX,
+                   /*block=*/true, &pos);
+}
+
+IOStatus WriteMessageV(int fd, uint8_t type, const IoBuffer* buffers,
+                       size_t count) {
+  assert(fd >= 0);
 
-  auto ret = WriteBytes(fd, header, sizeof(header), chunk_size);
-  if (ret != IOStatus::kOk) return ret;
+  uint8_t header[5];
+  IoPosition pos;
+  return WriteList(
+      fd,
+      IoBufferList(MessageHeader(type, TotalSize(buffers, count), header),
+                   buffers, count),
+      SIZE_MAX, /*block=*/true, &pos);
+}
+
+IOStatus SocketWriter::WriteBytesV(const IoBuffer* buffers, size_t count) {
+  return Write({nullptr, 0}, buffers, count);
+}
+
+IOStatus SocketWriter::WriteMessageV(uint8_t type, const IoBuffer* buffers,
+                                     size_t count) {
+  uint8_t header[5];
+  return Write(MessageHeader(type, TotalSize(buffers, count), header), buffers,
+               count);
+}
+
+IOStatus SocketWriter::Write(const IoBuffer& header, const IoBuffer* buffers,
+                             size_t count) {
+  if (Flush() == IOStatus::kError) return IOStatus::kError;
+  if (Pending() >= high_water_) return IOStatus::kWouldBlock;
+
+  const IoBufferList list(header, buffers, count);
+  IoPosition pos;
+  // New bytes can only skip the queue when nothing is waiting before them.
+  if (Pending() == 0 && WriteList(fd_, list, SIZE_MAX, /*block=*/false,
+                                  &pos) == IOStatus::kError)
+    return IOStatus::kError;
 
-  return WriteBytes(fd, bytes, size, chunk_size);
+  for (Advance(list, 0, &pos); pos.index < list.Count();
+       ++pos.index, pos.offset = 0) {
+    const auto& buffer = list[pos.index];
+    const auto* data = static_cast<const uint8_t*>(buffer.data);
+    pending_.insert(pending_.end(), data + pos.offset, data + buffer.size);
+  }
+  if (Pending() >= high_water_ && fn_) fn_(ctx_, Pending());
+  return IOStatus::kOk;
+}
+
+IOStatus SocketWriter::Flush() {
+  if (Pending() == 0) return IOStatus::kOk;
+
+  const IoBuffer rest = {pending_.data() + pending_pos_, Pending()};
+  const IoBufferList list(rest, nullptr, 0);
+  IoPosition pos;
+  const auto status = WriteList(fd_, list, SIZE_MAX, /*block=*/false, &pos);
+  pending_pos_ += pos.index < list.Count() ? pos.offset : rest.size;
+
+  if (pending_pos_ == pending_.size()) {
+    pending_.clear();
+    pending_pos_ = 0;
+  } else if (pending_pos_ >= pending_.size() / 2) {
+    pending_.erase(pending_.begin(), pending_.begin() + pending_pos_);
+    pending_pos_ = 0;
+  }
+  return status;
 }
 
 bool SocketHasPendingInput(int sockfd) {
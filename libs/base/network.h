@@ -19,6 +19,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <vector>
 
 #include "third_party/nxp/rt1176-sdk/middleware/lwip/src/include/lwip/ip_addr.h"
 
@@ -31,7 +32,17 @@ enum class IOStatus {
   // Reached end-of-file during read operation.
   kEof,
   // An error occurred during operation.
-  kError
+  kError,
+  // The socket can't accept more data without blocking.
+  kWouldBlock
+};
+
+// A buffer to write with `WriteBytesV()` or `WriteMessageV()`.
+struct IoBuffer {
+  // A pointer to the first byte.
+  const void* data;
+  // The number of bytes.
+  size_t size;
 };
 
 // Reads data from a socket file descriptor to a buffer.
@@ -92,6 +103,120 @@ IOStatus WriteArray(int fd, const T* array, size_t array_size) {
 IOStatus WriteMessage(int fd, uint8_t type, const void* bytes, size_t size,
                       size_t chunk_size = 1024);
 
+// Writes several buffers into a socket file descriptor as one stream of bytes.
+//
+// The buffers are passed to `lwip_writev()` together, so small buffers don't
+// each cost a TCP segment. This call blocks until every byte is sent, resuming
+// short writes from the first unwritten byte, so nothing is copied into a
+// staging buffer. (`SocketWriter` doesn't block, so it copies what the socket
+// doesn't take.)
+//
+// @param fd The file descriptor to write to.
+// @param buffers The buffers to write, in order.
+// @param count The number of buffers.
+// @return The status result of the operation.
+IOStatus WriteBytesV(int fd, const IoBuffer* buffers, size_t count);
+
+// Writes a `message` with custom type from several buffers into a socket file
+// descriptor.
+//
+// The message has the same format as with `WriteMessage()`. The header and
+// all buffers are written with the same `lwip_writev()` calls, so a header
+// and a small payload go out in one TCP segment.
+//
+// @param fd The file descriptor to write to.
+// @param type The type of the message.
+// @param buffers The buffers that make up the message payload, in order.
+// @param count The number of buffers.
+// @return The status result of the operation.
+IOStatus WriteMessageV(int fd, uint8_t type, const IoBuffer* buffers,
+                       size_t count);
+
+// Writes whole messages to a socket without blocking.
+//
+// Each write sends as much as the socket's send buffer accepts right away and
+// keeps a copy of the rest, which later writes and `Flush()` send first. Once
+// `high_water` bytes are waiting, new writes are refused with
+// `IOStatus::kWouldBlock` instead of being queued, so a slow client makes a
+// streaming task drop whole messages rather than stall or corrupt the stream.
+//
+// For example, to stream camera frames at frame rate:
+//
+// ```
+// SocketWriter writer(client_socket, /*high_water=*/32 * 1024);
+// IoBuffer frame = {jpeg.data(), jpeg_size};
+// if (writer.WriteMessageV(kImageData, &frame, 1) == IOStatus::kWouldBlock)
+//   ++frames_dropped;
+// ```
+//
+// The unsent part of each write is copied into a heap buffer owned by the
+// writer, which grows as needed. Because a write is only accepted while fewer
+// than `high_water` bytes are pending, that buffer holds at most `high_water`
+// bytes plus the unsent part of one message; choose `high_water` with the
+// largest message in mind.
+//
+// A `SocketWriter` isn't thread-safe, and the socket must not be written
+// to directly while it has pending bytes.
+class SocketWriter {
+ public:
+  // Called when the number of pending bytes reaches the high-water mark.
+  //
+  // @param ctx The `ctx` passed to the constructor.
+  // @param pending The number of bytes waiting to be sent.
+  using HighWaterCallback = void (*)(void* ctx, size_t pending);
+
+  // Constructor.
+  //
+  // @param fd The socket file descriptor to write to.
+  // @param high_water The number of pending bytes at which writes are
+  // refused.
+  // @param fn Optional function to call when `high_water` is reached.
+  // @param ctx Optional context passed to `fn`.
+  SocketWriter(int fd, size_t high_water, HighWaterCallback fn = nullptr,
+               void* ctx = nullptr)
+      : fd_(fd), high_water_(high_water), fn_(fn), ctx_(ctx) {}
+
+  // Writes several buffers as one unit.
+  //
+  // @param buffers The buffers to write, in order.
+  // @param count The number of buffers.
+  // @return `IOStatus::kOk` if the buffers were sent or queued,
+  // `IOStatus::kWouldBlock` if they were refused because too many bytes are
+  // pending, or `IOStatus::kError` if the socket failed.
+  IOStatus WriteBytesV(const IoBuffer* buffers, size_t count);
+
+  // Writes a message with the format of `WriteMessage()` as one unit.
+  //
+  // @param type The type of the message.
+  // @param buffers The buffers that make up the message payload, in order.
+  // @param count The number of buffers.
+  // @return The same as `WriteBytesV()`.
+  IOStatus WriteMessageV(uint8_t type, const IoBuffer* buffers, size_t count);
+
+  // Sends pending bytes without blocking.
+  //
+  // @return `IOStatus::kOk` if nothing is pending anymore,
+  // `IOStatus::kWouldBlock` if some bytes are still pending, or
+  // `IOStatus::kError` if the socket failed.
+  IOStatus Flush();
+
+  // Gets the number of bytes waiting to be sent.
+  //
+  // @return The number of pending bytes.
+  size_t Pending() const { return pending_.size() - pending_pos_; }
+
+ private:
+  IOStatus Write(const IoBuffer& header, const IoBuffer* buffers,
+                 size_t count);
+
+  int fd_;
+  size_t high_water_;
+  HighWaterCallback fn_;
+  void* ctx_;
+  std::vector<uint8_t> pending_;
+  size_t pending_pos_ = 0;
+};
+
 // Checks whether a socket file descriptor still has some bytes to read.
 //
 // @param sockfd The socket file descriptor to check.
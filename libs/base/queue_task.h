@@ -27,6 +27,28 @@
 namespace coralmicro {
 
 inline constexpr size_t kDefaultTaskStackDepth = configMINIMAL_STACK_SIZE;
+
+// Task notification index used to wake a task waiting in
+// `QueueTask::SendRequest()`. Index 0 is left for applications and index 1 is
+// used by `Ipc`.
+inline constexpr UBaseType_t kQueueTaskNotification = 2;
+static_assert(kQueueTaskNotification < configTASK_NOTIFICATION_ARRAY_ENTRIES,
+              "Not enough task notification entries for QueueTask");
+
+// Completion callback stored in each `QueueTask` request.
+//
+// This is a plain function pointer and context rather than `std::function`,
+// so it never allocates and can be copied through a FreeRTOS queue. An empty
+// callback (the default) means nobody is waiting for the response.
+template <typename Response>
+struct QueueTaskCallback {
+  void (*fn)(void* ctx, const Response& resp) = nullptr;
+  void* ctx = nullptr;
+
+  explicit operator bool() const { return fn != nullptr; }
+  void operator()(const Response& resp) const { fn(ctx, resp); }
+};
+
 template <typename Request, typename Response, const char* Name,
           size_t StackDepth, UBaseType_t Priority, UBaseType_t QueueLength>
 class QueueTask {
@@ -38,34 +60,56 @@ class QueueTask {
   // called. Initialized any needed data here, but beware that the FreeRTOS
   // scheduler may not yet be running.
   virtual void Init() {
-    request_queue_ = xQueueCreate(QueueLength, sizeof(Request));
+    request_queue_ = xQueueCreate(QueueLength, sizeof(Envelope));
     CHECK(request_queue_);
-    CHECK(xTaskCreateStatic(StaticTaskMain, Name, StackDepth, this, Priority,
-                            task_stack_, &task_));
+    task_handle_ = xTaskCreateStatic(StaticTaskMain, Name, StackDepth, this,
+                                     Priority, task_stack_, &task_);
+    CHECK(task_handle_);
   }
 
  protected:
+  // Sends a request and blocks until the handler responds.
+  //
+  // Nothing is allocated: the caller waits on a task notification and the
+  // handler writes the response straight into the caller's stack. While the
+  // request is pending, the worker task runs at least at the caller's
+  // priority, so a high-priority caller isn't held up by medium-priority
+  // tasks preempting the worker.
   Response SendRequest(Request& req) {
     Response resp;
-    SemaphoreHandle_t sem = xSemaphoreCreateBinary();
-    req.callback = [sem, &resp](Response cb_resp) {
-      resp = cb_resp;
-      CHECK(xSemaphoreGive(sem) == pdTRUE);
-    };
-    CHECK(xQueueSend(request_queue_, &req, portMAX_DELAY) == pdTRUE);
-    CHECK(xSemaphoreTake(sem, portMAX_DELAY) == pdTRUE);
-    vSemaphoreDelete(sem);
+    Waiter waiter{xTaskGetCurrentTaskHandle(), &resp, false};
+    req.callback.fn = Complete;
+    req.callback.ctx = &waiter;
+
+    const UBaseType_t priority = uxTaskPriorityGet(nullptr);
+    Envelope envelope{req, priority};
+    CHECK(xQueueSend(request_queue_, &envelope, portMAX_DELAY) == pdTRUE);
+
+    // Raise the worker only once the request is queued, so it can't drop back
+    // to `Priority` in between. The worker lowers itself in a critical section
+    // too, and only once the queue is empty; if the request is already done,
+    // the worker has handled it at `priority` and must not be raised again.
+    taskENTER_CRITICAL();
+    if (!waiter.done && priority > uxTaskPriorityGet(task_handle_))
+      vTaskPrioritySet(task_handle_, priority);
+    taskEXIT_CRITICAL();
+
+    ulTaskNotifyTakeIndexed(kQueueTaskNotification, pdTRUE, portMAX_DELAY);
     return resp;
   }
 
   void SendRequestAsync(Request& req) {
+    // Nobody waits for asynchronous requests, so they don't raise the worker's
+    // priority.
+    Envelope envelope{req, 0};
     // If IPSR is non-zero, we are in an interrupt.
     if (__get_IPSR() != 0) {
       BaseType_t reschedule;
-      CHECK(xQueueSendFromISR(request_queue_, &req, &reschedule) == pdTRUE);
+      CHECK(xQueueSendFromISR(request_queue_, &envelope, &reschedule) ==
+            pdTRUE);
       portYIELD_FROM_ISR(reschedule);
     } else {
-      CHECK(xQueueSend(request_queue_, &req, portMAX_DELAY) == pdTRUE);
+      CHECK(xQueueSend(request_queue_, &envelope, portMAX_DELAY) == pdTRUE);
     }
   }
 
@@ -74,6 +118,28 @@ class QueueTask {
   QueueHandle_t request_queue_;
 
  private:
+  // A request and the priority of the task that sent it.
+  struct Envelope {
+    Request request;
+    UBaseType_t priority;
+  };
+
+  // A task blocked in `SendRequest()`, on that task's stack.
+  struct Waiter {
+    TaskHandle_t task;
+    Response* resp;
+    // Set once the response is written, before the task is notified.
+    volatile bool done;
+  };
+
+  static void Complete(void* ctx, const Response& resp) {
+    auto* waiter = static_cast<Waiter*>(ctx);
+    TaskHandle_t task = waiter->task;
+    *waiter->resp = resp;
+    waiter->done = true;
+    xTaskNotifyGiveIndexed(task, kQueueTaskNotification);
+  }
+
   static void StaticTaskMain(void* param) {
     static_cast<QueueTask*>(param)->TaskMain();
   }
@@ -83,13 +149,24 @@ class QueueTask {
   // from the queue. This will block and yield the CPU if no messages are
   // available. When a message is received, the implementation-specific
   // handler is invoked.
+  //
+  // The task keeps any priority inherited from waiting callers until the
+  // queue is empty, then drops back to `Priority`.
   [[noreturn]] void TaskMain() {
     TaskInit();
 
-    Request msg;
+    Envelope envelope;
     while (true) {
-      if (xQueueReceive(request_queue_, &msg, portMAX_DELAY) == pdTRUE) {
-        RequestHandler(&msg);
+      if (xQueueReceive(request_queue_, &envelope, portMAX_DELAY) == pdTRUE) {
+        if (envelope.priority > uxTaskPriorityGet(nullptr))
+          vTaskPrioritySet(nullptr, envelope.priority);
+        RequestHandler(&envelope.request);
+
+        taskENTER_CRITICAL();
+        if (uxQueueMessagesWaiting(request_queue_) == 0 &&
+            uxTaskPriorityGet(nullptr) != Priority)
+          vTaskPrioritySet(nullptr, Priority);
+        taskEXIT_CRITICAL();
       }
     }
   }
@@ -101,6 +178,8 @@ class QueueTask {
 
   // Implementation-specific handler for messages coming from the queue.
   virtual void RequestHandler(Request* msg) = 0;
+
+  TaskHandle_t task_handle_;
 };
 
 }  // namespace coralmicro
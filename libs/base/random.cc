@@ -18,7 +18,6 @@
 
 #include <cstddef>
 #include <cstdio>
-#include <functional>
 
 #include "libs/base/queue_task.h"
 #include "libs/base/tasks.h"
@@ -35,7 +34,7 @@ struct Response {
 struct Request {
   void* out;
   size_t len;
-  std::function<void(Response)> callback;
+  QueueTaskCallback<Response> callback;
 };
 
 constexpr char kRandomTaskName[] = "random_task";
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/base/trace.h"
+
+#include "libs/base/filesystem.h"
+#include "libs/base/timer.h"
+#include "third_party/freertos_kernel/include/FreeRTOS.h"
+#include "third_party/freertos_kernel/include/task.h"
+#include "third_party/nxp/rt1176-sdk/devices/MIMXRT1176/drivers/fsl_common.h"
+
+namespace coralmicro {
+
+uint8_t* Trace::WriteHeader(uint8_t* p, size_t size, const char* format) {
+  const auto event_size = static_cast<uint16_t>(size);
+  const auto id = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(format));
+  const uint64_t timestamp = TimerMicros();
+  // Events from interrupts are recorded with task 0.
+  const auto task =
+      __get_IPSR() != 0
+          ? 0
+          : static_cast<uint32_t>(
+                reinterpret_cast<uintptr_t>(xTaskGetCurrentTaskHandle()));
+  p = Put(p, &event_size, sizeof(event_size));
+  p = Put(p, &id, sizeof(id));
+  p = Put(p, &timestamp, sizeof(timestamp));
+  return Put(p, &task, sizeof(task));
+}
+
+bool Trace::WriteToFile(const char* path) {
+  lfs_file_t file;
+  if (lfs_file_open(Lfs(), &file, path,
+                    LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND) < 0)
+    return false;
+
+  uint8_t buffer[512];
+  bool ok = true;
+  size_t size;
+  while (ok && (size = Read(buffer, sizeof(buffer))) > 0)
+    ok = lfs_file_write(Lfs(), &file, buffer, size) ==
+         static_cast<lfs_ssize_t>(size);
+  return lfs_file_close(Lfs(), &file) >= 0 && ok;
+}
+
+}  // namespace coralmicro
@@ -0,0 +1,246 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_BASE_TRACE_H_
+#define LIBS_BASE_TRACE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "libs/base/log_ring.h"
+
+// Size of each core's trace ring in bytes, a power of two.
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE (16 * 1024)
+#endif
+
+// @cond Do not generate docs
+#define TRACE_STRINGIFY_(x) #x
+#define TRACE_STRINGIFY(x) TRACE_STRINGIFY_(x)
+
+// Format strings go in a section that is kept in the ELF file but not loaded
+// on the device, so they cost no flash or RAM. A string's offset in the
+// section is its ID. The trailing "@" comments out the flags that GCC would
+// add, as for `.sdram_bss`.
+#if defined(__arm__)
+#define TRACE_SECTION \
+  __attribute__((section(".coralmicro_trace,\"\",%progbits @"), used))
+#else
+#define TRACE_SECTION __attribute__((section(".coralmicro_trace"), used))
+#endif
+
+#define TRACE_RECORD_(type, fmt, ...)                               \
+  do {                                                              \
+    static const char kTraceFormat[] TRACE_SECTION =                \
+        type "|" __FILE__ ":" TRACE_STRINGIFY(__LINE__) "|" fmt;    \
+    ::coralmicro::Trace::GetSingleton()->Record(kTraceFormat,       \
+                                                ##__VA_ARGS__);     \
+  } while (0)
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// @endcond
+
+// Records a trace message.
+//
+// Formatting is done on the host by `scripts/trace_decode.py`, so only the
+// arguments are copied on the device. `fmt` must be a string literal and
+// uses `printf()` conversions; arguments may be integers, floating-point
+// numbers, pointers, and strings (up to 255 bytes are recorded).
+#define TRACE(fmt, ...) TRACE_RECORD_("I", fmt, ##__VA_ARGS__)
+
+// Records the start of a span named `name`, a string literal. Shown as a
+// slice in Chrome's trace viewer together with the matching `TRACE_END()`
+// from the same task.
+#define TRACE_BEGIN(name) TRACE_RECORD_("B", name)
+
+// Records the end of a span started with `TRACE_BEGIN()`.
+#define TRACE_END(name) TRACE_RECORD_("E", name)
+
+// Records a span named `name` from here to the end of the enclosing scope.
+#define TRACE_SCOPE(name)                                                  \
+  TRACE_BEGIN(name);                                                       \
+  ::coralmicro::TraceScopeEnd TRACE_CONCAT(trace_scope_, __LINE__)([] {    \
+    TRACE_END(name);                                                       \
+  })
+
+// Records the value of the counter named `name`, a string literal. Shown as a
+// graph in Chrome's trace viewer.
+#define TRACE_COUNTER(name, value) TRACE_RECORD_("C", name, value)
+
+namespace coralmicro {
+
+// Type of each argument recorded in a trace event.
+enum class TraceArgType : uint8_t {
+  kInt32 = 1,
+  kUint32 = 2,
+  kInt64 = 3,
+  kUint64 = 4,
+  kDouble = 5,
+  kString = 6,
+  kPointer = 7,
+};
+
+// Statistics reported by `Trace`.
+using TraceStats = LogRingStats;
+
+// Singleton object that records binary trace events into a ring buffer.
+//
+// Use the `TRACE()`, `TRACE_SCOPE()`, `TRACE_BEGIN()`, `TRACE_END()`, and
+// `TRACE_COUNTER()` macros to record events. Each event is a few bytes: the
+// ID of its format string, a `TimerMicros()` timestamp, the current task, and
+// the raw arguments. There's no formatting on the device and no locking, so
+// tracing is cheap enough to leave enabled in production builds. When the
+// ring is full, new events are dropped and counted in `GetStats()`.
+//
+// Each core has its own ring. Drain it with `Read()`, for example to a
+// `CdcAcm` interface, or use `WriteToFile()` or `TraceUriHandler`. Decode
+// the data on a host with the program's ELF file from the build directory:
+//
+// ```
+// python3 scripts/trace_decode.py --elf my_app --chrome trace.json trace.bin
+// ```
+//
+// Then open `trace.json` in `chrome://tracing` or Perfetto.
+class Trace {
+ public:
+  // Gets the `Trace` singleton.
+  //
+  // @return A pointer to the singleton.
+  static Trace* GetSingleton() {
+    static Trace trace;
+    return &trace;
+  }
+
+  // Takes recorded events from the ring. The data must be kept in order,
+  // and drained by one task at a time, for the decoder to read it.
+  //
+  // @param buffer The buffer to copy events into.
+  // @param size The size of the buffer in bytes.
+  // @return The number of bytes copied, or 0 if there are no events.
+  size_t Read(uint8_t* buffer, size_t size) { return ring_.Read(buffer, size); }
+
+  // Appends all recorded events to a file.
+  //
+  // @param path The file path.
+  // @return True on success, false if the file couldn't be written.
+  bool WriteToFile(const char* path);
+
+  // Gets the trace statistics.
+  //
+  // @return A snapshot of the counters.
+  TraceStats GetStats() const { return ring_.GetStats(); }
+
+  // @cond Do not generate docs
+  // Records one event. Use the `TRACE` macros instead.
+  template <typename... Args>
+  void Record(const char* format, const Args&... args) {
+    const size_t size = kHeaderSize + (ArgSize(args) + ... + 0);
+    LogRing::Span span;
+    if (size > UINT16_MAX || !ring_.Reserve(size, &span)) return;
+    [[maybe_unused]] uint8_t* p = WriteHeader(span.data, size, format);
+    ((p = WriteArg(p, args)), ...);
+    ring_.Commit(span);
+  }
+  // @endcond
+
+ private:
+  // The event size, format ID, timestamp, and task.
+  static constexpr size_t kHeaderSize = 2 + 4 + 8 + 4;
+  static constexpr size_t kMaxStringSize = 255;
+
+  Trace() = default;
+  Trace(const Trace&) = delete;
+  Trace& operator=(const Trace&) = delete;
+
+  static uint8_t* WriteHeader(uint8_t* p, size_t size, const char* format);
+
+  static uint8_t* Put(uint8_t* p, const void* data, size_t size) {
+    std::memcpy(p, data, size);
+    return p + size;
+  }
+
+  static size_t StringSize(const char* str) {
+    return str ? strnlen(str, kMaxStringSize) : 0;
+  }
+
+  template <typename T>
+  static size_t ArgSize(const T& arg) {
+    if constexpr (std::is_convertible_v<T, const char*>) {
+      return 2 + StringSize(arg);
+    } else if constexpr (std::is_pointer_v<T>) {
+      return 1 + sizeof(uint32_t);
+    } else if constexpr (std::is_floating_point_v<T>) {
+      return 1 + sizeof(double);
+    } else {
+      static_assert(std::is_integral_v<T> || std::is_enum_v<T>,
+                    "Unsupported trace argument type");
+      return 1 + (sizeof(T) > 4 ? 8 : 4);
+    }
+  }
+
+  template <typename T>
+  static uint8_t* WriteArg(uint8_t* p, const T& arg) {
+    if constexpr (std::is_convertible_v<T, const char*>) {
+      const char* str = arg;
+      const auto size = static_cast<uint8_t>(StringSize(str));
+      *p++ = static_cast<uint8_t>(TraceArgType::kString);
+      *p++ = size;
+      return Put(p, str, size);
+    } else if constexpr (std::is_pointer_v<T>) {
+      const auto value =
+          static_cast<uint32_t>(reinterpret_cast<uintptr_t>(arg));
+      *p++ = static_cast<uint8_t>(TraceArgType::kPointer);
+      return Put(p, &value, sizeof(value));
+    } else if constexpr (std::is_floating_point_v<T>) {
+      const auto value = static_cast<double>(arg);
+      *p++ = static_cast<uint8_t>(TraceArgType::kDouble);
+      return Put(p, &value, sizeof(value));
+    } else if constexpr (sizeof(T) > 4) {
+      const auto value = static_cast<uint64_t>(arg);
+      *p++ = static_cast<uint8_t>(std::is_signed_v<T> ? TraceArgType::kInt64
+                                                      : TraceArgType::kUint64);
+      return Put(p, &value, sizeof(value));
+    } else {
+      const auto value = static_cast<uint32_t>(arg);
+      *p++ = static_cast<uint8_t>(std::is_signed_v<T> ? TraceArgType::kInt32
+                                                      : TraceArgType::kUint32);
+      return Put(p, &value, sizeof(value));
+    }
+  }
+
+  alignas(4) uint8_t storage_[TRACE_RING_SIZE];
+  LogRing ring_{storage_, TRACE_RING_SIZE};
+};
+
+// @cond Do not generate docs
+// Calls a function when it goes out of scope, for `TRACE_SCOPE()`.
+template <typename F>
+class TraceScopeEnd {
+ public:
+  explicit TraceScopeEnd(F f) : f_(f) {}
+  ~TraceScopeEnd() { f_(); }
+
+ private:
+  F f_;
+};
+// @endcond
+
+}  // namespace coralmicro
+
+#endif  // LIBS_BASE_TRACE_H_
@@ -29,6 +29,7 @@
 #include "third_party/nxp/rt1176-sdk/devices/MIMXRT1176/drivers/cm4/fsl_cache.h"
 #endif
 
+#include <algorithm>
 #include <cstring>
 #include <memory>
 
@@ -164,12 +165,19 @@ void ResizeNearestNeighbor(const uint8_t* src, int src_w, int src_h,
   }
 }
 
+// Demosaics the output rows [y_begin, y_end), clamped to the rows that have a
+// full neighborhood, calling `callback(x, y, r, g, b)` for each pixel.
 template <typename Callback>
-void BayerInternal(const uint8_t* camera_raw, int width, int height,
-                   CameraFilterMethod filter, Callback callback) {
+void BayerInternalRows(const uint8_t* camera_raw, int width, int height,
+                       CameraFilterMethod filter, int y_begin, int y_end,
+                       Callback callback) {
+  y_begin = std::max(y_begin, 2);
+  y_end = std::min(y_end, height - 2);
+  if (y_begin >= y_end) return;
+
   if (filter == CameraFilterMethod::kNearestNeighbor) {
-    bool blue = true, green = false;
-    for (int y = 2; y < height - 2; y++) {
+    bool blue = (y_begin & 1) == 0, green = !blue;
+    for (int y = y_begin; y < y_end; y++) {
       int start = green ? 3 : 2;
       for (int x = start; x < width - 2; x += 2) {
         int g1x = x + 1, g1y = y;
@@ -206,8 +214,8 @@ void BayerInternal(const uint8_t* camera_raw, int width, int height,
   } else if (filter == CameraFilterMethod::kBilinear) {
     int bayer_stride = width;
 
-    size_t bayer_offset = 0;
-    for (int y = 2; y < height - 2; y++) {
+    size_t bayer_offset = static_cast<size_t>(y_begin - 2) * width;
+    for (int y = y_begin; y < y_end; y++) {
       bool odd_row = y & 1;
       int x = 1;
       size_t bayer_end = bayer_offset + (width - 2);
@@ -313,6 +321,13 @@ void BayerInternal(const uint8_t* camera_raw, int width, int height,
   }
 }
 
+template <typename Callback>
+void BayerInternal(const uint8_t* camera_raw, int width, int height,
+                   CameraFilterMethod filter, Callback callback) {
+  BayerInternalRows(camera_raw, width, height, filter, 2, height - 2,
+                    callback);
+}
+
 void RotateXY(CameraRotation rotation, int in_x, int in_y, int* out_x,
               int* out_y) {
   CHECK(out_x);
@@ -454,6 +469,73 @@ void AutoWhiteBalance(uint8_t* camera_rgb, int width, int height) {
         std::min(255UL, (static_cast<uint32_t>(b) * b_gain_i) >> 8));
   }
 }
+
+// Estimates the same gains as `AutoWhiteBalance()` straight from the Bayer
+// mosaic, using one red, two green and one blue site per 2x2 cell, so frames
+// that are never demosaiced as a whole can still be white balanced.
+void RawWhiteBalanceGains(const uint8_t* camera_raw, int width, int height,
+                          uint16_t gains[3]) {
+  unsigned int r_sum = 0, g_sum = 0, b_sum = 0;
+  const uint16_t threshold16 = static_cast<uint16_t>(0.9f * 255);
+  // Blue sites are on even rows and columns, red on odd rows and columns.
+  for (int y = 0; y + 1 < height; y += 2) {
+    const uint8_t* row0 = camera_raw + y * width;
+    const uint8_t* row1 = row0 + width;
+    for (int x = 0; x + 1 < width; x += 2) {
+      const uint8_t b = row0[x];
+      const uint8_t g = (static_cast<uint32_t>(row0[x + 1]) + row1[x] + 1) >> 1;
+      const uint8_t r = row1[x + 1];
+      const uint16_t min_rgb = std::min(r, std::min(g, b));
+      const uint16_t max_rgb = std::max(r, std::max(g, b));
+      if (((max_rgb - min_rgb) * 255) > (threshold16 * max_rgb)) continue;
+      r_sum += r;
+      g_sum += g;
+      b_sum += b;
+    }
+  }
+  const float sums[3] = {static_cast<float>(r_sum), static_cast<float>(g_sum),
+                         static_cast<float>(b_sum)};
+  const float max_channel = std::max(sums[0], std::max(sums[1], sums[2]));
+  for (int i = 0; i < 3; ++i) {
+    const float gain = sums[i] < 0.1f ? 0.0f : max_channel / sums[i];
+    gains[i] = static_cast<uint16_t>(gain * (1 << 8));
+  }
+}
+
+// Writes one pixel in a `CameraStripFormat`. The YCbCr coefficients are the
+// JFIF ones in 16.16 fixed point.
+inline void WriteStripPixel(CameraStripFormat fmt, uint8_t* dst, uint32_t r,
+                            uint32_t g, uint32_t b) {
+  switch (fmt) {
+    case CameraStripFormat::kRgb:
+      dst[0] = r;
+      dst[1] = g;
+      dst[2] = b;
+      break;
+    case CameraStripFormat::kBgr:
+      dst[0] = b;
+      dst[1] = g;
+      dst[2] = r;
+      break;
+    case CameraStripFormat::kYCbCr: {
+      const int32_t ri = r, gi = g, bi = b;
+      dst[0] = (19595 * ri + 38470 * gi + 7471 * bi + 32768) >> 16;
+      dst[1] = (-11059 * ri - 21709 * gi + 32768 * bi + (128 << 16) + 32767) >>
+               16;
+      dst[2] = (32768 * ri - 27439 * gi - 5329 * bi + (128 << 16) + 32767) >>
+               16;
+    } break;
+    case CameraStripFormat::kY8: {
+      const float r_f = static_cast<float>(r) / kUint8Max;
+      const float g_f = static_cast<float>(g) / kUint8Max;
+      const float b_f = static_cast<float>(b) / kUint8Max;
+      dst[0] = static_cast<uint8_t>(
+          ((kRedCoefficient * r_f * r_f) + (kGreenCoefficient * g_f * g_f) +
+           (kBlueCoefficient * b_f * b_f)) *
+          kUint8Max);
+    } break;
+  }
+}
 }  // namespace
 
 extern "C" void CSI_DriverIRQHandler(void);
@@ -556,6 +638,96 @@ bool CameraTask::GetFrame(const std::vector<CameraFrameFormat>& fmts) {
   return ret;
 }
 
+int CameraStripFormatBpp(CameraStripFormat fmt) {
+  switch (fmt) {
+    case CameraStripFormat::kRgb:
+    case CameraStripFormat::kBgr:
+    case CameraStripFormat::kYCbCr:
+      return 3;
+    case CameraStripFormat::kY8:
+      return 1;
+  }
+  return 0;
+}
+
+CameraStripReader::CameraStripReader(const uint8_t* raw,
+                                     const CameraStripConfig& config,
+                                     bool white_balance)
+    : raw_(raw), config_(config), gains_{1 << 8, 1 << 8, 1 << 8} {
+  if (white_balance) {
+    RawWhiteBalanceGains(raw_, CameraTask::kWidth, CameraTask::kHeight,
+                         gains_);
+  }
+}
+
+bool CameraStripReader::Read(int row, int num_rows, uint8_t* out) const {
+  const int width = CameraTask::kWidth;
+  const int height = CameraTask::kHeight;
+  if (row < 0 || num_rows <= 0 || row + num_rows > height) return false;
+
+  // Pixels without a full Bayer neighborhood are black, as in `GetFrame()`.
+  const int bpp = CameraStripFormatBpp(config_.fmt);
+  const CameraStripFormat fmt = config_.fmt;
+  for (int i = 0; i < width * num_rows; ++i)
+    WriteStripPixel(fmt, out + i * bpp, 0, 0, 0);
+
+  // A 180 degree rotation maps output row r to input row (height - r).
+  int y_begin = row, y_end = row + num_rows;
+  if (config_.rotation == CameraRotation::k180) {
+    y_begin = height - (row + num_rows) + 1;
+    y_end = height - row + 1;
+  }
+  const CameraRotation rotation = config_.rotation;
+  const uint32_t r_gain = gains_[0], g_gain = gains_[1], b_gain = gains_[2];
+  BayerInternalRows(
+      raw_, width, height, config_.filter, y_begin, y_end,
+      [=](int x, int y, uint8_t r, uint8_t g, uint8_t b) {
+        int rot_x, rot_y;
+        RotateXY(rotation, x, y, &rot_x, &rot_y);
+        rot_y -= row;
+        if (rot_y < 0 || rot_y >= num_rows) return;
+        WriteStripPixel(fmt, out + (rot_y * width + rot_x) * bpp,
+                        std::min<uint32_t>(255, (r * r_gain) >> 8),
+                        std::min<uint32_t>(255, (g * g_gain) >> 8),
+                        std::min<uint32_t>(255, (b * b_gain) >> 8));
+      });
+  return true;
+}
+
+bool CameraTask::GetFrameStrips(const CameraStripConfig& config, void* ctx,
+                                CameraStripConsumer fn) {
+  if (config.rotation != CameraRotation::k0 &&
+      config.rotation != CameraRotation::k180) {
+    printf("Strip reads only support 0 and 180 degree rotation\r\n");
+    return false;
+  }
+  if (!enabled_) {
+    printf("Camera is not enabled, cannot capture frame.\r\n");
+    return false;
+  }
+  if (mode_ == CameraMode::kTrigger && !GpioGet(Gpio::kCameraTrigger)) {
+    printf("Camera is in trigger mode but was never triggered\r\n");
+    return false;
+  }
+
+  uint8_t* raw = nullptr;
+  int index = GetFrame(&raw, true);
+  if (!raw) {
+    return false;
+  }
+  if (mode_ == CameraMode::kTrigger) {
+    GpioSet(Gpio::kCameraTrigger, false);
+  }
+
+  CameraStripReader reader(
+      raw, config,
+      config.white_balance && test_pattern_ == CameraTestPattern::kNone);
+  bool ret = fn(ctx, &reader);
+
+  GetSingleton()->ReturnFrame(index);
+  return ret;
+}
+
 bool CameraTask::Read(uint16_t reg, uint8_t* val) {
   lpi2c_master_transfer_t transfer;
   transfer.flags = kLPI2C_TransferDefaultFlag;
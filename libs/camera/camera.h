@@ -18,7 +18,6 @@
 #define LIBS_CAMERA_CAMERA_H_
 
 #include <cstdint>
-#include <functional>
 #include <vector>
 
 #include "libs/base/queue_task.h"
@@ -149,7 +148,7 @@ struct Request {
     DiscardRequest discard;
     CameraMotionDetectionConfig motion_detection_config;
   } request;
-  std::function<void(Response)> callback;
+  QueueTaskCallback<Response> callback;
 };
 
 }  // namespace camera
@@ -214,6 +213,52 @@ struct CameraFrameFormat {
   bool white_balance = true;
 };
 
+// Pixel layouts produced by `CameraStripReader`.
+enum class CameraStripFormat {
+  // 3 bytes per pixel, red first.
+  kRgb,
+  // 3 bytes per pixel, blue first.
+  kBgr,
+  // 3 bytes per pixel of full-range BT.601 luma and chroma, as used by JPEG.
+  kYCbCr,
+  // Y8 (grayscale) image.
+  kY8,
+};
+
+// Gets the bytes-per-pixel used by the given strip format.
+// @param The strip format (from `CameraStripFormat`).
+// @return The number of bytes per pixel.
+int CameraStripFormatBpp(CameraStripFormat fmt);
+
+// Specifies the image processing to perform when reading frames strip by
+// strip with `CameraTask::GetFrameStrips()`.
+//
+// Strips are always at the native resolution (`CameraTask::kWidth` by
+// `CameraTask::kHeight`).
+struct CameraStripConfig {
+  // Pixel layout of each strip.
+  CameraStripFormat fmt = CameraStripFormat::kRgb;
+  // Filter method such as bilinear (default) or nearest-neighbor.
+  CameraFilterMethod filter = CameraFilterMethod::kBilinear;
+  // Image rotation. Only `CameraRotation::k0` and `CameraRotation::k180` are
+  // supported, because other rotations turn rows into columns.
+  CameraRotation rotation = CameraRotation::k0;
+  // Set true to perform auto whitebalancing (default), false to disable it.
+  // The gains are estimated from the raw frame before the first strip.
+  bool white_balance = true;
+};
+
+class CameraStripReader;
+
+// The function type that consumes a frame with `CameraStripReader::Read()`.
+//
+// The camera frame is held until the function returns.
+//
+// @param ctx Extra parameters, defined with `CameraTask::GetFrameStrips()`.
+// @param reader The reader that demosaics rows of the frame.
+// @return True on success, false otherwise.
+using CameraStripConsumer = bool (*)(void* ctx, CameraStripReader* reader);
+
 // Provides access to the Dev Board Micro camera.
 //
 // You can access the shared camera object with `CameraTask::GetSingleton()`.
@@ -270,6 +315,38 @@ class CameraTask
   // @return True if image processing succeeds, false otherwise.
   bool GetFrame(const std::vector<CameraFrameFormat>& fmts);
 
+  // Gets one frame from the camera buffer and lets a function process it a
+  // few rows at a time.
+  //
+  // Unlike `GetFrame()`, the frame is never converted as a whole: `fn` calls
+  // `CameraStripReader::Read()` to demosaic just the rows it needs next, so a
+  // consumer such as `JpegEncoder` can work from a strip buffer of a few
+  // kilobytes instead of a full RGB frame. For example:
+  //
+  // ```
+  // static JpegEncoder encoder;
+  // std::vector<uint8_t> jpeg;
+  // CameraStripConfig config{CameraStripFormat::kYCbCr};
+  // CameraTask::GetSingleton()->GetFrameStrips(
+  //     config, &jpeg, +[](void* ctx, CameraStripReader* reader) {
+  //       return encoder.Encode(reader->Width(), reader->Height(),
+  //                             JpegPixelFormat::kYCbCr, /*quality=*/75,
+  //                             reader, CameraStripReader::ReadRows,
+  //                             static_cast<std::vector<uint8_t>*>(ctx));
+  //     });
+  // ```
+  //
+  // @note This blocks until a new frame is available from the camera, and has
+  // the same trigger mode behavior as `GetFrame()`.
+  //
+  // @param config The strip format and image processing.
+  // @param ctx Extra parameters to pass through to the consumer function.
+  // @param fn The function that reads the frame.
+  // @return The result of `fn`, or false if no frame was available or the
+  // configuration isn't supported.
+  bool GetFrameStrips(const CameraStripConfig& config, void* ctx,
+                      CameraStripConsumer fn);
+
   // Turns the camera power on and off. You must call this before `Enable()`.
   // @param enable True to turn the camera on, false to turn it off.
   // @return True if the action was successful, false otherwise.
@@ -344,6 +421,57 @@ class CameraTask
   bool enabled_{false};
 };
 
+// Demosaics rows of a raw camera frame on demand.
+//
+// You get a `CameraStripReader` from `CameraTask::GetFrameStrips()`; it is only
+// valid inside the consumer function.
+class CameraStripReader {
+ public:
+  // Gets the width of the frame.
+  // @return The width in pixels.
+  int Width() const { return CameraTask::kWidth; }
+
+  // Gets the height of the frame.
+  // @return The height in pixels.
+  int Height() const { return CameraTask::kHeight; }
+
+  // Gets the number of bytes in one row of the frame.
+  // @return The row size in bytes.
+  int RowBytes() const {
+    return CameraTask::kWidth * CameraStripFormatBpp(config_.fmt);
+  }
+
+  // Demosaics consecutive rows of the frame.
+  //
+  // Rows can be read in any order, but reading them top to bottom is the most
+  // cache friendly.
+  //
+  // @param row The index of the first row.
+  // @param num_rows The number of rows.
+  // @param out The buffer to fill with `num_rows * RowBytes()` bytes.
+  // @return True on success, false if the rows are out of range.
+  bool Read(int row, int num_rows, uint8_t* out) const;
+
+  // Calls `Read()` on a reader passed as `ctx`.
+  //
+  // This matches `JpegEncoder::RowCallback`, so a reader can feed an encoder
+  // directly.
+  static bool ReadRows(void* ctx, int row, int num_rows, uint8_t* out) {
+    return static_cast<const CameraStripReader*>(ctx)->Read(row, num_rows,
+                                                             out);
+  }
+
+ private:
+  friend class CameraTask;
+  CameraStripReader(const uint8_t* raw, const CameraStripConfig& config,
+                    bool white_balance);
+
+  const uint8_t* raw_;
+  CameraStripConfig config_;
+  // 8.8 fixed-point red, green and blue gains.
+  uint16_t gains_[3];
+};
+
 }  // namespace coralmicro
 
 #endif  // LIBS_CAMERA_CAMERA_H_
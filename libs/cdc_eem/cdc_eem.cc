@@ -21,19 +21,101 @@
 #include "libs/base/utils.h"
 #include "libs/nxp/rt1176-sdk/usb_device_cdc_eem.h"
 #include "third_party/nxp/rt1176-sdk/middleware/lwip/src/include/lwip/etharp.h"
+#include "third_party/nxp/rt1176-sdk/middleware/lwip/src/include/lwip/stats.h"
 #include "third_party/nxp/rt1176-sdk/middleware/lwip/src/include/netif/ethernet.h"
+#include "third_party/nxp/rt1176-sdk/devices/MIMXRT1176/drivers/fsl_common.h"
 #include "third_party/nxp/rt1176-sdk/middleware/usb/output/source/device/class/usb_device_cdc_acm.h"
 
 extern "C" void start_dhcp_server(uint32_t local_addr);
 
+#include <algorithm>
+#include <array>
 #include <cstring>
-#include <memory>
-#include <vector>
 
 #define DATA_OUT (1)
 #define DATA_IN (0)
 
 namespace coralmicro {
+namespace {
+// How long the TX task waits for a busy bulk IN endpoint before checking it
+// again, in case a completion was missed.
+constexpr int kTxBusyWaitMs = 1;
+
+constexpr std::array<uint32_t, 256> MakeCrc32Table() {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < table.size(); ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit)
+      crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+    table[i] = crc;
+  }
+  return table;
+}
+
+constexpr auto kCrc32Table = MakeCrc32Table();
+
+// The Ethernet CRC-32, as appended to EEM packets with the CRC bit set.
+uint32_t Crc32(const uint8_t *data, size_t length) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < length; ++i)
+    crc = kCrc32Table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+uint32_t LoadLe32(const uint8_t *data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) |
+         (static_cast<uint32_t>(data[3]) << 24);
+}
+
+void StoreLe32(uint8_t *data, uint32_t value) {
+  data[0] = value & 0xFF;
+  data[1] = (value >> 8) & 0xFF;
+  data[2] = (value >> 16) & 0xFF;
+  data[3] = (value >> 24) & 0xFF;
+}
+
+// Bytes after the header of an EEM packet.
+size_t PayloadLength(uint16_t packet_hdr) {
+  if (packet_hdr & EEM_HEADER_TYPE_MASK) {
+    const uint16_t opcode =
+        (packet_hdr & EEM_COMMAND_OPCODE_MASK) >> EEM_COMMAND_OPCODE_SHIFT;
+    // Only echo commands carry data, as long as their parameter.
+    return (opcode == EEM_COMMAND_ECHO || opcode == EEM_COMMAND_ECHO_RESPONSE)
+               ? (packet_hdr & EEM_COMMAND_PARAM_MASK) >>
+                     EEM_COMMAND_PARAM_SHIFT
+               : 0;
+  }
+  return (packet_hdr & EEM_DATA_LEN_MASK) >> EEM_DATA_LEN_SHIFT;
+}
+
+// Whether an EEM packet carries a frame. Zero-length packets only pad
+// transfers.
+bool IsDataFrame(uint16_t packet_hdr) {
+  return !(packet_hdr & EEM_HEADER_TYPE_MASK) &&
+         PayloadLength(packet_hdr) > sizeof(uint32_t);
+}
+
+// Bytes of the frame in an EEM data packet, without the CRC.
+uint16_t FrameLength(uint16_t packet_hdr) {
+  return static_cast<uint16_t>(PayloadLength(packet_hdr) - sizeof(uint32_t));
+}
+
+// Without the CRC bit, the CRC field is a sentinel. USB already checks each
+// transfer, so it isn't validated.
+//
+// This runs on the USB device task for every frame, so bad frames are
+// counted in lwIP's link stats (`lwip_stats.link.chkerr`) rather than logged.
+bool FrameCrcValid(const uint8_t *frame, uint16_t length, uint16_t packet_hdr) {
+  if ((packet_hdr & EEM_DATA_CRC_MASK) &&
+      LoadLe32(frame + length) != Crc32(frame, length)) {
+    LINK_STATS_INC(link.chkerr);
+    LINK_STATS_INC(link.drop);
+    return false;
+  }
+  return true;
+}
+}  // namespace
+
 std::map<class_handle_t, CdcEem *> CdcEem::handle_map_;
 
 void CdcEem::Init(uint8_t bulk_in_ep, uint8_t bulk_out_ep, uint8_t data_iface) {
@@ -43,11 +125,11 @@ void CdcEem::Init(uint8_t bulk_in_ep, uint8_t bulk_out_ep, uint8_t data_iface) {
   cdc_eem_data_endpoints_[DATA_OUT].endpointAddress =
       bulk_out_ep | (USB_OUT << 7);
   cdc_eem_interfaces_[0].interfaceNumber = data_iface;
-  tx_queue_ = xQueueCreate(10, sizeof(void *));
+  tx_queue_ = xQueueCreate(kTxQueueLength, sizeof(struct pbuf *));
   CHECK(tx_queue_);
   CHECK(xTaskCreate(CdcEem::StaticTaskFunction, "cdc_eem_task",
                     configMINIMAL_STACK_SIZE * 10, this, kUsbDeviceTaskPriority,
-                    nullptr) == pdPASS);
+                    &tx_task_) == pdPASS);
 
   std::string usb_ip;
   if (!GetUsbIpAddress(&usb_ip) ||
@@ -65,12 +147,42 @@ void CdcEem::Init(uint8_t bulk_in_ep, uint8_t bulk_out_ep, uint8_t data_iface) {
 }
 
 void CdcEem::TaskFunction(void *param) {
+  struct pbuf *p = nullptr;
+  int index = 0;
   while (true) {
-    std::vector<uint8_t> *packet;
-    if (xQueueReceive(tx_queue_, &packet, portMAX_DELAY) == pdTRUE) {
-      TransmitFrame(packet->data(), packet->size());
-      delete packet;
+    if (!p && xQueueReceive(tx_queue_, &p, portMAX_DELAY) != pdTRUE) continue;
+
+    // Until the host has sent a packet, we don't know its byte order.
+    if (endianness_ == Endianness::kUnknown) {
+      pbuf_free(p);
+      p = nullptr;
+      continue;
     }
+
+    // Put as many queued frames as fit into one transfer. A frame that
+    // doesn't fit starts the next transfer.
+    uint8_t *buffer = tx_buffers_[index];
+    size_t length = 0;
+    do {
+      if (length + kEemHeaderSize + p->tot_len + kEemCrcSize >
+          CDC_EEM_TX_TRANSFER_SIZE)
+        break;
+      length += WritePacket(p, buffer + length);
+      pbuf_free(p);
+      p = nullptr;
+    } while (xQueueReceive(tx_queue_, &p, 0) == pdTRUE);
+
+    // End a transfer that is a multiple of the USB packet size with a
+    // zero-length EEM packet, so the host doesn't wait for more data.
+    if (length % kMaxPacketUsb == 0) {
+      std::memset(buffer + length, 0, kEemHeaderSize);
+      length += kEemHeaderSize;
+    }
+
+    // The other buffer is free once this transfer is accepted, because only
+    // one transfer is in flight at a time.
+    TransmitTransfer(buffer, length);
+    index ^= 1;
   }
 }
 
@@ -79,7 +191,7 @@ err_t CdcEem::NetifInit(struct netif *netif) {
   netif->name[1] = 's';
   netif->output = etharp_output;
   netif->linkoutput = CdcEem::StaticTxFunc;
-  netif->mtu = 300;
+  netif->mtu = kMtu;
   netif->hwaddr_len = 6;
   netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_IGMP;
 
@@ -94,52 +206,83 @@ err_t CdcEem::NetifInit(struct netif *netif) {
 }
 
 err_t CdcEem::TxFunc(struct netif *netif, struct pbuf *p) {
-  auto *packet = new std::vector<uint8_t>(p->tot_len);
-  if (pbuf_copy_partial(p, packet->data(), p->tot_len, 0) != p->tot_len) {
-    delete packet;
+  if (p->tot_len > kMaxFrameSize) {
     return ERR_IF;
   }
 
-  if (xQueueSendToBack(tx_queue_, &packet, 0) != pdTRUE) {
-    delete packet;
+  // Keep the pbuf chain until the TX task has copied it into a transfer.
+  // lwIP doesn't retransmit a TCP segment while its pbuf is referenced here.
+  // Chains that point at memory the caller may reuse as soon as this returns
+  // (PBUF_REF) are copied instead.
+  struct pbuf *q = p;
+  if (PBUF_NEEDS_COPY(p)) {
+    q = pbuf_clone(PBUF_RAW, PBUF_RAM, p);
+    if (!q) {
+      return ERR_MEM;
+    }
+  } else {
+    pbuf_ref(q);
+  }
+  if (xQueueSendToBack(tx_queue_, &q, 0) != pdTRUE) {
+    pbuf_free(q);
     return ERR_IF;
   }
 
   return ERR_OK;
 }
 
-err_t CdcEem::TransmitFrame(void *buffer, uint32_t length) {
-  if (endianness_ == Endianness::kUnknown) {
-    return ERR_IF;
-  }
-  usb_status_t status;
-  uint32_t crc = PP_HTONL(0xdeadbeef);
-  uint16_t *header = reinterpret_cast<uint16_t *>(tx_buffer_);
-  *header = (0 << EEM_DATA_CRC_SHIFT) |
-            ((length + sizeof(uint32_t)) & EEM_DATA_LEN_MASK);
+size_t CdcEem::WritePacket(struct pbuf *p, uint8_t *out) const {
+  const uint16_t frame_length = p->tot_len;
+  uint16_t header = (CDC_EEM_TX_CRC << EEM_DATA_CRC_SHIFT) |
+                    ((frame_length + kEemCrcSize) & EEM_DATA_LEN_MASK);
   if (endianness_ == Endianness::kBigEndian) {
-    *header = htons(*header);
+    header = htons(header);
   }
-  std::memcpy(tx_buffer_ + sizeof(uint16_t), buffer, length);
-  std::memcpy(tx_buffer_ + sizeof(uint16_t) + length, &crc, sizeof(uint32_t));
+  std::memcpy(out, &header, kEemHeaderSize);
+
+  uint8_t *frame = out + kEemHeaderSize;
+  pbuf_copy_partial(p, frame, frame_length, 0);
+
+  uint8_t *crc = frame + frame_length;
+#if CDC_EEM_TX_CRC
+  StoreLe32(crc, Crc32(frame, frame_length));
+#else
+  const uint32_t sentinel = PP_HTONL(0xdeadbeef);
+  std::memcpy(crc, &sentinel, kEemCrcSize);
+#endif
+  return kEemHeaderSize + frame_length + kEemCrcSize;
+}
+
+void CdcEem::TransmitTransfer(uint8_t *buffer, size_t length) {
+  usb_status_t status;
   while (true) {
-    status = USB_DeviceCdcEemSend(class_handle_, bulk_in_ep_, tx_buffer_,
-                                  sizeof(uint16_t) + length + sizeof(uint32_t));
-    if (status == kStatus_USB_Busy) {
-      taskYIELD();
-    } else {
+    status = USB_DeviceCdcEemSend(class_handle_, bulk_in_ep_, buffer, length);
+    if (status != kStatus_USB_Busy) {
       break;
     }
+    // Wait for the transfer in flight to finish.
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(kTxBusyWaitMs));
   }
   if (status != kStatus_USB_Success) {
     DbgConsole_Printf("[EEM] USB_DeviceCdcEemSend failed, ERR_IF\r\n");
-    return ERR_IF;
   }
+}
 
-  return (status == kStatus_USB_Success) ? ERR_OK : ERR_IF;
+void CdcEem::NotifyTxDone() {
+  if (!tx_task_) {
+    return;
+  }
+  // If IPSR is non-zero, we are in an interrupt.
+  if (__get_IPSR() != 0) {
+    BaseType_t reschedule = pdFALSE;
+    vTaskNotifyGiveFromISR(tx_task_, &reschedule);
+    portYIELD_FROM_ISR(reschedule);
+  } else {
+    xTaskNotifyGive(tx_task_);
+  }
 }
 
-err_t CdcEem::ReceiveFrame(uint8_t *buffer, uint32_t length) {
+err_t CdcEem::ReceiveFrame(const uint8_t *buffer, uint32_t length) {
   struct pbuf *frame = pbuf_alloc(PBUF_RAW, length, PBUF_POOL);
   if (!frame) {
     printf("Failed to allocate pbuf\r\n");
@@ -156,6 +299,31 @@ err_t CdcEem::ReceiveFrame(uint8_t *buffer, uint32_t length) {
   return ERR_OK;
 }
 
+void CdcEem::ReceiveFrameInPlace(struct pbuf *p, const uint8_t *packet,
+                                 uint16_t packet_hdr) {
+  const uint8_t *data = packet + kEemHeaderSize;
+  const uint16_t data_len = FrameLength(packet_hdr);
+  if (!FrameCrcValid(data, data_len, packet_hdr)) {
+    pbuf_free(p);
+    return;
+  }
+  // lwIP expects the IP header after the Ethernet header to be 4-byte
+  // aligned. That's the case for a frame at the start of the buffer.
+  if ((reinterpret_cast<uintptr_t>(data) + SIZEOF_ETH_HDR) % 4 != 0) {
+    ReceiveFrame(data, data_len);
+    pbuf_free(p);
+    return;
+  }
+
+  pbuf_remove_header(p, data - static_cast<const uint8_t *>(p->payload));
+  pbuf_realloc(p, data_len);
+  err_t ret = netif_.input(p, &netif_);
+  if (ret != ERR_OK) {
+    printf("tcpip_input() failed %d\r\n", ret);
+    pbuf_free_callback(p);
+  }
+}
+
 usb_status_t CdcEem::SetControlLineState(
     usb_device_cdc_eem_request_param_struct_t *eem_param) {
   uint8_t dte_status = eem_param->setupValue;
@@ -205,10 +373,11 @@ usb_status_t CdcEem::SetControlLineState(
   return ret;
 }
 
-void CdcEem::DetectEndianness(uint32_t packet_length) {
+void CdcEem::DetectEndianness(const uint8_t *data, uint32_t packet_length) {
   if (endianness_ == Endianness::kUnknown) {
-    uint16_t packet_hdr_le = *reinterpret_cast<uint16_t *>(rx_buffer_);
-    uint16_t packet_hdr_be = ntohs(*reinterpret_cast<uint16_t *>(rx_buffer_));
+    uint16_t packet_hdr_le;
+    std::memcpy(&packet_hdr_le, data, sizeof(packet_hdr_le));
+    uint16_t packet_hdr_be = ntohs(packet_hdr_le);
     // Two-byte packets are usually EEM command packets, but we can't
     // detect endianness from them with certainty -- so we will not try.
     if (packet_length <= sizeof(uint16_t)) {
@@ -229,43 +398,202 @@ void CdcEem::DetectEndianness(uint32_t packet_length) {
   }
 }
 
-void CdcEem::ProcessPacket(uint32_t packet_length) {
-  DetectEndianness(packet_length);
-  if (endianness_ == Endianness::kUnknown) {
+usb_status_t CdcEem::FillRxRing() {
+  usb_status_t status = kStatus_USB_Error;
+  for (int slot = 0; slot < kRxRingSize; ++slot) {
+    if (rx_ring_[slot]) {
+      status = kStatus_USB_Success;
+      continue;
+    }
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, kRxTransferSize, PBUF_POOL);
+    if (!p) {
+      printf("Failed to allocate pbuf\r\n");
+      break;
+    }
+    if (PrimeReceive(slot, p)) {
+      status = kStatus_USB_Success;
+    }
+  }
+  return status;
+}
+
+bool CdcEem::PrimeReceive(int slot, struct pbuf *p) {
+  // The class driver allows one receive at a time, so queue them on the
+  // endpoint directly. The controller fills them in order.
+  auto *cdc_eem =
+      reinterpret_cast<usb_device_cdc_eem_struct_t *>(class_handle_);
+  rx_ring_[slot] = p;
+  if (USB_DeviceRecvRequest(cdc_eem->handle, bulk_out_ep_,
+                            static_cast<uint8_t *>(p->payload),
+                            kRxTransferSize) != kStatus_USB_Success) {
+    rx_ring_[slot] = nullptr;
+    pbuf_free(p);
+    return false;
+  }
+  return true;
+}
+
+void CdcEem::ReceiveDone(uint8_t *buffer, uint32_t length) {
+  int slot = 0;
+  while (slot < kRxRingSize &&
+         !(rx_ring_[slot] && rx_ring_[slot]->payload == buffer)) {
+    ++slot;
+  }
+  if (slot == kRxRingSize) {
+    return;
+  }
+  struct pbuf *p = rx_ring_[slot];
+  rx_ring_[slot] = nullptr;
+
+  // The receive was cancelled, because the endpoint is being deinitialized.
+  if (length == USB_UNINITIALIZED_VAL_32) {
+    pbuf_free(p);
+    rx_carry_ = 0;
     return;
   }
 
-  uint16_t packet_hdr = *reinterpret_cast<uint16_t *>(rx_buffer_);
+  // Queue a new buffer before parsing this one, so the controller keeps
+  // receiving. If the pool is empty, drop the transfer and reuse its buffer.
+  struct pbuf *next = pbuf_alloc(PBUF_RAW, kRxTransferSize, PBUF_POOL);
+  if (!next) {
+    printf("Failed to allocate pbuf\r\n");
+    rx_carry_ = 0;
+    rx_discard_ = rx_discard_ || length == kRxTransferSize;
+    PrimeReceive(slot, p);
+    return;
+  }
+  PrimeReceive(slot, next);
+  ProcessTransfer(p, length);
+}
+
+uint16_t CdcEem::ReadHeader(const uint8_t *data) const {
+  uint16_t packet_hdr;
+  std::memcpy(&packet_hdr, data, sizeof(packet_hdr));
   if (endianness_ == Endianness::kBigEndian) {
     packet_hdr = ntohs(packet_hdr);
   }
+  return packet_hdr;
+}
+
+void CdcEem::ProcessTransfer(struct pbuf *p, uint32_t transfer_length) {
+  const uint8_t *data = static_cast<const uint8_t *>(p->payload);
+  size_t remaining = transfer_length;
+
+  // A short transfer ends on a packet boundary.
+  if (rx_discard_) {
+    rx_discard_ = transfer_length == kRxTransferSize;
+    pbuf_free(p);
+    return;
+  }
+
+  if (rx_carry_ > 0) {
+    const size_t used = FinishCarriedPacket(data, remaining);
+    data += used;
+    remaining -= used;
+  }
 
+  // Hosts that don't aggregate send one packet per transfer, which is what
+  // endianness detection looks for.
+  DetectEndianness(data, remaining);
+  if (endianness_ == Endianness::kUnknown) {
+    pbuf_free(p);
+    return;
+  }
+
+  // Frames are copied out of the buffer, except the last one, which lwIP
+  // gets in the buffer itself. Hosts that don't aggregate send one frame per
+  // transfer, so their frames are never copied.
+  const uint8_t *last_frame = nullptr;
+  uint16_t last_frame_hdr = 0;
+  size_t packet_length = 0;
+  while (remaining >= kEemHeaderSize) {
+    const uint16_t packet_hdr = ReadHeader(data);
+    packet_length = kEemHeaderSize + PayloadLength(packet_hdr);
+    if (packet_length > remaining) {
+      break;
+    }
+    if (IsDataFrame(packet_hdr)) {
+      if (last_frame) {
+        ProcessPacket(last_frame, last_frame_hdr);
+      }
+      last_frame = data;
+      last_frame_hdr = packet_hdr;
+    } else {
+      ProcessPacket(data, packet_hdr);
+    }
+    data += packet_length;
+    remaining -= packet_length;
+  }
+
+  // A packet can only continue in the next transfer if this one filled the
+  // whole buffer; otherwise the rest is malformed. Copy it before lwIP owns
+  // the buffer. A packet too large to carry can't be resynchronized from, so
+  // skip to the end of the USB transfer.
+  if (remaining > 0 && transfer_length == kRxTransferSize) {
+    if (remaining < kEemHeaderSize ||
+        packet_length <= sizeof(rx_carry_buffer_)) {
+      std::memcpy(rx_carry_buffer_, data, remaining);
+      rx_carry_ = remaining;
+    } else {
+      rx_discard_ = true;
+    }
+  }
+
+  if (last_frame) {
+    ReceiveFrameInPlace(p, last_frame, last_frame_hdr);
+  } else {
+    pbuf_free(p);
+  }
+}
+
+size_t CdcEem::FinishCarriedPacket(const uint8_t *data, size_t length) {
+  size_t used = 0;
+  if (rx_carry_ < kEemHeaderSize) {
+    used = std::min(kEemHeaderSize - rx_carry_, length);
+    std::memcpy(rx_carry_buffer_ + rx_carry_, data, used);
+    rx_carry_ += used;
+    if (rx_carry_ < kEemHeaderSize) {
+      return used;
+    }
+  }
+
+  const uint16_t packet_hdr = ReadHeader(rx_carry_buffer_);
+  const size_t packet_length = kEemHeaderSize + PayloadLength(packet_hdr);
+  if (packet_length > sizeof(rx_carry_buffer_) ||
+      packet_length - rx_carry_ > length - used) {
+    // The whole transfer is part of the bad packet; if it filled the buffer,
+    // the packet goes on in the next one too.
+    rx_carry_ = 0;
+    rx_discard_ = length == kRxTransferSize;
+    return length;
+  }
+  std::memcpy(rx_carry_buffer_ + rx_carry_, data + used,
+              packet_length - rx_carry_);
+  used += packet_length - rx_carry_;
+  rx_carry_ = 0;
+  ProcessPacket(rx_carry_buffer_, packet_hdr);
+  return used;
+}
+
+void CdcEem::ProcessPacket(const uint8_t *packet, uint16_t packet_hdr) {
   if (packet_hdr & EEM_HEADER_TYPE_MASK) {
     uint16_t opcode =
         (packet_hdr & EEM_COMMAND_OPCODE_MASK) >> EEM_COMMAND_OPCODE_SHIFT;
     uint16_t param =
         (packet_hdr & EEM_COMMAND_PARAM_MASK) >> EEM_COMMAND_PARAM_SHIFT;
-    uint8_t *data = rx_buffer_ + sizeof(uint16_t);
     (void)param;
-    (void)data;
     switch (opcode) {
       case EEM_COMMAND_ECHO_RESPONSE:
         break;
       default:
         DbgConsole_Printf("Unhandled EEM opcode: %u\r\n", opcode);
     }
-  } else {
-    uint16_t checksum = (packet_hdr & EEM_DATA_CRC_MASK) >> EEM_DATA_CRC_SHIFT;
-    uint16_t len = (packet_hdr & EEM_DATA_LEN_MASK) >> EEM_DATA_LEN_SHIFT;
-    if (len == 0) {
-      return;
+  } else if (IsDataFrame(packet_hdr)) {
+    const uint8_t *data = packet + kEemHeaderSize;
+    const uint16_t data_len = FrameLength(packet_hdr);
+    if (FrameCrcValid(data, data_len, packet_hdr)) {
+      ReceiveFrame(data, data_len);
     }
-    uint8_t *data = rx_buffer_ + sizeof(uint16_t);
-    uint16_t data_len = len - sizeof(uint32_t);
-    // TODO(atv): We should validate checksum. But we won't (for now). See if
-    // the stack handles that?
-    (void)checksum;
-    ReceiveFrame(data, data_len);
   }
 }
 
@@ -275,8 +603,9 @@ bool CdcEem::HandleEvent(uint32_t event, void *param) {
     case kUSB_DeviceEventSetConfiguration:
       break;
     case kUSB_DeviceEventSetInterface:
-      USB_DeviceCdcEemRecv(class_handle_, bulk_out_ep_, rx_buffer_,
-                           cdc_eem_data_endpoints_[DATA_OUT].maxPacketSize);
+      rx_carry_ = 0;
+      rx_discard_ = false;
+      status = FillRxRing();
       break;
     default:
       DbgConsole_Printf("%s unhandled event %d\r\n", __PRETTY_FUNCTION__,
@@ -295,22 +624,19 @@ usb_status_t CdcEem::Handler(uint32_t event, void *param) {
 
   switch (event) {
     case kUSB_DeviceEemEventRecvResponse: {
-      ProcessPacket(ep_cb->length);
-      ret =
-          USB_DeviceCdcEemRecv(class_handle_, bulk_out_ep_, rx_buffer_,
-                               cdc_eem_data_endpoints_[DATA_OUT].maxPacketSize);
+      ReceiveDone(ep_cb->buffer, ep_cb->length);
+      ret = kStatus_USB_Success;
       break;
     }
     case kUSB_DeviceEemEventSendResponse:
       if (ep_cb->length != 0 &&
-          (ep_cb->length % cdc_eem_data_endpoints_[DATA_OUT].maxPacketSize) ==
+          (ep_cb->length % cdc_eem_data_endpoints_[DATA_IN].maxPacketSize) ==
               0) {
         ret = USB_DeviceCdcEemSend(class_handle_, bulk_in_ep_, nullptr, 0);
       } else {
+        NotifyTxDone();
         if (ep_cb->buffer || (!ep_cb->buffer && ep_cb->length == 0)) {
-          ret = USB_DeviceCdcEemRecv(
-              class_handle_, bulk_out_ep_, rx_buffer_,
-              cdc_eem_data_endpoints_[DATA_OUT].maxPacketSize);
+          ret = FillRxRing();
         }
       }
       break;
@@ -17,6 +17,8 @@
 #ifndef LIBS_CDC_EEM_CDC_EEM_H_
 #define LIBS_CDC_EEM_CDC_EEM_H_
 
+#include <cstddef>
+#include <cstdint>
 #include <map>
 
 /* clang-format off */
@@ -26,12 +28,32 @@
 #include "third_party/nxp/rt1176-sdk/middleware/usb/include/usb.h"
 #include "third_party/nxp/rt1176-sdk/middleware/usb/output/source/device/class/usb_device_class.h"  // Must be above other class headers.
 #include "libs/nxp/rt1176-sdk/usb_device_cdc_eem.h"
+#include "third_party/freertos_kernel/include/FreeRTOS.h"
+#include "third_party/freertos_kernel/include/queue.h"
+#include "third_party/freertos_kernel/include/task.h"
 /* clang-format on */
 
+// Computes a real Ethernet CRC for each transmitted frame, instead of the
+// 0xDEADBEEF sentinel that EEM allows because USB already checks each
+// transfer. Received frames are always checked when the host sends a CRC.
+#ifndef CDC_EEM_TX_CRC
+#define CDC_EEM_TX_CRC 0
+#endif
+
+// Most bytes of EEM packets sent to the host in one bulk transfer. Linux's
+// cdc_eem driver receives into buffers of MTU + 24 bytes, and splits or drops
+// packets from larger transfers.
+#ifndef CDC_EEM_TX_TRANSFER_SIZE
+#define CDC_EEM_TX_TRANSFER_SIZE 1524
+#endif
+
 namespace coralmicro {
 
 class CdcEem {
  public:
+  // MTU of the USB network interface.
+  static constexpr int kMtu = 1500;
+
   CdcEem() = default;
   CdcEem(const CdcEem &) = delete;
   CdcEem &operator=(const CdcEem &) = delete;
@@ -48,9 +70,42 @@ class CdcEem {
   bool HandleEvent(uint32_t event, void *param);
 
  private:
+  // An EEM packet is a 2-byte header, then an Ethernet frame without its
+  // FCS, then a 4-byte CRC.
+  static constexpr size_t kEemHeaderSize = sizeof(uint16_t);
+  static constexpr size_t kEemCrcSize = sizeof(uint32_t);
+  static constexpr size_t kMaxFrameSize = kMtu + 14;
+  static constexpr size_t kMaxPacketSize =
+      kEemHeaderSize + kMaxFrameSize + kEemCrcSize;
+  static constexpr size_t kMaxPacketUsb = 512;
+  // Bytes requested for each receive, into a pool pbuf. Hosts that don't
+  // aggregate send one packet per transfer; others may put several EEM
+  // packets in one transfer.
+  static constexpr size_t kRxTransferSize = 3 * kMaxPacketUsb;
+  // Receives kept in flight on the bulk OUT endpoint.
+  static constexpr int kRxRingSize = 4;
+  // Room for a 2-byte zero-length EEM packet, which ends a transfer that is
+  // a multiple of the USB packet size.
+  static constexpr size_t kTxBufferSize =
+      CDC_EEM_TX_TRANSFER_SIZE + kEemHeaderSize;
+  static constexpr int kTxQueueLength = 32;
+  static_assert(CDC_EEM_TX_TRANSFER_SIZE >= kMaxPacketSize,
+                "CDC_EEM_TX_TRANSFER_SIZE must fit a full-size frame");
+  static_assert(kRxTransferSize >= kMaxPacketSize,
+                "kRxTransferSize must fit a full-size packet");
+  static_assert(PBUF_POOL_BUFSIZE >= kRxTransferSize,
+                "A receive must fit in one pool pbuf");
+
   usb_status_t SetControlLineState(
       usb_device_cdc_eem_request_param_struct_t *eem_param);
-  void ProcessPacket(uint32_t packet_length);
+  usb_status_t FillRxRing();
+  bool PrimeReceive(int slot, struct pbuf *p);
+  void ReceiveDone(uint8_t *buffer, uint32_t length);
+  void ProcessTransfer(struct pbuf *p, uint32_t transfer_length);
+  size_t FinishCarriedPacket(const uint8_t *data, size_t length);
+  uint16_t ReadHeader(const uint8_t *data) const;
+  void ProcessPacket(const uint8_t *packet, uint16_t packet_hdr);
+  void NotifyTxDone();
 
   static std::map<class_handle_t, CdcEem *> handle_map_;
   static usb_status_t StaticHandler(class_handle_t class_handle, uint32_t event,
@@ -75,8 +130,11 @@ class CdcEem {
   }
   void TaskFunction(void *param);
 
-  err_t TransmitFrame(void *buffer, uint32_t length);
-  err_t ReceiveFrame(uint8_t *buffer, uint32_t length);
+  size_t WritePacket(struct pbuf *p, uint8_t *out) const;
+  void TransmitTransfer(uint8_t *buffer, size_t length);
+  err_t ReceiveFrame(const uint8_t *buffer, uint32_t length);
+  void ReceiveFrameInPlace(struct pbuf *p, const uint8_t *packet,
+                           uint16_t packet_hdr);
 
   usb_device_endpoint_struct_t cdc_eem_data_endpoints_[2] = {
       {
@@ -156,10 +214,21 @@ class CdcEem {
                  .interval = 0},
   };
 
-  uint8_t tx_buffer_[512];
-  uint8_t rx_buffer_[512];
+  // One transfer is filled while the other is sent.
+  alignas(32) uint8_t tx_buffers_[2][kTxBufferSize];
+  // Pool pbufs that the USB controller is receiving into, or nullptr. Only
+  // the USB device task touches the ring.
+  struct pbuf *rx_ring_[kRxRingSize] = {};
+  // The start of a packet that continues in the next transfer.
+  uint8_t rx_carry_buffer_[kMaxPacketSize];
+  size_t rx_carry_ = 0;
+  // Set after a full transfer is dropped, until a short transfer shows where
+  // packets start again.
+  bool rx_discard_ = false;
   uint8_t bulk_in_ep_, bulk_out_ep_;
+  // Frames from lwIP, as referenced pbufs.
   QueueHandle_t tx_queue_;
+  TaskHandle_t tx_task_ = nullptr;
   class_handle_t class_handle_;
 
   ip4_addr_t netif_ipaddr_, netif_netmask_, netif_gw_;
@@ -171,7 +240,7 @@ class CdcEem {
     kBigEndian,
   };
   Endianness endianness_ = Endianness::kUnknown;
-  void DetectEndianness(uint32_t packet_length);
+  void DetectEndianness(const uint8_t *data, uint32_t transfer_length);
 };
 
 }  // namespace coralmicro
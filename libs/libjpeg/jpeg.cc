@@ -17,11 +17,14 @@
 #include "libs/libjpeg/jpeg.h"
 
 #include <algorithm>
+#include <cstring>
 
 #include "third_party/nxp/rt1176-sdk/middleware/libjpeg/inc/jpeglib.h"
 
 namespace coralmicro {
 namespace {
+// Vectors start at this size and then double, so a large frame only needs a
+// few reallocations.
 constexpr size_t kVectorSizeIncrement = 10 * 1024;
 
 struct vector_destination_mgr {
@@ -38,10 +41,11 @@ empty_vector_output_buffer(j_compress_ptr cinfo) {
   auto* dest = reinterpret_cast<vector_destination_mgr*>(cinfo->dest);
 
   auto size = dest->out->size();
-  dest->out->resize(size + kVectorSizeIncrement);
+  auto increment = std::max(size, kVectorSizeIncrement);
+  dest->out->resize(size + increment);
 
   dest->pub.next_output_byte = dest->out->data() + size;
-  dest->pub.free_in_buffer = kVectorSizeIncrement;
+  dest->pub.free_in_buffer = increment;
 
   return TRUE;
 }
@@ -129,8 +133,314 @@ void JpegCompressImpl(struct jpeg_compress_struct* cinfo, unsigned char* rgb,
   jpeg_finish_compress(cinfo);
   jpeg_destroy_compress(cinfo);
 }
+
+// Rows handed to libjpeg per `jpeg_write_scanlines()` call. This matches the
+// height of an MCU row with 2x2 chroma subsampling.
+constexpr int kStripRows = 16;
+// Arena allocations are aligned to the M7 cache line, which also satisfies
+// libjpeg builds that use SIMD.
+constexpr size_t kArenaAlignment = 32;
+}  // namespace
+
+// @cond
+struct JpegEncoder::State {
+  // Destination for both the buffer and the vector output modes. It lives
+  // here rather than in a libjpeg pool so it's never reallocated.
+  struct Destination {
+    jpeg_destination_mgr pub;
+    uint8_t* buf;
+    size_t size;
+    std::vector<uint8_t>* out;
+    bool overflow;
+    // Bytes compressed into `discard` after `buf` filled up, not counting
+    // what's in `discard` now.
+    size_t overflow_bytes;
+    uint8_t discard[256];
+  };
+
+  jpeg_compress_struct cinfo;
+  jpeg_error_mgr jerr;
+  Destination dest;
+  // libjpeg's own memory manager methods, used for permanent allocations and
+  // whenever the arena is full.
+  jpeg_memory_mgr base_mem;
+
+  std::vector<uint8_t> arena;
+  size_t arena_used = 0;
+  size_t arena_high_water = 0;
+  // Size the last fixed-buffer encode needed, for `RequiredSize()`.
+  size_t required_size = 0;
+
+  std::vector<uint8_t> strip;
+
+  J_COLOR_SPACE color_space = JCS_UNKNOWN;
+  int quality = -1;
+};
+// @endcond
+
+namespace {
+JpegEncoder::State* GetEncoderState(j_common_ptr cinfo) {
+  return static_cast<JpegEncoder::State*>(cinfo->client_data);
+}
+
+void* ArenaAlloc(JpegEncoder::State* state, size_t size) {
+  const auto base = reinterpret_cast<uintptr_t>(state->arena.data());
+  const auto start =
+      (base + state->arena_used + kArenaAlignment - 1) & ~(kArenaAlignment - 1);
+  const size_t end = start - base + size;
+  if (end > state->arena.size()) return nullptr;
+  state->arena_used = end;
+  state->arena_high_water = std::max(state->arena_high_water, end);
+  return reinterpret_cast<void*>(start);
+}
+
+METHODDEF(void*)
+encoder_alloc_small(j_common_ptr cinfo, int pool_id, size_t size) {
+  auto* state = GetEncoderState(cinfo);
+  if (pool_id == JPOOL_IMAGE) {
+    if (auto* p = ArenaAlloc(state, size)) return p;
+  }
+  return state->base_mem.alloc_small(cinfo, pool_id, size);
+}
+
+METHODDEF(void FAR*)
+encoder_alloc_large(j_common_ptr cinfo, int pool_id, size_t size) {
+  auto* state = GetEncoderState(cinfo);
+  if (pool_id == JPOOL_IMAGE) {
+    if (auto* p = ArenaAlloc(state, size)) return p;
+  }
+  return state->base_mem.alloc_large(cinfo, pool_id, size);
+}
+
+METHODDEF(JSAMPARRAY)
+encoder_alloc_sarray(j_common_ptr cinfo, int pool_id, JDIMENSION samplesperrow,
+                     JDIMENSION numrows) {
+  auto rows = static_cast<JSAMPARRAY>(
+      encoder_alloc_small(cinfo, pool_id, numrows * sizeof(JSAMPROW)));
+  for (JDIMENSION i = 0; i < numrows; ++i) {
+    rows[i] = static_cast<JSAMPROW>(
+        encoder_alloc_large(cinfo, pool_id, samplesperrow * sizeof(JSAMPLE)));
+  }
+  return rows;
+}
+
+METHODDEF(JBLOCKARRAY)
+encoder_alloc_barray(j_common_ptr cinfo, int pool_id, JDIMENSION blocksperrow,
+                     JDIMENSION numrows) {
+  auto rows = static_cast<JBLOCKARRAY>(
+      encoder_alloc_small(cinfo, pool_id, numrows * sizeof(JBLOCKROW)));
+  for (JDIMENSION i = 0; i < numrows; ++i) {
+    rows[i] = static_cast<JBLOCKROW>(
+        encoder_alloc_large(cinfo, pool_id, blocksperrow * sizeof(JBLOCK)));
+  }
+  return rows;
+}
+
+METHODDEF(void)
+encoder_free_pool(j_common_ptr cinfo, int pool_id) {
+  auto* state = GetEncoderState(cinfo);
+  if (pool_id == JPOOL_IMAGE) state->arena_used = 0;
+  state->base_mem.free_pool(cinfo, pool_id);
+}
+
+METHODDEF(void)
+init_encoder_destination(j_compress_ptr cinfo) { (void)cinfo; }
+
+METHODDEF(boolean)
+empty_encoder_output_buffer(j_compress_ptr cinfo) {
+  auto* dest = reinterpret_cast<JpegEncoder::State::Destination*>(cinfo->dest);
+  if (dest->out) {
+    const auto size = dest->out->size();
+    const auto increment = std::max(size, kVectorSizeIncrement);
+    dest->out->resize(size + increment);
+    dest->pub.next_output_byte = dest->out->data() + size;
+    dest->pub.free_in_buffer = increment;
+    return TRUE;
+  }
+  // Keep compressing into a scratch area instead of suspending, which libjpeg
+  // doesn't support for compression. The result is reported as a failure,
+  // but the bytes are counted so the caller can learn the size it needed.
+  if (dest->overflow) dest->overflow_bytes += sizeof(dest->discard);
+  dest->overflow = true;
+  dest->pub.next_output_byte = dest->discard;
+  dest->pub.free_in_buffer = sizeof(dest->discard);
+  return TRUE;
+}
+
+METHODDEF(void)
+term_encoder_destination(j_compress_ptr cinfo) {
+  auto* dest = reinterpret_cast<JpegEncoder::State::Destination*>(cinfo->dest);
+  if (dest->out) dest->out->resize(dest->out->size() - dest->pub.free_in_buffer);
+}
+
+void SetEncoderDest(JpegEncoder::State* state, uint8_t* buf, size_t size,
+                    std::vector<uint8_t>* out) {
+  auto& dest = state->dest;
+  if (out) {
+    // Reuse whatever capacity the vector already has.
+    out->resize(std::max(out->capacity(), kVectorSizeIncrement));
+    buf = out->data();
+    size = out->size();
+  }
+  dest.pub.init_destination = init_encoder_destination;
+  dest.pub.empty_output_buffer = empty_encoder_output_buffer;
+  dest.pub.term_destination = term_encoder_destination;
+  dest.pub.next_output_byte = buf;
+  dest.pub.free_in_buffer = size;
+  dest.buf = buf;
+  dest.size = size;
+  dest.out = out;
+  dest.overflow = false;
+  dest.overflow_bytes = 0;
+  state->cinfo.dest = &dest.pub;
+}
+
+// Records the size that an encode into a fixed-size buffer needed. Returns
+// that size, or 0 if encoding failed or the image didn't fit.
+size_t FinishBufferEncode(JpegEncoder::State* state, bool ok) {
+  const auto& dest = state->dest;
+  if (!ok) {
+    state->required_size = 0;
+    return 0;
+  }
+  // libjpeg asks for more room as soon as the buffer is full, so an image
+  // that fits exactly also overflows, with nothing discarded.
+  const size_t used = dest.overflow
+                          ? dest.size + dest.overflow_bytes +
+                                sizeof(dest.discard) - dest.pub.free_in_buffer
+                          : dest.size - dest.pub.free_in_buffer;
+  state->required_size = used;
+  return used <= dest.size ? used : 0;
+}
+
+void SwapRedBlue(const uint8_t* src, uint8_t* dst, size_t num_pixels) {
+  for (size_t i = 0; i < num_pixels; ++i, src += 3, dst += 3) {
+    const uint8_t r = src[0];
+    dst[1] = src[1];
+    dst[0] = src[2];
+    dst[2] = r;
+  }
+}
+
+// Compresses an image from either `pixels` or `fn` into the destination set by
+// `SetEncoderDest()`. Returns false if the row callback failed.
+bool EncodeRows(JpegEncoder::State* state, const uint8_t* pixels, int width,
+                int height, JpegPixelFormat format, int quality, void* ctx,
+                JpegEncoder::RowCallback fn) {
+  auto* cinfo = &state->cinfo;
+  cinfo->image_width = width;
+  cinfo->image_height = height;
+  cinfo->input_components = JpegPixelFormatBpp(format);
+  auto color_space = JCS_RGB;
+  if (format == JpegPixelFormat::kY8) color_space = JCS_GRAYSCALE;
+  if (format == JpegPixelFormat::kYCbCr) color_space = JCS_YCbCr;
+  cinfo->in_color_space = color_space;
+  // Tables only need to be rebuilt when the input or quality changes.
+  if (color_space != state->color_space) {
+    jpeg_set_defaults(cinfo);
+    state->color_space = color_space;
+    state->quality = -1;
+  }
+  if (quality != state->quality) {
+    jpeg_set_quality(cinfo, quality, TRUE);
+    state->quality = quality;
+  }
+
+  const size_t stride = static_cast<size_t>(width) * cinfo->input_components;
+  const bool needs_strip = fn || format == JpegPixelFormat::kRgb;
+  if (needs_strip && state->strip.size() < kStripRows * stride)
+    state->strip.resize(kStripRows * stride);
+
+  jpeg_start_compress(cinfo, TRUE);
+  JSAMPROW rows[kStripRows];
+  while (cinfo->next_scanline < cinfo->image_height) {
+    const int row = cinfo->next_scanline;
+    const int num_rows = std::min(kStripRows, height - row);
+    uint8_t* strip;
+    if (fn) {
+      strip = state->strip.data();
+      if (!fn(ctx, row, num_rows, strip)) {
+        jpeg_abort_compress(cinfo);
+        return false;
+      }
+      if (format == JpegPixelFormat::kRgb)
+        SwapRedBlue(strip, strip, num_rows * width);
+    } else if (format == JpegPixelFormat::kRgb) {
+      strip = state->strip.data();
+      SwapRedBlue(pixels + row * stride, strip, num_rows * width);
+    } else {
+      // libjpeg never writes to its input rows.
+      strip = const_cast<uint8_t*>(pixels + row * stride);
+    }
+    for (int i = 0; i < num_rows; ++i) rows[i] = strip + i * stride;
+    jpeg_write_scanlines(cinfo, rows, num_rows);
+  }
+  jpeg_finish_compress(cinfo);
+  return true;
+}
 }  // namespace
 
+int JpegPixelFormatBpp(JpegPixelFormat format) {
+  return format == JpegPixelFormat::kY8 ? 1 : 3;
+}
+
+JpegEncoder::JpegEncoder(size_t arena_size) : state_(new State) {
+  auto* cinfo = &state_->cinfo;
+  cinfo->err = jpeg_std_error(&state_->jerr);
+  cinfo->client_data = state_.get();
+  jpeg_create_compress(cinfo);
+
+  state_->arena.resize(arena_size);
+  state_->base_mem = *cinfo->mem;
+  cinfo->mem->alloc_small = encoder_alloc_small;
+  cinfo->mem->alloc_large = encoder_alloc_large;
+  cinfo->mem->alloc_sarray = encoder_alloc_sarray;
+  cinfo->mem->alloc_barray = encoder_alloc_barray;
+  cinfo->mem->free_pool = encoder_free_pool;
+}
+
+JpegEncoder::~JpegEncoder() { jpeg_destroy_compress(&state_->cinfo); }
+
+size_t JpegEncoder::Encode(const uint8_t* pixels, int width, int height,
+                           JpegPixelFormat format, int quality, uint8_t* buf,
+                           size_t size) {
+  SetEncoderDest(state_.get(), buf, size, nullptr);
+  return FinishBufferEncode(
+      state_.get(), EncodeRows(state_.get(), pixels, width, height, format,
+                               quality, nullptr, nullptr));
+}
+
+bool JpegEncoder::Encode(const uint8_t* pixels, int width, int height,
+                         JpegPixelFormat format, int quality,
+                         std::vector<uint8_t>* out) {
+  SetEncoderDest(state_.get(), nullptr, 0, out);
+  return EncodeRows(state_.get(), pixels, width, height, format, quality,
+                    nullptr, nullptr);
+}
+
+size_t JpegEncoder::Encode(int width, int height, JpegPixelFormat format,
+                           int quality, void* ctx, RowCallback fn,
+                           uint8_t* buf, size_t size) {
+  SetEncoderDest(state_.get(), buf, size, nullptr);
+  return FinishBufferEncode(
+      state_.get(), EncodeRows(state_.get(), nullptr, width, height, format,
+                               quality, ctx, fn));
+}
+
+bool JpegEncoder::Encode(int width, int height, JpegPixelFormat format,
+                         int quality, void* ctx, RowCallback fn,
+                         std::vector<uint8_t>* out) {
+  SetEncoderDest(state_.get(), nullptr, 0, out);
+  return EncodeRows(state_.get(), nullptr, width, height, format, quality, ctx,
+                    fn);
+}
+
+size_t JpegEncoder::RequiredSize() const { return state_->required_size; }
+
+size_t JpegEncoder::ArenaHighWaterMark() const {
+  return state_->arena_high_water;
+}
+
 unsigned long JpegCompressRgb(unsigned char* rgb, int width, int height,
                               int quality, unsigned char* buf,
                               unsigned long size) {
@@ -17,7 +17,9 @@
 #ifndef LIBS_LIBJPEG_JPEG_H_
 #define LIBS_LIBJPEG_JPEG_H_
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
 namespace coralmicro {
@@ -67,6 +69,161 @@ JpegBuffer JpegCompressRgb(unsigned char* rgb, int width, int height,
 void JpegCompressRgb(unsigned char* rgb, int width, int height, int quality,
                      std::vector<uint8_t>* out);
 
+// Pixel formats accepted by `JpegEncoder`.
+enum class JpegPixelFormat {
+  // 3 bytes per pixel, red first.
+  kRgb,
+  // 3 bytes per pixel, blue first. This is the order libjpeg consumes
+  // directly, so rows are never copied.
+  kBgr,
+  // 1 byte per pixel grayscale.
+  kY8,
+  // 3 bytes per pixel of full-range BT.601 luma and chroma. This skips
+  // libjpeg's color conversion step.
+  kYCbCr,
+};
+
+// Gets the number of bytes per pixel of a `JpegPixelFormat`.
+//
+// @param format The pixel format.
+// @return The number of bytes per pixel.
+int JpegPixelFormatBpp(JpegPixelFormat format);
+
+// Compresses images to JPEG, reusing the compressor between frames.
+//
+// Unlike `JpegCompressRgb()`, which creates and destroys a libjpeg compressor
+// for every image (and swaps the red and blue channels of your RGB buffer in
+// place), a `JpegEncoder` keeps its compressor, quantization and Huffman
+// tables, and working memory for as long as it exists. It never modifies the
+// input image, so you can compress a camera frame and then pass the same
+// buffer to a model.
+//
+// Working memory that libjpeg needs for each image comes from a fixed arena
+// allocated by the constructor, so encoding a frame doesn't touch the heap
+// once the arena is large enough (allocations that don't fit fall back to
+// libjpeg's own allocator).
+//
+// A `JpegEncoder` is not thread-safe; use one per task.
+//
+// For example:
+//
+// ```
+// JpegEncoder encoder;
+// std::vector<uint8_t> jpeg;
+// encoder.Encode(frame.data(), width, height, JpegPixelFormat::kRgb,
+//                /*quality=*/75, &jpeg);
+// ```
+class JpegEncoder {
+ public:
+  // Default size of the working memory arena. This covers the compressor
+  // state for images of the camera's native resolution.
+  static constexpr size_t kDefaultArenaSize = 64 * 1024;
+
+  // The function type that provides image rows to `Encode()`.
+  //
+  // @param ctx Extra parameters, defined with `Encode()`.
+  // @param row The index of the first row to provide.
+  // @param num_rows The number of rows to provide.
+  // @param rows The buffer to fill with `num_rows` rows in the encoder's input
+  // format, each `width * JpegPixelFormatBpp(format)` bytes long.
+  // @return True on success, false to abort encoding.
+  using RowCallback = bool (*)(void* ctx, int row, int num_rows,
+                               uint8_t* rows);
+
+  // Constructor.
+  //
+  // @param arena_size Size in bytes of the working memory arena.
+  explicit JpegEncoder(size_t arena_size = kDefaultArenaSize);
+  // @cond
+  JpegEncoder(const JpegEncoder&) = delete;
+  JpegEncoder& operator=(const JpegEncoder&) = delete;
+  ~JpegEncoder();
+  // @endcond
+
+  // Compresses an image into a fixed-size buffer.
+  //
+  // @param pixels The image, in the given format. It is not modified.
+  // @param width The image's width.
+  // @param height The image's height.
+  // @param format The pixel format of `pixels`.
+  // @param quality The quality of the image after compression (must be within
+  // [0-100]).
+  // @param buf The buffer to return the JPEG image data to.
+  // @param size The size allocated for buf.
+  // @return The size of the resulting JPEG image, or 0 if it didn't fit, in
+  // which case `RequiredSize()` gives the size it needed.
+  size_t Encode(const uint8_t* pixels, int width, int height,
+                JpegPixelFormat format, int quality, uint8_t* buf,
+                size_t size);
+
+  // Compresses an image into a vector.
+  //
+  // @param pixels The image, in the given format. It is not modified.
+  // @param width The image's width.
+  // @param height The image's height.
+  // @param format The pixel format of `pixels`.
+  // @param quality The quality of the image after compression (must be within
+  // [0-100]).
+  // @param out The output vector to return the resulting JPEG image to.
+  // @return True on success, false otherwise.
+  bool Encode(const uint8_t* pixels, int width, int height,
+              JpegPixelFormat format, int quality, std::vector<uint8_t>* out);
+
+  // Compresses an image provided a few rows at a time by a callback.
+  //
+  // This lets you compress an image that never exists in memory as a whole.
+  //
+  // @param width The image's width.
+  // @param height The image's height.
+  // @param format The pixel format provided by `fn`.
+  // @param quality The quality of the image after compression (must be within
+  // [0-100]).
+  // @param ctx Extra parameters to pass through to the callback function.
+  // @param fn The function to provide image rows.
+  // @param buf The buffer to return the JPEG image data to.
+  // @param size The size allocated for buf.
+  // @return The size of the resulting JPEG image, or 0 on failure or if it
+  // didn't fit, in which case `RequiredSize()` gives the size it needed.
+  size_t Encode(int width, int height, JpegPixelFormat format, int quality,
+                void* ctx, RowCallback fn, uint8_t* buf, size_t size);
+
+  // Compresses an image provided a few rows at a time by a callback into a
+  // vector.
+  //
+  // @param width The image's width.
+  // @param height The image's height.
+  // @param format The pixel format provided by `fn`.
+  // @param quality The quality of the image after compression (must be within
+  // [0-100]).
+  // @param ctx Extra parameters to pass through to the callback function.
+  // @param fn The function to provide image rows.
+  // @param out The output vector to return the resulting JPEG image to.
+  // @return True on success, false otherwise.
+  bool Encode(int width, int height, JpegPixelFormat format, int quality,
+              void* ctx, RowCallback fn, std::vector<uint8_t>* out);
+
+  // Gets the size of the image from the last `Encode()` into a fixed-size
+  // buffer, including an image that didn't fit. Pass it to
+  // `BufferPool::Handle::SetSize()` so the pool's statistics see oversized
+  // frames.
+  //
+  // @return The size in bytes, or 0 if the last encode failed for another
+  // reason.
+  size_t RequiredSize() const;
+
+  // Gets the most working memory used from the arena for a single image.
+  //
+  // @return The arena high-water mark in bytes.
+  size_t ArenaHighWaterMark() const;
+
+  // @cond
+  struct State;
+  // @endcond
+
+ private:
+  std::unique_ptr<State> state_;
+};
+
 }  // namespace coralmicro
 
 #endif  // LIBS_LIBJPEG_JPEG_H_
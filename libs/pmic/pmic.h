@@ -18,7 +18,6 @@
 #define LIBS_PMIC_PMIC_H_
 
 #include <cstdint>
-#include <functional>
 
 #include "libs/base/queue_task.h"
 #include "libs/base/tasks.h"
@@ -56,7 +55,7 @@ struct Request {
   union {
     RailRequest rail;
   } request;
-  std::function<void(Response)> callback;
+  QueueTaskCallback<Response> callback;
 };
 
 }  // namespace pmic
@@ -16,18 +16,30 @@
 
 #include "libs/rpc/rpc_http_server.h"
 
+#include <algorithm>
 #include <cassert>
+#include <climits>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <utility>
 
+#include "libs/base/check.h"
+#include "libs/base/mutex.h"
+#include "libs/base/timer.h"
 #include "third_party/nxp/rt1176-sdk/middleware/lwip/src/include/lwip/apps/fs.h"
 #include "third_party/nxp/rt1176-sdk/middleware/lwip/src/include/lwip/apps/httpd.h"
+#include "third_party/nxp/rt1176-sdk/middleware/lwip/src/include/lwip/tcpip.h"
 
 #define FS_FILE_FLAGS_JSON_RPC (1 << 7)
+#define FS_FILE_FLAGS_BINARY_RPC (1 << 6)
 
 namespace coralmicro {
 namespace {
+// Statistics are kept for at most this many method names, so clients can't
+// exhaust memory with made-up methods. Other names share the "" entry.
+constexpr size_t kMaxMethods = 32;
+
 int Append(const char* buf, int len, void* userdata) {
   auto* v = static_cast<std::vector<char>*>(userdata);
   v->insert(v->end(), buf, buf + len);
@@ -42,21 +54,110 @@ void* FindPointerParam(const char* param, int iNumParams, char** pcParam,
   }
   return nullptr;
 }
+
+bool ReadSize(const std::vector<char>& buf, size_t* pos, uint32_t* size) {
+  if (buf.size() - *pos < 4) return false;
+  const auto* p = reinterpret_cast<const uint8_t*>(buf.data() + *pos);
+  *size = p[0] | (p[1] << 8) | (p[2] << 16) |
+          (static_cast<uint32_t>(p[3]) << 24);
+  *pos += 4;
+  return true;
+}
+
+void WriteSize(uint32_t size, std::vector<uint8_t>* out) {
+  for (int i = 0; i < 4; ++i) out->push_back((size >> (8 * i)) & 0xff);
+}
+
+bool ParseBinaryRequest(const std::vector<char>& buf, const char** json,
+                        uint32_t* json_size, JsonRpcAttachments* attachments) {
+  size_t pos = 0;
+  if (!ReadSize(buf, &pos, json_size) || *json_size > buf.size() - pos)
+    return false;
+  *json = buf.data() + pos;
+  pos += *json_size;
+
+  while (pos < buf.size()) {
+    uint32_t size;
+    if (!ReadSize(buf, &pos, &size) || size > buf.size() - pos) return false;
+    attachments->AddRequest(
+        {reinterpret_cast<const uint8_t*>(buf.data() + pos), size});
+    pos += size;
+  }
+  return true;
+}
+
+void AppendError(const char* json, size_t json_size, int code,
+                 const char* message, std::vector<char>* out) {
+  const char* id;
+  ssize_t id_size;
+  std::string error = "{\"id\":";
+  if (json && mjson_find(json, json_size, "$.id", &id, &id_size) != 0)
+    error.append(id, id_size);
+  else
+    error += "null";
+  error += ",\"error\":{\"code\":" + std::to_string(code) +
+           ",\"message\":\"" + message + "\"}}\n";
+  Append(error.data(), error.size(), out);
+}
 }  // namespace
 
+JsonRpcHttpServer::JsonRpcHttpServer(struct jsonrpc_ctx* ctx)
+    : ctx_(ctx), mutex_(xSemaphoreCreateMutex()) {
+  CHECK(mutex_);
+}
+
+void JsonRpcHttpServer::StartWorkers(const JsonRpcWorkerConfig& config) {
+  CHECK(workers_.empty());
+  CHECK(config.num_workers > 0 && config.queue_size > 0);
+  jobs_ = xQueueCreate(config.queue_size, sizeof(Job*));
+  CHECK(jobs_);
+
+  workers_.resize(config.num_workers);
+  for (auto& worker : workers_) {
+    CHECK(xTaskCreate(StaticWorker, "jsonrpc_worker", config.stack_size, this,
+                      config.task_priority, &worker) == pdPASS);
+  }
+}
+
+void JsonRpcHttpServer::SetMethodConcurrency(const char* method,
+                                             int max_concurrent) {
+  MutexLock lock(mutex_);
+  methods_[method].max_concurrent = std::max(0, max_concurrent);
+}
+
+std::vector<JsonRpcMethodStats> JsonRpcHttpServer::GetMethodStats() const {
+  std::vector<JsonRpcMethodStats> stats;
+  MutexLock lock(mutex_);
+  stats.reserve(methods_.size());
+  for (const auto& [name, method] : methods_) {
+    stats.push_back({name, method.max_concurrent, method.calls,
+                     method.rejected, method.queued, method.max_queued,
+                     method.total_run_us, method.max_run_us,
+                     method.max_wait_us});
+  }
+  return stats;
+}
+
 err_t JsonRpcHttpServer::PostBegin(void* connection, const char* uri,
                                    const char* http_request,
                                    u16_t http_request_len, int content_len,
                                    char* response_uri, u16_t response_uri_len,
                                    u8_t* post_auto_wnd) {
-  if (std::strcmp("/jsonrpc", uri) != 0) return ERR_ARG;
+  const bool binary = std::strcmp("/jsonrpc/binary", uri) == 0;
+  if (!binary && std::strcmp("/jsonrpc", uri) != 0) return ERR_ARG;
 
-  buffers_[connection].reserve(content_len);
+  // A connection that was aborted before its response was opened leaves its
+  // state behind, and lwIP may reuse the address for this one.
+  auto& conn = connections_[connection];
+  if (conn) ReleaseConnection(std::move(conn));
+  conn = std::make_unique<Connection>();
+  conn->binary = binary;
+  conn->request.reserve(content_len);
   return ERR_OK;
 };
 
 err_t JsonRpcHttpServer::PostReceiveData(void* connection, struct pbuf* p) {
-  auto& buf = buffers_[connection];
+  auto& buf = connections_[connection]->request;
   auto off = buf.size();
   buf.resize(buf.size() + p->tot_len);
   auto len = pbuf_copy_partial(p, buf.data() + off, buf.size() - off, 0);
@@ -67,12 +168,213 @@ err_t JsonRpcHttpServer::PostReceiveData(void* connection, struct pbuf* p) {
 
 void JsonRpcHttpServer::PostFinished(void* connection, char* response_uri,
                                      u16_t response_uri_len) {
-  auto& buf = buffers_[connection];
-  std::vector<char> reply;
-  jsonrpc_ctx_process(ctx_, buf.data(), buf.size(), Append, &reply, nullptr);
-  buf = std::move(reply);
+  auto* conn = FindConnection(connection);
+  assert(conn);
   snprintf(response_uri, response_uri_len,
-           "/jsonrpc/response.json?connection=%p", connection);
+           "/jsonrpc/response.%s?connection=%p", conn->binary ? "bin" : "json",
+           connection);
+
+  if (Parse(conn)) {
+    if (!workers_.empty()) {
+      Dispatch(conn);
+      return;
+    }
+
+    const auto start_us = TimerMicros();
+    Process(conn);
+    const auto run_us = TimerMicros() - start_us;
+    MutexLock lock(mutex_);
+    RecordCall(GetMethod(*conn), 0, run_us);
+  }
+  BuildResponse(conn);
+  conn->done = true;
+}
+
+bool JsonRpcHttpServer::Parse(Connection* conn) {
+  if (!conn->binary) {
+    conn->json = conn->request.data();
+    conn->json_size = conn->request.size();
+    return true;
+  }
+
+  uint32_t json_size;
+  if (!ParseBinaryRequest(conn->request, &conn->json, &json_size,
+                          &conn->attachments)) {
+    AppendError(nullptr, 0, -32700, "invalid binary frame", &conn->response);
+    return false;
+  }
+  conn->json_size = json_size;
+  return true;
+}
+
+void JsonRpcHttpServer::Process(Connection* conn) {
+  // Binary attachments point into the request, which stays alive until the
+  // connection closes.
+  jsonrpc_ctx_process(ctx_, conn->json, conn->json_size, Append,
+                      &conn->response,
+                      conn->binary ? &conn->attachments : nullptr);
+}
+
+void JsonRpcHttpServer::BuildResponse(Connection* conn) {
+  const auto& attachments = conn->attachments.Response();
+  conn->sizes.reserve(4 * (attachments.size() + 1));
+  conn->pieces.reserve(2 * (attachments.size() + 1) + 1);
+
+  // The response writes its own headers, so it can be opened before a worker
+  // has produced it. The first piece is the header, filled in last.
+  size_t size = 0;
+  conn->pieces.push_back({});
+  auto add_piece = [conn, &size](JsonRpcSpan span) {
+    if (conn->binary) {
+      WriteSize(span.size, &conn->sizes);
+      conn->pieces.push_back({conn->sizes.data() + conn->sizes.size() - 4, 4});
+      size += 4;
+    }
+    conn->pieces.push_back(span);
+    size += span.size;
+  };
+  add_piece({reinterpret_cast<const uint8_t*>(conn->response.data()),
+             conn->response.size()});
+  for (const auto& attachment : attachments) add_piece(attachment.Span());
+
+  char header[128];
+  const int header_size = std::snprintf(
+      header, sizeof(header),
+      "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %u\r\n"
+      "Connection: close\r\n\r\n",
+      conn->binary ? "application/octet-stream" : "application/json",
+      static_cast<unsigned>(size));
+  conn->header.assign(header, header_size);
+  conn->pieces[0] = {reinterpret_cast<const uint8_t*>(conn->header.data()),
+                     conn->header.size()};
+}
+
+JsonRpcHttpServer::Method* JsonRpcHttpServer::GetMethod(
+    const Connection& conn) {
+  char name[64];
+  if (mjson_get_string(conn.json, conn.json_size, "$.method", name,
+                       sizeof(name)) < 0 ||
+      (methods_.size() >= kMaxMethods && methods_.count(name) == 0))
+    name[0] = '\0';
+  return &methods_[name];
+}
+
+void JsonRpcHttpServer::RecordCall(Method* method, uint64_t wait_us,
+                                   uint64_t run_us) {
+  ++method->calls;
+  method->total_run_us += run_us;
+  method->max_run_us = std::max(method->max_run_us, run_us);
+  method->max_wait_us = std::max(method->max_wait_us, wait_us);
+}
+
+void JsonRpcHttpServer::Dispatch(Connection* conn) {
+  auto* job = new Job{conn, nullptr, TimerMicros()};
+  {
+    MutexLock lock(mutex_);
+    job->method = GetMethod(*conn);
+    if (xQueueSend(jobs_, &job, 0) == pdTRUE) {
+      // Holding the core lock keeps the worker from completing the job
+      // before it is marked busy.
+      conn->busy = true;
+      if (++job->method->queued > job->method->max_queued)
+        job->method->max_queued = job->method->queued;
+      return;
+    }
+    ++job->method->rejected;
+  }
+  delete job;
+
+  AppendError(conn->json, conn->json_size, -32000, "server busy",
+              &conn->response);
+  BuildResponse(conn);
+  conn->done = true;
+}
+
+void JsonRpcHttpServer::StaticWorker(void* param) {
+  static_cast<JsonRpcHttpServer*>(param)->Worker();
+}
+
+void JsonRpcHttpServer::Worker() {
+  while (true) {
+    Job* job;
+    CHECK(xQueueReceive(jobs_, &job, portMAX_DELAY) == pdTRUE);
+    // A job whose method is at its limit waits in the method's pending list
+    // and is run by the worker that finishes the method's current call.
+    if (!StartJob(job)) continue;
+
+    while (job) {
+      const auto start_us = TimerMicros();
+      Process(job->conn);
+      const auto end_us = TimerMicros();
+      Complete(job->conn);
+
+      auto* next =
+          FinishJob(job, start_us - job->enqueue_us, end_us - start_us);
+      delete job;
+      job = next;
+    }
+  }
+}
+
+bool JsonRpcHttpServer::StartJob(Job* job) {
+  MutexLock lock(mutex_);
+  auto* method = job->method;
+  if (method->max_concurrent > 0 && method->active >= method->max_concurrent) {
+    method->pending.push_back(job);
+    return false;
+  }
+  ++method->active;
+  --method->queued;
+  return true;
+}
+
+JsonRpcHttpServer::Job* JsonRpcHttpServer::FinishJob(Job* job,
+                                                      uint64_t wait_us,
+                                                      uint64_t run_us) {
+  MutexLock lock(mutex_);
+  auto* method = job->method;
+  RecordCall(method, wait_us, run_us);
+  --method->active;
+  if (method->pending.empty()) return nullptr;
+
+  auto* next = method->pending.front();
+  method->pending.pop_front();
+  ++method->active;
+  --method->queued;
+  return next;
+}
+
+void JsonRpcHttpServer::Complete(Connection* conn) {
+  BuildResponse(conn);
+
+  LOCK_TCPIP_CORE();
+  conn->busy = false;
+  if (conn->closed) {
+    delete conn;
+  } else {
+    conn->done = true;
+    if (conn->wait_fn) {
+      auto fn = conn->wait_fn;
+      conn->wait_fn = nullptr;
+      fn(conn->wait_arg);
+    }
+  }
+  UNLOCK_TCPIP_CORE();
+}
+
+void JsonRpcHttpServer::ReleaseConnection(std::unique_ptr<Connection> conn) {
+  // A worker that is still running the request deletes it when it finishes.
+  if (conn->busy) {
+    conn->closed = true;
+    conn->wait_fn = nullptr;
+    conn.release();
+  }
+}
+
+JsonRpcHttpServer::Connection* JsonRpcHttpServer::FindConnection(
+    void* connection) {
+  auto it = connections_.find(connection);
+  return it != connections_.end() ? it->second.get() : nullptr;
 }
 
 void JsonRpcHttpServer::CgiHandler(struct fs_file* file, const char* uri,
@@ -81,15 +383,15 @@ void JsonRpcHttpServer::CgiHandler(struct fs_file* file, const char* uri,
   if (file->flags & FS_FILE_FLAGS_JSON_RPC) {
     void* connection =
         FindPointerParam("connection", iNumParams, pcParam, pcValue);
-    assert(connection);
-
-    auto& buf = buffers_[connection];
+    assert(FindConnection(connection));
 
+    // The length is in the header written with the response, which may not
+    // exist yet.
     file->pextension = connection;
-    file->data = buf.data();
-    file->len = buf.size();
-    file->index = file->len;
-    file->flags |= FS_FILE_FLAGS_HEADER_PERSISTENT;
+    file->data = nullptr;
+    file->len = INT_MAX;
+    file->index = 0;
+    file->flags |= FS_FILE_FLAGS_HEADER_INCLUDED;
     return;
   }
 
@@ -103,16 +405,75 @@ int JsonRpcHttpServer::FsOpenCustom(struct fs_file* file, const char* name) {
     return 1;
   }
 
+  if (std::strcmp("/jsonrpc/response.bin", name) == 0) {
+    std::memset(file, 0, sizeof(*file));
+    file->flags |= FS_FILE_FLAGS_JSON_RPC | FS_FILE_FLAGS_BINARY_RPC;
+    return 1;
+  }
+
   return HttpServer::FsOpenCustom(file, name);
 }
 
+int JsonRpcHttpServer::FsReadCustom(struct fs_file* file, char* buffer,
+                                    int count) {
+  if (!(file->flags & FS_FILE_FLAGS_JSON_RPC))
+    return HttpServer::FsReadCustom(file, buffer, count);
+
+  auto* conn = FindConnection(file->pextension);
+  if (!conn) return FS_READ_EOF;
+  if (!conn->done) return FS_READ_DELAYED;
+
+  size_t offset = file->index;
+  int total = 0;
+  for (const auto& piece : conn->pieces) {
+    if (total == count) break;
+    if (offset >= piece.size) {
+      offset -= piece.size;
+      continue;
+    }
+    const auto n = std::min<size_t>(count - total, piece.size - offset);
+    std::memcpy(buffer + total, piece.data + offset, n);
+    total += n;
+    offset = 0;
+  }
+  file->index += total;
+  return total > 0 ? total : FS_READ_EOF;
+}
+
 void JsonRpcHttpServer::FsCloseCustom(struct fs_file* file) {
   if (file->flags & FS_FILE_FLAGS_JSON_RPC) {
-    buffers_.erase(file->pextension);
+    auto it = connections_.find(file->pextension);
+    if (it != connections_.end()) {
+      ReleaseConnection(std::move(it->second));
+      connections_.erase(it);
+    }
     return;
   }
 
   HttpServer::FsCloseCustom(file);
 };
 
+// `pextension` holds the connection rather than a pointer tagged by
+// `HttpServer`. A response is readable once its handler has finished.
+bool JsonRpcHttpServer::FsCanReadCustom(struct fs_file* file) {
+  if (file->flags & FS_FILE_FLAGS_JSON_RPC) {
+    auto* conn = FindConnection(file->pextension);
+    return !conn || conn->done;
+  }
+  return HttpServer::FsCanReadCustom(file);
+}
+
+bool JsonRpcHttpServer::FsWaitReadCustom(struct fs_file* file,
+                                         HttpWaitCallback callback_fn,
+                                         void* callback_arg) {
+  if (file->flags & FS_FILE_FLAGS_JSON_RPC) {
+    auto* conn = FindConnection(file->pextension);
+    if (!conn || conn->done) return false;
+    conn->wait_fn = callback_fn;
+    conn->wait_arg = callback_arg;
+    return true;
+  }
+  return HttpServer::FsWaitReadCustom(file, callback_fn, callback_arg);
+}
+
 }  // namespace coralmicro
@@ -17,18 +17,124 @@
 #ifndef LIBS_RPC_RPC_HTTP_SERVER_H_
 #define LIBS_RPC_RPC_HTTP_SERVER_H_
 
+#include <cstdint>
+#include <deque>
 #include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "libs/base/http_server.h"
+#include "libs/base/tasks.h"
+#include "libs/rpc/rpc_utils.h"
+#include "third_party/freertos_kernel/include/FreeRTOS.h"
+#include "third_party/freertos_kernel/include/queue.h"
+#include "third_party/freertos_kernel/include/semphr.h"
+#include "third_party/freertos_kernel/include/task.h"
 #include "third_party/mjson/src/mjson.h"
 
 namespace coralmicro {
 
+// Configuration for `JsonRpcHttpServer::StartWorkers()`.
+struct JsonRpcWorkerConfig {
+  // Number of worker tasks, which is the most handlers that can run at once.
+  int num_workers = 2;
+  // Number of requests that can wait for a worker. Requests beyond this are
+  // answered right away with a "server busy" error.
+  int queue_size = 8;
+  // Priority of the worker tasks. Keep it below the lwIP TCP/IP task so
+  // handlers never delay network traffic.
+  int task_priority = kAppTaskPriority - 1;
+  // Stack size of each worker task, in words. Handlers run on this stack.
+  uint32_t stack_size = configMINIMAL_STACK_SIZE * 10;
+};
+
+// Statistics for one JSON-RPC method, reported by
+// `JsonRpcHttpServer::GetMethodStats()`.
+struct JsonRpcMethodStats {
+  // The method name, or empty for requests without a valid method.
+  std::string method;
+  // Maximum number of calls that run at once, or 0 for no limit.
+  int max_concurrent;
+  // Number of completed calls.
+  uint32_t calls;
+  // Number of calls refused because the worker queue was full.
+  uint32_t rejected;
+  // Number of calls waiting to run right now.
+  int queued;
+  // Most calls that were waiting to run at once.
+  int max_queued;
+  // Total time spent in the handler, in microseconds.
+  uint64_t total_run_us;
+  // Longest time spent in the handler, in microseconds.
+  uint64_t max_run_us;
+  // Longest time a call waited to run after the request arrived, in
+  // microseconds.
+  uint64_t max_wait_us;
+};
+
+// An `HttpServer` that serves JSON-RPC requests posted to `/jsonrpc`.
+//
+// Requests posted to `/jsonrpc/binary` instead use a binary framing that
+// carries raw attachments next to the JSON text, which avoids base64 encoding
+// images, tensors, and model chunks. Both the request and the response are:
+//
+// ```
+// uint32 json_size (little-endian)
+// json_size bytes of JSON-RPC request or response
+// for each attachment:
+//   uint32 attachment_size (little-endian)
+//   attachment_size bytes
+// ```
+//
+// The JSON refers to attachments by index with objects such as
+// `{"attachment": 0}`. Handlers read request attachments in place with
+// `JsonRpcGetAttachmentParam()` or `JsonRpcGetBinaryParam()`, and add response
+// attachments with `JsonRpcAddAttachment()`.
+//
+// By default, handlers run in the lwIP TCP/IP task, so a slow handler delays
+// all other HTTP traffic. Call `StartWorkers()` to run handlers on a pool of
+// worker tasks instead; the response is sent when the handler finishes. Use
+// `SetMethodConcurrency()` to serialize methods that share a resource such as
+// the Edge TPU:
+//
+// ```
+// JsonRpcHttpServer server;
+// server.SetMethodConcurrency("run_detection_model", 1);
+// server.StartWorkers(JsonRpcWorkerConfig{});
+// UseHttpServer(&server);
+// ```
 class JsonRpcHttpServer : public coralmicro::HttpServer {
  public:
-  explicit JsonRpcHttpServer(struct jsonrpc_ctx* ctx = &jsonrpc_default_context)
-      : ctx_(ctx) {}
+  explicit JsonRpcHttpServer(
+      struct jsonrpc_ctx* ctx = &jsonrpc_default_context);
+
+  // Starts worker tasks that run JSON-RPC handlers outside of the lwIP
+  // TCP/IP task.
+  //
+  // Call this once, before the server receives requests. The workers run for
+  // the lifetime of the server. Handlers then run concurrently with each
+  // other and with the network stack, so they must only use thread-safe
+  // APIs.
+  //
+  // @param config The worker pool configuration.
+  void StartWorkers(const JsonRpcWorkerConfig& config);
+
+  // Limits how many calls to a method run at once.
+  //
+  // Calls beyond the limit wait without holding a worker, so other methods
+  // keep running. The limit only applies when workers are started.
+  //
+  // @param method The JSON-RPC method name.
+  // @param max_concurrent The maximum number of concurrent calls; 1
+  // serializes the method and 0 removes the limit.
+  void SetMethodConcurrency(const char* method, int max_concurrent);
+
+  // Gets timing and queue statistics for every method that has been called or
+  // has a concurrency limit.
+  //
+  // @return A snapshot of the per-method counters.
+  std::vector<JsonRpcMethodStats> GetMethodStats() const;
 
   err_t PostBegin(void* connection, const char* uri, const char* http_request,
                   u16_t http_request_len, int content_len, char* response_uri,
@@ -41,11 +147,76 @@ class JsonRpcHttpServer : public coralmicro::HttpServer {
                   char** pcParam, char** pcValue) override;
 
   int FsOpenCustom(struct fs_file* file, const char* name) override;
+  int FsReadCustom(struct fs_file* file, char* buffer, int count) override;
   void FsCloseCustom(struct fs_file* file) override;
+  bool FsCanReadCustom(struct fs_file* file) override;
+  bool FsWaitReadCustom(struct fs_file* file, HttpWaitCallback callback_fn,
+                        void* callback_arg) override;
 
  private:
+  // @cond
+  struct Connection {
+    std::vector<char> request;
+    std::vector<char> response;
+    bool binary = false;
+    const char* json = nullptr;
+    size_t json_size = 0;
+    // Responses are sent from these pieces without joining them.
+    JsonRpcAttachments attachments;
+    std::string header;
+    std::vector<uint8_t> sizes;
+    std::vector<JsonRpcSpan> pieces;
+    // Protected by the lwIP core lock.
+    bool done = false;
+    bool busy = false;
+    bool closed = false;
+    HttpWaitCallback wait_fn = nullptr;
+    void* wait_arg = nullptr;
+  };
+
+  struct Job;
+  struct Method {
+    int max_concurrent = 0;
+    int active = 0;
+    std::deque<Job*> pending;
+    uint32_t calls = 0;
+    uint32_t rejected = 0;
+    int queued = 0;
+    int max_queued = 0;
+    uint64_t total_run_us = 0;
+    uint64_t max_run_us = 0;
+    uint64_t max_wait_us = 0;
+  };
+
+  struct Job {
+    Connection* conn;
+    Method* method;
+    uint64_t enqueue_us;
+  };
+  // @endcond
+
+  static void StaticWorker(void* param);
+  void Worker();
+  bool Parse(Connection* conn);
+  void Process(Connection* conn);
+  void BuildResponse(Connection* conn);
+  void Dispatch(Connection* conn);
+  Method* GetMethod(const Connection& conn);
+  static void RecordCall(Method* method, uint64_t wait_us, uint64_t run_us);
+  bool StartJob(Job* job);
+  Job* FinishJob(Job* job, uint64_t wait_us, uint64_t run_us);
+  void Complete(Connection* conn);
+  void ReleaseConnection(std::unique_ptr<Connection> conn);
+  Connection* FindConnection(void* connection);
+
   struct jsonrpc_ctx* ctx_;
-  std::map<void*, std::vector<char>> buffers_;  // connection-to-buffer map
+  // Connection-to-state map, protected by the lwIP core lock.
+  std::map<void*, std::unique_ptr<Connection>> connections_;
+
+  SemaphoreHandle_t mutex_;
+  std::map<std::string, Method> methods_;  // protected by mutex_
+  QueueHandle_t jobs_ = nullptr;
+  std::vector<TaskHandle_t> workers_;
 };
 
 }  // namespace coralmicro
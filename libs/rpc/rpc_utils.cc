@@ -17,6 +17,7 @@
 #include "libs/rpc/rpc_utils.h"
 
 #include <memory>
+#include <utility>
 
 #include "third_party/mjson/src/mjson.h"
 
@@ -33,8 +34,50 @@ std::unique_ptr<char[]> JsonRpcCreateParamFormatString(const char* param_name) {
   return param_pattern;
 }
 
+JsonRpcAttachments* GetAttachments(struct jsonrpc_request* request) {
+  return static_cast<JsonRpcAttachments*>(request->userdata);
+}
+
+bool FindAttachment(struct jsonrpc_request* request, const char* param_name,
+                    JsonRpcSpan* out) {
+  auto* attachments = GetAttachments(request);
+  if (!attachments) return false;
+
+  const char* attachment_format = "$[0].%s.attachment";
+  auto size = snprintf(nullptr, 0, attachment_format, param_name) + 1;
+  auto attachment_pattern = std::make_unique<char[]>(size);
+  snprintf(attachment_pattern.get(), size, attachment_format, param_name);
+
+  double index;
+  if (mjson_get_number(request->params, request->params_len,
+                       attachment_pattern.get(), &index) == 0)
+    return false;
+  return attachments->GetRequest(static_cast<int>(index), out);
+}
+
 }  // namespace
 
+bool JsonRpcAttachments::GetRequest(int index, JsonRpcSpan* out) const {
+  if (index < 0 || index >= static_cast<int>(request_.size())) return false;
+  *out = request_[index];
+  return true;
+}
+
+int JsonRpcAttachments::AddResponse(const void* data, size_t size) {
+  Attachment attachment;
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  attachment.copy.assign(bytes, bytes + size);
+  response_.push_back(std::move(attachment));
+  return response_.size() - 1;
+}
+
+int JsonRpcAttachments::AddResponse(BufferPool::Handle buffer) {
+  Attachment attachment;
+  attachment.buffer = std::move(buffer);
+  response_.push_back(std::move(attachment));
+  return response_.size() - 1;
+}
+
 void JsonRpcReturnBadParam(struct jsonrpc_request* request, const char* message,
                            const char* param_name) {
   jsonrpc_return_error(request, JSONRPC_ERROR_BAD_PARAMS, message, "{%Q:%Q}",
@@ -113,4 +156,36 @@ bool JsonRpcGetBase64Param(struct jsonrpc_request* request,
   return true;
 }
 
+bool JsonRpcGetAttachmentParam(struct jsonrpc_request* request,
+                               const char* param_name, JsonRpcSpan* out) {
+  if (!FindAttachment(request, param_name, out)) {
+    JsonRpcReturnBadParam(request, "invalid param", param_name);
+    return false;
+  }
+  return true;
+}
+
+bool JsonRpcGetBinaryParam(struct jsonrpc_request* request,
+                           const char* param_name,
+                           std::vector<uint8_t>* storage, JsonRpcSpan* out) {
+  if (FindAttachment(request, param_name, out)) return true;
+  if (!JsonRpcGetBase64Param(request, param_name, storage)) return false;
+  *out = {storage->data(), storage->size()};
+  return true;
+}
+
+int JsonRpcAddAttachment(struct jsonrpc_request* request, const void* data,
+                         size_t size) {
+  auto* attachments = GetAttachments(request);
+  if (!attachments) return -1;
+  return attachments->AddResponse(data, size);
+}
+
+int JsonRpcAddAttachment(struct jsonrpc_request* request,
+                         BufferPool::Handle buffer) {
+  auto* attachments = GetAttachments(request);
+  if (!attachments) return -1;
+  return attachments->AddResponse(std::move(buffer));
+}
+
 }  // namespace coralmicro
\ No newline at end of file
@@ -17,14 +17,86 @@
 #ifndef LIBS_RPC_RPC_UTILS_H_
 #define LIBS_RPC_RPC_UTILS_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
 #include <vector>
 
+#include "libs/base/buffer_pool.h"
 #include "third_party/mjson/src/mjson.h"
 
 namespace coralmicro {
 
+// A reference to bytes owned by someone else.
+struct JsonRpcSpan {
+  // A pointer to the first byte.
+  const uint8_t* data;
+  // The number of bytes.
+  size_t size;
+};
+
+// Holds the raw binary attachments of one binary JSON-RPC request and its
+// response.
+//
+// Binary requests (see `JsonRpcHttpServer`) carry images, tensors, and model
+// chunks next to the JSON text instead of base64 encoding them inside it. The
+// JSON refers to an attachment by index with an object such as
+// `{"attachment": 0}`. Handlers don't use this class directly; they call
+// `JsonRpcGetAttachmentParam()`, `JsonRpcGetBinaryParam()`, and
+// `JsonRpcAddAttachment()`.
+class JsonRpcAttachments {
+ public:
+  // A response attachment, either copied or held by reference.
+  struct Attachment {
+    // Gets the attachment bytes.
+    //
+    // @return A span of the attachment.
+    JsonRpcSpan Span() const {
+      if (buffer) return {buffer.Data(), buffer.Size()};
+      return {copy.data(), copy.size()};
+    }
+
+    // A pooled buffer, if the attachment is held by reference.
+    BufferPool::Handle buffer;
+    // The bytes, if the attachment was copied.
+    std::vector<uint8_t> copy;
+  };
+
+  // Adds a request attachment. The bytes aren't copied.
+  //
+  // @param span The attachment, which must outlive this object.
+  void AddRequest(JsonRpcSpan span) { request_.push_back(span); }
+
+  // Gets a request attachment.
+  //
+  // @param index The index of the attachment.
+  // @param out The attachment.
+  // @return True on success, false if `index` is out of range.
+  bool GetRequest(int index, JsonRpcSpan* out) const;
+
+  // Adds a response attachment by copying it.
+  //
+  // @param data The attachment bytes.
+  // @param size The number of bytes.
+  // @return The index of the attachment.
+  int AddResponse(const void* data, size_t size);
+
+  // Adds a response attachment by reference, without copying it.
+  //
+  // @param buffer The attachment, held until the response is sent.
+  // @return The index of the attachment.
+  int AddResponse(BufferPool::Handle buffer);
+
+  // Gets the response attachments.
+  //
+  // @return The attachments, in index order.
+  const std::vector<Attachment>& Response() const { return response_; }
+
+ private:
+  std::vector<JsonRpcSpan> request_;
+  std::vector<Attachment> response_;
+};
+
 // Response a JSONRPC_ERROR_BAD_PARAMS code to the requester.
 //
 // @param request The request to response to.
@@ -68,6 +140,55 @@ bool JsonRpcGetStringParam(struct jsonrpc_request* request,
 bool JsonRpcGetBase64Param(struct jsonrpc_request* request,
                            const char* param_name, std::vector<uint8_t>* out);
 
+// Gets a binary param that was sent as a raw attachment.
+//
+// The param must be an object like `{"attachment": 0}` in a binary request.
+//
+// @param request The request to parse the param.
+// @param param_name The name of the parameter to parse.
+// @param out The attachment bytes, valid until the handler returns. They are
+// not copied.
+// @returns True if the param were parsed successfully, else False.
+bool JsonRpcGetAttachmentParam(struct jsonrpc_request* request,
+                               const char* param_name, JsonRpcSpan* out);
+
+// Gets a binary param that was sent either as a raw attachment or as a base64
+// encoded string, so handlers can serve both kinds of clients.
+//
+// @param request The request to parse the param.
+// @param param_name The name of the parameter to parse.
+// @param storage Holds the decoded data of a base64 param. Attachments are
+// not copied into it.
+// @param out The param bytes, valid until the handler returns and `storage`
+// changes.
+// @returns True if the param were parsed successfully, else False.
+bool JsonRpcGetBinaryParam(struct jsonrpc_request* request,
+                           const char* param_name,
+                           std::vector<uint8_t>* storage, JsonRpcSpan* out);
+
+// Adds a raw attachment to the response of a binary request, by copying it.
+//
+// Refer to it from the JSON result with `{"attachment": index}`. For other
+// requests, fall back to a base64 (`%V`) result.
+//
+// @param request The request to respond to.
+// @param data The attachment bytes.
+// @param size The number of bytes.
+// @returns The index of the attachment, or -1 if the request isn't binary.
+int JsonRpcAddAttachment(struct jsonrpc_request* request, const void* data,
+                         size_t size);
+
+// Adds a pooled buffer to the response of a binary request, by reference.
+//
+// The buffer is sent straight from the pool and released once the response is
+// finished.
+//
+// @param request The request to respond to.
+// @param buffer The attachment.
+// @returns The index of the attachment, or -1 if the request isn't binary.
+int JsonRpcAddAttachment(struct jsonrpc_request* request,
+                         BufferPool::Handle buffer);
+
 }  // namespace coralmicro
 
 #endif  // define LIBS_RPC_RPC_UTILS_H_
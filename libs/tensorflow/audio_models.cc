@@ -16,30 +16,33 @@
 
 #include "libs/tensorflow/audio_models.h"
 
+#include <algorithm>
+
 #include "libs/base/check.h"
 #include "libs/base/filesystem.h"
 #include "libs/tpu/edgetpu_op.h"
+#include "third_party/tflite-micro/tensorflow/lite/experimental/microfrontend/lib/bits.h"
 #include "third_party/tflite-micro/tensorflow/lite/micro/micro_interpreter.h"
 
 namespace coralmicro::tensorflow {
 
-bool PrepareAudioFrontEnd(FrontendState* frontend_state,
-                          AudioModel model_type) {
+namespace {
+FrontendConfig GetFrontendConfig(AudioModel model_type, int* sample_rate) {
   FrontendConfig config{};
   size_t size_ms, step_size_ms;
-  int num_channels, sample_rate;
+  int num_channels;
   if (model_type == kYAMNet) {
     size_ms = kYamnetFeatureSliceDurationMs;
     step_size_ms = kYamnetFeatureSliceStrideMs;
     num_channels = kYamnetFeatureSliceSize;
-    sample_rate = kYamnetSampleRate;
+    *sample_rate = kYamnetSampleRate;
     config.filterbank.lower_band_limit = 125.0;
     config.filterbank.upper_band_limit = 7500.0;
   } else if (model_type == kKeywordDetector) {
     size_ms = kKeywordDetectorFeatureSliceDurationMs;
     step_size_ms = kKeywordDetectorFeatureSliceStrideMs;
     num_channels = kKeywordDetectorFeatureSliceSize;
-    sample_rate = kKeywordDetectorSampleRate;
+    *sample_rate = kKeywordDetectorSampleRate;
     config.filterbank.lower_band_limit = 60.0;
     config.filterbank.upper_band_limit = 3800.0;
   } else {
@@ -59,6 +62,14 @@ bool PrepareAudioFrontEnd(FrontendState* frontend_state,
   config.pcan_gain_control.gain_bits = 21;
   config.log_scale.enable_log = 1;
   config.log_scale.scale_shift = 6;
+  return config;
+}
+}  // namespace
+
+bool PrepareAudioFrontEnd(FrontendState* frontend_state,
+                          AudioModel model_type) {
+  int sample_rate;
+  auto config = GetFrontendConfig(model_type, &sample_rate);
   if (!FrontendPopulateState(&config, frontend_state, sample_rate)) {
     printf("FrontendPopulateState() failed\r\n");
     return false;
@@ -77,6 +88,26 @@ void YamNetPreprocessInput(const int16_t* audio_input,
   PreprocessAudioInput(audio_input, frontend_state, kYAMNet, feature_buffer,
                        kYamnetAudioSize);
 
+  YamNetFeaturesToInput(feature_buffer.data(), input_tensor);
+}
+
+void KeywordDetectorPreprocessInput(const int16_t* audio_data,
+                                    TfLiteTensor* input_tensor,
+                                    FrontendState* frontend_state) {
+  CHECK(input_tensor);
+  // Run frontend process for raw audio data.
+  // TODO(michaelbrooks): Properly slice the data so that we don't need to
+  // re-run the frontend on windows we've already processed.
+  std::vector<int16_t> feature_buffer(kKeywordDetectorFeatureElementCount);
+  PreprocessAudioInput(audio_data, frontend_state, kYAMNet, feature_buffer,
+                       kKeywordDetectorAudioSize);
+
+  KeywordDetectorFeaturesToInput(feature_buffer.data(), input_tensor);
+}
+
+void YamNetFeaturesToInput(const int16_t* features,
+                           TfLiteTensor* input_tensor) {
+  CHECK(input_tensor);
   // Converts the int16_t raw_audio input to float spectrogram.
   auto* input = tflite::GetTensorData<float>(input_tensor);
   // Determine the offset and scalar based on the calculated data.
@@ -84,36 +115,28 @@ void YamNetPreprocessInput(const int16_t* audio_input,
   // around the same. Can likely hard code.
   constexpr float kExpectedSpectraMax = 3.5f;
   const auto [min, max] =
-      std::minmax_element(std::begin(feature_buffer), std::end(feature_buffer));
+      std::minmax_element(features, features + kYamnetFeatureElementCount);
   int offset = (*max + *min) / 2;
   float scalar = kExpectedSpectraMax / (*max - offset);
   for (int i = 0; i < kYamnetFeatureElementCount; ++i) {
-    input[i] = (static_cast<float>(feature_buffer[i]) - offset) * scalar;
+    input[i] = (static_cast<float>(features[i]) - offset) * scalar;
   }
 }
 
-void KeywordDetectorPreprocessInput(const int16_t* audio_data,
-                                    TfLiteTensor* input_tensor,
-                                    FrontendState* frontend_state) {
+void KeywordDetectorFeaturesToInput(const int16_t* features,
+                                    TfLiteTensor* input_tensor) {
   CHECK(input_tensor);
-  // Run frontend process for raw audio data.
-  // TODO(michaelbrooks): Properly slice the data so that we don't need to
-  // re-run the frontend on windows we've already processed.
-  std::vector<int16_t> feature_buffer(kKeywordDetectorFeatureElementCount);
-  PreprocessAudioInput(audio_data, frontend_state, kYAMNet, feature_buffer,
-                       kKeywordDetectorAudioSize);
-
   auto* input = tflite::GetTensorData<uint8>(input_tensor);
 
-  const auto [min, max] =
-      std::minmax_element(std::begin(feature_buffer), std::end(feature_buffer));
+  const auto [min, max] = std::minmax_element(
+      features, features + kKeywordDetectorFeatureElementCount);
 
   float scale = static_cast<float>(*max - *min) / 256.0f;
 
   for (int i = 0; i < kKeywordDetectorFeatureElementCount; ++i) {
     // This conversion allows for requantization from int16 to uint8
-    input[i] = static_cast<uint8_t>(
-        static_cast<float>(feature_buffer[i] - *min) / scale);
+    input[i] =
+        static_cast<uint8_t>(static_cast<float>(features[i] - *min) / scale);
   }
 }
 
@@ -142,4 +165,160 @@ void PreprocessAudioInput(const int16_t* audio_data,
   }
 }
 
+SharedAudioFrontend::~SharedAudioFrontend() {
+  for (auto& model : models_) FreeModel(&model);
+  FreeWindow();
+}
+
+void SharedAudioFrontend::FreeModel(Model* model) {
+  FilterbankFreeStateContents(&model->filterbank);
+  NoiseReductionFreeStateContents(&model->noise_reduction);
+  PcanGainControlFreeStateContents(&model->pcan_gain_control);
+}
+
+void SharedAudioFrontend::FreeWindow() {
+  WindowFreeStateContents(&window_);
+  FftFreeStateContents(&fft_);
+  window_ = {};
+  fft_ = {};
+}
+
+int SharedAudioFrontend::AddModel(AudioModel model_type) {
+  int sample_rate;
+  auto config = GetFrontendConfig(model_type, &sample_rate);
+
+  // The first model sets up the window and FFT, later ones must match them.
+  if (models_.empty()) {
+    if (!WindowPopulateState(&config.window, &window_, sample_rate) ||
+        !FftPopulateState(&fft_, window_.size)) {
+      printf("Failed to populate the audio window and FFT\r\n");
+      FreeWindow();
+      return -1;
+    }
+    FftInit(&fft_);
+    sample_rate_ = sample_rate;
+  } else if (sample_rate != sample_rate_ ||
+             config.window.size_ms * sample_rate / 1000 != window_.size ||
+             config.window.step_size_ms * sample_rate / 1000 !=
+                 window_.step) {
+    return -1;
+  }
+
+  // Same as FrontendPopulateState(), from the filterbank on.
+  Model model{};
+  const int correction_bits =
+      MostSignificantBit32(fft_.fft_size) - 1 - (kFilterbankBits / 2);
+  if (!FilterbankPopulateState(&config.filterbank, &model.filterbank,
+                               sample_rate, fft_.fft_size / 2 + 1) ||
+      !NoiseReductionPopulateState(&config.noise_reduction,
+                                   &model.noise_reduction,
+                                   model.filterbank.num_channels) ||
+      !PcanGainControlPopulateState(
+          &config.pcan_gain_control, &model.pcan_gain_control,
+          model.noise_reduction.estimate, model.filterbank.num_channels,
+          model.noise_reduction.smoothing_bits, correction_bits) ||
+      !LogScalePopulateState(&config.log_scale, &model.log_scale)) {
+    printf("Failed to populate the audio frontend\r\n");
+    FreeModel(&model);
+    if (models_.empty()) FreeWindow();
+    return -1;
+  }
+  FilterbankReset(&model.filterbank);
+  NoiseReductionReset(&model.noise_reduction);
+
+  if (model_type == kYAMNet) {
+    model.slice_size = kYamnetFeatureSliceSize;
+    model.slice_count = kYamnetFeatureSliceCount;
+  } else {
+    model.slice_size = kKeywordDetectorFeatureSliceSize;
+    model.slice_count = kKeywordDetectorFeatureSliceCount;
+  }
+  model.features.resize(model.slice_size * model.slice_count);
+
+  const auto& filterbank = model.filterbank;
+  if (models_.empty()) {
+    energy_start_ = filterbank.start_index;
+    energy_end_ = filterbank.end_index;
+  } else {
+    energy_start_ = std::min(energy_start_, filterbank.start_index);
+    energy_end_ = std::max(energy_end_, filterbank.end_index);
+  }
+  models_.push_back(std::move(model));
+  return static_cast<int>(models_.size()) - 1;
+}
+
+size_t SharedAudioFrontend::ProcessSamples(const int16_t* samples,
+                                           size_t num_samples) {
+  CHECK(!models_.empty());
+  const int correction_bits =
+      MostSignificantBit32(fft_.fft_size) - 1 - (kFilterbankBits / 2);
+
+  size_t num_slices = 0;
+  while (num_samples > 0) {
+    size_t num_samples_read;
+    const bool ready = WindowProcessSamples(&window_, samples, num_samples,
+                                            &num_samples_read);
+    samples += num_samples_read;
+    num_samples -= num_samples_read;
+    if (!ready) continue;
+
+    const int input_shift =
+        15 - MostSignificantBit32(window_.max_abs_output_value);
+    FftCompute(&fft_, window_.output, input_shift);
+
+    // Same in-place conversion as FrontendProcessSamples(), but over the
+    // union of all filterbank ranges.
+    auto* energy = reinterpret_cast<int32_t*>(fft_.output);
+    for (int i = energy_start_; i < energy_end_; ++i) {
+      const int32_t real = fft_.output[i].real;
+      const int32_t imag = fft_.output[i].imag;
+      energy[i] = static_cast<uint32_t>(real * real + imag * imag);
+    }
+
+    for (auto& model : models_) {
+      FilterbankAccumulateChannels(&model.filterbank, energy);
+      uint32_t* scaled_filterbank =
+          FilterbankSqrt(&model.filterbank, input_shift);
+      NoiseReductionApply(&model.noise_reduction, scaled_filterbank);
+      if (model.pcan_gain_control.enable_pcan)
+        PcanGainControlApply(&model.pcan_gain_control, scaled_filterbank);
+      const uint16_t* logged_filterbank =
+          LogScaleApply(&model.log_scale, scaled_filterbank,
+                        model.filterbank.num_channels, correction_bits);
+
+      std::copy_n(logged_filterbank, model.slice_size,
+                  model.features.begin() + model.next_slice * model.slice_size);
+      model.next_slice = (model.next_slice + 1) % model.slice_count;
+      model.filled = std::min(model.filled + 1, model.slice_count);
+    }
+    ++num_slices;
+  }
+  return num_slices;
+}
+
+bool SharedAudioFrontend::FeaturesReady(int index) const {
+  const auto& model = models_.at(index);
+  return model.filled == model.slice_count;
+}
+
+void SharedAudioFrontend::GetFeatures(int index, int16_t* features) const {
+  const auto& model = models_.at(index);
+  const auto split =
+      model.features.begin() + model.next_slice * model.slice_size;
+  features = std::copy(split, model.features.end(), features);
+  std::copy(model.features.begin(), split, features);
+}
+
+void SharedAudioFrontend::Reset() {
+  WindowReset(&window_);
+  FftReset(&fft_);
+  for (auto& model : models_) {
+    FilterbankReset(&model.filterbank);
+    NoiseReductionReset(&model.noise_reduction);
+    std::fill(model.features.begin(), model.features.end(), 0);
+    model.next_slice = 0;
+    model.filled = 0;
+  }
+}
+
 }  // namespace coralmicro::tensorflow
@@ -117,6 +117,117 @@ void KeywordDetectorPreprocessInput(const int16_t* audio_data,
                                     TfLiteTensor* input_tensor,
                                     FrontendState* frontend_state);
 
+// Converts YamNet spectrogram features to the model's float input.
+//
+// @param features `kYamnetFeatureElementCount` features, for example from
+// `SharedAudioFrontend::GetFeatures()`.
+// @param input_tensor The tensor where the model input is stored.
+void YamNetFeaturesToInput(const int16_t* features,
+                           TfLiteTensor* input_tensor);
+
+// Converts keyword detector spectrogram features to the model's uint8 input.
+//
+// @param features `kKeywordDetectorFeatureElementCount` features, for example
+// from `SharedAudioFrontend::GetFeatures()`.
+// @param input_tensor The tensor where the model input is stored.
+void KeywordDetectorFeaturesToInput(const int16_t* features,
+                                    TfLiteTensor* input_tensor);
+
+// Computes spectrograms for several audio models from a single audio stream,
+// sharing the window and FFT between them.
+//
+// YamNet and the keyword detector both use 25 ms windows with a 10 ms stride,
+// and only differ in their filterbanks. Rather than running a full
+// `FrontendState` per model, this keeps a single window and FFT, computes the
+// power spectrum once per slice, and applies each registered model's own
+// filterbank, noise reduction and log scale to it. Each model keeps its own
+// ring of the latest feature slices, so new audio only needs to be processed
+// once, as it arrives.
+//
+// This class is not thread-safe.
+//
+// For example:
+//
+// ```
+// tensorflow::SharedAudioFrontend frontend;
+// int yamnet = frontend.AddModel(tensorflow::kYAMNet);
+// int keyword = frontend.AddModel(tensorflow::kKeywordDetector);
+//
+// // For every new block of 16-bit audio:
+// frontend.ProcessSamples(samples, num_samples);
+// if (frontend.FeaturesReady(yamnet)) {
+//   frontend.GetFeatures(yamnet, features.data());
+//   tensorflow::YamNetFeaturesToInput(features.data(),
+//                                     interpreter.input_tensor(0));
+// }
+// ```
+class SharedAudioFrontend {
+ public:
+  SharedAudioFrontend() = default;
+  // @cond
+  SharedAudioFrontend(const SharedAudioFrontend&) = delete;
+  SharedAudioFrontend& operator=(const SharedAudioFrontend&) = delete;
+  ~SharedAudioFrontend();
+  // @endcond
+
+  // Registers a model to compute features for.
+  //
+  // All models must use the same sample rate, window size and stride.
+  // Models must be added before the first call to `ProcessSamples()`.
+  //
+  // @param model_type The type of audio model.
+  // @return The index of the model to use with the other functions, or -1 if
+  // the model isn't compatible with the models already registered.
+  int AddModel(AudioModel model_type);
+
+  // Computes features for new audio samples.
+  //
+  // @param samples An array of signed int16 audio data.
+  // @param num_samples The number of samples in the array.
+  // @return The number of new feature slices produced for every model.
+  size_t ProcessSamples(const int16_t* samples, size_t num_samples);
+
+  // Checks whether a model's feature ring has been filled.
+  //
+  // @param index The model index returned by `AddModel()`.
+  // @return True once enough audio has been processed for a full input.
+  bool FeaturesReady(int index) const;
+
+  // Copies the latest features for a model, oldest slice first.
+  //
+  // @param index The model index returned by `AddModel()`.
+  // @param features Output array with room for the model's feature element
+  // count (for example, `kYamnetFeatureElementCount`).
+  void GetFeatures(int index, int16_t* features) const;
+
+  // Clears the feature rings and resets the frontend state.
+  void Reset();
+
+ private:
+  // The stages of a model's frontend that follow the shared FFT.
+  struct Model {
+    FilterbankState filterbank;
+    NoiseReductionState noise_reduction;
+    PcanGainControlState pcan_gain_control;
+    LogScaleState log_scale;
+    size_t slice_size;
+    size_t slice_count;
+    size_t next_slice;
+    size_t filled;
+    std::vector<int16_t> features;
+  };
+
+  static void FreeModel(Model* model);
+  void FreeWindow();
+
+  WindowState window_ = {};
+  FftState fft_ = {};
+  std::vector<Model> models_;
+  int sample_rate_ = 0;
+  int energy_start_ = 0;
+  int energy_end_ = 0;
+};
+
 // @cond
 void PreprocessAudioInput(const int16_t* audio_data,
                           FrontendState* frontend_state, AudioModel model_type,
@@ -0,0 +1,442 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/testlib/resource_store.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+#include "libs/base/check.h"
+#include "libs/base/filesystem.h"
+#include "libs/base/mutex.h"
+#include "third_party/nxp/rt1176-sdk/middleware/mbedtls/include/mbedtls/md.h"
+
+namespace coralmicro::testlib {
+namespace {
+constexpr size_t kAlignment = 16;
+constexpr size_t kShaSize = 32;
+// littlefs attribute that holds the SHA-256 of a resource file.
+constexpr uint8_t kSha256Attr = 0x53;
+
+size_t AlignUp(size_t n) { return (n + kAlignment - 1) & ~(kAlignment - 1); }
+
+std::string Hex(const uint8_t* data, size_t size) {
+  static constexpr char kDigits[] = "0123456789abcdef";
+  std::string hex;
+  hex.reserve(2 * size);
+  for (size_t i = 0; i < size; ++i) {
+    hex.push_back(kDigits[data[i] >> 4]);
+    hex.push_back(kDigits[data[i] & 0xF]);
+  }
+  return hex;
+}
+
+bool StartSha256(mbedtls_md_context_t* ctx) {
+  return mbedtls_md_setup(ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256),
+                          /*hmac=*/0) == 0 &&
+         mbedtls_md_starts(ctx) == 0;
+}
+
+// Gets the SHA-256 saved with a file, computing and saving it if missing.
+bool FileSha256(const std::string& path, size_t size, std::string* hex) {
+  uint8_t digest[kShaSize];
+  if (lfs_getattr(Lfs(), path.c_str(), kSha256Attr, digest, kShaSize) ==
+      static_cast<lfs_ssize_t>(kShaSize)) {
+    *hex = Hex(digest, kShaSize);
+    return true;
+  }
+
+  lfs_file_t file;
+  if (lfs_file_open(Lfs(), &file, path.c_str(), LFS_O_RDONLY) < 0)
+    return false;
+  mbedtls_md_context_t ctx;
+  mbedtls_md_init(&ctx);
+  bool ok = StartSha256(&ctx);
+  std::vector<uint8_t> buffer(4096);
+  for (size_t done = 0; ok && done < size;) {
+    auto n = lfs_file_read(Lfs(), &file, buffer.data(),
+                           std::min(buffer.size(), size - done));
+    ok = n > 0 && mbedtls_md_update(&ctx, buffer.data(), n) == 0;
+    done += n;
+  }
+  ok = ok && mbedtls_md_finish(&ctx, digest) == 0;
+  mbedtls_md_free(&ctx);
+  lfs_file_close(Lfs(), &file);
+  if (!ok) return false;
+
+  lfs_setattr(Lfs(), path.c_str(), kSha256Attr, digest, kShaSize);
+  *hex = Hex(digest, kShaSize);
+  return true;
+}
+}  // namespace
+
+const char* ResourceStatusMessage(ResourceStatus status) {
+  switch (status) {
+    case ResourceStatus::kOk:
+      return "ok";
+    case ResourceStatus::kUnknown:
+      return "unknown resource";
+    case ResourceStatus::kOutOfBounds:
+      return "chunk out of bounds";
+    case ResourceStatus::kNoSpace:
+      return "out of resource memory";
+    case ResourceStatus::kIoError:
+      return "flash i/o error";
+    case ResourceStatus::kHashMismatch:
+      return "sha256 mismatch";
+    case ResourceStatus::kInvalidName:
+      return "invalid resource name";
+  }
+  return "unknown error";
+}
+
+struct ResourceStore::Entry {
+  Entry() { mbedtls_md_init(&sha); }
+  ~Entry() { mbedtls_md_free(&sha); }
+
+  ResourceStorage storage;
+  size_t size = 0;
+  bool complete = false;
+  // Contiguous bytes from the start that were hashed and, on flash, written.
+  size_t hashed = 0;
+  mbedtls_md_context_t sha;
+  std::string expected_sha256;
+  std::string sha256;
+  // The upload target in memory, or the copy of a file loaded by `Get()`.
+  Resource resource;
+
+  // Ranges received in memory, as start to end offsets.
+  std::map<size_t, size_t> received;
+
+  // The file being uploaded to flash, and chunks that arrived early.
+  lfs_file_t file;
+  bool file_open = false;
+  std::map<size_t, std::vector<uint8_t>> pending;
+  size_t pending_bytes = 0;
+};
+
+ResourceStore::ResourceStore(uint8_t* arena, size_t arena_size,
+                             const char* flash_dir, size_t max_pending_bytes)
+    : arena_(arena),
+      flash_dir_(flash_dir),
+      max_pending_bytes_(max_pending_bytes),
+      mutex_(xSemaphoreCreateMutex()) {
+  CHECK(mutex_);
+  CHECK(reinterpret_cast<uintptr_t>(arena) % kAlignment == 0);
+  free_[0] = arena_size & ~(kAlignment - 1);
+}
+
+ResourceStore::~ResourceStore() {
+  while (!entries_.empty()) Erase(entries_.begin()->first);
+  vSemaphoreDelete(mutex_);
+}
+
+bool ResourceStore::ValidName(const std::string& name) {
+  return !name.empty() && name.find('/') == std::string::npos &&
+         name.find("..") == std::string::npos;
+}
+
+std::string ResourceStore::Path(const std::string& name) const {
+  return flash_dir_ + "/" + name;
+}
+
+uint8_t* ResourceStore::Allocate(size_t size) {
+  size = AlignUp(std::max<size_t>(size, 1));
+  for (auto it = free_.begin(); it != free_.end(); ++it) {
+    if (it->second < size) continue;
+    const size_t offset = it->first;
+    const size_t remaining = it->second - size;
+    free_.erase(it);
+    if (remaining) free_[offset + size] = remaining;
+    return arena_ + offset;
+  }
+  return nullptr;
+}
+
+void ResourceStore::Free(uint8_t* data, size_t size) {
+  size_t offset = data - arena_;
+  size = AlignUp(std::max<size_t>(size, 1));
+  // Merge with the free ranges on either side.
+  auto next = free_.lower_bound(offset);
+  if (next != free_.end() && next->first == offset + size) {
+    size += next->second;
+    next = free_.erase(next);
+  }
+  if (next != free_.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      prev->second += size;
+      return;
+    }
+  }
+  free_[offset] = size;
+}
+
+void ResourceStore::Erase(const std::string& name) {
+  auto it = entries_.find(name);
+  if (it == entries_.end()) return;
+
+  auto* entry = it->second.get();
+  if (entry->resource.data_) Free(entry->resource.data_, entry->size);
+  if (entry->file_open) {
+    lfs_file_close(Lfs(), &entry->file);
+    lfs_remove(Lfs(), Path(name).c_str());
+  }
+  entries_.erase(it);
+}
+
+ResourceStatus ResourceStore::Begin(const std::string& name, size_t size,
+                                    ResourceStorage storage,
+                                    const std::string& expected_sha256) {
+  if (!ValidName(name)) return ResourceStatus::kInvalidName;
+  MutexLock lock(mutex_);
+  Erase(name);
+
+  auto entry = std::make_unique<Entry>();
+  entry->storage = storage;
+  entry->size = size;
+  entry->expected_sha256 = expected_sha256;
+  std::transform(entry->expected_sha256.begin(), entry->expected_sha256.end(),
+                 entry->expected_sha256.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  if (!StartSha256(&entry->sha)) return ResourceStatus::kNoSpace;
+
+  if (storage == ResourceStorage::kRam) {
+    entry->resource.data_ = Allocate(size);
+    if (!entry->resource.data_) return ResourceStatus::kNoSpace;
+    entry->resource.size_ = size;
+  } else {
+    const auto path = Path(name);
+    if (!LfsMakeDirs(LfsDirname(path.c_str()).c_str()) ||
+        lfs_file_open(Lfs(), &entry->file, path.c_str(),
+                      LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) < 0)
+      return ResourceStatus::kIoError;
+    entry->file_open = true;
+    lfs_removeattr(Lfs(), path.c_str(), kSha256Attr);
+  }
+
+  auto* e = entry.get();
+  entries_[name] = std::move(entry);
+  if (size == 0) return Finish(name, e);
+  return ResourceStatus::kOk;
+}
+
+ResourceStatus ResourceStore::Write(const std::string& name, size_t offset,
+                                    const uint8_t* data, size_t size) {
+  MutexLock lock(mutex_);
+  auto it = entries_.find(name);
+  if (it == entries_.end()) return ResourceStatus::kUnknown;
+
+  auto* entry = it->second.get();
+  if (offset > entry->size || size > entry->size - offset)
+    return ResourceStatus::kOutOfBounds;
+  // A retried chunk of a finished upload.
+  if (entry->complete) return ResourceStatus::kOk;
+
+  auto status = entry->storage == ResourceStorage::kRam
+                    ? WriteRam(entry, offset, data, size)
+                    : WriteFlash(entry, offset, data, size);
+  if (status != ResourceStatus::kOk) return status;
+  if (entry->hashed == entry->size) return Finish(name, entry);
+  return ResourceStatus::kOk;
+}
+
+ResourceStatus ResourceStore::WriteRam(Entry* entry, size_t offset,
+                                       const uint8_t* data, size_t size) {
+  std::memcpy(entry->resource.data_ + offset, data, size);
+
+  // Merge the chunk with the ranges it touches.
+  size_t start = offset;
+  size_t end = offset + size;
+  auto& received = entry->received;
+  auto it = received.upper_bound(start);
+  if (it != received.begin()) {
+    auto prev = std::prev(it);
+    if (prev->second >= start) {
+      start = prev->first;
+      end = std::max(end, prev->second);
+      it = received.erase(prev);
+    }
+  }
+  while (it != received.end() && it->first <= end) {
+    end = std::max(end, it->second);
+    it = received.erase(it);
+  }
+  received[start] = end;
+
+  // Hash whatever is now contiguous from the start.
+  const auto& first = *received.begin();
+  if (first.first == 0 && first.second > entry->hashed) {
+    if (mbedtls_md_update(&entry->sha, entry->resource.data_ + entry->hashed,
+                          first.second - entry->hashed) != 0)
+      return ResourceStatus::kNoSpace;
+    entry->hashed = first.second;
+  }
+  return ResourceStatus::kOk;
+}
+
+ResourceStatus ResourceStore::WriteFlash(Entry* entry, size_t offset,
+                                         const uint8_t* data, size_t size) {
+  // Already written.
+  if (offset + size <= entry->hashed) return ResourceStatus::kOk;
+
+  // Hold chunks that arrive early until the data before them is written.
+  if (offset > entry->hashed) {
+    auto& chunk = entry->pending[offset];
+    const size_t pending_bytes =
+        entry->pending_bytes - chunk.size() + size;
+    if (pending_bytes > max_pending_bytes_) {
+      if (chunk.empty()) entry->pending.erase(offset);
+      return ResourceStatus::kNoSpace;
+    }
+    chunk.assign(data, data + size);
+    entry->pending_bytes = pending_bytes;
+    return ResourceStatus::kOk;
+  }
+
+  auto append = [entry](const uint8_t* data, size_t size) {
+    auto n = lfs_file_write(Lfs(), &entry->file, data, size);
+    if (n < 0 || static_cast<size_t>(n) != size) return false;
+    if (mbedtls_md_update(&entry->sha, data, size) != 0) return false;
+    entry->hashed += size;
+    return true;
+  };
+
+  if (!append(data + (entry->hashed - offset), offset + size - entry->hashed))
+    return ResourceStatus::kIoError;
+  while (!entry->pending.empty()) {
+    auto it = entry->pending.begin();
+    if (it->first > entry->hashed) break;
+    const size_t end = it->first + it->second.size();
+    const bool ok =
+        end <= entry->hashed ||
+        append(it->second.data() + (entry->hashed - it->first),
+               end - entry->hashed);
+    entry->pending_bytes -= it->second.size();
+    entry->pending.erase(it);
+    if (!ok) return ResourceStatus::kIoError;
+  }
+  return ResourceStatus::kOk;
+}
+
+ResourceStatus ResourceStore::Finish(const std::string& name, Entry* entry) {
+  uint8_t digest[kShaSize];
+  if (mbedtls_md_finish(&entry->sha, digest) != 0)
+    return ResourceStatus::kNoSpace;
+  entry->sha256 = Hex(digest, kShaSize);
+
+  if (!entry->expected_sha256.empty() &&
+      entry->expected_sha256 != entry->sha256) {
+    Erase(name);
+    return ResourceStatus::kHashMismatch;
+  }
+
+  if (entry->file_open) {
+    entry->file_open = false;
+    const auto path = Path(name);
+    if (lfs_file_close(Lfs(), &entry->file) < 0) {
+      lfs_remove(Lfs(), path.c_str());
+      Erase(name);
+      return ResourceStatus::kIoError;
+    }
+    lfs_setattr(Lfs(), path.c_str(), kSha256Attr, digest, kShaSize);
+  }
+  entry->complete = true;
+  entry->received.clear();
+  return ResourceStatus::kOk;
+}
+
+ResourceStatus ResourceStore::Put(const std::string& name, const uint8_t* data,
+                                  size_t size) {
+  auto status = Begin(name, size, ResourceStorage::kRam);
+  if (status != ResourceStatus::kOk || size == 0) return status;
+  return Write(name, 0, data, size);
+}
+
+ResourceStatus ResourceStore::Delete(const std::string& name) {
+  if (!ValidName(name)) return ResourceStatus::kInvalidName;
+  MutexLock lock(mutex_);
+  const bool known = entries_.count(name) != 0;
+  Erase(name);
+  const bool removed = lfs_remove(Lfs(), Path(name).c_str()) >= 0;
+  return known || removed ? ResourceStatus::kOk : ResourceStatus::kUnknown;
+}
+
+const Resource* ResourceStore::Get(const std::string& name) {
+  if (!ValidName(name)) return nullptr;
+  MutexLock lock(mutex_);
+  auto it = entries_.find(name);
+  Entry* entry = nullptr;
+  if (it != entries_.end()) {
+    entry = it->second.get();
+    if (!entry->complete) return nullptr;
+    if (entry->resource.data_) return &entry->resource;
+  } else {
+    // A resource uploaded to flash before this boot.
+    lfs_info info;
+    if (lfs_stat(Lfs(), Path(name).c_str(), &info) < 0 ||
+        info.type != LFS_TYPE_REG)
+      return nullptr;
+    auto new_entry = std::make_unique<Entry>();
+    new_entry->storage = ResourceStorage::kFlash;
+    new_entry->size = info.size;
+    new_entry->hashed = info.size;
+    new_entry->complete = true;
+    entry = new_entry.get();
+    entries_[name] = std::move(new_entry);
+  }
+
+  auto* data = Allocate(entry->size);
+  if (!data) return nullptr;
+  if (LfsReadFile(Path(name).c_str(), data, entry->size) != entry->size) {
+    Free(data, entry->size);
+    return nullptr;
+  }
+  entry->resource.data_ = data;
+  entry->resource.size_ = entry->size;
+  return &entry->resource;
+}
+
+ResourceStatus ResourceStore::GetInfo(const std::string& name,
+                                      ResourceInfo* info) {
+  if (!ValidName(name)) return ResourceStatus::kInvalidName;
+  MutexLock lock(mutex_);
+  auto it = entries_.find(name);
+  if (it != entries_.end()) {
+    auto* entry = it->second.get();
+    if (entry->complete && entry->sha256.empty() &&
+        !FileSha256(Path(name), entry->size, &entry->sha256))
+      return ResourceStatus::kIoError;
+    *info = {entry->storage, entry->size, entry->hashed, entry->complete,
+             entry->sha256};
+    return ResourceStatus::kOk;
+  }
+
+  lfs_info file_info;
+  const auto path = Path(name);
+  if (lfs_stat(Lfs(), path.c_str(), &file_info) < 0 ||
+      file_info.type != LFS_TYPE_REG)
+    return ResourceStatus::kUnknown;
+  *info = {ResourceStorage::kFlash, file_info.size, file_info.size, true, {}};
+  if (!FileSha256(path, file_info.size, &info->sha256))
+    return ResourceStatus::kIoError;
+  return ResourceStatus::kOk;
+}
+
+}  // namespace coralmicro::testlib
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBS_TESTLIB_RESOURCE_STORE_H_
+#define LIBS_TESTLIB_RESOURCE_STORE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "third_party/freertos_kernel/include/FreeRTOS.h"
+#include "third_party/freertos_kernel/include/semphr.h"
+
+namespace coralmicro::testlib {
+
+// Where an uploaded resource is kept.
+enum class ResourceStorage {
+  // In the store's preallocated memory. Lost at reboot.
+  kRam,
+  // In a file on flash. Kept across reboots, and loaded into memory the
+  // first time it is used.
+  kFlash,
+};
+
+// Result of a `ResourceStore` operation.
+enum class ResourceStatus {
+  kOk,
+  // No resource has that name.
+  kUnknown,
+  // The chunk doesn't fit in the resource.
+  kOutOfBounds,
+  // The store's memory, or the buffer for out-of-order chunks, is full.
+  kNoSpace,
+  // Reading or writing flash failed.
+  kIoError,
+  // The uploaded data doesn't match the expected SHA-256. The resource is
+  // deleted.
+  kHashMismatch,
+  // The name is empty or contains '/' or "..".
+  kInvalidName,
+};
+
+// Gets a message that describes a status, for RPC errors.
+//
+// @param status The status.
+// @return A short message.
+const char* ResourceStatusMessage(ResourceStatus status);
+
+// Information about a resource, from `ResourceStore::GetInfo()`.
+struct ResourceInfo {
+  // Where the resource is kept.
+  ResourceStorage storage;
+  // The size of the resource in bytes.
+  size_t size;
+  // The number of bytes received so far, counting only the contiguous data
+  // from the start of the resource.
+  size_t received;
+  // Whether all of the resource was received.
+  bool complete;
+  // The SHA-256 of the resource as lowercase hex, once complete.
+  std::string sha256;
+};
+
+// A complete resource, from `ResourceStore::Get()`.
+class Resource {
+ public:
+  // Gets the resource data.
+  //
+  // @return A pointer to the data, aligned to 16 bytes.
+  const uint8_t* data() const { return data_; }
+
+  // Gets the size of the resource.
+  //
+  // @return The size in bytes.
+  size_t size() const { return size_; }
+
+ private:
+  friend class ResourceStore;
+  uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Stores resources, such as models and test images, uploaded in chunks over
+// RPC.
+//
+// Chunks are written straight to their final place, either in a preallocated
+// memory region or in a file, instead of being staged in a growing heap
+// buffer. Chunks may arrive in any order, so several can be uploaded in
+// parallel. The SHA-256 of the resource is computed as the data arrives: in
+// memory, over the contiguous data received so far; on flash, chunks are
+// appended in order and any that arrive early wait in a bounded buffer.
+//
+// The SHA-256 of a resource on flash is saved with the file, so a client can
+// call `GetInfo()` after a reboot and skip uploading a model that is already
+// on the device.
+//
+// Resource names become file names in the flash directory, so they can't
+// contain '/' or "..". Methods return `ResourceStatus::kInvalidName` for
+// names that fail `ValidName()`.
+//
+// All methods are thread-safe, but a `Resource` returned by `Get()` is only
+// valid until the resource is deleted or uploaded again.
+class ResourceStore {
+ public:
+  // Checks whether a name can be used for a resource.
+  //
+  // @param name The resource name.
+  // @return True if the name isn't empty and contains neither '/' nor "..".
+  static bool ValidName(const std::string& name);
+
+  // Constructor.
+  //
+  // @param arena Memory for resources, aligned to 16 bytes.
+  // @param arena_size The size of the memory in bytes.
+  // @param flash_dir The directory for resources on flash.
+  // @param max_pending_bytes Most bytes of out-of-order chunks held for each
+  // resource that is being uploaded to flash.
+  ResourceStore(uint8_t* arena, size_t arena_size, const char* flash_dir,
+                size_t max_pending_bytes);
+  ~ResourceStore();
+  ResourceStore(const ResourceStore&) = delete;
+  ResourceStore& operator=(const ResourceStore&) = delete;
+
+  // Starts uploading a resource, replacing any resource with the same name.
+  //
+  // @param name The resource name.
+  // @param size The size of the resource in bytes.
+  // @param storage Where to keep the resource.
+  // @param expected_sha256 If not empty, the SHA-256 of the resource as hex;
+  // the upload fails if the data doesn't match.
+  // @return The status.
+  ResourceStatus Begin(const std::string& name, size_t size,
+                       ResourceStorage storage,
+                       const std::string& expected_sha256 = {});
+
+  // Writes one chunk of a resource.
+  //
+  // @param name The resource name.
+  // @param offset The offset of the chunk in the resource.
+  // @param data The chunk data.
+  // @param size The chunk size in bytes.
+  // @return The status.
+  ResourceStatus Write(const std::string& name, size_t offset,
+                       const uint8_t* data, size_t size);
+
+  // Stores a small resource in memory in one call.
+  //
+  // @param name The resource name.
+  // @param data The resource data.
+  // @param size The size in bytes.
+  // @return The status.
+  ResourceStatus Put(const std::string& name, const uint8_t* data,
+                     size_t size);
+
+  // Deletes a resource, including its file on flash.
+  //
+  // @param name The resource name.
+  // @return The status.
+  ResourceStatus Delete(const std::string& name);
+
+  // Gets a complete resource, loading it from flash if needed.
+  //
+  // @param name The resource name.
+  // @return The resource, or nullptr if there is no complete resource with
+  // that name or the name isn't valid.
+  const Resource* Get(const std::string& name);
+
+  // Gets information about a resource, including one on flash from a
+  // previous boot.
+  //
+  // @param name The resource name.
+  // @param info The resource information.
+  // @return The status.
+  ResourceStatus GetInfo(const std::string& name, ResourceInfo* info);
+
+ private:
+  struct Entry;
+
+  std::string Path(const std::string& name) const;
+  uint8_t* Allocate(size_t size);
+  void Free(uint8_t* data, size_t size);
+  void Erase(const std::string& name);
+  ResourceStatus WriteRam(Entry* entry, size_t offset, const uint8_t* data,
+                          size_t size);
+  ResourceStatus WriteFlash(Entry* entry, size_t offset, const uint8_t* data,
+                            size_t size);
+  ResourceStatus Finish(const std::string& name, Entry* entry);
+
+  uint8_t* arena_;
+  std::string flash_dir_;
+  size_t max_pending_bytes_;
+  SemaphoreHandle_t mutex_;
+  // Free ranges of the arena, by offset.
+  std::map<size_t, size_t> free_;
+  std::map<std::string, std::unique_ptr<Entry>> entries_;
+};
+
+}  // namespace coralmicro::testlib
+
+#endif  // LIBS_TESTLIB_RESOURCE_STORE_H_
@@ -17,7 +17,7 @@
 #include "libs/testlib/test_lib.h"
 
 #include <array>
-#include <map>
+#include <cstring>
 
 #include "libs/a71ch/a71ch.h"
 #include "libs/audio/audio_driver.h"
@@ -30,6 +30,7 @@
 #include "libs/base/wifi.h"
 #include "libs/camera/camera.h"
 #include "libs/rpc/rpc_utils.h"
+#include "libs/testlib/resource_store.h"
 #include "libs/tensorflow/classification.h"
 #include "libs/tensorflow/detection.h"
 #include "libs/tensorflow/posenet_decoder_op.h"
@@ -56,14 +57,38 @@ AudioDriver g_audio_driver(g_audio_buffers);
 constexpr int kTensorArenaSize = 8 * 1024 * 1024;
 STATIC_TENSOR_ARENA_IN_SDRAM(tensor_arena, kTensorArenaSize);
 
-// Map for containing uploaded resources.
-// Key is the output of StrHash with the resource name as the parameter.
-std::map<std::string, std::vector<uint8_t>> g_stored_resources;
+// Memory for uploaded resources, such as models and test images.
+constexpr int kResourceArenaSize = 16 * 1024 * 1024;
+uint8_t resource_arena[kResourceArenaSize] __attribute__((aligned(16)))
+__attribute__((section(".sdram_bss,\"aw\",%nobits @")));
+// Directory for resources uploaded with "storage": "flash".
+constexpr char kResourceDir[] = "/resources";
+// Most bytes of out-of-order chunks held for each upload to flash.
+constexpr size_t kMaxPendingResourceBytes = 1024 * 1024;
+
+ResourceStore* Resources() {
+  static ResourceStore store(resource_arena, kResourceArenaSize, kResourceDir,
+                             kMaxPendingResourceBytes);
+  return &store;
+}
+
+const Resource* GetResource(const std::string& resource_name) {
+  return Resources()->Get(resource_name);
+}
+
+void ReturnResourceError(struct jsonrpc_request* request,
+                         ResourceStatus status) {
+  jsonrpc_return_error(request, -1, ResourceStatusMessage(status), nullptr);
+}
 
-std::vector<uint8_t>* GetResource(const std::string& resource_name) {
-  auto it = g_stored_resources.find(resource_name);
-  if (it == g_stored_resources.end()) return nullptr;
-  return &it->second;
+// Checks the "name" param of a resource RPC, which becomes a file name on
+// flash, and returns a bad param error if it isn't valid.
+bool CheckResourceName(struct jsonrpc_request* request,
+                       const std::string& resource_name) {
+  if (ResourceStore::ValidName(resource_name)) return true;
+  JsonRpcReturnBadParam(
+      request, "name must not be empty or contain '/' or '..'", "name");
+  return false;
 }
 
 std::optional<TempSensor> CheckTempSensor(int sensor_num) {
@@ -120,48 +145,111 @@ void SetTPUPowerState(struct jsonrpc_request* request) {
   jsonrpc_return_success(request, "{}");
 }
 
+// Implements the "begin_upload_resource" RPC.
+// Takes "name" and "size", and optionally "storage" ("ram", the default, or
+// "flash" to keep the resource across reboots) and "sha256" (the expected
+// hash as hex, checked when the last chunk arrives).
 void BeginUploadResource(struct jsonrpc_request* request) {
   std::string resource_name;
   if (!JsonRpcGetStringParam(request, "name", &resource_name)) return;
+  if (!CheckResourceName(request, resource_name)) return;
 
   int resource_size;
   if (!JsonRpcGetIntegerParam(request, "size", &resource_size)) return;
+  if (resource_size < 0) {
+    JsonRpcReturnBadParam(request, "size must be positive", "size");
+    return;
+  }
+
+  char storage[8] = "ram";
+  mjson_get_string(request->params, request->params_len, "$[0].storage",
+                   storage, sizeof(storage));
+  char sha256[65] = {};
+  mjson_get_string(request->params, request->params_len, "$[0].sha256",
+                   sha256, sizeof(sha256));
 
-  g_stored_resources[resource_name].resize(resource_size);
+  auto status = Resources()->Begin(
+      resource_name, resource_size,
+      std::strcmp(storage, "flash") == 0 ? ResourceStorage::kFlash
+                                         : ResourceStorage::kRam,
+      sha256);
+  if (status != ResourceStatus::kOk) {
+    ReturnResourceError(request, status);
+    return;
+  }
   jsonrpc_return_success(request, "{}");
 }
 
+// Implements the "upload_resource_chunk" RPC.
+// Takes "name", "offset", and "data". Chunks may be sent in any order.
+// Returns the number of contiguous bytes received, whether the upload is
+// complete, and, once it is, the SHA-256 of the resource.
 void UploadResourceChunk(struct jsonrpc_request* request) {
   std::string resource_name;
   if (!JsonRpcGetStringParam(request, "name", &resource_name)) return;
+  if (!CheckResourceName(request, resource_name)) return;
 
-  auto* resource = GetResource(resource_name);
-  if (!resource) {
-    jsonrpc_return_error(request, -1, "unknown resource", nullptr);
+  int offset;
+  if (!JsonRpcGetIntegerParam(request, "offset", &offset)) return;
+  if (offset < 0) {
+    ReturnResourceError(request, ResourceStatus::kOutOfBounds);
     return;
   }
 
-  int offset;
-  if (!JsonRpcGetIntegerParam(request, "offset", &offset)) return;
+  // Binary requests carry the chunk as a raw attachment, which is copied
+  // straight from the request body.
+  std::vector<uint8_t> storage;
+  JsonRpcSpan data;
+  if (!JsonRpcGetBinaryParam(request, "data", &storage, &data)) return;
 
-  std::vector<uint8_t> data;
-  if (!JsonRpcGetBase64Param(request, "data", &data)) return;
-  std::memcpy(resource->data() + offset, data.data(), data.size());
+  auto status = Resources()->Write(resource_name, offset, data.data, data.size);
+  ResourceInfo info;
+  if (status == ResourceStatus::kOk)
+    status = Resources()->GetInfo(resource_name, &info);
+  if (status != ResourceStatus::kOk) {
+    ReturnResourceError(request, status);
+    return;
+  }
+  jsonrpc_return_success(request, "{%Q:%lu,%Q:%s,%Q:%Q}", "received",
+                         static_cast<unsigned long>(info.received), "complete",
+                         info.complete ? "true" : "false", "sha256",
+                         info.sha256.c_str());
+}
 
-  jsonrpc_return_success(request, "{}");
+// Implements the "get_resource_info" RPC.
+// Takes "name". Returns the size, storage, upload progress, and SHA-256 of a
+// resource, including one uploaded to flash before the last reboot, so a
+// client can skip uploading it again.
+void GetResourceInfo(struct jsonrpc_request* request) {
+  std::string resource_name;
+  if (!JsonRpcGetStringParam(request, "name", &resource_name)) return;
+  if (!CheckResourceName(request, resource_name)) return;
+
+  ResourceInfo info;
+  auto status = Resources()->GetInfo(resource_name, &info);
+  if (status != ResourceStatus::kOk) {
+    ReturnResourceError(request, status);
+    return;
+  }
+  jsonrpc_return_success(
+      request, "{%Q:%lu,%Q:%lu,%Q:%s,%Q:%Q,%Q:%Q}", "size",
+      static_cast<unsigned long>(info.size), "received",
+      static_cast<unsigned long>(info.received), "complete",
+      info.complete ? "true" : "false", "storage",
+      info.storage == ResourceStorage::kFlash ? "flash" : "ram", "sha256",
+      info.sha256.c_str());
 }
 
 void DeleteResource(struct jsonrpc_request* request) {
   std::string resource_name;
   if (!JsonRpcGetStringParam(request, "name", &resource_name)) return;
+  if (!CheckResourceName(request, resource_name)) return;
 
-  auto it = g_stored_resources.find(resource_name);
-  if (it == g_stored_resources.end()) {
-    jsonrpc_return_error(request, -1, "unknown resource", nullptr);
+  auto status = Resources()->Delete(resource_name);
+  if (status != ResourceStatus::kOk) {
+    ReturnResourceError(request, status);
     return;
   }
-
-  g_stored_resources.erase(it);
   jsonrpc_return_success(request, "{}");
 }
 
@@ -171,12 +259,20 @@ void FetchResource(struct jsonrpc_request* request) {
     jsonrpc_return_error(request, -1, "missing resource name", nullptr);
     return;
   }
+  if (!CheckResourceName(request, resource_name)) return;
 
   auto* resource = GetResource(resource_name);
   if (!resource) {
     jsonrpc_return_error(request, -1, "Unknown resource", nullptr);
     return;
   }
+  int attachment =
+      JsonRpcAddAttachment(request, resource->data(), resource->size());
+  if (attachment >= 0) {
+    jsonrpc_return_success(request, "{%Q:{%Q:%d}}", "data", "attachment",
+                           attachment);
+    return;
+  }
   jsonrpc_return_success(request, "{%Q:%V}", "data", resource->size(),
                          resource->data());
 }
@@ -902,7 +998,8 @@ void CryptoGetSha256(struct jsonrpc_request* request) {
   auto maybe_sha = coralmicro::A71ChGetSha256(file_content);
   if (maybe_sha.has_value()) {
     const auto& sha = maybe_sha.value();
-    g_stored_resources[stored_sha_name] = {sha.begin(), sha.end()};
+    Resources()->Put(stored_sha_name,
+                     reinterpret_cast<const uint8_t*>(sha.data()), sha.size());
     jsonrpc_return_success(request, "{%Q:%V}", "sha_256", sha.size(),
                            sha.data());
     return;
@@ -942,11 +1039,13 @@ void CryptoGetEccSignature(struct jsonrpc_request* request) {
     return;
   }
   if (auto maybe_signature =
-          coralmicro::A71ChGetEccSignature(index, *stored_sha);
+          coralmicro::A71ChGetEccSignature(index, stored_sha->data(),
+                                            stored_sha->size());
       maybe_signature.has_value()) {
     const auto& signature = maybe_signature.value();
-    g_stored_resources[stored_signature_name] = {signature.begin(),
-                                                 signature.end()};
+    Resources()->Put(stored_signature_name,
+                     reinterpret_cast<const uint8_t*>(signature.data()),
+                     signature.size());
     jsonrpc_return_success(request, "{%Q:%V}", "ecc_signature",
                            signature.size(), signature.data());
     return;
@@ -30,6 +30,7 @@ inline constexpr char kMethodSetTPUPowerState[] = "set_tpu_power_state";
 inline constexpr char kMethodPosenetStressRun[] = "posenet_stress_run";
 inline constexpr char kMethodBeginUploadResource[] = "begin_upload_resource";
 inline constexpr char kMethodUploadResourceChunk[] = "upload_resource_chunk";
+inline constexpr char kMethodGetResourceInfo[] = "get_resource_info";
 inline constexpr char kMethodDeleteResource[] = "delete_resource";
 inline constexpr char kMethodFetchResource[] = "fetch_resource";
 inline constexpr char kMethodRunClassificationModel[] =
@@ -61,6 +62,7 @@ void RunTestConv1(struct jsonrpc_request* request);
 void SetTPUPowerState(struct jsonrpc_request* request);
 void BeginUploadResource(struct jsonrpc_request* request);
 void UploadResourceChunk(struct jsonrpc_request* request);
+void GetResourceInfo(struct jsonrpc_request* request);
 void DeleteResource(struct jsonrpc_request* request);
 void FetchResource(struct jsonrpc_request* request);
 void PosenetStressRun(struct jsonrpc_request* request);
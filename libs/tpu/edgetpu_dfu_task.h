@@ -17,8 +17,6 @@
 #ifndef LIBS_TPU_EDGETPU_DFU_TASK_H_
 #define LIBS_TPU_EDGETPU_DFU_TASK_H_
 
-#include <functional>
-
 #include "libs/base/queue_task.h"
 #include "libs/base/tasks.h"
 #include "third_party/modified/nxp/rt1176-sdk/usb_host_config.h"
@@ -69,7 +67,7 @@ struct Request {
   union {
     NextStateRequest next_state;
   } request;
-  std::function<void(Response)> callback;
+  QueueTaskCallback<Response> callback;
 };
 
 }  // namespace edgetpu_dfu
@@ -31,62 +31,154 @@ constexpr char kKeyVersion[] = "1";
 constexpr char kKeyChipName[] = "2";
 constexpr char kKeyParamCache_DEPRECATED[] = "3";
 constexpr char kKeyExecutable[] = "4";
+
+// Bits of `EdgeTpuManager::events_`.
+constexpr EventBits_t kConnectedBit = 1 << 0;
+constexpr EventBits_t kErrorBit = 1 << 1;
+constexpr EventBits_t kDetachedBit = 1 << 2;
+
+// Most time to wait for the Edge TPU to leave the USB bus after powering it
+// down, before powering it up again.
+constexpr int kDetachTimeoutMs = 30;
+// Delay before retrying a keep-warm power down when the manager is busy.
+constexpr int kKeepWarmRetryMs = 10;
 }  // namespace
 
-EdgeTpuContext::EdgeTpuContext() {
-  EdgeTpuTask::GetSingleton()->SetPower(true);
-}
+EdgeTpuContext::EdgeTpuContext() {}
 
 EdgeTpuContext::~EdgeTpuContext() {
-  EdgeTpuTask::GetSingleton()->SetPower(false);
-  // Small delay ensuring usb instance is released.
-  vTaskDelay(pdMS_TO_TICKS(30));
+  EdgeTpuManager::GetSingleton()->ReleaseDevice();
 }
 
-EdgeTpuManager::EdgeTpuManager() : mutex_(xSemaphoreCreateMutex()) {
+EdgeTpuManager::EdgeTpuManager()
+    : mutex_(xSemaphoreCreateMutex()),
+      events_(xEventGroupCreate()),
+      keep_warm_timer_(xTimerCreate("edgetpu_keep_warm", 1, pdFALSE, nullptr,
+                                    KeepWarmTimerCallback)) {
   CHECK(mutex_);
+  CHECK(events_);
+  CHECK(keep_warm_timer_);
+  xEventGroupSetBits(events_, kDetachedBit);
 }
 
 void EdgeTpuManager::NotifyConnected(
     usb_host_edgetpu_instance_t* usb_instance) {
   usb_instance_ = usb_instance;
 
-  // The EdgeTPU has left the USB bus -- clean up state.
-  if (!usb_instance_) {
+  if (usb_instance_) {
+    xEventGroupClearBits(events_, kDetachedBit);
+    xEventGroupSetBits(events_, kConnectedBit);
+  } else {
+    // The EdgeTPU has left the USB bus -- clean up state.
     current_parameter_caching_token_ = 0;
+    xEventGroupClearBits(events_, kConnectedBit);
+    xEventGroupSetBits(events_, kDetachedBit);
   }
 }
 
-void EdgeTpuManager::NotifyError() { usb_error_ = true; }
+void EdgeTpuManager::NotifyError() { xEventGroupSetBits(events_, kErrorBit); }
 
 std::shared_ptr<EdgeTpuContext> EdgeTpuManager::OpenDevice(
-    PerformanceMode mode) {
+    PerformanceMode mode, uint32_t timeout_ms) {
   MutexLock lock(mutex_);
 
   auto context = context_.lock();
   if (context) return context;
 
-  context = std::make_shared<EdgeTpuContext>();
+  // Reopened while kept warm.
+  xTimerStop(keep_warm_timer_, 0);
 
-  while (!usb_instance_) {
-    if (usb_error_) {
-      printf("%s: Error encountered while bringing up the tpu\r\n", __func__);
-      usb_error_ = false;  // Reset error.
-      return nullptr;
-    }
-    taskYIELD();
-    vTaskDelay(pdMS_TO_TICKS(100));
+  if (!powered_) {
+    // Let an earlier power down finish before powering up again, so we don't
+    // pick up the USB instance from before.
+    xEventGroupWaitBits(events_, kDetachedBit, pdFALSE, pdTRUE,
+                        pdMS_TO_TICKS(kDetachTimeoutMs));
+    xEventGroupClearBits(events_, kErrorBit);
+    EdgeTpuTask::GetSingleton()->SetPower(true);
+    powered_ = true;
+    driver_mode_.reset();
   }
 
-  // Got tpu usb instance, init the tpu driver.
-  if (!tpu_driver_.Initialize(usb_instance_, mode)) {
+  const EventBits_t bits =
+      xEventGroupWaitBits(events_, kConnectedBit | kErrorBit, pdFALSE,
+                          pdFALSE, pdMS_TO_TICKS(timeout_ms));
+  if (bits & kErrorBit) {
+    printf("%s: Error encountered while bringing up the tpu\r\n", __func__);
+    PowerDownLocked();
+    return nullptr;
+  }
+  if (!(bits & kConnectedBit) || !usb_instance_) {
+    printf("%s: Timed out waiting for the tpu\r\n", __func__);
+    PowerDownLocked();
     return nullptr;
   }
 
+  // Got tpu usb instance, init the tpu driver. A kept-warm tpu is already
+  // initialized unless the mode changed.
+  if (driver_mode_ != mode) {
+    if (!tpu_driver_.Initialize(usb_instance_, mode)) {
+      PowerDownLocked();
+      return nullptr;
+    }
+    driver_mode_ = mode;
+    current_parameter_caching_token_ = 0;
+  }
+
+  context = std::make_shared<EdgeTpuContext>();
   context_ = context;
   return context;
 }
 
+void EdgeTpuManager::SetKeepWarm(uint32_t keep_warm_ms) {
+  MutexLock lock(mutex_);
+  keep_warm_ms_ = keep_warm_ms;
+  if (keep_warm_ms_ == 0 && context_.expired()) {
+    xTimerStop(keep_warm_timer_, 0);
+    PowerDownLocked();
+  }
+}
+
+void EdgeTpuManager::ReleaseDevice() {
+  MutexLock lock(mutex_);
+  // OpenDevice() may have handed out a new context after the last one
+  // expired but before its destructor got here.
+  if (!context_.expired()) return;
+  if (keep_warm_ms_ == 0) {
+    PowerDownLocked();
+  } else {
+    // Also starts the timer.
+    xTimerChangePeriod(keep_warm_timer_, pdMS_TO_TICKS(keep_warm_ms_), 0);
+  }
+}
+
+void EdgeTpuManager::PowerDownLocked() {
+  if (!powered_) return;
+  powered_ = false;
+  driver_mode_.reset();
+  current_parameter_caching_token_ = 0;
+  // The USB instance goes away with the power; don't let OpenDevice() use it
+  // before the detach is reported.
+  usb_instance_ = nullptr;
+  xEventGroupClearBits(events_, kConnectedBit);
+  EdgeTpuTask::GetSingleton()->SetPowerAsync(false);
+}
+
+void EdgeTpuManager::KeepWarmTimerCallback(TimerHandle_t timer) {
+  auto* manager = GetSingleton();
+  // Don't block the timer task; if the manager is busy, try again shortly.
+  if (xSemaphoreTake(manager->mutex_, 0) != pdTRUE) {
+    xTimerChangePeriod(timer, pdMS_TO_TICKS(kKeepWarmRetryMs), 0);
+    return;
+  }
+  // Reopened since the timer fired.
+  if (!manager->context_.expired()) {
+    xSemaphoreGive(manager->mutex_);
+    return;
+  }
+  manager->PowerDownLocked();
+  xSemaphoreGive(manager->mutex_);
+}
+
 EdgeTpuPackage* EdgeTpuManager::RegisterPackage(const char* package_content,
                                                 size_t length) {
   MutexLock lock(mutex_);
@@ -193,8 +285,9 @@ TfLiteStatus EdgeTpuManager::Invoke(EdgeTpuPackage* package,
 std::optional<float> EdgeTpuManager::GetTemperature() {
   MutexLock lock(mutex_);
   // Only attempt to read the temperature if the device has been opened.
-  auto context = context_.lock();
-  if (context) return tpu_driver_.GetTemperature();
+  // Don't lock the context here: if this became the last reference, it would
+  // be released while holding the mutex.
+  if (!context_.expired()) return tpu_driver_.GetTemperature();
   return std::nullopt;
 }
 
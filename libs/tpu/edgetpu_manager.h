@@ -27,7 +27,9 @@
 #include "libs/tpu/executable_generated.h"
 #include "libs/tpu/usb_host_edgetpu.h"
 #include "third_party/freertos_kernel/include/FreeRTOS.h"
+#include "third_party/freertos_kernel/include/event_groups.h"
 #include "third_party/freertos_kernel/include/semphr.h"
+#include "third_party/freertos_kernel/include/timers.h"
 #include "third_party/tflite-micro/tensorflow/lite/c/common.h"
 
 namespace coralmicro {
@@ -39,7 +41,9 @@ namespace coralmicro {
 //
 // The `EdgeTpuContext` can be shared among multiple software components, and
 // the life of this object is directly tied to the Edge TPU power, so the
-// Edge TPU powers down after the last `EdgeTpuContext` reference leaves scope.
+// Edge TPU powers down after the last `EdgeTpuContext` reference leaves scope
+// (or later, if set with `EdgeTpuManager::SetKeepWarm()`). Powering down
+// doesn't block the task that releases the context.
 //
 // The lifetime of the `EdgeTpuContext` must be longer than all associated
 // `tflite::MicroInterpreter` instances.
@@ -112,14 +116,33 @@ class EdgeTpuManager {
   // the Edge TPU inferencing speed, but it can also make the Edge TPU
   // module hotter, which might cause burns if touched.
   //
+  // @param timeout_ms The most time to wait for the Edge TPU to power up and
+  // connect over USB, in milliseconds.
+  //
   // @return A shared pointer to Edge TPU device. The shared_ptr can point to
-  // nullptr in case of error.
+  // nullptr in case of error or timeout.
   std::shared_ptr<EdgeTpuContext> OpenDevice(
-      PerformanceMode mode = PerformanceMode::kHigh);
+      PerformanceMode mode = PerformanceMode::kHigh,
+      uint32_t timeout_ms = kDefaultOpenTimeoutMs);
+
+  // Sets how long the Edge TPU stays powered after the last `EdgeTpuContext`
+  // is released.
+  //
+  // Powering up the Edge TPU and waiting for it on USB takes much longer than
+  // an inference. If inferences come in bursts, keeping it powered in between
+  // lets `OpenDevice()` return right away, without initializing the Edge TPU
+  // or caching parameters again, at the cost of idle power.
+  //
+  // @param keep_warm_ms Time to keep the Edge TPU powered, in milliseconds.
+  // The default is 0, which powers it down as soon as it's released.
+  void SetKeepWarm(uint32_t keep_warm_ms);
 
   // @cond Do not generate docs
+  static constexpr uint32_t kDefaultOpenTimeoutMs = 10000;
+
   void NotifyError();
   void NotifyConnected(usb_host_edgetpu_instance_t* usb_instance);
+  void ReleaseDevice();
   // @endcond
 
   // Gets the current Edge TPU junction temperature.
@@ -128,6 +151,9 @@ class EdgeTpuManager {
   std::optional<float> GetTemperature();
 
  private:
+  void PowerDownLocked();
+  static void KeepWarmTimerCallback(TimerHandle_t timer);
+
   TpuDriver tpu_driver_;
   std::map<uintptr_t, EdgeTpuPackage*> packages_;
   std::array<EdgeTpuPackage*, 2> cached_packages_;
@@ -135,7 +161,15 @@ class EdgeTpuManager {
   usb_host_edgetpu_instance_t* usb_instance_ = nullptr;
   std::weak_ptr<EdgeTpuContext> context_;
   SemaphoreHandle_t mutex_;
-  bool usb_error_{false};
+  // USB state from `NotifyConnected()` and `NotifyError()`.
+  EventGroupHandle_t events_;
+  // Powers the Edge TPU down once it's been idle for `keep_warm_ms_`.
+  TimerHandle_t keep_warm_timer_;
+  uint32_t keep_warm_ms_ = 0;
+  // Whether the Edge TPU is powered for an open or kept-warm context.
+  bool powered_ = false;
+  // The mode the driver was initialized with since the Edge TPU powered up.
+  std::optional<PerformanceMode> driver_mode_;
 };
 
 }  // namespace coralmicro
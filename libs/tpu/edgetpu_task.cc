@@ -209,6 +209,13 @@ void EdgeTpuTask::SetPower(bool enable) {
   SendRequest(req);
 }
 
+void EdgeTpuTask::SetPowerAsync(bool enable) {
+  Request req;
+  req.type = RequestType::kSetPower;
+  req.request.set_power.enable = enable;
+  SendRequestAsync(req);
+}
+
 void EdgeTpuTask::RequestHandler(Request *req) {
   Response resp;
   resp.type = req->type;
@@ -17,8 +17,6 @@
 #ifndef LIBS_TPU_EDGETPU_TASK_H_
 #define LIBS_TPU_EDGETPU_TASK_H_
 
-#include <functional>
-
 #include "libs/base/queue_task.h"
 #include "libs/base/tasks.h"
 #include "third_party/modified/nxp/rt1176-sdk/usb_host_config.h"
@@ -75,7 +73,7 @@ struct Request {
     NextStateRequest next_state;
     SetPowerRequest set_power;
   } request;
-  std::function<void(Response)> callback;
+  QueueTaskCallback<Response> callback;
 };
 
 }  // namespace edgetpu
@@ -89,6 +87,8 @@ class EdgeTpuTask
  public:
   bool GetPower();
   void SetPower(bool enable);
+  // Like `SetPower()`, but returns without waiting for the request.
+  void SetPowerAsync(bool enable);
   static EdgeTpuTask *GetSingleton() {
     static EdgeTpuTask task;
     return &task;
@@ -0,0 +1,232 @@
+#!/usr/bin/python3
+# Copyright 2022 Google LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""Decodes binary trace data recorded with libs/base/trace.h.
+
+Prints each event as text, and optionally writes a Chrome trace JSON file for
+chrome://tracing or https://ui.perfetto.dev. For example:
+
+  python3 scripts/trace_decode.py --elf build/apps/my_app/my_app trace.bin \\
+      --m4 build/apps/my_app/my_app_m4 trace_m4.bin --chrome trace.json
+"""
+
+import argparse
+import json
+import re
+import struct
+import sys
+
+TRACE_SECTION = '.coralmicro_trace'
+
+# Event header: size, format ID, timestamp in microseconds, and task.
+HEADER = struct.Struct('<HIQI')
+
+# Argument types, from TraceArgType.
+ARG_INT32 = 1
+ARG_UINT32 = 2
+ARG_INT64 = 3
+ARG_UINT64 = 4
+ARG_DOUBLE = 5
+ARG_STRING = 6
+ARG_POINTER = 7
+
+ARG_FORMATS = {
+    ARG_INT32: '<i',
+    ARG_UINT32: '<I',
+    ARG_INT64: '<q',
+    ARG_UINT64: '<Q',
+    ARG_DOUBLE: '<d',
+    ARG_POINTER: '<I',
+}
+
+PRINTF_SPEC = re.compile(
+    r'%([-+ #0]*)(\*|\d+)?(\.(?:\*|\d+))?(hh|h|ll|l|j|z|t|L)?([diouxXeEfFgGcsp%])')
+
+
+class Formats:
+  """The trace format strings of one program, read from its ELF file."""
+
+  def __init__(self, elf_path):
+    with open(elf_path, 'rb') as f:
+      elf = f.read()
+    if elf[:4] != b'\x7fELF':
+      raise ValueError(f'{elf_path} is not an ELF file')
+    if elf[5] != 1:
+      raise ValueError(f'{elf_path} is not little-endian')
+
+    if elf[4] == 1:  # 32-bit
+      shoff, = struct.unpack_from('<I', elf, 0x20)
+      shentsize, shnum, shstrndx = struct.unpack_from('<HHH', elf, 0x2E)
+      section = struct.Struct('<IIIIIIIIII')
+    else:
+      shoff, = struct.unpack_from('<Q', elf, 0x28)
+      shentsize, shnum, shstrndx = struct.unpack_from('<HHH', elf, 0x3A)
+      section = struct.Struct('<IIQQQQIIQQ')
+
+    headers = [
+        section.unpack_from(elf, shoff + i * shentsize) for i in range(shnum)
+    ]
+    names_offset = headers[shstrndx][4]
+    self.base = 0
+    self.data = b''
+    for name, _, _, addr, offset, size, *_ in headers:
+      end = elf.index(b'\0', names_offset + name)
+      if elf[names_offset + name:end].decode() == TRACE_SECTION:
+        self.base = addr
+        self.data = elf[offset:offset + size]
+        break
+    else:
+      raise ValueError(f'{elf_path} has no {TRACE_SECTION} section')
+
+  def get(self, format_id):
+    """Returns the event type, source location, and format for an ID."""
+    start = format_id - self.base
+    if not 0 <= start < len(self.data):
+      return None
+    end = self.data.index(b'\0', start)
+    event_type, location, fmt = self.data[start:end].decode(
+        errors='replace').split('|', 2)
+    return event_type, location, fmt
+
+
+def format_message(fmt, args):
+  """Formats a printf-style string with the recorded arguments."""
+
+  def convert(match):
+    flags, width, precision, _, conversion = match.groups()
+    if conversion == 'p':
+      flags, conversion = flags + '#', 'x'
+    elif conversion in 'iu':
+      conversion = 'd'
+    return '%' + flags + (width or '') + (precision or '') + conversion
+
+  try:
+    return PRINTF_SPEC.sub(convert, fmt) % tuple(args)
+  except (TypeError, ValueError):
+    return f'{fmt} {args}'
+
+
+def decode_events(data, formats):
+  """Yields the events in a trace stream as dicts."""
+  pos = 0
+  while pos + HEADER.size <= len(data):
+    size, format_id, timestamp, task = HEADER.unpack_from(data, pos)
+    if size < HEADER.size or pos + size > len(data):
+      break
+    end = pos + size
+    pos += HEADER.size
+
+    args = []
+    while pos < end:
+      arg_type = data[pos]
+      pos += 1
+      if arg_type == ARG_STRING:
+        length = data[pos]
+        args.append(data[pos + 1:pos + 1 + length].decode(errors='replace'))
+        pos += 1 + length
+      elif arg_type in ARG_FORMATS:
+        arg_format = ARG_FORMATS[arg_type]
+        args.append(struct.unpack_from(arg_format, data, pos)[0])
+        pos += struct.calcsize(arg_format)
+      else:
+        break
+    pos = end
+
+    info = formats.get(format_id)
+    if info is None:
+      print(f'Unknown format ID 0x{format_id:08x}; wrong ELF file?',
+            file=sys.stderr)
+      continue
+    event_type, location, fmt = info
+    yield {
+        'type': event_type,
+        'location': location,
+        'timestamp': timestamp,
+        'task': task,
+        'format': fmt,
+        'args': args,
+    }
+
+
+def chrome_event(event, pid):
+  """Converts a decoded event to a Chrome trace event."""
+  tid = event['task']
+  result = {'pid': pid, 'tid': tid, 'ts': event['timestamp']}
+  if event['type'] == 'I':
+    result.update({
+        'ph': 'i',
+        's': 't',
+        'name': format_message(event['format'], event['args']),
+        'args': {'location': event['location']},
+    })
+  elif event['type'] in 'BE':
+    result.update({'ph': event['type'], 'name': event['format']})
+  elif event['type'] == 'C':
+    result.update({
+        'ph': 'C',
+        'name': event['format'],
+        'args': {event['format']: event['args'][0] if event['args'] else 0},
+    })
+  return result
+
+
+def main():
+  parser = argparse.ArgumentParser(
+      description='Decodes Coral Dev Board Micro trace data',
+      formatter_class=argparse.RawDescriptionHelpFormatter,
+      epilog=__doc__)
+  parser.add_argument('--elf', required=True,
+                      help='ELF file of the M7 program that recorded the trace')
+  parser.add_argument('traces', nargs='+',
+                      help='M7 trace files, in the order they were drained')
+  parser.add_argument('--m4', nargs=2, metavar=('ELF', 'TRACE'),
+                      help='ELF file and trace file of the M4 program')
+  parser.add_argument('--chrome', metavar='JSON',
+                      help='Writes a Chrome trace JSON file')
+  parser.add_argument('--quiet', action='store_true',
+                      help='Does not print events as text')
+  args = parser.parse_args()
+
+  streams = [('M7', Formats(args.elf),
+              b''.join(open(path, 'rb').read() for path in args.traces))]
+  if args.m4:
+    with open(args.m4[1], 'rb') as f:
+      streams.append(('M4', Formats(args.m4[0]), f.read()))
+
+  chrome_events = []
+  for pid, (core, formats, data) in enumerate(streams):
+    chrome_events.append({
+        'ph': 'M',
+        'pid': pid,
+        'name': 'process_name',
+        'args': {'name': core},
+    })
+    for event in decode_events(data, formats):
+      if not args.quiet:
+        if event['type'] == 'C':
+          message = f'{event["format"]} = {event["args"][0]}'
+        else:
+          message = format_message(event['format'], event['args'])
+        task = f'0x{event["task"]:08x}' if event['task'] else 'ISR'
+        print(f'{event["timestamp"] / 1e6:12.6f} {core} {task} '
+              f'{event["type"]} {event["location"]} {message}')
+      chrome_events.append(chrome_event(event, pid))
+
+  if args.chrome:
+    with open(args.chrome, 'w') as f:
+      json.dump({'traceEvents': chrome_events, 'displayTimeUnit': 'ms'}, f)
+
+
+if __name__ == '__main__':
+  main()
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/base/buffer_pool.h"
+
+#include <cstdint>
+#include <utility>
+
+#include "test_util.h"
+
+namespace coralmicro {
+namespace {
+
+void TestAcquireAndRelease() {
+  BufferPool pool(/*num_buffers=*/2, /*buffer_size=*/100);
+  EXPECT(pool.BufferSize() == 100);
+  EXPECT(pool.NumFree() == 2);
+
+  auto a = pool.Acquire();
+  auto b = pool.Acquire();
+  EXPECT(a && b);
+  EXPECT(a.Data() != b.Data());
+  EXPECT(a.Capacity() == 100 && a.Size() == 0);
+  EXPECT(reinterpret_cast<uintptr_t>(a.Data()) % 32 == 0);
+  EXPECT(reinterpret_cast<uintptr_t>(b.Data()) % 32 == 0);
+  EXPECT(pool.NumFree() == 0);
+
+  EXPECT(!pool.Acquire(/*timeout_ms=*/10));
+  EXPECT(pool.GetStats().acquire_failures == 1);
+  EXPECT(pool.GetStats().max_in_use == 2);
+
+  a.Reset();
+  EXPECT(!a && a.Data() == nullptr && a.Capacity() == 0);
+  EXPECT(pool.NumFree() == 1);
+  b = {};
+  EXPECT(pool.NumFree() == 2);
+}
+
+void TestSharedHandles() {
+  BufferPool pool(/*num_buffers=*/1, /*buffer_size=*/64);
+  auto a = pool.Acquire();
+  EXPECT(a.SetSize(10));
+  {
+    auto copy = a;
+    EXPECT(copy.Data() == a.Data() && copy.Size() == 10);
+    auto moved = std::move(copy);
+    EXPECT(!copy && moved.Data() == a.Data());
+    a.Reset();
+    // The buffer stays out of the pool while any handle refers to it.
+    EXPECT(pool.NumFree() == 0);
+    EXPECT(moved.Size() == 10);
+  }
+  EXPECT(pool.NumFree() == 1);
+
+  // A reused buffer starts empty.
+  auto c = pool.Acquire();
+  EXPECT(c.Size() == 0);
+
+  // Release() and Adopt() pass a reference through a void pointer.
+  void* opaque = c.Release();
+  EXPECT(!c && pool.NumFree() == 0);
+  BufferPool::Handle::Adopt(static_cast<BufferPool::Buffer*>(opaque));
+  EXPECT(pool.NumFree() == 1);
+}
+
+void TestSizeStats() {
+  BufferPool pool(/*num_buffers=*/1, /*buffer_size=*/100);
+  auto a = pool.Acquire();
+  EXPECT(a.SetSize(60));
+  EXPECT(a.SetSize(100));
+  auto stats = pool.GetStats();
+  EXPECT(stats.max_size == 100 && stats.oversize_count == 0);
+
+  // Data that didn't fit is still recorded, so the stats show how large the
+  // buffers need to be.
+  EXPECT(!a.SetSize(150));
+  EXPECT(a.Size() == 100);
+  stats = pool.GetStats();
+  EXPECT(stats.max_size == 150 && stats.oversize_count == 1);
+
+  EXPECT(!BufferPool::Handle().SetSize(1));
+}
+
+}  // namespace
+}  // namespace coralmicro
+
+int main() {
+  using namespace coralmicro;
+  RUN_TEST(TestAcquireAndRelease);
+  RUN_TEST(TestSharedHandles);
+  RUN_TEST(TestSizeStats);
+  return TEST_RESULT();
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "third_party/freertos_kernel/include/FreeRTOS.h"
+#include "third_party/freertos_kernel/include/queue.h"
+#include "third_party/freertos_kernel/include/semphr.h"
+#include "third_party/freertos_kernel/include/task.h"
+
+struct HostQueue {
+  UBaseType_t length;
+  UBaseType_t item_size;
+  std::deque<std::vector<uint8_t>> items;
+  std::mutex mutex;
+  std::condition_variable changed;
+};
+
+namespace {
+// Waits until `ready` returns true, or until `ticks` milliseconds pass.
+template <typename Predicate>
+bool Wait(HostQueue* queue, std::unique_lock<std::mutex>* lock,
+          TickType_t ticks, Predicate ready) {
+  if (ticks == portMAX_DELAY) {
+    queue->changed.wait(*lock, ready);
+    return true;
+  }
+  return queue->changed.wait_for(*lock, std::chrono::milliseconds(ticks),
+                                 ready);
+}
+}  // namespace
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  return new HostQueue{length, item_size, {}, {}, {}};
+}
+
+void vQueueDelete(QueueHandle_t queue) { delete queue; }
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t wait) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!Wait(queue, &lock, wait,
+            [queue] { return queue->items.size() < queue->length; }))
+    return pdFALSE;
+  const auto* bytes = static_cast<const uint8_t*>(item);
+  queue->items.emplace_back(bytes, bytes + queue->item_size);
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t wait) {
+  std::unique_lock<std::mutex> lock(queue->mutex);
+  if (!Wait(queue, &lock, wait, [queue] { return !queue->items.empty(); }))
+    return pdFALSE;
+  if (queue->item_size)
+    std::memcpy(item, queue->items.front().data(), queue->item_size);
+  queue->items.pop_front();
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  return queue->items.size();
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  auto* sema = xQueueCreate(1, 0);
+  xSemaphoreGive(sema);
+  return sema;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() { return xQueueCreate(1, 0); }
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sema, TickType_t wait) {
+  return xQueueReceive(sema, nullptr, wait);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sema) {
+  return xQueueSend(sema, nullptr, 0);
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* /*name*/,
+                       uint32_t /*stack_depth*/, void* param,
+                       UBaseType_t /*priority*/, TaskHandle_t* handle) {
+  std::thread(fn, param).detach();
+  if (handle) *handle = nullptr;
+  return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+void vTaskSuspendAll() {}
@@ -0,0 +1,33 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TESTS_HOST_CHECK_H_
+#define TESTS_HOST_CHECK_H_
+
+#include <cstdio>
+#include <cstdlib>
+
+// Host version of libs/base/check.h, which needs the board console.
+#define CHECK(a)                                                          \
+  do {                                                                    \
+    if (!(a)) {                                                           \
+      std::fprintf(stderr, "%s:%d %s was not true.\n", __FILE__, __LINE__, \
+                   #a);                                                   \
+      std::abort();                                                       \
+    }                                                                     \
+  } while (0)
+
+#endif  // TESTS_HOST_CHECK_H_
@@ -0,0 +1,46 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host stand-in for the parts of the FreeRTOS API that host tests use. Tasks
+// are threads, and a tick is one millisecond.
+
+#ifndef TESTS_HOST_FREERTOS_H_
+#define TESTS_HOST_FREERTOS_H_
+
+#include <cstdint>
+
+using BaseType_t = long;
+using UBaseType_t = unsigned long;
+using TickType_t = uint32_t;
+using StackType_t = uint32_t;
+
+struct HostQueue;
+struct HostTask;
+using QueueHandle_t = HostQueue*;
+using SemaphoreHandle_t = HostQueue*;
+using TaskHandle_t = HostTask*;
+using TaskFunction_t = void (*)(void*);
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define portMAX_DELAY static_cast<TickType_t>(0xffffffffUL)
+#define pdMS_TO_TICKS(ms) static_cast<TickType_t>(ms)
+#define configMINIMAL_STACK_SIZE 90
+#define tskIDLE_PRIORITY 0
+
+#endif  // TESTS_HOST_FREERTOS_H_
@@ -0,0 +1,29 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TESTS_HOST_TASK_H_
+#define TESTS_HOST_TASK_H_
+
+#include "third_party/freertos_kernel/include/FreeRTOS.h"
+
+// Starts a detached thread. The stack size and priority are ignored.
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name,
+                       uint32_t stack_depth, void* param,
+                       UBaseType_t priority, TaskHandle_t* handle);
+void vTaskDelay(TickType_t ticks);
+void vTaskSuspendAll();
+
+#endif  // TESTS_HOST_TASK_H_
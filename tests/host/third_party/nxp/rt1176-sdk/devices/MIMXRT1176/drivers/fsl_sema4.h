@@ -0,0 +1,26 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TESTS_HOST_FSL_SEMA4_H_
+#define TESTS_HOST_FSL_SEMA4_H_
+
+#include <cstdint>
+
+// There is only one core on a host, so the gates do nothing.
+inline void SEMA4_Lock(void*, uint8_t, uint8_t) {}
+inline void SEMA4_Unlock(void*, uint8_t) {}
+
+#endif  // TESTS_HOST_FSL_SEMA4_H_
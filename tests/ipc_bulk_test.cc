@@ -0,0 +1,239 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/base/ipc_bulk.h"
+
+#include <cstring>
+#include <thread>
+
+#include "test_util.h"
+
+namespace coralmicro {
+namespace {
+constexpr size_t kSlabSize = 64;
+constexpr size_t kNumSlabs = 4;
+
+// Two cores' worth of lanes and slabs, connected back to back.
+struct Channel {
+  alignas(kIpcBulkSlabAlignment) uint8_t a_slabs[kSlabSize * kNumSlabs];
+  alignas(kIpcBulkSlabAlignment) uint8_t b_slabs[kSlabSize * kNumSlabs];
+  IpcBulkLane a_to_b;
+  IpcBulkLane b_to_a;
+
+  Channel() {
+    a_to_b.Init(a_slabs, kSlabSize, kNumSlabs);
+    b_to_a.Init(b_slabs, kSlabSize, kNumSlabs);
+  }
+};
+
+void TestRingEmptyAndFull() {
+  IpcBulkRing ring;
+  ring.Reset();
+  IpcBulkDescriptor descriptor;
+  EXPECT(!ring.Pop(&descriptor));
+  EXPECT(ring.Size() == 0);
+
+  for (uint32_t i = 0; i < kIpcBulkRingSize; ++i)
+    EXPECT(ring.Push({i, i + 1, i + 2}));
+  EXPECT(ring.Size() == kIpcBulkRingSize);
+  EXPECT(!ring.Push({0, 0, 0}));
+
+  EXPECT(ring.Pop(&descriptor));
+  EXPECT(descriptor.offset == 0 && descriptor.size == 1 &&
+         descriptor.type == 2);
+  EXPECT(ring.Push({99, 0, 0}));
+  EXPECT(!ring.Push({0, 0, 0}));
+}
+
+void TestRingWraparound() {
+  IpcBulkRing ring;
+  ring.Reset();
+  // Start near the end of the index range so it wraps past zero too.
+  ring.head = ring.tail = UINT32_MAX - 20;
+  uint32_t next_push = 0, next_pop = 0;
+  for (int round = 0; round < 10; ++round) {
+    for (int i = 0; i < 7; ++i) EXPECT(ring.Push({next_push, 0, next_push++}));
+    IpcBulkDescriptor descriptor;
+    for (int i = 0; i < 7; ++i) {
+      EXPECT(ring.Pop(&descriptor));
+      EXPECT(descriptor.offset == next_pop && descriptor.type == next_pop);
+      ++next_pop;
+    }
+    EXPECT(ring.Size() == 0);
+  }
+  EXPECT(ring.head < 100);
+}
+
+void TestHandoff() {
+  Channel channel;
+  IpcBulkEndpoint a(&channel.a_to_b, &channel.b_to_a);
+  IpcBulkEndpoint b(&channel.b_to_a, &channel.a_to_b);
+
+  IpcBulkMessage message;
+  EXPECT(!b.Receive(&message));
+
+  IpcBulkBuffer buffer = a.Allocate(/*now_us=*/100);
+  EXPECT(buffer.data == channel.a_slabs);
+  EXPECT(buffer.capacity == kSlabSize);
+  std::memcpy(buffer.data, "hello", 5);
+  EXPECT(a.Send(buffer, 5, /*type=*/7, /*now_us=*/110));
+
+  EXPECT(b.Receive(&message));
+  EXPECT(message.data == buffer.data);  // Not copied.
+  EXPECT(message.size == 5 && message.type == 7);
+  EXPECT(std::memcmp(message.data, "hello", 5) == 0);
+  EXPECT(!b.Receive(&message));
+
+  // The slab stays in flight until it's released.
+  EXPECT(a.GetStats().messages_completed == 0);
+  b.Release(message);
+  a.Allocate(/*now_us=*/150);
+  const auto stats = a.GetStats();
+  EXPECT(stats.messages_sent == 1 && stats.bytes_sent == 5);
+  EXPECT(stats.messages_completed == 1);
+  EXPECT(stats.total_latency_us == 40 && stats.max_latency_us == 40);
+  EXPECT(stats.max_in_flight == 1);
+  EXPECT(b.GetStats().messages_received == 1);
+  EXPECT(b.GetStats().bytes_received == 5);
+}
+
+void TestAllSlabsInUse() {
+  Channel channel;
+  IpcBulkEndpoint a(&channel.a_to_b, &channel.b_to_a);
+  IpcBulkEndpoint b(&channel.b_to_a, &channel.a_to_b);
+
+  for (size_t i = 0; i < kNumSlabs; ++i) {
+    IpcBulkBuffer buffer = a.Allocate(0);
+    EXPECT(buffer.data != nullptr);
+    EXPECT(a.Send(buffer, i, i, 0));
+  }
+  EXPECT(a.Allocate(0).data == nullptr);
+  EXPECT(a.GetStats().allocation_failures == 1);
+  EXPECT(a.GetStats().max_in_flight == kNumSlabs);
+
+  IpcBulkMessage message;
+  EXPECT(b.Receive(&message));
+  EXPECT(message.type == 0);
+  b.Release(message);
+  IpcBulkBuffer buffer = a.Allocate(0);
+  EXPECT(buffer.data == message.data);
+  EXPECT(a.Allocate(0).data == nullptr);
+
+  // A slab that's freed without sending can be allocated again.
+  a.Free(buffer);
+  EXPECT(a.Allocate(0).data == buffer.data);
+}
+
+void TestSendTooLarge() {
+  Channel channel;
+  IpcBulkEndpoint a(&channel.a_to_b, &channel.b_to_a);
+  IpcBulkBuffer buffer = a.Allocate(0);
+  EXPECT(!a.Send(buffer, kSlabSize + 1, 0, 0));
+  EXPECT(a.Send(buffer, kSlabSize, 0, 0));
+}
+
+void TestInvalidDescriptors() {
+  Channel channel;
+  IpcBulkEndpoint b(&channel.b_to_a, &channel.a_to_b);
+  channel.a_to_b.submit.Push({kSlabSize * kNumSlabs, 0, 0});  // Past the end.
+  channel.a_to_b.submit.Push({1, 0, 0});                      // Misaligned.
+  channel.a_to_b.submit.Push({0, kSlabSize + 1, 0});          // Too big.
+  channel.a_to_b.submit.Push({kSlabSize, 3, 9});
+
+  IpcBulkMessage message;
+  EXPECT(b.Receive(&message));
+  EXPECT(message.data == channel.a_slabs + kSlabSize && message.type == 9);
+  EXPECT(b.GetStats().invalid_descriptors == 3);
+}
+
+int cleaned = 0, invalidated = 0;
+
+void TestCacheOps() {
+  Channel channel;
+  IpcBulkCacheOps cache;
+  cache.clean = [](const void*, size_t size) { cleaned += size; };
+  cache.invalidate = [](const void*, size_t size) { invalidated += size; };
+  IpcBulkEndpoint a(&channel.a_to_b, &channel.b_to_a, cache);
+  IpcBulkEndpoint b(&channel.b_to_a, &channel.a_to_b, cache);
+
+  EXPECT(a.Send(a.Allocate(0), 10, 0, 0));
+  EXPECT(cleaned == 10 && invalidated == 0);
+  IpcBulkMessage message;
+  EXPECT(b.Receive(&message));
+  EXPECT(invalidated == 10);
+}
+
+// Streams messages between two threads, one per core, through more slabs
+// than fit in the ring so both rings wrap many times.
+void TestConcurrentStream() {
+  constexpr uint32_t kMessages = 100000;
+  Channel channel;
+  IpcBulkEndpoint a(&channel.a_to_b, &channel.b_to_a);
+  IpcBulkEndpoint b(&channel.b_to_a, &channel.a_to_b);
+
+  std::thread sender([&a] {
+    for (uint32_t i = 0; i < kMessages;) {
+      IpcBulkBuffer buffer = a.Allocate(0);
+      if (!buffer.data) {
+        std::this_thread::yield();
+        continue;
+      }
+      const size_t size = 4 + i % (kSlabSize - 4);
+      std::memset(buffer.data, static_cast<uint8_t>(i), size);
+      std::memcpy(buffer.data, &i, sizeof(i));
+      a.Send(buffer, size, i, 0);
+      ++i;
+    }
+  });
+
+  uint32_t expected = 0;
+  int corrupted = 0;
+  while (expected < kMessages) {
+    IpcBulkMessage message;
+    if (!b.Receive(&message)) {
+      std::this_thread::yield();
+      continue;
+    }
+    uint32_t seq;
+    std::memcpy(&seq, message.data, sizeof(seq));
+    if (seq != expected || message.type != expected ||
+        message.size != 4 + expected % (kSlabSize - 4) ||
+        (message.size > 4 &&
+         message.data[message.size - 1] != static_cast<uint8_t>(expected)))
+      ++corrupted;
+    b.Release(message);
+    ++expected;
+  }
+  sender.join();
+  EXPECT(corrupted == 0);
+  EXPECT(b.GetStats().messages_received == kMessages);
+  EXPECT(a.GetStats().max_in_flight <= kNumSlabs);
+}
+}  // namespace
+}  // namespace coralmicro
+
+int main() {
+  using namespace coralmicro;
+  RUN_TEST(TestRingEmptyAndFull);
+  RUN_TEST(TestRingWraparound);
+  RUN_TEST(TestHandoff);
+  RUN_TEST(TestAllSlabsInUse);
+  RUN_TEST(TestSendTooLarge);
+  RUN_TEST(TestInvalidDescriptors);
+  RUN_TEST(TestCacheOps);
+  RUN_TEST(TestConcurrentStream);
+  return TEST_RESULT();
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <vector>
+
+#include "libs/base/buffer_pool.h"
+#include "libs/libjpeg/jpeg.h"
+#include "test_util.h"
+
+namespace coralmicro {
+namespace {
+constexpr int kWidth = 160;
+constexpr int kHeight = 120;
+
+// Noise compresses poorly, so the JPEG is large enough to overflow buffers.
+std::vector<uint8_t> NoiseImage() {
+  std::vector<uint8_t> pixels(kWidth * kHeight * 3);
+  uint32_t state = 1;
+  for (auto& p : pixels) {
+    state = state * 1664525 + 1013904223;
+    p = state >> 24;
+  }
+  return pixels;
+}
+
+bool ReadRows(void* ctx, int row, int num_rows, uint8_t* rows) {
+  const auto* pixels = static_cast<const uint8_t*>(ctx);
+  std::memcpy(rows, pixels + row * kWidth * 3, num_rows * kWidth * 3);
+  return true;
+}
+
+void TestRequiredSize() {
+  const auto pixels = NoiseImage();
+  JpegEncoder encoder;
+  std::vector<uint8_t> expected;
+  EXPECT(encoder.Encode(pixels.data(), kWidth, kHeight, JpegPixelFormat::kRgb,
+                        /*quality=*/75, &expected));
+  const size_t size = expected.size();
+  EXPECT(size > 1024);
+
+  // Overflowing by much more than the encoder's scratch area.
+  std::vector<uint8_t> small(size / 4);
+  EXPECT(encoder.Encode(pixels.data(), kWidth, kHeight, JpegPixelFormat::kRgb,
+                        /*quality=*/75, small.data(), small.size()) == 0);
+  EXPECT(encoder.RequiredSize() == size);
+
+  // One byte short.
+  std::vector<uint8_t> buffer(size);
+  EXPECT(encoder.Encode(pixels.data(), kWidth, kHeight, JpegPixelFormat::kRgb,
+                        /*quality=*/75, buffer.data(), size - 1) == 0);
+  EXPECT(encoder.RequiredSize() == size);
+
+  EXPECT(encoder.Encode(pixels.data(), kWidth, kHeight, JpegPixelFormat::kRgb,
+                        /*quality=*/75, buffer.data(), size) == size);
+  EXPECT(encoder.RequiredSize() == size);
+  EXPECT(buffer == expected);
+
+  // The same through the row callback.
+  EXPECT(encoder.Encode(kWidth, kHeight, JpegPixelFormat::kRgb, /*quality=*/75,
+                        const_cast<uint8_t*>(pixels.data()), ReadRows,
+                        small.data(), small.size()) == 0);
+  EXPECT(encoder.RequiredSize() == size);
+
+  // A failed row callback isn't an overflow.
+  EXPECT(encoder.Encode(
+             kWidth, kHeight, JpegPixelFormat::kRgb, /*quality=*/75, nullptr,
+             [](void*, int, int, uint8_t*) { return false; }, buffer.data(),
+             buffer.size()) == 0);
+  EXPECT(encoder.RequiredSize() == 0);
+}
+
+// Encoding into pooled buffers the way the camera examples do counts frames
+// that don't fit in the pool's stats.
+void TestOverflowCountedByPool() {
+  const auto pixels = NoiseImage();
+  JpegEncoder encoder;
+  std::vector<uint8_t> expected;
+  EXPECT(encoder.Encode(pixels.data(), kWidth, kHeight, JpegPixelFormat::kRgb,
+                        /*quality=*/75, &expected));
+
+  BufferPool pool(/*num_buffers=*/1, /*buffer_size=*/expected.size() / 2);
+  auto jpeg = pool.Acquire();
+  const size_t size =
+      encoder.Encode(pixels.data(), kWidth, kHeight, JpegPixelFormat::kRgb,
+                     /*quality=*/75, jpeg.Data(), jpeg.Capacity());
+  EXPECT(size == 0);
+  EXPECT(!jpeg.SetSize(encoder.RequiredSize()));
+
+  const auto stats = pool.GetStats();
+  EXPECT(stats.oversize_count == 1);
+  EXPECT(stats.max_size == expected.size());
+}
+
+}  // namespace
+}  // namespace coralmicro
+
+int main() {
+  using namespace coralmicro;
+  RUN_TEST(TestRequiredSize);
+  RUN_TEST(TestOverflowCountedByPool);
+  return TEST_RESULT();
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/base/lfs_async_writer.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "libs/base/check.h"
+#include "libs/base/timer.h"
+#include "test_util.h"
+
+namespace coralmicro {
+namespace {
+constexpr size_t kPageSize = 2048;
+constexpr size_t kPagesPerBlock = 64;
+constexpr size_t kBlockCount = 16;
+
+// Long enough that appends are only synced by eviction or `Flush()`.
+constexpr int kSyncIntervalMs = 60 * 60 * 1000;
+constexpr int kFlushTimeoutMs = 5000;
+
+LfsRamFlash g_flash(kPageSize, kPagesPerBlock, kBlockCount);
+LfsBlockDevice g_device(&g_flash, kPageSize, kPagesPerBlock, kBlockCount);
+lfs_config g_config;
+lfs_t g_lfs;
+SemaphoreHandle_t g_lfs_mutex;
+
+int LfsSync(const lfs_config*) { return LFS_ERR_OK; }
+
+int LfsLock(const lfs_config*) {
+  return xSemaphoreTake(g_lfs_mutex, portMAX_DELAY) == pdTRUE ? 0 : -1;
+}
+
+int LfsUnlock(const lfs_config*) {
+  return xSemaphoreGive(g_lfs_mutex) == pdTRUE ? 0 : -1;
+}
+
+bool InitFilesystem() {
+  g_lfs_mutex = xSemaphoreCreateMutex();
+  g_device.Configure(&g_config);
+  g_config.sync = LfsSync;
+  g_config.lock = LfsLock;
+  g_config.unlock = LfsUnlock;
+  g_config.block_cycles = 250;
+  return lfs_format(&g_lfs, &g_config) >= 0 &&
+         lfs_mount(&g_lfs, &g_config) >= 0;
+}
+
+// Gets the committed size of a file; appends that aren't synced don't count.
+lfs_soff_t CommittedSize(const char* path) {
+  lfs_info info;
+  if (lfs_stat(&g_lfs, path, &info) < 0) return -1;
+  return info.size;
+}
+
+std::string ReadFile(const char* path) {
+  lfs_file_t file;
+  if (lfs_file_open(&g_lfs, &file, path, LFS_O_RDONLY) < 0) return {};
+  const auto size = lfs_file_size(&g_lfs, &file);
+  std::string contents(size > 0 ? size : 0, '\0');
+  const auto n = lfs_file_read(&g_lfs, &file, &contents[0], contents.size());
+  lfs_file_close(&g_lfs, &file);
+  return n == static_cast<lfs_ssize_t>(contents.size()) ? contents
+                                                        : std::string();
+}
+
+// Waits for the writer task to finish the given number of appends.
+bool WaitForAppends(uint32_t appends) {
+  for (int i = 0; i < kFlushTimeoutMs; ++i) {
+    if (LfsAsyncWriter::GetSingleton()->GetStats().appends_written >= appends)
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return false;
+}
+
+void TestOrdering() {
+  auto* writer = LfsAsyncWriter::GetSingleton();
+  EXPECT(writer->Append("/order", "a"));
+  EXPECT(writer->Append("/order", "b"));
+  // Replacing the file closes the open append handle first.
+  const std::string contents = "new";
+  EXPECT(writer->WriteFile(
+      "/order", reinterpret_cast<const uint8_t*>(contents.data()),
+      contents.size()));
+  EXPECT(writer->Append("/order", "c"));
+  EXPECT(writer->Flush(kFlushTimeoutMs));
+  EXPECT(ReadFile("/order") == "newc");
+
+  const auto stats = writer->GetStats();
+  EXPECT(stats.files_written == 1);
+  EXPECT(stats.appends_written == 3);
+  EXPECT(stats.bytes_written == 6);
+  EXPECT(stats.queue_depth == 0);
+  EXPECT(stats.queued_bytes == 0);
+  EXPECT(stats.failed_writes == 0);
+}
+
+void TestDropsWhenFull() {
+  auto* writer = LfsAsyncWriter::GetSingleton();
+  const auto before = writer->GetStats();
+
+  // Holding the filesystem lock stalls the writer task, so the copied bytes
+  // stay reserved until it's released.
+  CHECK(xSemaphoreTake(g_lfs_mutex, portMAX_DELAY) == pdTRUE);
+  const std::string chunk(40, 'x');
+  EXPECT(writer->Append("/full", chunk));
+  EXPECT(!writer->Append("/full", chunk));
+  EXPECT(writer->Append("/full", std::string(24, 'y')));
+  EXPECT(writer->GetStats().queued_bytes == 64);
+  // The flush can't finish until the writer task gets the lock.
+  EXPECT(!writer->Flush(50));
+  CHECK(xSemaphoreGive(g_lfs_mutex) == pdTRUE);
+
+  EXPECT(writer->Flush(kFlushTimeoutMs));
+  EXPECT(ReadFile("/full") == chunk + std::string(24, 'y'));
+  const auto stats = writer->GetStats();
+  EXPECT(stats.dropped_writes == before.dropped_writes + 1);
+  EXPECT(stats.appends_written == before.appends_written + 2);
+  EXPECT(stats.queued_bytes == 0);
+}
+
+void TestEvictsLeastRecentlyUsed() {
+  auto* writer = LfsAsyncWriter::GetSingleton();
+  const auto appends = writer->GetStats().appends_written;
+
+  // Two files stay open; "/b" is the least recently used when "/c" opens.
+  EXPECT(writer->Append("/a", "a1"));
+  EXPECT(writer->Append("/b", "b1"));
+  EXPECT(writer->Append("/a", "a2"));
+  EXPECT(writer->Append("/c", "c1"));
+  EXPECT(WaitForAppends(appends + 4));
+
+  // Only the evicted file has been closed, so only its data is committed.
+  EXPECT(CommittedSize("/a") == 0);
+  EXPECT(CommittedSize("/b") == 2);
+  EXPECT(CommittedSize("/c") == 0);
+
+  EXPECT(writer->Flush(kFlushTimeoutMs));
+  EXPECT(ReadFile("/a") == "a1a2");
+  EXPECT(ReadFile("/b") == "b1");
+  EXPECT(ReadFile("/c") == "c1");
+  EXPECT(writer->GetStats().syncs >= 1);
+}
+
+}  // namespace
+
+lfs_t* Lfs() { return &g_lfs; }
+
+bool LfsWriteFile(const char* path, const uint8_t* buf, size_t size) {
+  lfs_file_t file;
+  if (lfs_file_open(&g_lfs, &file, path,
+                    LFS_O_WRONLY | LFS_O_TRUNC | LFS_O_CREAT) < 0)
+    return false;
+  const auto n = lfs_file_write(&g_lfs, &file, buf, size);
+  return lfs_file_close(&g_lfs, &file) >= 0 && n >= 0 &&
+         static_cast<size_t>(n) == size;
+}
+
+// Each call is a microsecond later than the last, so the writer's LRU order
+// doesn't depend on the host clock's resolution.
+uint64_t TimerMicros() {
+  static std::atomic<uint64_t> now{0};
+  return ++now;
+}
+
+}  // namespace coralmicro
+
+int main() {
+  using namespace coralmicro;
+  CHECK(InitFilesystem());
+
+  LfsAsyncWriterConfig config;
+  config.queue_size = 8;
+  config.max_queued_bytes = 64;
+  config.max_open_files = 2;
+  config.sync_interval_ms = kSyncIntervalMs;
+  config.sync_bytes = 1024 * 1024;
+  LfsAsyncWriter::GetSingleton()->Start(config);
+
+  RUN_TEST(TestOrdering);
+  RUN_TEST(TestDropsWhenFull);
+  RUN_TEST(TestEvictsLeastRecentlyUsed);
+  return TEST_RESULT();
+}
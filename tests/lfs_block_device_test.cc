@@ -0,0 +1,206 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/base/lfs_block_device.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "test_util.h"
+
+namespace coralmicro {
+namespace {
+// The geometry of the filesystem region of the board's NAND, with fewer
+// blocks to keep the test fast.
+constexpr size_t kPageSize = 2048;
+constexpr size_t kPagesPerBlock = 64;
+constexpr size_t kBlockCount = 64;
+
+uint64_t FlashClock(void* ctx) {
+  return static_cast<LfsRamFlash*>(ctx)->ElapsedMicros();
+}
+
+std::vector<uint8_t> Pattern(size_t size, uint8_t seed) {
+  std::vector<uint8_t> data(size);
+  for (size_t i = 0; i < size; ++i) data[i] = static_cast<uint8_t>(seed + i);
+  return data;
+}
+
+void TestRamFlashRules() {
+  LfsRamFlash flash(kPageSize, kPagesPerBlock, 2);
+  std::vector<uint8_t> page(kPageSize);
+  EXPECT(flash.ReadPage(0, page.data(), page.size()));
+  EXPECT(page == std::vector<uint8_t>(kPageSize, 0xFF));
+
+  const auto data = Pattern(kPageSize, 1);
+  EXPECT(flash.ProgramPage(0, data.data(), data.size()));
+  // Like NAND, a page can only be programmed once between erases.
+  EXPECT(!flash.ProgramPage(0, data.data(), data.size()));
+  EXPECT(flash.ReadPage(0, page.data(), page.size()));
+  EXPECT(page == data);
+
+  EXPECT(flash.EraseBlock(0));
+  EXPECT(flash.ReadPage(0, page.data(), page.size()));
+  EXPECT(page == std::vector<uint8_t>(kPageSize, 0xFF));
+  EXPECT(flash.ProgramPage(0, data.data(), data.size()));
+
+  EXPECT(!flash.ReadPage(2 * kPagesPerBlock, page.data(), page.size()));
+  EXPECT(!flash.ReadPage(0, page.data(), kPageSize + 1));
+  EXPECT(!flash.EraseBlock(2));
+
+  const LfsRamFlashTiming timing;
+  EXPECT(flash.ElapsedMicros() ==
+         3 * timing.read_us + 2 * timing.prog_us + timing.erase_us);
+}
+
+void TestBlockDevice() {
+  LfsRamFlash flash(kPageSize, kPagesPerBlock, kBlockCount);
+  LfsBlockDevice device(&flash, kPageSize, kPagesPerBlock, kBlockCount, {},
+                        FlashClock, &flash);
+  lfs_config config = {};
+  device.Configure(&config);
+  EXPECT(config.context == &device);
+  EXPECT(config.read_size == kPageSize);
+  EXPECT(config.prog_size == kPageSize);
+  EXPECT(config.block_size == kPageSize * kPagesPerBlock);
+  EXPECT(config.block_count == kBlockCount);
+  EXPECT(config.cache_size == 4 * kPageSize);
+  EXPECT(config.lookahead_size == 8);
+
+  // Several pages per call go through the littlefs callbacks.
+  const auto data = Pattern(3 * kPageSize, 7);
+  EXPECT(config.prog(&config, 1, kPageSize, data.data(), data.size()) ==
+         LFS_ERR_OK);
+  std::vector<uint8_t> read(data.size());
+  EXPECT(config.read(&config, 1, kPageSize, read.data(), read.size()) ==
+         LFS_ERR_OK);
+  EXPECT(read == data);
+
+  // Pages must be programmed and read whole.
+  EXPECT(device.Read(1, 1, read.data(), kPageSize) == LFS_ERR_INVAL);
+  EXPECT(device.Prog(1, 0, data.data(), 100) == LFS_ERR_INVAL);
+  // Programming a page twice is an error, as on NAND.
+  EXPECT(device.Prog(1, kPageSize, data.data(), kPageSize) == LFS_ERR_IO);
+
+  EXPECT(config.erase(&config, 1) == LFS_ERR_OK);
+  EXPECT(device.Erase(1) == LFS_ERR_OK);
+  EXPECT(device.Erase(2) == LFS_ERR_OK);
+  EXPECT(device.Erase(kBlockCount) == LFS_ERR_IO);
+
+  const auto stats = device.GetStats();
+  EXPECT(stats.page_reads == 3);
+  EXPECT(stats.page_writes == 3);
+  EXPECT(stats.block_erases == 3);
+  EXPECT(stats.max_block_erases == 2);
+  EXPECT(device.EraseCount(1) == 2);
+  EXPECT(device.EraseCount(2) == 1);
+  EXPECT(stats.read_us + stats.prog_us + stats.erase_us ==
+         flash.ElapsedMicros());
+
+  device.ResetStats();
+  EXPECT(device.GetStats().page_reads == 0);
+  EXPECT(device.EraseCount(1) == 0);
+}
+
+int NoLock(const lfs_config*) { return 0; }
+
+struct PhaseResult {
+  LfsBlockDeviceStats stats;
+  uint64_t elapsed_us;
+};
+
+// Writes and reads back a file through littlefs on simulated flash, and
+// reports the flash work each phase took.
+bool RunFilesystem(const LfsBlockDeviceConfig& device_config,
+                   PhaseResult* write, PhaseResult* read) {
+  constexpr size_t kFileSize = 256 * 1024;
+  constexpr size_t kChunkSize = 4096;
+
+  LfsRamFlash flash(kPageSize, kPagesPerBlock, kBlockCount);
+  LfsBlockDevice device(&flash, kPageSize, kPagesPerBlock, kBlockCount,
+                        device_config, FlashClock, &flash);
+  lfs_config config = {};
+  device.Configure(&config);
+  config.lock = NoLock;
+  config.unlock = NoLock;
+  config.block_cycles = 250;
+
+  lfs_t lfs;
+  if (lfs_format(&lfs, &config) < 0 || lfs_mount(&lfs, &config) < 0)
+    return false;
+
+  const auto data = Pattern(kFileSize, 3);
+  lfs_file_t file;
+  device.ResetStats();
+  auto start = flash.ElapsedMicros();
+  if (lfs_file_open(&lfs, &file, "bench", LFS_O_WRONLY | LFS_O_CREAT) < 0)
+    return false;
+  for (size_t offset = 0; offset < kFileSize; offset += kChunkSize) {
+    if (lfs_file_write(&lfs, &file, &data[offset], kChunkSize) !=
+        static_cast<lfs_ssize_t>(kChunkSize))
+      return false;
+  }
+  if (lfs_file_close(&lfs, &file) < 0) return false;
+  *write = {device.GetStats(), flash.ElapsedMicros() - start};
+
+  std::vector<uint8_t> contents(kFileSize);
+  device.ResetStats();
+  start = flash.ElapsedMicros();
+  if (lfs_file_open(&lfs, &file, "bench", LFS_O_RDONLY) < 0) return false;
+  for (size_t offset = 0; offset < kFileSize; offset += kChunkSize) {
+    if (lfs_file_read(&lfs, &file, &contents[offset], kChunkSize) !=
+        static_cast<lfs_ssize_t>(kChunkSize))
+      return false;
+  }
+  if (lfs_file_close(&lfs, &file) < 0) return false;
+  *read = {device.GetStats(), flash.ElapsedMicros() - start};
+
+  return lfs_unmount(&lfs) >= 0 && contents == data;
+}
+
+// Compares cache sizes for a 256 KB sequential write and read. The times
+// come from the flash timing model, not the host clock.
+void BenchmarkCacheSizes() {
+  std::printf("%-12s %10s %10s %10s %10s %10s\n", "cache_pages",
+              "write_ms", "pages_out", "erases", "read_ms", "pages_in");
+  for (size_t cache_pages : {1, 2, 4, 8}) {
+    LfsBlockDeviceConfig device_config;
+    device_config.cache_pages = cache_pages;
+    PhaseResult write, read;
+    const bool ok = RunFilesystem(device_config, &write, &read);
+    EXPECT(ok);
+    if (!ok) continue;
+    std::printf("%-12zu %10.1f %10u %10u %10.1f %10u\n", cache_pages,
+                write.elapsed_us / 1000.0, write.stats.page_writes,
+                write.stats.block_erases, read.elapsed_us / 1000.0,
+                read.stats.page_reads);
+    // Every page of the file is read and written at least once.
+    EXPECT(write.stats.page_writes >= 128);
+    EXPECT(read.stats.page_reads >= 128);
+  }
+}
+
+}  // namespace
+}  // namespace coralmicro
+
+int main() {
+  using namespace coralmicro;
+  RUN_TEST(TestRamFlashRules);
+  RUN_TEST(TestBlockDevice);
+  RUN_TEST(BenchmarkCacheSizes);
+  return TEST_RESULT();
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "libs/base/log_ring.h"
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test_util.h"
+
+namespace coralmicro {
+namespace {
+// 256 bytes holds four records of the largest size, 60 bytes plus header.
+constexpr size_t kRingSize = 256;
+
+struct Ring {
+  alignas(4) uint8_t storage[kRingSize];
+  LogRing ring{storage, kRingSize};
+};
+
+bool WriteString(LogRing* ring, const std::string& s) {
+  return ring->Write(s.data(), s.size());
+}
+
+std::string ReadAll(LogRing* ring, size_t buffer_size = 64) {
+  std::string out;
+  std::vector<uint8_t> buffer(buffer_size);
+  while (size_t n = ring->Read(buffer.data(), buffer.size()))
+    out.append(reinterpret_cast<char*>(buffer.data()), n);
+  return out;
+}
+
+void TestRoundTrip() {
+  Ring r;
+  EXPECT(r.ring.max_record_size() == 60);
+  uint8_t buffer[64];
+  EXPECT(r.ring.Read(buffer, sizeof(buffer)) == 0);
+
+  EXPECT(WriteString(&r.ring, "hello"));
+  EXPECT(WriteString(&r.ring, " world"));
+  EXPECT(ReadAll(&r.ring) == "hello world");
+  EXPECT(r.ring.Read(buffer, sizeof(buffer)) == 0);
+
+  const auto stats = r.ring.GetStats();
+  EXPECT(stats.bytes_written == 11);
+  EXPECT(stats.writes_dropped == 0);
+  // Each record is a 4-byte header and its data, rounded up to 4 bytes.
+  EXPECT(stats.max_used_bytes == 12 + 12);
+}
+
+void TestSplitRead() {
+  Ring r;
+  EXPECT(WriteString(&r.ring, "0123456789"));
+  uint8_t buffer[4];
+  EXPECT(r.ring.Read(buffer, sizeof(buffer)) == 4);
+  EXPECT(std::memcmp(buffer, "0123", 4) == 0);
+  // The record stays in the ring until it has been fully read.
+  const uint32_t position = r.ring.ReadPosition();
+  EXPECT(r.ring.Read(buffer, sizeof(buffer)) == 4);
+  EXPECT(std::memcmp(buffer, "4567", 4) == 0);
+  EXPECT(r.ring.ReadPosition() == position);
+  EXPECT(r.ring.Read(buffer, sizeof(buffer)) == 2);
+  EXPECT(std::memcmp(buffer, "89", 2) == 0);
+  EXPECT(r.ring.ReadPosition() != position);
+  EXPECT(r.ring.Read(buffer, sizeof(buffer)) == 0);
+}
+
+void TestFullRing() {
+  Ring r;
+  const std::string record(60, 'x');
+  for (int i = 0; i < 4; ++i) EXPECT(WriteString(&r.ring, record));
+  EXPECT(r.ring.GetStats().max_used_bytes == kRingSize);
+
+  // Failed attempts by a writer that retries are not drops.
+  LogRing::Span span;
+  EXPECT(!r.ring.TryReserve(1, &span));
+  EXPECT(!r.ring.TryReserve(1, &span));
+  EXPECT(r.ring.GetStats().writes_dropped == 0);
+
+  EXPECT(!r.ring.Reserve(1, &span));
+  EXPECT(!WriteString(&r.ring, "abc"));
+  auto stats = r.ring.GetStats();
+  EXPECT(stats.writes_dropped == 2);
+  EXPECT(stats.bytes_dropped == 4);
+  EXPECT(stats.bytes_written == 240);
+
+  EXPECT(ReadAll(&r.ring) == record + record + record + record);
+  EXPECT(r.ring.TryReserve(1, &span));
+  r.ring.Commit(span);
+  stats = r.ring.GetStats();
+  EXPECT(stats.writes_dropped == 2);
+  EXPECT(stats.bytes_written == 241);
+}
+
+void TestOversizedRecord() {
+  Ring r;
+  LogRing::Span span;
+  EXPECT(!r.ring.TryReserve(61, &span));
+  EXPECT(r.ring.GetStats().writes_dropped == 0);
+  EXPECT(!WriteString(&r.ring, std::string(61, 'x')));
+  const auto stats = r.ring.GetStats();
+  EXPECT(stats.writes_dropped == 1);
+  EXPECT(stats.bytes_dropped == 61);
+  EXPECT(stats.bytes_written == 0);
+  EXPECT(WriteString(&r.ring, std::string(60, 'x')));
+}
+
+void TestWraparound() {
+  Ring r;
+  // Move the ring position to 132: three records of 4 + 40 bytes.
+  for (int i = 0; i < 3; ++i)
+    EXPECT(WriteString(&r.ring, std::string(40, 'a')));
+  EXPECT(ReadAll(&r.ring).size() == 120);
+  EXPECT(r.ring.ReadPosition() == 132);
+
+  // The first record ends at 196; the second doesn't fit before the end of
+  // the ring, so it starts at 256 after padding.
+  const std::string first(60, 'b'), second(60, 'c');
+  LogRing::Span span;
+  EXPECT(r.ring.Reserve(first.size(), &span));
+  EXPECT(span.end == 196);
+  std::memcpy(span.data, first.data(), first.size());
+  r.ring.Commit(span);
+  EXPECT(r.ring.Reserve(second.size(), &span));
+  EXPECT(span.end == 320);
+  EXPECT(span.data == r.storage + 4);
+  std::memcpy(span.data, second.data(), second.size());
+  r.ring.Commit(span);
+
+  EXPECT(ReadAll(&r.ring) == first + second);
+  EXPECT(r.ring.ReadPosition() == 320);
+  EXPECT(r.ring.GetStats().writes_dropped == 0);
+
+  // The padding is reclaimed along with the records.
+  for (int i = 0; i < 4; ++i)
+    EXPECT(WriteString(&r.ring, std::string(60, 'd')));
+  EXPECT(ReadAll(&r.ring).size() == 240);
+}
+
+void TestUncommittedRecordBlocksReader() {
+  Ring r;
+  LogRing::Span first;
+  EXPECT(r.ring.Reserve(5, &first));
+  EXPECT(WriteString(&r.ring, "second"));
+  uint8_t buffer[64];
+  EXPECT(r.ring.Read(buffer, sizeof(buffer)) == 0);
+
+  std::memcpy(first.data, "first", 5);
+  r.ring.Commit(first);
+  EXPECT(ReadAll(&r.ring) == "firstsecond");
+  EXPECT(r.ring.ReadPosition() == first.end + 12);
+}
+
+// Writers on several threads retry until their records fit; the reader must
+// see every record, each writer's in order.
+void TestConcurrentWriters() {
+  constexpr int kWriters = 4;
+  constexpr uint32_t kRecords = 50000;
+  struct Record {
+    uint32_t writer;
+    uint32_t seq;
+  };
+
+  alignas(4) static uint8_t storage[1024];
+  LogRing ring(storage, sizeof(storage));
+
+  std::vector<std::thread> writers;
+  for (uint32_t w = 0; w < kWriters; ++w) {
+    writers.emplace_back([&ring, w] {
+      for (uint32_t seq = 0; seq < kRecords; ++seq) {
+        LogRing::Span span;
+        while (!ring.TryReserve(sizeof(Record), &span))
+          std::this_thread::yield();
+        const Record record{w, seq};
+        std::memcpy(span.data, &record, sizeof(record));
+        ring.Commit(span);
+      }
+    });
+  }
+
+  uint32_t next_seq[kWriters] = {};
+  uint32_t received = 0;
+  bool in_order = true;
+  std::vector<uint8_t> pending;
+  uint8_t buffer[100];
+  while (received < kWriters * kRecords) {
+    const size_t n = ring.Read(buffer, sizeof(buffer));
+    if (n == 0) {
+      std::this_thread::yield();
+      continue;
+    }
+    pending.insert(pending.end(), buffer, buffer + n);
+    size_t offset = 0;
+    for (; pending.size() - offset >= sizeof(Record);
+         offset += sizeof(Record)) {
+      Record record;
+      std::memcpy(&record, &pending[offset], sizeof(record));
+      // Keep draining on a mismatch so the writers can finish.
+      if (record.writer >= kWriters) {
+        in_order = false;
+      } else {
+        if (record.seq != next_seq[record.writer]) in_order = false;
+        next_seq[record.writer] = record.seq + 1;
+      }
+      ++received;
+    }
+    pending.erase(pending.begin(), pending.begin() + offset);
+  }
+  for (auto& writer : writers) writer.join();
+
+  EXPECT(in_order);
+  EXPECT(received == kWriters * kRecords);
+  const auto stats = ring.GetStats();
+  EXPECT(stats.writes_dropped == 0);
+  EXPECT(stats.bytes_written == kWriters * kRecords * sizeof(Record));
+  EXPECT(stats.max_used_bytes <= sizeof(storage));
+}
+
+}  // namespace
+}  // namespace coralmicro
+
+int main() {
+  using namespace coralmicro;
+  RUN_TEST(TestRoundTrip);
+  RUN_TEST(TestSplitRead);
+  RUN_TEST(TestFullRing);
+  RUN_TEST(TestOversizedRecord);
+  RUN_TEST(TestWraparound);
+  RUN_TEST(TestUncommittedRecordBlocksReader);
+  RUN_TEST(TestConcurrentWriters);
+  return TEST_RESULT();
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TESTS_TEST_UTIL_H_
+#define TESTS_TEST_UTIL_H_
+
+#include <cstdio>
+
+namespace coralmicro {
+namespace testing {
+inline int failures = 0;
+}  // namespace testing
+}  // namespace coralmicro
+
+// Reports a failure, and keeps running the test, if `cond` is false.
+#define EXPECT(cond)                                                       \
+  do {                                                                     \
+    if (!(cond)) {                                                         \
+      std::fprintf(stderr, "%s:%d: EXPECT(%s) failed\n", __FILE__,         \
+                   __LINE__, #cond);                                       \
+      ++::coralmicro::testing::failures;                                   \
+    }                                                                      \
+  } while (0)
+
+// Runs a test function and prints its name.
+#define RUN_TEST(fn)                    \
+  do {                                  \
+    std::printf("[ RUN ] %s\n", #fn);   \
+    fn();                               \
+  } while (0)
+
+// Returns the exit status for `main()`.
+#define TEST_RESULT() (::coralmicro::testing::failures == 0 ? 0 : 1)
+
+#endif  // TESTS_TEST_UTIL_H_
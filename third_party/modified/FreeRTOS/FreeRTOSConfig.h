@@ -130,7 +130,7 @@ void vGeneratePrimaryToSecondaryInterrupt(void*);
 void vGenerateSecondaryToPrimaryInterrupt(void*);
 #define sbSEND_COMPLETED( pxStreamBuffer ) vGenerateSecondaryToPrimaryInterrupt( pxStreamBuffer )
 #endif
-#define configTASK_NOTIFICATION_ARRAY_ENTRIES (2)
+#define configTASK_NOTIFICATION_ARRAY_ENTRIES (3)
 
 #define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS() do {} while (0)
 #if defined(__cplusplus)